@@ -415,6 +415,38 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     return tb->tc.ptr;
 }
 
+/**
+ * helper_lookup_return_ptr: look up the TB of a predicted return
+ * @env: current cpu state
+ * @entry: the CPUReturnEntry of the call, see translator_goto_return()
+ *
+ * As helper_lookup_tb_ptr(), for a return that translator_goto_return()
+ * found going back to its call in the same state: the cs_base and flags
+ * the call noted are those of the current cpu state, so they needn't be
+ * computed.
+ */
+const void *HELPER(lookup_return_ptr)(CPUArchState *env, void *entry)
+{
+    CPUState *cpu = env_cpu(env);
+    CPUReturnEntry *ret = entry;
+    TranslationBlock *tb;
+    uint32_t cflags;
+
+    cflags = curr_cflags(cpu);
+    if (check_for_breakpoints(cpu, ret->pc, &cflags)) {
+        cpu_loop_exit(cpu);
+    }
+
+    tb = tb_lookup(cpu, ret->pc, ret->cs_base, ret->flags, cflags);
+    if (tb == NULL) {
+        cpu->ret_stack.misses++;
+        return tcg_code_gen_epilogue;
+    }
+
+    cpu->ret_stack.hits++;
+    return tb->tc.ptr;
+}
+
 /* Execute a TB, and fix up the CPU state afterwards if necessary */
 /*
  * Disable CFI checks.
@@ -845,6 +877,8 @@ static inline bool cpu_handle_interrupt(CPUState *cpu,
                     tcg_ops->need_replay_interrupt(interrupt_request)) {
                     replay_interrupt();
                 }
+                /* The handler may change what the guest was polling */
+                cpu->poll.count = 0;
                 /*
                  * After processing the interrupt, ensure an EXCP_DEBUG is
                  * raised when single-stepping so that GDB doesn't miss the
@@ -85,6 +85,16 @@ static void icount_update_locked(CPUState *cpu)
     int64_t executed = icount_get_executed(cpu);
     cpu->icount_budget -= executed;
 
+    /*
+     * Stall cycles are normally charged to the decrementer and so are
+     * already part of @executed.  What did not fit in the decrementer at
+     * TB entry is kept apart; it was never part of the budget and only
+     * moves time forward.  Such an overflow always exhausts the
+     * decrementer, so it is folded in here before the next TB runs.
+     */
+    executed += cpu->icount_stall;
+    cpu->icount_stall = 0;
+
     qatomic_set_i64(&timers_state.qemu_icount,
                     timers_state.qemu_icount + executed);
 }
@@ -14,6 +14,12 @@
 extern int64_t max_delay;
 extern int64_t max_advance;
 
+/* Polling loop parking, see poll-park.c */
+extern bool tcg_poll_park_enabled;
+void tcg_poll_note_read(CPUState *cpu, MemoryRegion *mr, hwaddr offset,
+                        unsigned size, uint64_t value, uintptr_t retaddr);
+void tcg_cpu_poll_park(CPUState *cpu);
+
 /*
  * Return true if CS is not running in parallel with other cpus, either
  * because there are no other cpus or we are within an exclusive context.
@@ -60,6 +60,7 @@ void tb_lock_page0(tb_page_addr_t);
 void tb_lock_page1(tb_page_addr_t, tb_page_addr_t);
 void tb_unlock_page1(tb_page_addr_t, tb_page_addr_t);
 void tb_unlock_pages(TranslationBlock *);
+unsigned tb_page_write_gen(tb_page_addr_t);
 #endif
 
 #ifdef CONFIG_SOFTMMU
@@ -72,8 +73,62 @@ G_NORETURN void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 TranslationBlock *tb_gen_code(CPUState *cpu, vaddr pc,
                               uint64_t cs_base, uint32_t flags,
                               int cflags);
+TranslationBlock *tb_gen_code_at(CPUState *cpu, vaddr pc, uint64_t cs_base,
+                                 uint32_t flags, int cflags,
+                                 tb_page_addr_t phys_pc, void *host_pc);
 void page_init(void);
-void tb_htable_init(void);
+void tb_htable_init(bool count_retranslate);
+void tb_note_translated(const TranslationBlock *tb);
+void tb_reclaim(CPUState *cpu);
+
+/* Hot TBs translated again as superblocks, see superblock.c */
+extern uint32_t tcg_superblock_threshold;
+void tb_superblock_init(void);
+bool tb_superblock_is_hot(const TranslationBlock *tb);
+void tb_superblock_flush(void);
+
+/* Shadow return stack, see translator.c */
+extern bool tcg_return_stack;
+
+/* Persistent translation cache, see tb-cache.c */
+#ifdef CONFIG_USER_ONLY
+static inline TranslationBlock *tb_cache_lookup(CPUState *cpu,
+                                                tb_page_addr_t phys_pc,
+                                                vaddr pc, uint64_t cs_base,
+                                                uint32_t flags,
+                                                uint32_t cflags)
+{
+    return NULL;
+}
+static inline void tb_cache_note(TranslationBlock *tb, bool save) { }
+static inline void tb_cache_flush(void) { }
+#else
+void tb_cache_open(const char *path);
+void tb_cache_load(void);
+TranslationBlock *tb_cache_lookup(CPUState *cpu, tb_page_addr_t phys_pc,
+                                  vaddr pc, uint64_t cs_base, uint32_t flags,
+                                  uint32_t cflags);
+void tb_cache_note(TranslationBlock *tb, bool save);
+void tb_cache_invalidate(tb_page_addr_t start, tb_page_addr_t last);
+void tb_cache_flush(void);
+#endif
+
+/* Translation ahead of demand on helper threads, see translate-ahead.c */
+#ifdef CONFIG_USER_ONLY
+static inline void translate_ahead(CPUState *cpu, const TranslationBlock *tb,
+                                   vaddr pc)
+{
+}
+static inline void translate_ahead_pause(void) { }
+static inline void translate_ahead_resume(void) { }
+#else
+#define TRANSLATE_AHEAD_MAX_THREADS 64
+void translate_ahead_init(unsigned threads);
+void translate_ahead(CPUState *cpu, const TranslationBlock *tb, vaddr pc);
+void translate_ahead_pause(void);
+void translate_ahead_resume(void);
+#endif
+
 void tb_reset_jump(TranslationBlock *tb, int n);
 TranslationBlock *tb_link_page(TranslationBlock *tb);
 bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc);
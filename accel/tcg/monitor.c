@@ -141,6 +141,19 @@ static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+static void ret_stack_counts(size_t *phits, size_t *pmisses)
+{
+    CPUState *cpu;
+    size_t hits = 0, misses = 0;
+
+    CPU_FOREACH(cpu) {
+        hits += qatomic_read(&cpu->ret_stack.hits);
+        misses += qatomic_read(&cpu->ret_stack.misses);
+    }
+    *phits = hits;
+    *pmisses = misses;
+}
+
 static void tcg_dump_info(GString *buf)
 {
     g_string_append_printf(buf, "[TCG profiler not compiled]\n");
@@ -151,6 +164,8 @@ static void dump_exec_info(GString *buf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t ret_hits, ret_misses;
+    unsigned gen_count, retranslate_count;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -187,10 +202,37 @@ static void dump_exec_info(GString *buf)
     qht_statistics_destroy(&hst);
 
     g_string_append_printf(buf, "\nStatistics:\n");
+    gen_count = qatomic_read(&tb_ctx.tb_gen_count);
+    retranslate_count = qatomic_read(&tb_ctx.tb_retranslate_count);
     g_string_append_printf(buf, "TB flush count      %u\n",
                            qatomic_read(&tb_ctx.tb_flush_count));
     g_string_append_printf(buf, "TB invalidate count %u\n",
                            qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    g_string_append_printf(buf, "TB eviction count   %u (%u TBs, %u jumps "
+                           "unlinked)\n",
+                           qatomic_read(&tb_ctx.tb_evict_count),
+                           qatomic_read(&tb_ctx.tb_evicted_count),
+                           qatomic_read(&tb_ctx.tb_evict_unlinked_count));
+    if (tb_ctx.count_retranslate) {
+        g_string_append_printf(buf, "TB translations     %u (%0.2f%% dropped "
+                               "and translated again)\n",
+                               gen_count, gen_count ?
+                               (double)retranslate_count / gen_count * 100 : 0);
+    } else {
+        g_string_append_printf(buf, "TB translations     %u\n", gen_count);
+    }
+    g_string_append_printf(buf, "superblock count    %u (%u with loops "
+                           "unrolled, %u hot TBs)\n",
+                           qatomic_read(&tb_ctx.tb_superblock_count),
+                           qatomic_read(&tb_ctx.tb_superblock_loop_count),
+                           qatomic_read(&tb_ctx.tb_superblock_hot_count));
+    g_string_append_printf(buf, "TB cache adopted    %u (of %u loaded)\n",
+                           qatomic_read(&tb_ctx.tb_cache_adopt_count),
+                           qatomic_read(&tb_ctx.tb_cache_load_count));
+    ret_stack_counts(&ret_hits, &ret_misses);
+    g_string_append_printf(buf, "return stack hits   %zu (%zu%% of returns)\n",
+                           ret_hits, ret_hits + ret_misses ?
+                           ret_hits * 100 / (ret_hits + ret_misses) : 0);
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
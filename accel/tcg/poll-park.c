@@ -0,0 +1,127 @@
+/*
+ * Parking of vCPUs busy-waiting on a device register
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Firmware often spins on a status register, e.g.
+ *     while (!(USART->SR & USART_SR_TXE));
+ * and each iteration goes through the MMIO slow path.  With the "poll-park"
+ * TCG property, a vCPU whose MMIO reads keep returning the same value, from
+ * the same guest load, with its registers unchanged (see
+ * TCGCPUOps.poll_state) and no interrupt or MMIO write in between, is
+ * taken out of the TB loop and sleeps.
+ *
+ * Nothing the vCPU does can end such a loop, so it can only end once the
+ * device changes, which happens in the main loop (timers, chardev and
+ * network input) or by an interrupt.  The main loop wakes the parked vCPUs
+ * after each iteration, interrupts kick them, and the sleep ends at the
+ * next virtual clock deadline, or after a short timeout in case of a
+ * change made elsewhere (another vCPU, an I/O thread).  Once woken, the
+ * vCPU must see the same reads again before it parks again.
+ *
+ * Devices computing a register from the clock on read, with no timer
+ * armed, would then only move at each timeout: they set
+ * MemoryRegion.disable_poll_park.
+ *
+ * A loop keeping its iteration count in memory rather than in a register
+ * is not told apart, and runs fewer iterations per unit of time; nothing
+ * defines that rate without icount, where parking is disabled.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "exec/memory.h"
+#include "hw/core/cpu.h"
+#include "hw/core/tcg-cpu-ops.h"
+#include "sysemu/cpu-timers.h"
+#include "sysemu/tcg.h"
+#include "internal-common.h"
+#include "trace.h"
+
+/* Identical reads before the vCPU is parked */
+#define POLL_PARK_THRESHOLD 32
+/* Longest sleep without a wake up */
+#define POLL_PARK_MAX_MS 10
+
+bool tcg_poll_park_enabled;
+
+/* Main loop iterations, a parked vCPU does not sleep if this changed */
+static unsigned poll_park_generation;
+
+void tcg_poll_note_read(CPUState *cpu, MemoryRegion *mr, hwaddr offset,
+                        unsigned size, uint64_t value, uintptr_t retaddr)
+{
+    CPUPollState *p = &cpu->poll;
+    uint64_t state;
+
+    if (!tcg_poll_park_enabled || icount_enabled() ||
+        mr->disable_poll_park || !cpu->cc->tcg_ops->poll_state) {
+        return;
+    }
+
+    state = cpu->cc->tcg_ops->poll_state(cpu);
+    if (p->count && p->mr == mr && p->offset == offset && p->size == size &&
+        p->value == value && p->retaddr == retaddr && p->cpu_state == state) {
+        if (++p->count >= POLL_PARK_THRESHOLD && !p->parked) {
+            p->parked = true;
+            p->generation = poll_park_generation;
+            /* Leave the TB loop, tcg_cpu_poll_park() does the sleeping */
+            cpu_exit(cpu);
+        }
+        return;
+    }
+
+    p->mr = mr;
+    p->offset = offset;
+    p->size = size;
+    p->value = value;
+    p->retaddr = retaddr;
+    p->cpu_state = state;
+    p->count = 1;
+}
+
+void tcg_cpu_poll_park(CPUState *cpu)
+{
+    CPUPollState *p = &cpu->poll;
+    int64_t deadline;
+    int ms = POLL_PARK_MAX_MS;
+
+    if (!p->parked) {
+        return;
+    }
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                          QEMU_TIMER_ATTR_ALL);
+    if (deadline >= 0) {
+        ms = MIN(ms, DIV_ROUND_UP(deadline, SCALE_MS));
+    }
+    if (ms && p->generation == poll_park_generation &&
+        !cpu->interrupt_request && !cpu->stop && !cpu->unplug &&
+        cpu_work_list_empty(cpu)) {
+        trace_tcg_poll_park(cpu->cpu_index, memory_region_name(p->mr),
+                            p->offset, p->value);
+        qemu_cond_timedwait_bql(cpu->halt_cond, ms);
+    }
+    p->parked = false;
+    p->count = 0;
+}
+
+void tcg_poll_unpark_all(void)
+{
+    CPUState *cpu;
+
+    if (!tcg_poll_park_enabled) {
+        return;
+    }
+    poll_park_generation++;
+    CPU_FOREACH(cpu) {
+        if (cpu->poll.parked) {
+            qemu_cond_broadcast(cpu->halt_cond);
+        }
+    }
+}
@@ -0,0 +1,86 @@
+/*
+ * Superblocks: hot TBs translated again across direct branches
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A TB ends at each branch, and chained TBs store the guest registers
+ * they keep in host registers at each boundary, which the next TB loads
+ * again.  With the "superblock-threshold" TCG property, TBs of targets
+ * able to (see DisasContextBase.superblock_capable) count their
+ * executions.  Once a TB is hot it is invalidated, and translated again
+ * from the same entry point as a superblock: the target goes on
+ * translating at the destination of the direct branches it meets, and
+ * leaves through a side exit when a branch is not going the assumed way.
+ * A branch back into the code already translated, typically the back edge
+ * of a loop, is followed as well, which unrolls the loop into the TB.
+ * The optimizer and register allocator then work on the whole trace.
+ *
+ * The entry points of hot TBs are kept until the next tb_flush, so that
+ * a superblock invalidated by a write to its page is translated as a
+ * superblock again.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "exec/exec-all.h"
+#include "exec/helper-proto-common.h"
+#include "tb-context.h"
+#include "internal-target.h"
+#include "trace.h"
+
+uint32_t tcg_superblock_threshold;
+
+static QemuMutex superblock_lock;
+/* tb_page_addr_t of the entry points of hot TBs */
+static GHashTable *superblock_hot;
+
+void tb_superblock_init(void)
+{
+    qemu_mutex_init(&superblock_lock);
+    superblock_hot = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                           g_free, NULL);
+}
+
+bool tb_superblock_is_hot(const TranslationBlock *tb)
+{
+    int64_t addr = tb_page_addr0(tb);
+    bool hot;
+
+    qemu_mutex_lock(&superblock_lock);
+    hot = g_hash_table_contains(superblock_hot, &addr);
+    qemu_mutex_unlock(&superblock_lock);
+    return hot;
+}
+
+void tb_superblock_flush(void)
+{
+    qemu_mutex_lock(&superblock_lock);
+    g_hash_table_remove_all(superblock_hot);
+    qemu_mutex_unlock(&superblock_lock);
+}
+
+/* Called on entry to @ptr, once it ran superblock-threshold times */
+void HELPER(superblock_hot)(CPUArchState *env, void *ptr)
+{
+    TranslationBlock *tb = ptr;
+    int64_t addr = tb_page_addr0(tb);
+
+    trace_superblock_hot(tb, addr);
+    qatomic_inc(&tb_ctx.tb_superblock_hot_count);
+    qemu_mutex_lock(&superblock_lock);
+    g_hash_table_add(superblock_hot, g_memdup2(&addr, sizeof(addr)));
+    qemu_mutex_unlock(&superblock_lock);
+
+    /*
+     * The TB runs to its end, and the next lookup of its entry point
+     * misses and translates the superblock.
+     */
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    mmap_unlock();
+}
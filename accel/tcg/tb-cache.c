@@ -0,0 +1,721 @@
+/*
+ * Persistent translation cache
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Test suites boot the same firmware over and over, and most of each run
+ * goes into translating the same code again.  With "-accel tcg,tb-cache=FILE"
+ * the code buffer and an index of the TBs it holds are saved to FILE on
+ * exit, and loaded back on the next start.
+ *
+ * The backend notes the host addresses in the code of each TB: calls to
+ * helpers, the constant pool entries holding them, and the pointers into
+ * the code buffer loaded by exit_tb and the memory access slow paths (see
+ * TCGHostReloc).  They are saved along with the TB, and moved on load when
+ * the QEMU binary or the code buffer are not where they were, e.g. with
+ * ASLR; a TB whose addresses cannot be encoded from its new place is
+ * dropped.  The buffer is mapped at the same distance from the binary if
+ * possible, which keeps the pc-relative calls to helpers in range.
+ * Jumps within the code buffer, such as those to the epilogue, move along
+ * with it.  Backends not noting host addresses need the buffer and the
+ * binary at the addresses they had, i.e. a non-PIE build or ASLR disabled
+ * ("setarch -R").  The same binary, host CPU features, CPU model and
+ * buffer size are needed in any case; otherwise the file is ignored, and
+ * rewritten on exit.
+ *
+ * A loaded TB is only entered in the lookup structures when tb_gen_code()
+ * is asked for it, and only if the RAM page it comes from still has the
+ * content it had when saved.  The hash of each page checked is kept until
+ * the page is written to.  TBs covering two pages, those with host
+ * pointers embedded (plugins, some gvec helpers), and those charging the
+ * instruction fetch stalls of the icount timing model, which depend on
+ * the memory latencies the board had set up when they were translated,
+ * are not saved.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/cacheflush.h"
+#include "qemu/rcu.h"
+#include "exec/exec-all.h"
+#include "exec/cputlb.h"
+#include "exec/memory.h"
+#include "hw/core/cpu.h"
+#include "sysemu/sysemu.h"
+#include "tcg/tcg.h"
+#include "host/cpuinfo.h"
+#include "tb-hash.h"
+#include "tb-context.h"
+#include "internal-target.h"
+#include "trace.h"
+
+#define TB_CACHE_MAGIC "QEMU-TBC"
+
+typedef struct TBCacheHeader {
+    char magic[8];
+    char version[56];       /* QEMU version and target */
+    uint64_t text;          /* load address of the QEMU binary */
+    uint64_t exe_size;
+    int64_t exe_mtime;
+    uint64_t cpuinfo;       /* host CPU features */
+    uint32_t cpu_model;     /* hash of the guest CPU type */
+    uint32_t page_bits;
+    uint64_t buf_rx;        /* code buffer layout */
+    uint64_t total_size;
+    uint64_t stride;
+    uint64_t nr_regions;
+    uint64_t prologue_size;
+    uint64_t nr_ranges;     /* ranges of saved code */
+    uint64_t nr_entries;    /* TBs */
+    uint64_t nr_relocs;     /* host addresses in their code */
+} TBCacheHeader;
+
+/* Part of the code buffer, offsets from its start */
+typedef struct TBCacheRange {
+    uint64_t start;
+    uint64_t end;
+} TBCacheRange;
+
+typedef struct TBCacheEntry {
+    uint64_t offset;        /* of the TranslationBlock in the buffer */
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t page_addr;
+    uint64_t page_hash;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t first_reloc;   /* index of its first TBCacheReloc */
+    uint32_t nr_relocs;
+} TBCacheEntry;
+
+/* A TCGHostReloc, at @offset from the TranslationBlock */
+typedef struct TBCacheReloc {
+    uint64_t value;
+    int64_t addend;
+    uint32_t offset;
+    int32_t type;
+} TBCacheReloc;
+
+typedef struct TBCachePage {
+    uint64_t addr;
+    uint64_t hash;
+} TBCachePage;
+
+static struct {
+    char *path;
+    Notifier exit;
+    TBCacheHeader header;   /* of the file, if usable */
+
+    QemuMutex lock;
+    /* TBCacheEntry of the TBs loaded but not yet adopted */
+    GHashTable *entries;
+    /* TBCachePage of the pages checked since they were last written */
+    GHashTable *pages;
+    /* TBs not to save */
+    GHashTable *excluded;
+    /* GArray of the TBCacheReloc of each TB, with addresses of this run */
+    GHashTable *relocs;
+    unsigned nr_pending;
+} tb_cache;
+
+static uint64_t tb_cache_hash_page(tb_page_addr_t addr)
+{
+    g_autoptr(GChecksum) sum = g_checksum_new(G_CHECKSUM_SHA256);
+    uint8_t digest[32];
+    gsize len = sizeof(digest);
+
+    RCU_READ_LOCK_GUARD();
+    g_checksum_update(sum, qemu_map_ram_ptr(NULL, addr & TARGET_PAGE_MASK),
+                      TARGET_PAGE_SIZE);
+    g_checksum_get_digest(sum, digest, &len);
+    return ldq_he_p(digest);
+}
+
+/* Call with the lock held */
+static uint64_t tb_cache_page_hash(tb_page_addr_t addr)
+{
+    uint64_t page = addr & TARGET_PAGE_MASK;
+    TBCachePage *p = g_hash_table_lookup(tb_cache.pages, &page);
+
+    if (!p) {
+        /* Have writes to the page call tb_cache_invalidate() */
+        tlb_protect_code(page);
+        p = g_new(TBCachePage, 1);
+        p->addr = page;
+        p->hash = tb_cache_hash_page(page);
+        g_hash_table_insert(tb_cache.pages, &p->addr, p);
+    }
+    return p->hash;
+}
+
+static guint tb_cache_entry_hash(gconstpointer v)
+{
+    const TBCacheEntry *e = v;
+
+    return tb_hash_func(e->page_addr, e->pc, e->flags, e->cs_base, e->cflags);
+}
+
+static gboolean tb_cache_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const TBCacheEntry *ea = a, *eb = b;
+
+    return ea->page_addr == eb->page_addr && ea->pc == eb->pc &&
+           ea->cs_base == eb->cs_base && ea->flags == eb->flags &&
+           ea->cflags == eb->cflags;
+}
+
+static uint32_t tb_cache_cpu_model(CPUState *cpu)
+{
+    return g_str_hash(object_get_typename(OBJECT(cpu)));
+}
+
+static void tb_cache_fill_header(TBCacheHeader *h)
+{
+    TCGRegionLayout l;
+    struct stat st;
+
+    tcg_region_get_layout(&l);
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, TB_CACHE_MAGIC, sizeof(h->magic));
+    snprintf(h->version, sizeof(h->version), "%s %s", QEMU_VERSION,
+             TARGET_NAME);
+    h->text = (uintptr_t)tb_cache_fill_header;
+    if (stat("/proc/self/exe", &st) == 0) {
+        h->exe_size = st.st_size;
+        h->exe_mtime = st.st_mtime;
+    }
+#ifdef CPUINFO_ALWAYS
+    h->cpuinfo = cpuinfo;
+#endif
+    h->cpu_model = first_cpu ? tb_cache_cpu_model(first_cpu) : 0;
+    h->page_bits = TARGET_PAGE_BITS;
+    h->buf_rx = (uintptr_t)tcg_splitwx_to_rx(l.start);
+    h->total_size = l.total_size;
+    h->stride = l.stride;
+    h->nr_regions = l.n;
+    h->prologue_size = l.prologue_size;
+}
+
+/* Whether the file was written by this binary, on this host */
+static bool tb_cache_header_ok(const TBCacheHeader *h)
+{
+    TBCacheHeader cur;
+
+    tb_cache_fill_header(&cur);
+    return !memcmp(h->magic, cur.magic, sizeof(cur.magic)) &&
+           !strncmp(h->version, cur.version, sizeof(cur.version)) &&
+           (TCG_TARGET_HOST_RELOCS || h->text == cur.text) &&
+           h->exe_size == cur.exe_size && h->exe_mtime == cur.exe_mtime &&
+           h->cpuinfo == cur.cpuinfo;
+}
+
+/* Where the host address @addr of the run which saved @from is in @to */
+static uint64_t tb_cache_move_addr(const TBCacheHeader *from,
+                                   const TBCacheHeader *to, uint64_t addr)
+{
+    if (addr - from->buf_rx < from->total_size) {
+        return addr - from->buf_rx + to->buf_rx;
+    }
+    return addr - from->text + to->text;
+}
+
+/* To be written: the TBs and the TBCacheReloc of their code */
+typedef struct TBCacheSave {
+    GArray *entries;
+    GArray *relocs;
+} TBCacheSave;
+
+/* Call with the lock held */
+static void tb_cache_save_entry(TBCacheSave *save, TBCacheEntry *e,
+                                TranslationBlock *tb)
+{
+    GArray *relocs = g_hash_table_lookup(tb_cache.relocs, tb);
+
+    e->first_reloc = save->relocs->len;
+    e->nr_relocs = relocs ? relocs->len : 0;
+    if (relocs) {
+        g_array_append_vals(save->relocs, relocs->data, relocs->len);
+    }
+    g_array_append_val(save->entries, *e);
+}
+
+static gboolean tb_cache_save_tb(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    TBCacheSave *save = data;
+    TCGRegionLayout l;
+    TBCacheEntry e;
+
+    if ((tb_cflags(tb) & CF_INVALID) || tb_page_addr0(tb) == -1 ||
+        tb_page_addr1(tb) != -1 ||
+        g_hash_table_contains(tb_cache.excluded, tb)) {
+        return false;
+    }
+    tcg_region_get_layout(&l);
+    e.offset = (void *)tb - l.start;
+    e.pc = tb_cflags(tb) & CF_PCREL ? 0 : tb->pc;
+    e.cs_base = tb->cs_base;
+    e.page_addr = tb_page_addr0(tb);
+    e.page_hash = tb_cache_hash_page(tb_page_addr0(tb));
+    e.flags = tb->flags;
+    e.cflags = tb->cflags;
+    tb_cache_save_entry(save, &e, tb);
+    return false;
+}
+
+static bool tb_cache_write(int fd, const void *buf, size_t len)
+{
+    return qemu_write_full(fd, buf, len) == len;
+}
+
+/* At exit, with the vCPUs stopped */
+static void tb_cache_save(Notifier *n, void *data)
+{
+    g_autofree char *tmp = g_strdup_printf("%s.tmp", tb_cache.path);
+    g_autoptr(GArray) entries = g_array_new(false, false,
+                                            sizeof(TBCacheEntry));
+    g_autoptr(GArray) relocs = g_array_new(false, false,
+                                           sizeof(TBCacheReloc));
+    TBCacheSave save = { entries, relocs };
+    g_autofree TBCacheRange *ranges = NULL;
+    g_autofree void **start = NULL;
+    g_autofree void **end = NULL;
+    TCGRegionLayout l;
+    TBCacheHeader h;
+    GHashTableIter iter;
+    gpointer value;
+    bool ok;
+    int fd;
+
+    if (!first_cpu) {
+        return;
+    }
+    tcg_region_get_layout(&l);
+    start = g_new(void *, l.n);
+    end = g_new(void *, l.n);
+    ranges = g_new(TBCacheRange, l.n);
+
+    qemu_mutex_lock(&tb_cache.lock);
+    tcg_tb_foreach(tb_cache_save_tb, &save);
+    /* Loaded TBs never used are kept for the next run */
+    g_hash_table_iter_init(&iter, tb_cache.entries);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        TBCacheEntry *e = value;
+
+        tb_cache_save_entry(&save, e, l.start + e->offset);
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+
+    tb_cache_fill_header(&h);
+    h.nr_ranges = tcg_region_used(start, end);
+    h.nr_entries = entries->len;
+    h.nr_relocs = relocs->len;
+    for (size_t i = 0; i < h.nr_ranges; i++) {
+        ranges[i].start = start[i] - l.start;
+        ranges[i].end = end[i] - l.start;
+    }
+
+    fd = qemu_create(tmp, O_WRONLY | O_TRUNC, 0644, NULL);
+    if (fd < 0) {
+        warn_report("tb-cache: cannot create %s: %s", tmp, strerror(errno));
+        return;
+    }
+    ok = tb_cache_write(fd, &h, sizeof(h)) &&
+         tb_cache_write(fd, ranges, h.nr_ranges * sizeof(*ranges));
+    for (size_t i = 0; ok && i < h.nr_ranges; i++) {
+        ok = tb_cache_write(fd, start[i], end[i] - start[i]);
+    }
+    ok = ok && tb_cache_write(fd, entries->data,
+                              entries->len * sizeof(TBCacheEntry)) &&
+         tb_cache_write(fd, relocs->data, relocs->len * sizeof(TBCacheReloc));
+    ok = close(fd) == 0 && ok;
+
+    /* Runs sharing the file keep reading the one they opened */
+    if (!ok || rename(tmp, tb_cache.path) < 0) {
+        warn_report("tb-cache: cannot write %s: %s", tb_cache.path,
+                    strerror(errno));
+        unlink(tmp);
+        return;
+    }
+    trace_tb_cache_save(tb_cache.path, h.nr_entries);
+}
+
+/*
+ * Called before the code buffer is allocated: read the header of @path,
+ * to map the buffer where the saved code expects it, or with host
+ * addresses noted, at the same distance from the binary.
+ */
+void tb_cache_open(const char *path)
+{
+    TBCacheHeader h;
+    int fd;
+
+    tb_cache.path = g_strdup(path);
+    qemu_mutex_init(&tb_cache.lock);
+    tb_cache.entries = g_hash_table_new_full(tb_cache_entry_hash,
+                                             tb_cache_entry_equal,
+                                             g_free, NULL);
+    tb_cache.pages = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                           NULL, g_free);
+    tb_cache.excluded = g_hash_table_new(NULL, NULL);
+    tb_cache.relocs = g_hash_table_new_full(NULL, NULL, NULL,
+                                            (GDestroyNotify)g_array_unref);
+    tcg_record_host_relocs = TCG_TARGET_HOST_RELOCS;
+    tb_cache.exit.notify = tb_cache_save;
+    qemu_add_exit_notifier(&tb_cache.exit);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    if (read(fd, &h, sizeof(h)) == sizeof(h) && tb_cache_header_ok(&h)) {
+        uint64_t rx = h.buf_rx;
+
+        if (TCG_TARGET_HOST_RELOCS) {
+            rx += (uintptr_t)tb_cache_fill_header - h.text;
+        }
+        tb_cache.header = h;
+        tcg_region_set_hint((void *)(uintptr_t)rx);
+    } else {
+        warn_report("tb-cache: %s was not written by this binary, ignored",
+                    path);
+    }
+    close(fd);
+}
+
+/* Check the ranges and entries of @map, the whole file of @size bytes */
+static bool tb_cache_check(const TBCacheHeader *h, const void *map,
+                           size_t size, const TCGRegionLayout *l)
+{
+    const TBCacheRange *ranges = map + sizeof(*h);
+    const TBCacheEntry *entries;
+    const TBCacheReloc *relocs;
+    size_t pos = sizeof(*h);
+    uint64_t prev_end = 0;
+
+    if (h->nr_ranges == 0 || h->nr_ranges > l->n ||
+        h->nr_entries > size / sizeof(TBCacheEntry) ||
+        h->nr_relocs > size / sizeof(TBCacheReloc)) {
+        return false;
+    }
+    pos += h->nr_ranges * sizeof(TBCacheRange);
+    if (pos > size) {
+        return false;
+    }
+    for (size_t i = 0; i < h->nr_ranges; i++) {
+        if (ranges[i].start < prev_end || ranges[i].end < ranges[i].start ||
+            ranges[i].end > l->total_size) {
+            return false;
+        }
+        prev_end = ranges[i].end;
+        pos += ranges[i].end - ranges[i].start;
+    }
+    if (size != pos + h->nr_entries * sizeof(TBCacheEntry) +
+                h->nr_relocs * sizeof(TBCacheReloc)) {
+        return false;
+    }
+    /* The code before the first TB, as generated by this run */
+    if (ranges[0].start != 0 || ranges[0].end < l->prologue_size ||
+        memcmp(&ranges[h->nr_ranges], l->start, l->prologue_size)) {
+        return false;
+    }
+
+    entries = map + pos;
+    relocs = (const void *)&entries[h->nr_entries];
+    for (size_t i = 0; i < h->nr_entries; i++) {
+        const TBCacheEntry *e = &entries[i];
+        size_t j;
+
+        for (j = 0; j < h->nr_ranges; j++) {
+            if (e->offset >= ranges[j].start &&
+                e->offset + sizeof(TranslationBlock) <= ranges[j].end) {
+                break;
+            }
+        }
+        if (j == h->nr_ranges || (e->cflags & CF_INVALID) ||
+            e->first_reloc > h->nr_relocs ||
+            e->nr_relocs > h->nr_relocs - e->first_reloc) {
+            return false;
+        }
+        /* The host addresses are within the code of the TB */
+        for (size_t k = 0; k < e->nr_relocs; k++) {
+            const TBCacheReloc *r = &relocs[e->first_reloc + k];
+
+            if (r->offset < sizeof(TranslationBlock) ||
+                e->offset + r->offset + sizeof(uint64_t) > ranges[j].end) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Move the host addresses @relocs in the code of @tb, as saved by the run
+ * of @from, to this run of @to.  Returns false if one of them cannot be
+ * encoded where the code is now.
+ */
+static bool tb_cache_relocate(TranslationBlock *tb, const TBCacheReloc *relocs,
+                              unsigned nr_relocs, const TBCacheHeader *from,
+                              const TBCacheHeader *to)
+{
+    g_autoptr(GArray) moved = NULL;
+
+    if (nr_relocs) {
+        moved = g_array_sized_new(false, false, sizeof(TBCacheReloc),
+                                  nr_relocs);
+    }
+    for (unsigned i = 0; i < nr_relocs; i++) {
+        TBCacheReloc r = relocs[i];
+
+        r.value = tb_cache_move_addr(from, to, r.value);
+        if (!tcg_patch_host_reloc((void *)tb + r.offset, r.type, r.value,
+                                  r.addend)) {
+            return false;
+        }
+        g_array_append_val(moved, r);
+    }
+    tb->tc.ptr = (void *)(uintptr_t)tb_cache_move_addr(from, to,
+                                                      (uintptr_t)tb->tc.ptr);
+    if (moved) {
+        g_hash_table_replace(tb_cache.relocs, tb, g_steal_pointer(&moved));
+    }
+    return true;
+}
+
+/*
+ * Called once the prologue is generated: copy the saved code into the
+ * buffer, move the host addresses in it, and index its TBs.
+ */
+void tb_cache_load(void)
+{
+    const TBCacheHeader *h = &tb_cache.header;
+    g_autoptr(GMappedFile) file = NULL;
+    const TBCacheRange *ranges;
+    const TBCacheEntry *entries;
+    const TBCacheReloc *relocs;
+    TBCacheHeader cur;
+    TCGRegionLayout l;
+    const void *map, *code;
+    size_t size;
+
+    if (!h->nr_ranges) {
+        return;
+    }
+    tcg_region_get_layout(&l);
+    tb_cache_fill_header(&cur);
+    if (h->total_size != cur.total_size || h->stride != cur.stride ||
+        h->nr_regions != cur.nr_regions ||
+        h->prologue_size != cur.prologue_size ||
+        h->page_bits != cur.page_bits) {
+        warn_report("tb-cache: the code buffer layout of %s differs, "
+                    "ignored", tb_cache.path);
+        return;
+    }
+    if (!TCG_TARGET_HOST_RELOCS && h->buf_rx != cur.buf_rx) {
+        warn_report("tb-cache: the code buffer of %s was at another "
+                    "address, ignored (ASLR enabled?)", tb_cache.path);
+        return;
+    }
+
+    file = g_mapped_file_new(tb_cache.path, false, NULL);
+    if (!file) {
+        return;
+    }
+    map = g_mapped_file_get_contents(file);
+    size = g_mapped_file_get_length(file);
+    if (size < sizeof(*h) || memcmp(map, h, sizeof(*h)) ||
+        !tb_cache_check(h, map, size, &l)) {
+        warn_report("tb-cache: %s is corrupted, ignored", tb_cache.path);
+        return;
+    }
+
+    ranges = map + sizeof(*h);
+    code = &ranges[h->nr_ranges];
+    for (size_t i = 0; i < h->nr_ranges; i++) {
+        size_t len = ranges[i].end - ranges[i].start;
+        size_t skip = i ? 0 : l.prologue_size;
+        void *rw = l.start + ranges[i].start + skip;
+
+        memcpy(rw, code + skip, len - skip);
+        code += len;
+    }
+    tcg_region_restore(l.start + ranges[h->nr_ranges - 1].end);
+
+    entries = code;
+    relocs = (const void *)&entries[h->nr_entries];
+    for (size_t i = 0; i < h->nr_entries; i++) {
+        TBCacheEntry *e;
+
+        if (!tb_cache_relocate(l.start + entries[i].offset,
+                               &relocs[entries[i].first_reloc],
+                               entries[i].nr_relocs, h, &cur)) {
+            continue;
+        }
+        e = g_memdup2(&entries[i], sizeof(*e));
+        g_hash_table_replace(tb_cache.entries, e, e);
+    }
+
+    for (size_t i = 0; i < h->nr_ranges; i++) {
+        size_t skip = i ? 0 : l.prologue_size;
+        void *rw = l.start + ranges[i].start + skip;
+
+        flush_idcache_range((uintptr_t)tcg_splitwx_to_rx(rw), (uintptr_t)rw,
+                            ranges[i].end - ranges[i].start - skip);
+    }
+    tb_cache.nr_pending = g_hash_table_size(tb_cache.entries);
+    qatomic_set(&tb_ctx.tb_cache_load_count, tb_cache.nr_pending);
+    trace_tb_cache_load(tb_cache.path, tb_cache.nr_pending,
+                        cur.buf_rx - h->buf_rx);
+}
+
+/*
+ * Called by tb_gen_code() before translating: return the saved TB for
+ * these parameters, entered in the lookup structures, if the guest code
+ * it was translated from is unchanged.
+ */
+TranslationBlock *tb_cache_lookup(CPUState *cpu, tb_page_addr_t phys_pc,
+                                  vaddr pc, uint64_t cs_base, uint32_t flags,
+                                  uint32_t cflags)
+{
+    TBCacheEntry key = {
+        .pc = cflags & CF_PCREL ? 0 : pc,
+        .cs_base = cs_base,
+        .page_addr = phys_pc,
+        .flags = flags,
+        .cflags = cflags,
+    };
+    TranslationBlock *tb, *existing_tb;
+    TCGRegionLayout l;
+    TBCacheEntry *e;
+
+    if (!qatomic_read(&tb_cache.nr_pending)) {
+        return NULL;
+    }
+
+    qemu_mutex_lock(&tb_cache.lock);
+    e = g_hash_table_lookup(tb_cache.entries, &key);
+    if (!e || tb_cache.header.cpu_model != tb_cache_cpu_model(cpu) ||
+        tb_cache_page_hash(phys_pc) != e->page_hash) {
+        qemu_mutex_unlock(&tb_cache.lock);
+        return NULL;
+    }
+    tcg_region_get_layout(&l);
+    tb = l.start + e->offset;
+    g_hash_table_remove(tb_cache.entries, e);
+    qatomic_set(&tb_cache.nr_pending, tb_cache.nr_pending - 1);
+    qemu_mutex_unlock(&tb_cache.lock);
+
+    /* As done by tb_gen_code() for a new TB */
+    qemu_spin_init(&tb->jmp_lock);
+    tb->jmp_list_head = (uintptr_t)NULL;
+    tb->jmp_list_next[0] = (uintptr_t)NULL;
+    tb->jmp_list_next[1] = (uintptr_t)NULL;
+    tb->jmp_dest[0] = (uintptr_t)NULL;
+    tb->jmp_dest[1] = (uintptr_t)NULL;
+    if (tb->jmp_reset_offset[0] != TB_JMP_OFFSET_INVALID) {
+        tb_reset_jump(tb, 0);
+    }
+    if (tb->jmp_reset_offset[1] != TB_JMP_OFFSET_INVALID) {
+        tb_reset_jump(tb, 1);
+    }
+
+    tb_lock_page0(phys_pc);
+    tcg_tb_insert(tb);
+    existing_tb = tb_link_page(tb);
+    assert_no_pages_locked();
+    if (unlikely(existing_tb != tb)) {
+        tcg_tb_remove(tb);
+        return existing_tb;
+    }
+    qatomic_inc(&tb_ctx.tb_cache_adopt_count);
+    trace_tb_cache_adopt(tb, pc);
+    return tb;
+}
+
+/*
+ * Called by tb_gen_code() for each new TB, which is saved on exit if @save,
+ * along with the host addresses noted in its code.
+ */
+void tb_cache_note(TranslationBlock *tb, bool save)
+{
+    GArray *relocs = NULL;
+
+    if (!tb_cache.path) {
+        return;
+    }
+    if (save && tcg_ctx->host_relocs) {
+        relocs = g_array_new(false, false, sizeof(TBCacheReloc));
+        for (TCGHostReloc *r = tcg_ctx->host_relocs; r; r = r->next) {
+            TBCacheReloc c = {
+                .value = r->value,
+                .addend = r->addend,
+                .offset = (void *)r->ptr - (void *)tb,
+                .type = r->type,
+            };
+            g_array_append_val(relocs, c);
+        }
+    }
+
+    /* @tb may reuse the place of an evicted TB */
+    qemu_mutex_lock(&tb_cache.lock);
+    if (save) {
+        g_hash_table_remove(tb_cache.excluded, tb);
+    } else {
+        g_hash_table_add(tb_cache.excluded, tb);
+    }
+    if (relocs) {
+        g_hash_table_replace(tb_cache.relocs, tb, relocs);
+    } else {
+        g_hash_table_remove(tb_cache.relocs, tb);
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+}
+
+static gboolean tb_cache_page_in(gpointer key, gpointer value, gpointer data)
+{
+    const TBCachePage *p = value;
+    const tb_page_addr_t *range = data;
+
+    return p->addr >= range[0] && p->addr <= range[1];
+}
+
+/* Guest RAM in [@start, @last] is written to */
+void tb_cache_invalidate(tb_page_addr_t start, tb_page_addr_t last)
+{
+    tb_page_addr_t range[2] = { start & TARGET_PAGE_MASK, last };
+
+    if (!qatomic_read(&tb_cache.nr_pending)) {
+        return;
+    }
+    qemu_mutex_lock(&tb_cache.lock);
+    if ((last - range[0]) >> TARGET_PAGE_BITS < 16) {
+        for (uint64_t page = range[0]; page <= last;
+             page += TARGET_PAGE_SIZE) {
+            g_hash_table_remove(tb_cache.pages, &page);
+        }
+    } else {
+        g_hash_table_foreach_remove(tb_cache.pages, tb_cache_page_in, range);
+    }
+    qemu_mutex_unlock(&tb_cache.lock);
+}
+
+/* The code buffer is flushed, along with the TBs loaded */
+void tb_cache_flush(void)
+{
+    if (!tb_cache.path) {
+        return;
+    }
+    qemu_mutex_lock(&tb_cache.lock);
+    g_hash_table_remove_all(tb_cache.entries);
+    g_hash_table_remove_all(tb_cache.pages);
+    g_hash_table_remove_all(tb_cache.excluded);
+    g_hash_table_remove_all(tb_cache.relocs);
+    qatomic_set(&tb_cache.nr_pending, 0);
+    qemu_mutex_unlock(&tb_cache.lock);
+}
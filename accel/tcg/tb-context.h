@@ -31,10 +31,21 @@ typedef struct TBContext TBContext;
 struct TBContext {
 
     struct qht htable;
+    bool count_retranslate;     /* tb_retranslate_count is kept */
 
     /* statistics */
     unsigned tb_flush_count;
     unsigned tb_phys_invalidate_count;
+    unsigned tb_evict_count;
+    unsigned tb_evicted_count;
+    unsigned tb_evict_unlinked_count;
+    unsigned tb_gen_count;
+    unsigned tb_retranslate_count;
+    unsigned tb_superblock_hot_count;
+    unsigned tb_superblock_count;
+    unsigned tb_superblock_loop_count;
+    unsigned tb_cache_load_count;
+    unsigned tb_cache_adopt_count;
 };
 
 extern TBContext tb_ctx;
@@ -31,6 +31,7 @@
 #include "tb-context.h"
 #include "internal-common.h"
 #include "internal-target.h"
+#include "trace.h"
 
 
 /* List iterators for lists of tagged pointers in TranslationBlock. */
@@ -55,11 +56,61 @@ static bool tb_cmp(const void *ap, const void *bp)
             tb_page_addr1(a) == tb_page_addr1(b));
 }
 
-void tb_htable_init(void)
+/*
+ * With tb-eviction, the entry points of the TBs dropped to make room in
+ * the code buffer, to count those translated again.  Past
+ * TB_DROPPED_MAX of them, the count is a lower bound.
+ */
+#define TB_DROPPED_MAX (1 << 16)
+static QemuMutex tb_dropped_lock;
+static GHashTable *tb_dropped;
+
+void tb_htable_init(bool count_retranslate)
 {
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
 
     qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
+    tb_ctx.count_retranslate = count_retranslate;
+    if (count_retranslate) {
+        qemu_mutex_init(&tb_dropped_lock);
+        tb_dropped = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                           g_free, NULL);
+    }
+}
+
+static gboolean tb_note_dropped(gpointer key, gpointer value, gpointer data)
+{
+    const TranslationBlock *tb = value;
+    int64_t addr = tb_page_addr0(tb);
+
+    if (!(tb_cflags(tb) & CF_INVALID)) {
+        qemu_mutex_lock(&tb_dropped_lock);
+        if (g_hash_table_size(tb_dropped) < TB_DROPPED_MAX) {
+            g_hash_table_add(tb_dropped, g_memdup2(&addr, sizeof(addr)));
+        }
+        qemu_mutex_unlock(&tb_dropped_lock);
+    }
+    return false;
+}
+
+/* Account for @tb, just translated */
+void tb_note_translated(const TranslationBlock *tb)
+{
+    int64_t addr = tb_page_addr0(tb);
+    bool again;
+
+    qatomic_inc(&tb_ctx.tb_gen_count);
+    if (!tb_ctx.count_retranslate) {
+        return;
+    }
+
+    qemu_mutex_lock(&tb_dropped_lock);
+    again = g_hash_table_remove(tb_dropped, &addr);
+    qemu_mutex_unlock(&tb_dropped_lock);
+
+    if (again) {
+        qatomic_inc(&tb_ctx.tb_retranslate_count);
+    }
 }
 
 typedef struct PageDesc PageDesc;
@@ -182,6 +233,8 @@ struct PageDesc {
     QemuSpin lock;
     /* list of TBs intersecting this ram page */
     uintptr_t first_tb;
+    /* writes to the page while it held code, see tb_page_write_gen() */
+    unsigned write_gen;
 };
 
 void page_table_config_init(void)
@@ -483,6 +536,19 @@ void tb_unlock_pages(TranslationBlock *tb)
     page_unlock(page_find_alloc(pindex0, false));
 }
 
+/*
+ * Count of the writes to the page of @paddr which hit it while it was
+ * protected for code, all of which go through
+ * tb_invalidate_phys_page_range__locked().  It does not move while the
+ * page is locked.
+ */
+unsigned tb_page_write_gen(tb_page_addr_t paddr)
+{
+    PageDesc *pd = page_find(paddr >> TARGET_PAGE_BITS);
+
+    return pd ? qatomic_read(&pd->write_gen) : 0;
+}
+
 static inline struct page_entry *
 page_entry_new(PageDesc *pd, tb_page_addr_t index)
 {
@@ -765,17 +831,24 @@ static void do_tb_flush(CPUState *cpu, run_on_cpu_data tb_flush_count)
         goto done;
     }
     did_flush = true;
+    translate_ahead_pause();
 
     CPU_FOREACH(cpu) {
         tcg_flush_jmp_cache(cpu);
     }
 
+    if (tb_ctx.count_retranslate) {
+        tcg_tb_foreach(tb_note_dropped, NULL);
+    }
     qht_reset_size(&tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     tb_remove_all();
 
     tcg_region_reset_all();
+    tb_cache_flush();
+    tb_superblock_flush();
     /* XXX: flush processor icache at this point if cache flush is expensive */
     qatomic_inc(&tb_ctx.tb_flush_count);
+    translate_ahead_resume();
 
 done:
     mmap_unlock();
@@ -798,6 +871,91 @@ void tb_flush(CPUState *cpu)
     }
 }
 
+typedef struct TBEvictStats {
+    unsigned nb_tbs;
+    unsigned nb_jmps;
+} TBEvictStats;
+
+/* jumps chained into @dest, which tb_jmp_unlink() is about to reset */
+static unsigned tb_jmp_count(TranslationBlock *dest)
+{
+    TranslationBlock *tb;
+    unsigned count = 0;
+    int n;
+
+    qemu_spin_lock(&dest->jmp_lock);
+    TB_FOR_EACH_JMP(dest, tb, n) {
+        count++;
+    }
+    qemu_spin_unlock(&dest->jmp_lock);
+    return count;
+}
+
+static gboolean tb_evict_iter(gpointer key, gpointer value, gpointer data)
+{
+    TranslationBlock *tb = value;
+    TBEvictStats *stats = data;
+
+    if (!(tb_cflags(tb) & CF_INVALID)) {
+        tb_note_dropped(key, value, NULL);
+        stats->nb_jmps += tb_jmp_count(tb);
+        tb_phys_invalidate(tb, -1);
+        stats->nb_tbs++;
+    }
+    return false;
+}
+
+/* evict the oldest region of the code buffer, or flush it all */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data tb_flush_count)
+{
+    TBEvictStats stats = {};
+    bool evicted;
+
+    mmap_lock();
+    /* A flush since the request made room already */
+    if (tb_ctx.tb_flush_count != tb_flush_count.host_int) {
+        mmap_unlock();
+        return;
+    }
+    translate_ahead_pause();
+    /* invalidating the TBs resets the jumps into them */
+    qemu_thread_jit_write();
+    evicted = tcg_region_evict(tb_evict_iter, &stats);
+    qemu_thread_jit_execute();
+    if (stats.nb_tbs) {
+        /* the cached translations may have been in the region */
+        tb_cache_flush();
+        qatomic_inc(&tb_ctx.tb_evict_count);
+        qatomic_set(&tb_ctx.tb_evicted_count,
+                    tb_ctx.tb_evicted_count + stats.nb_tbs);
+        qatomic_set(&tb_ctx.tb_evict_unlinked_count,
+                    tb_ctx.tb_evict_unlinked_count + stats.nb_jmps);
+        trace_tb_evict(stats.nb_tbs, stats.nb_jmps);
+    }
+    translate_ahead_resume();
+    mmap_unlock();
+
+    if (!evicted) {
+        do_tb_flush(cpu, tb_flush_count);
+    }
+}
+
+/*
+ * Make room in the full code buffer: drop the oldest translations with
+ * the "tb-eviction" TCG property, or else all of them with tb_flush.
+ */
+void tb_reclaim(CPUState *cpu)
+{
+    unsigned tb_flush_count = qatomic_read(&tb_ctx.tb_flush_count);
+
+    if (cpu_in_serial_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(tb_flush_count));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict,
+                              RUN_ON_CPU_HOST_INT(tb_flush_count));
+    }
+}
+
 /* remove @orig from its @n_orig-th jump list */
 static inline void tb_remove_from_jmp_list(TranslationBlock *orig, int n_orig)
 {
@@ -1109,6 +1267,8 @@ tb_invalidate_phys_page_range__locked(struct page_collection *pages,
     /* Range may not cross a page. */
     tcg_debug_assert(((start ^ last) & TARGET_PAGE_MASK) == 0);
 
+    qatomic_set(&p->write_gen, p->write_gen + 1);
+
     /*
      * We remove all the TBs in the range [start, last].
      * XXX: see if in some cases it could be faster to invalidate all the code
@@ -1172,6 +1332,7 @@ void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t last)
     struct page_collection *pages;
     tb_page_addr_t index, index_last;
 
+    tb_cache_invalidate(start, last);
     pages = page_collection_lock(start, last);
 
     index_last = last >> TARGET_PAGE_BITS;
@@ -1221,6 +1382,7 @@ void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
 {
     struct page_collection *pages;
 
+    tb_cache_invalidate(ram_addr, ram_addr + size - 1);
     pages = page_collection_lock(ram_addr, ram_addr + size - 1);
     tb_invalidate_phys_page_fast__locked(pages, ram_addr, size, retaddr);
     page_collection_unlock(pages);
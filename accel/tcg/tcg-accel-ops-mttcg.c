@@ -35,6 +35,7 @@
 #include "tcg/startup.h"
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-mttcg.h"
+#include "internal-common.h"
 
 typedef struct MttcgForceRcuNotifier {
     Notifier notifier;
@@ -112,6 +113,7 @@ static void *mttcg_cpu_thread_fn(void *arg)
                 /* Ignore everything else? */
                 break;
             }
+            tcg_cpu_poll_park(cpu);
         }
 
         qatomic_set_mb(&cpu->exit_request, 0);
@@ -36,6 +36,7 @@
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-rr.h"
 #include "tcg-accel-ops-icount.h"
+#include "internal-common.h"
 
 /* Kick all RR vCPUs */
 void rr_kick_vcpu_thread(CPUState *unused)
@@ -264,6 +265,13 @@ static void *rr_cpu_thread_fn(void *arg)
                 }
                 bql_lock();
 
+                /* Sleeping would stall the other vCPUs of the thread */
+                if (!CPU_NEXT(first_cpu)) {
+                    tcg_cpu_poll_park(cpu);
+                } else {
+                    cpu->poll.parked = false;
+                }
+
                 if (r == EXCP_DEBUG) {
                     cpu_handle_guest_debug(cpu);
                     break;
@@ -290,10 +298,12 @@ static void *rr_cpu_thread_fn(void *arg)
             qatomic_set_mb(&cpu->exit_request, 0);
         }
 
-        if (icount_enabled() && all_cpu_threads_idle()) {
+        if ((icount_enabled() || cpu_clock_sleep_skip_enabled()) &&
+            all_cpu_threads_idle()) {
             /*
              * When all cpus are sleeping (e.g in WFI), to avoid a deadlock
-             * in the main_loop, wake it up in order to start the warp timer.
+             * in the main_loop, wake it up in order to start the warp timer
+             * or to skip the idle time.
              */
             qemu_notify_event();
         }
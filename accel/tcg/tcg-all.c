@@ -38,6 +38,7 @@
 #if !defined(CONFIG_USER_ONLY)
 #include "hw/boards.h"
 #endif
+#include "internal-common.h"
 #include "internal-target.h"
 
 struct TCGState {
@@ -45,6 +46,10 @@ struct TCGState {
 
     bool mttcg_enabled;
     bool one_insn_per_tb;
+    bool poll_park;
+    char *tb_cache;
+    bool tb_eviction;
+    uint32_t translate_ahead;
     int splitwx_enabled;
     unsigned long tb_size;
 };
@@ -113,7 +118,15 @@ static int tcg_init_machine(MachineState *ms)
     mttcg_enabled = s->mttcg_enabled;
 
     page_init();
-    tb_htable_init();
+    tb_htable_init(s->tb_eviction);
+    tb_superblock_init();
+#if defined(CONFIG_SOFTMMU)
+    if (s->tb_cache) {
+        tb_cache_open(s->tb_cache);
+    }
+    tcg_region_set_eviction(s->tb_eviction);
+    translate_ahead_init(s->translate_ahead);
+#endif
     tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
 
 #if defined(CONFIG_SOFTMMU)
@@ -122,6 +135,9 @@ static int tcg_init_machine(MachineState *ms)
      * initialize the prologue now.
      */
     tcg_prologue_init();
+    if (s->tb_cache) {
+        tb_cache_load();
+    }
 #endif
 
     return 0;
@@ -207,6 +223,105 @@ static void tcg_set_one_insn_per_tb(Object *obj, bool value, Error **errp)
     qatomic_set(&one_insn_per_tb, value);
 }
 
+#ifndef CONFIG_USER_ONLY
+static bool tcg_get_poll_park(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->poll_park;
+}
+
+static void tcg_set_poll_park(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->poll_park = value;
+    tcg_poll_park_enabled = value;
+}
+
+static void tcg_get_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    uint32_t value = tcg_superblock_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    tcg_superblock_threshold = value;
+}
+
+static bool tcg_get_return_stack(Object *obj, Error **errp)
+{
+    return tcg_return_stack;
+}
+
+static void tcg_set_return_stack(Object *obj, bool value, Error **errp)
+{
+    tcg_return_stack = value;
+}
+
+static char *tcg_get_tb_cache(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return g_strdup(s->tb_cache);
+}
+
+static void tcg_set_tb_cache(Object *obj, const char *value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    g_free(s->tb_cache);
+    s->tb_cache = g_strdup(value);
+}
+
+static bool tcg_get_tb_eviction(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->tb_eviction;
+}
+
+static void tcg_set_tb_eviction(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->tb_eviction = value;
+}
+
+static void tcg_get_translate_ahead(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->translate_ahead;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_translate_ahead(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > TRANSLATE_AHEAD_MAX_THREADS) {
+        error_setg(errp, "translate-ahead must be at most %d",
+                   TRANSLATE_AHEAD_MAX_THREADS);
+        return;
+    }
+    s->translate_ahead = value;
+}
+#endif
+
 static int tcg_gdbstub_supported_sstep_flags(void)
 {
     /*
@@ -252,6 +367,44 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+#ifndef CONFIG_USER_ONLY
+    object_class_property_add_bool(oc, "poll-park",
+                                   tcg_get_poll_park,
+                                   tcg_set_poll_park);
+    object_class_property_set_description(oc, "poll-park",
+        "Sleep instead of spinning on an unchanged device register");
+
+    object_class_property_add_bool(oc, "return-stack",
+                                   tcg_get_return_stack,
+                                   tcg_set_return_stack);
+    object_class_property_set_description(oc, "return-stack",
+        "Predict the TB of function returns from the calls");
+
+    object_class_property_add(oc, "superblock-threshold", "uint32",
+        tcg_get_superblock_threshold, tcg_set_superblock_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "superblock-threshold",
+        "Executions of a TB before it is translated again as a superblock");
+
+    object_class_property_add_str(oc, "tb-cache",
+                                  tcg_get_tb_cache,
+                                  tcg_set_tb_cache);
+    object_class_property_set_description(oc, "tb-cache",
+        "File keeping the translated code from one run to the next");
+
+    object_class_property_add_bool(oc, "tb-eviction",
+                                   tcg_get_tb_eviction,
+                                   tcg_set_tb_eviction);
+    object_class_property_set_description(oc, "tb-eviction",
+        "Drop the oldest translations only when the TB cache is full");
+
+    object_class_property_add(oc, "translate-ahead", "uint32",
+        tcg_get_translate_ahead, tcg_set_translate_ahead,
+        NULL, NULL);
+    object_class_property_set_description(oc, "translate-ahead",
+        "Threads translating the blocks branched to by new TBs");
+#endif
 }
 
 static const TypeInfo tcg_accel_type = {
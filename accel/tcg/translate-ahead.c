@@ -0,0 +1,285 @@
+/*
+ * Translation of the blocks likely to run next, on helper threads
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * tb_gen_code() runs on the vCPU thread, which waits for each new block
+ * to be translated.  With the "translate-ahead" TCG property set to n,
+ * n helper threads translate the blocks that a new TB branches to
+ * directly, while the vCPU goes on running it, so that they are found in
+ * QHT when the vCPU gets there.
+ *
+ * Only the goto_tb destinations within the page of the TB are predicted
+ * (see translator_use_goto_tb), so that the helpers reuse the physical
+ * page the vCPU found for the TB, and never look into the TLB of the
+ * vCPU: a block which does not fit in that page is left to the vCPU
+ * (see translator_access).  The host address of the page is looked up
+ * again by the helper, as the RAM may be gone by then, and the block is
+ * dropped if the vCPU wrote to the page since it queued the job (see
+ * tb_page_write_gen).  Each helper has its own TCG context and region of
+ * the code buffer, claimed on its first job, once the target has set up
+ * its TCG globals.  Flushes and evictions of the code buffer, which
+ * reset the contexts, wait for the translations in progress.
+ *
+ * The target translator runs against the CPUState of the vCPU while the
+ * vCPU executes, so it must not read the architectural state there: the
+ * job carries the pc, cs_base and flags it needs.  What it may read is
+ * the configuration of the CPU, which is fixed once it is realized (for
+ * Arm: features, ID registers, cp_regs), or only changes before a
+ * tb_flush(), which makes any block translated meanwhile go away.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/rcu.h"
+#include "exec/exec-all.h"
+#include "exec/ram_addr.h"
+#include "tcg/tcg.h"
+#include "tcg/startup.h"
+#include "tb-hash.h"
+#include "tb-context.h"
+#include "internal-target.h"
+#include "trace.h"
+
+/* Pending predictions; the oldest are dropped when it overflows */
+#define TRANSLATE_AHEAD_QUEUE 64
+
+typedef struct TranslateAheadJob {
+    CPUState *cpu;
+    vaddr pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    tb_page_addr_t phys_pc;
+    unsigned write_gen;         /* tb_page_write_gen() when queued */
+} TranslateAheadJob;
+
+static unsigned translate_ahead_threads;
+
+static struct {
+    QemuMutex lock;
+    QemuCond work_cond;         /* a job was queued, or paused dropped */
+    QemuCond idle_cond;         /* busy dropped to 0 */
+    TranslateAheadJob queue[TRANSLATE_AHEAD_QUEUE];
+    unsigned head;
+    unsigned count;
+    unsigned busy;              /* threads translating */
+    unsigned paused;            /* translate_ahead_pause() nesting */
+    bool started;
+} ahead;
+
+/* Reserve the TCG contexts of @threads helpers.  Call before tcg_init(). */
+void translate_ahead_init(unsigned threads)
+{
+    translate_ahead_threads = threads;
+    if (!threads) {
+        return;
+    }
+    qemu_mutex_init(&ahead.lock);
+    qemu_cond_init(&ahead.work_cond);
+    qemu_cond_init(&ahead.idle_cond);
+    tcg_reserve_threads(threads);
+}
+
+/* Is the block of @job in QHT already?  Called within an RCU section. */
+static bool translate_ahead_found(const TranslateAheadJob *job)
+{
+    TranslationBlock key = {
+        .pc = job->pc,
+        .cs_base = job->cs_base,
+        .flags = job->flags,
+        .cflags = job->cflags,
+    };
+    uint32_t h;
+
+    tb_set_page_addr0(&key, job->phys_pc);
+    tb_set_page_addr1(&key, -1);
+    h = tb_hash_func(job->phys_pc,
+                     (job->cflags & CF_PCREL ? 0 : job->pc),
+                     job->flags, job->cs_base, job->cflags);
+    return qht_lookup(&tb_ctx.htable, &key, h) != NULL;
+}
+
+/*
+ * Host address of the RAM at @phys_pc, or NULL if it is gone, as the
+ * RAMBlock may have been unplugged since the job was queued.  Called
+ * within an RCU section, which keeps the block alive until it ends.
+ */
+static void *translate_ahead_host_pc(tb_page_addr_t phys_pc)
+{
+    RAMBlock *block;
+
+    RAMBLOCK_FOREACH(block) {
+        if (phys_pc - block->offset < block->used_length) {
+            return ramblock_ptr(block, phys_pc - block->offset);
+        }
+    }
+    return NULL;
+}
+
+static void translate_ahead_job(const TranslateAheadJob *job)
+{
+    TranslationBlock *tb;
+    void *host_pc;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        if (translate_ahead_found(job)) {
+            return;
+        }
+        host_pc = translate_ahead_host_pc(job->phys_pc);
+        if (!host_pc) {
+            return;
+        }
+        tcg_ctx->ahead_write_gen = job->write_gen;
+        tb = tb_gen_code_at(job->cpu, job->pc, job->cs_base, job->flags,
+                            job->cflags, job->phys_pc, host_pc);
+        trace_translate_ahead(tb, job->pc);
+    }
+}
+
+static void *translate_ahead_thread(void *arg)
+{
+    TranslateAheadJob job;
+
+    rcu_register_thread();
+    tcg_register_thread();
+    tcg_ctx->translating_ahead = true;
+    qemu_thread_jit_write();
+
+    while (true) {
+        qemu_mutex_lock(&ahead.lock);
+        while (ahead.paused || !ahead.count) {
+            qemu_cond_wait(&ahead.work_cond, &ahead.lock);
+        }
+        job = ahead.queue[ahead.head];
+        ahead.head = (ahead.head + 1) % TRANSLATE_AHEAD_QUEUE;
+        ahead.count--;
+        ahead.busy++;
+        qemu_mutex_unlock(&ahead.lock);
+
+        translate_ahead_job(&job);
+
+        qemu_mutex_lock(&ahead.lock);
+        if (--ahead.busy == 0) {
+            qemu_cond_broadcast(&ahead.idle_cond);
+        }
+        qemu_mutex_unlock(&ahead.lock);
+    }
+    return NULL;
+}
+
+static void translate_ahead_start(void)
+{
+    for (unsigned i = 0; i < translate_ahead_threads; i++) {
+        QemuThread thread;
+        char name[16];
+
+        snprintf(name, sizeof(name), "TCG ahead %u", i);
+        qemu_thread_create(&thread, name, translate_ahead_thread, NULL,
+                           QEMU_THREAD_DETACHED);
+    }
+    ahead.started = true;
+}
+
+static void translate_ahead_queue(const TranslateAheadJob *job)
+{
+    unsigned i, tail;
+
+    for (i = 0; i < ahead.count; i++) {
+        const TranslateAheadJob *q =
+            &ahead.queue[(ahead.head + i) % TRANSLATE_AHEAD_QUEUE];
+
+        if (q->pc == job->pc && q->phys_pc == job->phys_pc &&
+            q->flags == job->flags && q->cs_base == job->cs_base &&
+            q->cflags == job->cflags) {
+            return;
+        }
+    }
+    if (ahead.count == TRANSLATE_AHEAD_QUEUE) {
+        ahead.head = (ahead.head + 1) % TRANSLATE_AHEAD_QUEUE;
+        ahead.count--;
+    }
+    tail = (ahead.head + ahead.count) % TRANSLATE_AHEAD_QUEUE;
+    ahead.queue[tail] = *job;
+    ahead.count++;
+}
+
+/*
+ * The vCPU @cpu just translated @tb at @pc: queue the destinations of its
+ * goto_tb for the helpers, with the same state.  Called in an RCU
+ * section, right after tcg_ctx translated @tb and linked it, so that the
+ * page is protected for code.
+ */
+void translate_ahead(CPUState *cpu, const TranslationBlock *tb, vaddr pc)
+{
+    TranslateAheadJob job = {
+        .cpu = cpu,
+        .cs_base = tb->cs_base,
+        .flags = tb->flags,
+        .cflags = tb_cflags(tb) & ~CF_INVALID,
+    };
+    tb_page_addr_t phys_page = tb_page_addr0(tb) & TARGET_PAGE_MASK;
+    bool queued = false;
+
+    if (!translate_ahead_threads || !tcg_ctx->nb_gen_succ) {
+        return;
+    }
+    /* Plugins see the translations of a vCPU on its own thread */
+    if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS, cpu->plugin_mask)) {
+        return;
+    }
+
+    job.write_gen = tb_page_write_gen(phys_page);
+    qemu_mutex_lock(&ahead.lock);
+    for (int i = 0; i < tcg_ctx->nb_gen_succ; i++) {
+        vaddr dest = tcg_ctx->gen_succ[i];
+
+        job.pc = dest;
+        job.phys_pc = phys_page | (dest & ~TARGET_PAGE_MASK);
+        if (dest != pc && !translate_ahead_found(&job)) {
+            translate_ahead_queue(&job);
+            queued = true;
+        }
+    }
+    if (queued) {
+        if (!ahead.started) {
+            translate_ahead_start();
+        }
+        qemu_cond_signal(&ahead.work_cond);
+    }
+    qemu_mutex_unlock(&ahead.lock);
+}
+
+/*
+ * Wait for the translations in progress, and hold back the next ones
+ * until translate_ahead_resume().  Call from a safe-work context.
+ */
+void translate_ahead_pause(void)
+{
+    if (!translate_ahead_threads) {
+        return;
+    }
+    qemu_mutex_lock(&ahead.lock);
+    ahead.paused++;
+    while (ahead.busy) {
+        qemu_cond_wait(&ahead.idle_cond, &ahead.lock);
+    }
+    qemu_mutex_unlock(&ahead.lock);
+}
+
+void translate_ahead_resume(void)
+{
+    if (!translate_ahead_threads) {
+        return;
+    }
+    qemu_mutex_lock(&ahead.lock);
+    if (--ahead.paused == 0) {
+        qemu_cond_broadcast(&ahead.work_cond);
+    }
+    qemu_mutex_unlock(&ahead.lock);
+}
@@ -284,28 +284,23 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
-/* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              vaddr pc, uint64_t cs_base,
-                              uint32_t flags, int cflags)
+/*
+ * Translate the block at @pc, found at @phys_pc and @host_pc, into the
+ * code buffer of the current TCG context.  Returns NULL if the buffer is
+ * full, or if a translation ahead of demand cannot be done from the
+ * first page only, or is out of date.
+ * Called with mmap_lock held for user mode emulation.
+ */
+TranslationBlock *tb_gen_code_at(CPUState *cpu, vaddr pc, uint64_t cs_base,
+                                 uint32_t flags, int cflags,
+                                 tb_page_addr_t phys_pc, void *host_pc)
 {
     CPUArchState *env = cpu_env(cpu);
     TranslationBlock *tb, *existing_tb;
-    tb_page_addr_t phys_pc, phys_p2;
+    tb_page_addr_t phys_p2;
     tcg_insn_unit *gen_code_buf;
     int gen_code_size, search_size, max_insns;
     int64_t ti;
-    void *host_pc;
-
-    assert_memory_lock();
-    qemu_thread_jit_write();
-
-    phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
-
-    if (phys_pc == -1) {
-        /* Generate a one-shot TB with 1 insn in it */
-        cflags = (cflags & ~CF_COUNT_MASK) | 1;
-    }
 
     max_insns = cflags & CF_COUNT_MASK;
     if (max_insns == 0) {
@@ -317,12 +312,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     assert_no_pages_locked();
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
-        mmap_unlock();
-        /* Make the execution loop process the flush as soon as possible.  */
-        cpu->exception_index = EXCP_INTERRUPT;
-        cpu_loop_exit(cpu);
+        return NULL;
     }
 
     gen_code_buf = tcg_ctx->code_gen_ptr;
@@ -333,11 +323,25 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    tb->exec_count = 0;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     if (phys_pc != -1) {
         tb_lock_page0(phys_pc);
     }
+#ifndef CONFIG_USER_ONLY
+    /*
+     * Translating ahead of demand, the vCPU may have written the page
+     * since it queued the job.  Later writes wait for the page lock, and
+     * invalidate the TB once it is linked.
+     */
+    if (tcg_ctx->translating_ahead &&
+        tb_page_write_gen(phys_pc) != tcg_ctx->ahead_write_gen) {
+        tb_unlock_pages(tb);
+        qatomic_set(&tcg_ctx->code_gen_ptr, (void *)tb);
+        return NULL;
+    }
+#endif
 
     tcg_ctx->gen_tb = tb;
     tcg_ctx->addr_type = TARGET_LONG_BITS == 32 ? TCG_TYPE_I32 : TCG_TYPE_I64;
@@ -416,6 +420,17 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                           "Restarting code generation with re-locked pages");
             goto restart_translate;
 
+        case -4:
+            /*
+             * Translating ahead of demand, we went past the first page,
+             * which would require a lookup in the TLB of the vCPU.
+             * Leave this one to the vCPU.
+             */
+            tb_unlock_pages(tb);
+            tcg_ctx->gen_tb = NULL;
+            qatomic_set(&tcg_ctx->code_gen_ptr, (void *)tb);
+            return NULL;
+
         default:
             g_assert_not_reached();
         }
@@ -511,6 +526,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     qatomic_set(&tcg_ctx->code_gen_ptr, (void *)
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN));
+    /*
+     * Host pointers from the front end cannot be moved to the next run,
+     * and the stall cost depends on the memory latency setup of this one.
+     */
+    tb_cache_note(tb, !tcg_ctx->host_ptr_used && !tcg_ctx->stall_counted);
 
     /* init jump list */
     qemu_spin_init(&tb->jmp_lock);
@@ -561,6 +581,52 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         tcg_tb_remove(tb);
         return existing_tb;
     }
+    tb_note_translated(tb);
+    return tb;
+}
+
+/* Called with mmap_lock held for user mode emulation.  */
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              vaddr pc, uint64_t cs_base,
+                              uint32_t flags, int cflags)
+{
+    CPUArchState *env = cpu_env(cpu);
+    TranslationBlock *tb;
+    tb_page_addr_t phys_pc;
+    void *host_pc;
+
+    assert_memory_lock();
+    qemu_thread_jit_write();
+
+    phys_pc = get_page_addr_code_hostp(env, pc, &host_pc);
+
+    if (phys_pc == -1) {
+        /* Generate a one-shot TB with 1 insn in it */
+        cflags = (cflags & ~CF_COUNT_MASK) | 1;
+    }
+
+    /* Translated by an earlier run? */
+    if (phys_pc != -1) {
+        tb = tb_cache_lookup(cpu, phys_pc, pc, cs_base, flags, cflags);
+        if (tb) {
+            return tb;
+        }
+    }
+
+    tb = tb_gen_code_at(cpu, pc, cs_base, flags, cflags, phys_pc, host_pc);
+    if (unlikely(!tb)) {
+        /* eviction or flush must be done */
+        tb_reclaim(cpu);
+        mmap_unlock();
+        /* Make the execution loop process the flush as soon as possible.  */
+        cpu->exception_index = EXCP_INTERRUPT;
+        cpu_loop_exit(cpu);
+    }
+
+    /* Have the blocks it branches to translated meanwhile */
+    if (tb_page_addr0(tb) != -1 && cflags == curr_cflags(cpu)) {
+        translate_ahead(cpu, tb, pc);
+    }
     return tb;
 }
 
@@ -13,7 +13,9 @@
 #include "exec/exec-all.h"
 #include "exec/translator.h"
 #include "exec/plugin-gen.h"
+#include "exec/helper-gen-common.h"
 #include "tcg/tcg-op-common.h"
+#include "tb-context.h"
 #include "internal-target.h"
 
 static void set_can_do_io(DisasContextBase *db, bool val)
@@ -94,6 +96,56 @@ static TCGOp *gen_tb_start(DisasContextBase *db, uint32_t cflags)
     return icount_start_insn;
 }
 
+/*
+ * Like the icount decrement, the stall cost of the TB is only known once
+ * it has been translated: emit a move of a dummy immediate and patch it
+ * in gen_tb_stall_end().
+ *
+ * Stall cycles are taken out of the instruction budget in
+ * icount_decr.u16.low, so that the TB that follows exits on time for the
+ * next timer deadline.  Only the part that does not fit in what is left
+ * of the decrementer goes to cpu->icount_stall, which advances the clock
+ * on the next icount update; the next TB then finds an empty decrementer
+ * and exits to refill it.
+ */
+static TCGOp *gen_tb_stall_start(void)
+{
+    TCGv_i32 stall = tcg_temp_new_i32();
+    TCGv_i32 left = tcg_temp_new_i32();
+    TCGv_i32 charge = tcg_temp_new_i32();
+    TCGOp *op;
+
+    QEMU_BUILD_BUG_ON(sizeof_field(CPUState, icount_stall) != 4);
+    tcg_ctx->stall_counted = true;
+    tcg_gen_mov_i32(stall, tcg_constant_i32(0));
+    op = tcg_last_op();
+
+    tcg_gen_ld16u_i32(left, tcg_env,
+                      offsetof(ArchCPU, parent_obj.neg.icount_decr.u16.low)
+                      - offsetof(ArchCPU, env));
+    tcg_gen_umin_i32(charge, left, stall);
+    tcg_gen_sub_i32(left, left, charge);
+    tcg_gen_st16_i32(left, tcg_env,
+                     offsetof(ArchCPU, parent_obj.neg.icount_decr.u16.low)
+                     - offsetof(ArchCPU, env));
+
+    tcg_gen_sub_i32(stall, stall, charge);
+    tcg_gen_ld_i32(charge, tcg_env,
+                   offsetof(ArchCPU, parent_obj.icount_stall) -
+                   offsetof(ArchCPU, env));
+    tcg_gen_add_i32(charge, charge, stall);
+    tcg_gen_st_i32(charge, tcg_env,
+                   offsetof(ArchCPU, parent_obj.icount_stall) -
+                   offsetof(ArchCPU, env));
+    return op;
+}
+
+static void gen_tb_stall_end(TCGOp *stall_insn, uint32_t stall_cycles)
+{
+    tcg_set_insn_param(stall_insn, 1,
+                       tcgv_i32_arg(tcg_constant_i32(stall_cycles)));
+}
+
 static void gen_tb_end(const TranslationBlock *tb, uint32_t cflags,
                        TCGOp *icount_start_insn, int num_insns)
 {
@@ -112,6 +164,24 @@ static void gen_tb_end(const TranslationBlock *tb, uint32_t cflags,
     }
 }
 
+/*
+ * Count the executions of a TB which could be a superblock, and have it
+ * translated again as one when it gets hot.
+ */
+static void gen_tb_exec_count(TranslationBlock *tb)
+{
+    TCGv_ptr ptr = tcg_constant_ptr(&tb->exec_count);
+    TCGv_i32 count = tcg_temp_new_i32();
+    TCGLabel *cold = gen_new_label();
+
+    tcg_gen_ld_i32(count, ptr, 0);
+    tcg_gen_addi_i32(count, count, 1);
+    tcg_gen_st_i32(count, ptr, 0);
+    tcg_gen_brcondi_i32(TCG_COND_NE, count, tcg_superblock_threshold, cold);
+    gen_helper_superblock_hot(tcg_env, tcg_constant_ptr(tb));
+    gen_set_label(cold);
+}
+
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
 {
     /* Suppress goto_tb if requested. */
@@ -120,7 +190,130 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     }
 
     /* Check for the dest on the same page as the start of the TB.  */
-    return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
+    if ((db->pc_first ^ dest) & TARGET_PAGE_MASK) {
+        return false;
+    }
+
+    /* Remember it for translate_ahead(), unless we continue there */
+    if (!db->superblock && tcg_ctx->nb_gen_succ < 2 &&
+        (!tcg_ctx->nb_gen_succ || tcg_ctx->gen_succ[0] != dest)) {
+        tcg_ctx->gen_succ[tcg_ctx->nb_gen_succ++] = dest;
+    }
+    return true;
+}
+
+/*
+ * Shadow return stack.  With the "return-stack" TCG property, a call
+ * notes where it returns to, with the state the TB flags derive from.
+ * A return finding the address it branches to and the state unchanged
+ * has helper_lookup_return_ptr() look the TB up with the cs_base and
+ * flags noted by the call, without computing the cpu state as
+ * helper_lookup_tb_ptr() does.  The lookup itself is tb_lookup(), so it
+ * goes through the tb_jmp_cache like any other.  A stack overflowing wraps
+ * around, and then returns mispredict.
+ */
+bool tcg_return_stack;
+
+#define RET_STACK_OFS(field) \
+    (offsetof(ArchCPU, parent_obj.ret_stack.field) - offsetof(ArchCPU, env))
+#define RET_ENTRY_OFS(field) \
+    (RET_STACK_OFS(entry[0]) + offsetof(CPUReturnEntry, field))
+
+bool translator_use_return_stack(DisasContextBase *db)
+{
+    /* Also let helper_lookup_tb_ptr log the TBs executed */
+    return tcg_return_stack &&
+           !(tb_cflags(db->tb) & (CF_COUNT_MASK | CF_NO_GOTO_PTR |
+                                  CF_SINGLE_STEP | CF_NOIRQ)) &&
+           !qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC);
+}
+
+/* Base for RET_ENTRY_OFS() of the fields of entry @top */
+static TCGv_ptr gen_ret_entry(TCGv_i32 top)
+{
+    TCGv_i32 ofs = tcg_temp_new_i32();
+    TCGv_ptr entry = tcg_temp_new_ptr();
+
+    tcg_gen_muli_i32(ofs, top, sizeof(CPUReturnEntry));
+    tcg_gen_ext_i32_ptr(entry, ofs);
+    tcg_gen_add_ptr(entry, entry, tcg_env);
+    return entry;
+}
+
+void translator_push_return(DisasContextBase *db, TCGv_i64 pc,
+                            uint32_t flags, uint64_t cs_base,
+                            const intptr_t *state, int nb_state)
+{
+    TCGv_i32 top, tmp;
+    TCGv_ptr entry;
+
+    if (!translator_use_return_stack(db)) {
+        return;
+    }
+    tcg_debug_assert(nb_state <= CPU_RET_STATE_WORDS);
+
+    top = tcg_temp_new_i32();
+    tcg_gen_ld_i32(top, tcg_env, RET_STACK_OFS(top));
+    tcg_gen_addi_i32(top, top, 1);
+    tcg_gen_andi_i32(top, top, CPU_RET_STACK_SIZE - 1);
+    tcg_gen_st_i32(top, tcg_env, RET_STACK_OFS(top));
+    entry = gen_ret_entry(top);
+
+    tcg_gen_st_i64(pc, entry, RET_ENTRY_OFS(pc));
+    tcg_gen_st_i64(tcg_constant_i64(cs_base), entry, RET_ENTRY_OFS(cs_base));
+    tcg_gen_st_i32(tcg_constant_i32(flags), entry, RET_ENTRY_OFS(flags));
+
+    tmp = tcg_temp_new_i32();
+    for (int i = 0; i < nb_state; i++) {
+        tcg_gen_ld_i32(tmp, tcg_env, state[i]);
+        tcg_gen_st_i32(tmp, entry, RET_ENTRY_OFS(state[i]));
+    }
+}
+
+void translator_goto_return(DisasContextBase *db, TCGv_i64 pc,
+                            const intptr_t *state, int nb_state)
+{
+    TCGLabel *miss;
+    TCGv_i32 top, a32, b32;
+    TCGv_i64 b64;
+    TCGv_ptr entry, ptr, count;
+
+    tcg_debug_assert(translator_use_return_stack(db));
+    tcg_debug_assert(nb_state <= CPU_RET_STATE_WORDS);
+    miss = gen_new_label();
+
+    /* Pop the last call */
+    top = tcg_temp_new_i32();
+    tcg_gen_ld_i32(top, tcg_env, RET_STACK_OFS(top));
+    entry = gen_ret_entry(top);
+    tcg_gen_subi_i32(top, top, 1);
+    tcg_gen_andi_i32(top, top, CPU_RET_STACK_SIZE - 1);
+    tcg_gen_st_i32(top, tcg_env, RET_STACK_OFS(top));
+
+    /* Returning to where it was called from, in the same state? */
+    b64 = tcg_temp_new_i64();
+    tcg_gen_ld_i64(b64, entry, RET_ENTRY_OFS(pc));
+    tcg_gen_brcond_i64(TCG_COND_NE, pc, b64, miss);
+    a32 = tcg_temp_new_i32();
+    b32 = tcg_temp_new_i32();
+    for (int i = 0; i < nb_state; i++) {
+        tcg_gen_ld_i32(a32, tcg_env, state[i]);
+        tcg_gen_ld_i32(b32, entry, RET_ENTRY_OFS(state[i]));
+        tcg_gen_brcond_i32(TCG_COND_NE, a32, b32, miss);
+    }
+
+    /* Then the TB flags are the ones of the call */
+    ptr = tcg_temp_new_ptr();
+    tcg_gen_addi_ptr(entry, entry, RET_STACK_OFS(entry[0]));
+    gen_helper_lookup_return_ptr(ptr, tcg_env, entry);
+    tcg_gen_goto_ptr(ptr);
+
+    gen_set_label(miss);
+    count = tcg_temp_new_ptr();
+    tcg_gen_ld_ptr(count, tcg_env, RET_STACK_OFS(misses));
+    tcg_gen_addi_ptr(count, count, 1);
+    tcg_gen_st_ptr(count, tcg_env, RET_STACK_OFS(misses));
+    tcg_gen_lookup_and_goto_ptr();
 }
 
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
@@ -129,17 +322,23 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
 {
     uint32_t cflags = tb_cflags(tb);
     TCGOp *icount_start_insn;
+    TCGOp *stall_insn = NULL;
     bool plugin_enabled;
 
     /* Initialize DisasContext */
     db->tb = tb;
     db->pc_first = pc;
     db->pc_next = pc;
+    db->pc_max = pc;
     db->is_jmp = DISAS_NEXT;
     db->num_insns = 0;
     db->max_insns = *max_insns;
     db->singlestep_enabled = cflags & CF_SINGLE_STEP;
     db->saved_can_do_io = -1;
+    db->count_stalls = false;
+    db->superblock_capable = false;
+    db->superblock = false;
+    db->stall_cycles = 0;
     db->host_addr[0] = host_pc;
     db->host_addr[1] = NULL;
 
@@ -148,12 +347,29 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
 
     /* Start translating.  */
     icount_start_insn = gen_tb_start(db, cflags);
+    if (db->count_stalls && (cflags & CF_USE_ICOUNT)) {
+        stall_insn = gen_tb_stall_start();
+    }
     ops->tb_start(db, cpu);
     tcg_debug_assert(db->is_jmp == DISAS_NEXT);  /* no early exit */
 
     plugin_enabled = plugin_gen_tb_start(cpu, db, cflags & CF_MEMI_ONLY);
     db->plugin_enabled = plugin_enabled;
 
+    /*
+     * Side exits leave before the end of the TB, but icount charges the
+     * instructions of the whole TB on entry.
+     */
+    if (tcg_superblock_threshold && db->superblock_capable &&
+        !plugin_enabled && tb_page_addr0(tb) != -1 &&
+        !(cflags & (CF_NO_GOTO_TB | CF_SINGLE_STEP | CF_USE_ICOUNT))) {
+        if (tb_superblock_is_hot(tb)) {
+            db->superblock = true;
+        } else {
+            gen_tb_exec_count(tb);
+        }
+    }
+
     while (true) {
         *max_insns = ++db->num_insns;
         ops->insn_start(db, cpu);
@@ -204,13 +420,23 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
     /* Emit code to exit the TB, as indicated by db->is_jmp.  */
     ops->tb_stop(db, cpu);
     gen_tb_end(tb, cflags, icount_start_insn, db->num_insns);
+    if (stall_insn) {
+        gen_tb_stall_end(stall_insn, db->stall_cycles);
+    }
 
     if (plugin_enabled) {
         plugin_gen_tb_end(cpu, db->num_insns);
     }
 
+    if (db->superblock) {
+        qatomic_inc(&tb_ctx.tb_superblock_count);
+        if (db->pc_max != db->pc_first) {
+            qatomic_inc(&tb_ctx.tb_superblock_loop_count);
+        }
+    }
+
     /* The disas_log hook may use these values rather than recompute.  */
-    tb->size = db->pc_next - db->pc_first;
+    tb->size = MAX(db->pc_next, db->pc_max) - db->pc_first;
     tb->icount = db->num_insns;
 
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM)
@@ -249,6 +475,11 @@ static void *translator_access(CPUArchState *env, DisasContextBase *db,
         if (host == NULL) {
             tb_page_addr_t page0, old_page1, new_page1;
 
+            /* The TLB of the vCPU is not ours to fill */
+            if (tcg_ctx->translating_ahead) {
+                siglongjmp(tcg_ctx->jmp_trans, -4);
+            }
+
             new_page1 = get_page_addr_code_hostp(env, base, &db->host_addr[1]);
 
             /*
@@ -169,6 +169,20 @@ SRST
     Show the interrupts statistics (if available).
 ERST
 
+    {
+        .name       = "unimp",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the accesses to unimplemented devices",
+        .cmd_info_hrt = qmp_x_query_unimp,
+    },
+
+SRST
+  ``info unimp``
+    Show the guest accesses to unimplemented devices: read and write
+    counts, first and last guest PC, and the accessed offsets.
+ERST
+
     {
         .name       = "pic",
         .args_type  = "",
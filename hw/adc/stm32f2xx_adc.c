@@ -28,10 +28,7 @@
 #include "qemu/log.h"
 #include "qemu/module.h"
 #include "hw/adc/stm32f2xx_adc.h"
-
-#ifndef STM_ADC_ERR_DEBUG
-#define STM_ADC_ERR_DEBUG 0
-#endif
+#include "trace.h"
 
 #define  ADC_CR1_AWDCH                       ((uint32_t)0x0000001F)        /*!<AWDCH[4:0] bits (Analog watchdog channel select bits) */
 #define  ADC_CR1_AWDCH_0                     ((uint32_t)0x00000001)        /*!<Bit 0 */
@@ -85,14 +82,6 @@
 #define  ADC_CR2_SWSTART                     ((uint32_t)0x40000000)        /*!<Start Conversion of regular channels */
 
 
-#define DB_PRINT_L(lvl, fmt, args...) do { \
-    if (STM_ADC_ERR_DEBUG >= lvl) { \
-        qemu_log("%s: " fmt, __func__, ## args); \
-    } \
-} while (0)
-
-#define DB_PRINT(fmt, args...) DB_PRINT_L(1, fmt, ## args)
-
 static void stm32f2xx_adc_reset(DeviceState *dev)
 {
     STM32F2XXADCState *s = STM32F2XX_ADC(dev);
@@ -151,13 +140,8 @@ static uint32_t stm32f2xx_adc_generate_value(STM32F2XXADCState *s)
     }
 }
 
-static uint64_t stm32f2xx_adc_read(void *opaque, hwaddr addr,
-                                     unsigned int size)
+static uint64_t stm32f2xx_adc_read_reg(STM32F2XXADCState *s, hwaddr addr)
 {
-    STM32F2XXADCState *s = opaque;
-
-    DB_PRINT("Address: 0x%" HWADDR_PRIx "\n", addr);
-
     if (addr >= ADC_COMMON_ADDRESS) {
         qemu_log_mask(LOG_UNIMP,
                       "%s: ADC Common Register Unsupported\n", __func__);
@@ -221,14 +205,25 @@ static uint64_t stm32f2xx_adc_read(void *opaque, hwaddr addr,
     return 0;
 }
 
+static uint64_t stm32f2xx_adc_read(void *opaque, hwaddr addr,
+                                   unsigned int size)
+{
+    STM32F2XXADCState *s = opaque;
+    uint64_t value = stm32f2xx_adc_read_reg(s, addr);
+
+    s->mmio_reads++;
+    trace_stm32f2xx_adc_read(addr, value);
+    return value;
+}
+
 static void stm32f2xx_adc_write(void *opaque, hwaddr addr,
                        uint64_t val64, unsigned int size)
 {
     STM32F2XXADCState *s = opaque;
     uint32_t value = (uint32_t) val64;
 
-    DB_PRINT("Address: 0x%" HWADDR_PRIx ", Value: 0x%x\n",
-             addr, value);
+    s->mmio_writes++;
+    trace_stm32f2xx_adc_write(addr, value);
 
     if (addr >= 0x100) {
         qemu_log_mask(LOG_UNIMP,
@@ -336,6 +331,11 @@ static void stm32f2xx_adc_init(Object *obj)
     memory_region_init_io(&s->mmio, obj, &stm32f2xx_adc_ops, s,
                           TYPE_STM32F2XX_ADC, 0x100);
     sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+
+    object_property_add_uint64_ptr(obj, "mmio-reads", &s->mmio_reads,
+                                   OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "mmio-writes", &s->mmio_writes,
+                                   OBJ_PROP_FLAG_READ);
 }
 
 static void stm32f2xx_adc_class_init(ObjectClass *klass, void *data)
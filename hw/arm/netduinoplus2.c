@@ -31,26 +31,55 @@
 #include "hw/arm/stm32f405_soc.h"
 #include "hw/arm/boot.h"
 
-/* Main SYSCLK frequency in Hz (168MHz) */
-#define SYSCLK_FRQ 168000000ULL
+/* HSE crystal frequency in Hz (25MHz) */
+#define HSE_FRQ 25000000ULL
 
+/*
+ * Each vCPU given with -smp is a separate board, with its own address space
+ * and devices.  The boards after the first one use its flash memory: the
+ * firmware is only loaded once, and as the TBs are looked up by RAM address
+ * the code it translates is shared by all the boards.
+ */
 static void netduinoplus2_init(MachineState *machine)
 {
-    DeviceState *dev;
-    Clock *sysclk;
+    STM32F405State *first = NULL;
+    Clock *hse;
+    unsigned i;
 
     /* This clock doesn't need migration because it is fixed-frequency */
-    sysclk = clock_new(OBJECT(machine), "SYSCLK");
-    clock_set_hz(sysclk, SYSCLK_FRQ);
+    hse = clock_new(OBJECT(machine), "HSE");
+    clock_set_hz(hse, HSE_FRQ);
+
+    for (i = 0; i < machine->smp.cpus; i++) {
+        DeviceState *dev = qdev_new(TYPE_STM32F405_SOC);
+        STM32F405State *soc = STM32F405_SOC(dev);
+
+        if (!first) {
+            object_property_add_child(OBJECT(machine), "soc", OBJECT(dev));
+            first = soc;
+        } else {
+            g_autofree char *name = g_strdup_printf("soc%u", i);
+            g_autofree char *prefix = g_strdup_printf("soc%u.", i);
+            MemoryRegion *mem = g_new(MemoryRegion, 1);
 
-    dev = qdev_new(TYPE_STM32F405_SOC);
-    object_property_add_child(OBJECT(machine), "soc", OBJECT(dev));
-    qdev_connect_clock_in(dev, "sysclk", sysclk);
-    sysbus_realize_and_unref(SYS_BUS_DEVICE(dev), &error_fatal);
+            object_property_add_child(OBJECT(machine), name, OBJECT(dev));
+            memory_region_init(mem, OBJECT(dev), "netduinoplus2.memory",
+                               UINT64_MAX);
+            object_property_set_link(OBJECT(dev), "memory", OBJECT(mem),
+                                     &error_abort);
+            object_property_set_link(OBJECT(&soc->flash_if), "shared",
+                                     OBJECT(&first->flash_if), &error_abort);
+            /* -serial is for the first board, then "socN.usartM" */
+            qdev_prop_set_string(dev, "serial-prefix", prefix);
+        }
+        qdev_connect_clock_in(dev, "hse", hse);
+        sysbus_realize_and_unref(SYS_BUS_DEVICE(dev), &error_fatal);
 
-    armv7m_load_kernel(ARM_CPU(first_cpu),
-                       machine->kernel_filename,
-                       0, FLASH_SIZE);
+        /* Registers the reset of the CPU, the image goes to the flash */
+        armv7m_load_kernel(soc->armv7m.cpu,
+                           soc == first ? machine->kernel_filename : NULL,
+                           0, FLASH_SIZE);
+    }
 }
 
 static void netduinoplus2_machine_init(MachineClass *mc)
@@ -63,6 +92,8 @@ static void netduinoplus2_machine_init(MachineClass *mc)
     mc->desc = "Netduino Plus 2 Machine (Cortex-M4)";
     mc->init = netduinoplus2_init;
     mc->valid_cpu_types = valid_cpu_types;
+    /* Boards of a farm, see netduinoplus2_init() */
+    mc->max_cpus = 256;
 }
 
 DEFINE_MACHINE("netduinoplus2", netduinoplus2_machine_init)
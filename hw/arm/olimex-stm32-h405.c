@@ -34,21 +34,21 @@
 
 /* olimex-stm32-h405 implementation is derived from netduinoplus2 */
 
-/* Main SYSCLK frequency in Hz (168MHz) */
-#define SYSCLK_FRQ 168000000ULL
+/* HSE crystal frequency in Hz (8MHz) */
+#define HSE_FRQ 8000000ULL
 
 static void olimex_stm32_h405_init(MachineState *machine)
 {
     DeviceState *dev;
-    Clock *sysclk;
+    Clock *hse;
 
     /* This clock doesn't need migration because it is fixed-frequency */
-    sysclk = clock_new(OBJECT(machine), "SYSCLK");
-    clock_set_hz(sysclk, SYSCLK_FRQ);
+    hse = clock_new(OBJECT(machine), "HSE");
+    clock_set_hz(hse, HSE_FRQ);
 
     dev = qdev_new(TYPE_STM32F405_SOC);
     object_property_add_child(OBJECT(machine), "soc", OBJECT(dev));
-    qdev_connect_clock_in(dev, "sysclk", sysclk);
+    qdev_connect_clock_in(dev, "hse", hse);
     sysbus_realize_and_unref(SYS_BUS_DEVICE(dev), &error_fatal);
 
     armv7m_load_kernel(ARM_CPU(first_cpu),
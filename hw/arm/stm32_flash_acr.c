@@ -0,0 +1,169 @@
+/*
+ * STM32 flash access control register and instruction fetch timing
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * FLASH_ACR has the same layout on the STM32F4 (RM0090) and the STM32L4
+ * (RM0351): LATENCY in the low bits, then PRFTEN, ICEN and DCEN.  Only ACR
+ * is modelled here; the device is mapped over the rest of the flash
+ * interface: stm32f4xx-flash on the F4, an unimplemented device elsewhere.
+ *
+ * When linked to the CPU, the wait states written by the firmware are fed
+ * into the icount fetch timing model (arm_cpu_set_mem_latency()):
+ *  - every flash fetch line costs LATENCY extra cycles,
+ *  - with PRFTEN only the first line of a TB (the branch target) stalls,
+ *  - with ICEN (the ART accelerator on F4) fetches are assumed to hit the
+ *    instruction cache and cost nothing.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "hw/registerfields.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
+#include "hw/arm/stm32_flash_acr.h"
+#include "trace.h"
+
+REG32(ACR, 0x00)
+    FIELD(ACR, LATENCY, 0, 4)
+    FIELD(ACR, PRFTEN, 8, 1)
+    FIELD(ACR, ICEN, 9, 1)
+    FIELD(ACR, DCEN, 10, 1)
+    FIELD(ACR, ICRST, 11, 1)
+    FIELD(ACR, DCRST, 12, 1)
+    FIELD(ACR, RUN_PD, 13, 1)
+    FIELD(ACR, SLEEP_PD, 14, 1)
+
+/* ICRST and DCRST act on write and read back as zero */
+#define ACR_STORED_MASK (R_ACR_LATENCY_MASK | R_ACR_PRFTEN_MASK | \
+                         R_ACR_ICEN_MASK | R_ACR_DCEN_MASK | \
+                         R_ACR_RUN_PD_MASK | R_ACR_SLEEP_PD_MASK)
+
+void stm32_flash_acr_set_map(STM32FlashAcrState *s, const ARMMemLatency *map,
+                             unsigned len, unsigned nflash)
+{
+    assert(len <= STM32_FLASH_ACR_MAX_REGIONS && nflash <= len);
+    memcpy(s->map, map, len * sizeof(*map));
+    s->map_len = len;
+    s->nflash = nflash;
+}
+
+static void stm32_flash_acr_update_timing(STM32FlashAcrState *s)
+{
+    uint32_t wait_states = FIELD_EX32(s->acr, ACR, LATENCY);
+    bool prefetch = FIELD_EX32(s->acr, ACR, PRFTEN);
+    unsigned i;
+
+    if (!s->cpu || !s->map_len) {
+        return;
+    }
+
+    if (FIELD_EX32(s->acr, ACR, ICEN)) {
+        wait_states = 0;
+    }
+    for (i = 0; i < s->nflash; i++) {
+        s->map[i].wait_states = wait_states;
+        s->map[i].prefetch = prefetch;
+    }
+    arm_cpu_set_mem_latency(s->cpu, s->map, s->map_len);
+}
+
+static uint64_t stm32_flash_acr_read(void *opaque, hwaddr addr, unsigned size)
+{
+    STM32FlashAcrState *s = opaque;
+
+    trace_stm32_flash_acr_read(s->acr);
+    return s->acr;
+}
+
+static void stm32_flash_acr_write(void *opaque, hwaddr addr, uint64_t val64,
+                                  unsigned size)
+{
+    STM32FlashAcrState *s = opaque;
+    uint32_t old = s->acr;
+
+    s->acr = val64 & ACR_STORED_MASK;
+    trace_stm32_flash_acr_write(s->acr);
+
+    if ((old ^ s->acr) & (R_ACR_LATENCY_MASK | R_ACR_PRFTEN_MASK |
+                          R_ACR_ICEN_MASK)) {
+        stm32_flash_acr_update_timing(s);
+    }
+}
+
+static const MemoryRegionOps stm32_flash_acr_ops = {
+    .read = stm32_flash_acr_read,
+    .write = stm32_flash_acr_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl.min_access_size = 4,
+    .impl.max_access_size = 4,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+static void stm32_flash_acr_hold_reset(Object *obj)
+{
+    STM32FlashAcrState *s = STM32_FLASH_ACR(obj);
+
+    s->acr = s->reset_value & ACR_STORED_MASK;
+    stm32_flash_acr_update_timing(s);
+}
+
+static void stm32_flash_acr_init(Object *obj)
+{
+    STM32FlashAcrState *s = STM32_FLASH_ACR(obj);
+
+    memory_region_init_io(&s->mmio, obj, &stm32_flash_acr_ops, s,
+                          TYPE_STM32_FLASH_ACR, 4);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+}
+
+static int stm32_flash_acr_post_load(void *opaque, int version_id)
+{
+    stm32_flash_acr_update_timing(opaque);
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32_flash_acr = {
+    .name = TYPE_STM32_FLASH_ACR,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = stm32_flash_acr_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(acr, STM32FlashAcrState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property stm32_flash_acr_properties[] = {
+    DEFINE_PROP_UINT32("reset-value", STM32FlashAcrState, reset_value, 0),
+    DEFINE_PROP_LINK("cpu", STM32FlashAcrState, cpu, TYPE_ARM_CPU, ARMCPU *),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void stm32_flash_acr_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ResettableClass *rc = RESETTABLE_CLASS(klass);
+
+    dc->vmsd = &vmstate_stm32_flash_acr;
+    device_class_set_props(dc, stm32_flash_acr_properties);
+    rc->phases.hold = stm32_flash_acr_hold_reset;
+}
+
+static const TypeInfo stm32_flash_acr_info[] = {
+    {
+        .name          = TYPE_STM32_FLASH_ACR,
+        .parent        = TYPE_SYS_BUS_DEVICE,
+        .instance_size = sizeof(STM32FlashAcrState),
+        .instance_init = stm32_flash_acr_init,
+        .class_init    = stm32_flash_acr_class_init,
+    }
+};
+
+DEFINE_TYPES(stm32_flash_acr_info)
@@ -43,6 +43,15 @@ static const uint32_t spi_addr[STM_NUM_SPIS] = { 0x40013000, 0x40003800,
     0x40003C00 };
 
 static const int timer_irq[STM_NUM_TIMERS] = {28, 29, 30, 50};
+/* TIM2 and TIM5 have 32-bit counters */
+static const uint8_t timer_bits[] = { 32, 16, 16, 32 };
+/* Masters of TIM2 to 5 on ITR0..3, as an index into timer[] (RM0090 18.3.15) */
+static const int8_t timer_itr[][STM32F2XX_TIMER_NUM_ITR] = {
+    { -1, -1,  1,  2 },     /* TIM2: TIM1, TIM8, TIM3, TIM4 */
+    { -1,  0,  3,  2 },     /* TIM3: TIM1, TIM2, TIM5, TIM4 */
+    { -1,  0,  1, -1 },     /* TIM4: TIM1, TIM2, TIM3, TIM8 */
+    {  0,  1,  2, -1 },     /* TIM5: TIM2, TIM3, TIM4, TIM8 */
+};
 static const int usart_irq[STM_NUM_USARTS] = {37, 38, 39, 52, 53, 71};
 #define ADC_IRQ 18
 static const int spi_irq[STM_NUM_SPIS] = {35, 36, 51};
@@ -85,7 +94,7 @@ static void stm32f205_soc_realize(DeviceState *dev_soc, Error **errp)
     STM32F205State *s = STM32F205_SOC(dev_soc);
     DeviceState *dev, *armv7m;
     SysBusDevice *busdev;
-    int i;
+    int i, j;
 
     MemoryRegion *system_memory = get_system_memory();
 
@@ -162,6 +171,18 @@ static void stm32f205_soc_realize(DeviceState *dev_soc, Error **errp)
     for (i = 0; i < STM_NUM_TIMERS; i++) {
         dev = DEVICE(&(s->timer[i]));
         qdev_prop_set_uint64(dev, "clock-frequency", 1000000000);
+        qdev_prop_set_uint8(dev, "counter-bits", timer_bits[i]);
+        for (j = 0; j < STM32F2XX_TIMER_NUM_ITR; j++) {
+            char name[8];
+
+            if (timer_itr[i][j] < 0) {
+                continue;
+            }
+            snprintf(name, sizeof(name), "itr%d", j);
+            object_property_set_link(OBJECT(dev), name,
+                                     OBJECT(&s->timer[timer_itr[i][j]]),
+                                     &error_abort);
+        }
         if (!sysbus_realize(SYS_BUS_DEVICE(&s->timer[i]), errp)) {
             return;
         }
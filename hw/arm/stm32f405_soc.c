@@ -25,12 +25,17 @@
 #include "qemu/osdep.h"
 #include "qapi/error.h"
 #include "exec/address-spaces.h"
+#include "chardev/char.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/cpu-timers.h"
+#include "migration/vmstate.h"
 #include "hw/arm/stm32f405_soc.h"
 #include "hw/qdev-clock.h"
+#include "hw/qdev-properties.h"
 #include "hw/misc/unimp.h"
 
 #define SYSCFG_ADD                     0x40013800
+#define RCC_ADDR                       0x40023800
 static const uint32_t usart_addr[] = { 0x40011000, 0x40004400, 0x40004800,
                                        0x40004C00, 0x40005000, 0x40011400,
                                        0x40007800, 0x40007C00 };
@@ -41,16 +46,199 @@ static const uint32_t adc_addr[] = { 0x40012000, 0x40012100, 0x40012200,
                                      0x40012300, 0x40012400, 0x40012500 };
 static const uint32_t spi_addr[] =   { 0x40013000, 0x40003800, 0x40003C00,
                                        0x40013400, 0x40015000, 0x40015400 };
+static const uint32_t i2c_addr[] =   { 0x40005400, 0x40005800, 0x40005C00 };
+static const uint32_t can_addr[] =   { 0x40006400, 0x40006800 };
+static const uint32_t dma_addr[] =   { 0x40026000, 0x40026400 };
+#define GPIO_ADDR(port)                (0x40020000 + (port) * 0x400)
 #define EXTI_ADDR                      0x40013C00
+#define FLASH_IF_ADDR                  0x40023C00
+#define CRC_ADDR                       0x40023000
+#define RNG_ADDR                       0x50060800
+#define FSMC_ADDR                      0xA0000000
+#define FSMC_BANK1_ADDR                0x60000000
 
 #define SYSCFG_IRQ               71
+#define RCC_IRQ                  5
+#define FLASH_IF_IRQ             4
+#define RNG_IRQ                  80
 static const int usart_irq[] = { 37, 38, 39, 52, 53, 71, 82, 83 };
 static const int timer_irq[] = { 28, 29, 30, 50 };
+/* TIM2 and TIM5 have 32-bit counters */
+static const uint8_t timer_bits[] = { 32, 16, 16, 32 };
+/* Masters of TIM2 to 5 on ITR0..3, as an index into timer[] (RM0090 18.3.15) */
+static const int8_t timer_itr[][STM32F2XX_TIMER_NUM_ITR] = {
+    { -1, -1,  1,  2 },     /* TIM2: TIM1, TIM8, TIM3, TIM4 */
+    { -1,  0,  3,  2 },     /* TIM3: TIM1, TIM2, TIM5, TIM4 */
+    { -1,  0,  1, -1 },     /* TIM4: TIM1, TIM2, TIM3, TIM8 */
+    {  0,  1,  2, -1 },     /* TIM5: TIM2, TIM3, TIM4, TIM8 */
+};
 #define ADC_IRQ 18
 static const int spi_irq[] =   { 35, 36, 51, 0, 0, 0 };
+/* Event and error interrupts */
+static const int i2c_irq[][2] = { { 31, 32 }, { 33, 34 }, { 72, 73 } };
+/* TX, RX0, RX1 and SCE interrupts */
+static const int can_irq[][STM32F4XX_CAN_NUM_IRQS] = {
+    { 19, 20, 21, 22 }, { 63, 64, 65, 66 }
+};
+static const int dma_irq[][STM32F4XX_DMA_NUM_STREAMS] = {
+    { 11, 12, 13, 14, 15, 16, 17, 47 }, { 56, 57, 58, 59, 60, 68, 69, 70 }
+};
+
+/* A stream of DMA1 or DMA2 and the channel it takes a request on */
+typedef struct DmaRoute {
+    uint8_t dma;
+    uint8_t stream;
+    uint8_t channel;
+} DmaRoute;
+
+/*
+ * TX and RX requests of the USARTs and SPIs, up to two streams each
+ * (RM0090 tables 42 and 43)
+ */
+static const DmaRoute usart_dma[][2][2] = {
+    { { { 2, 7, 4 } },              { { 2, 2, 4 }, { 2, 5, 4 } } },
+    { { { 1, 6, 4 } },              { { 1, 5, 4 } } },
+    { { { 1, 3, 4 }, { 1, 4, 7 } }, { { 1, 1, 4 } } },
+    { { { 1, 4, 4 } },              { { 1, 2, 4 } } },
+    { { { 1, 7, 4 } },              { { 1, 0, 4 } } },
+    { { { 2, 6, 5 }, { 2, 7, 5 } }, { { 2, 1, 5 }, { 2, 2, 5 } } },
+};
+static const DmaRoute spi_dma[][2][2] = {
+    { { { 2, 3, 3 }, { 2, 5, 3 } }, { { 2, 0, 3 }, { 2, 2, 3 } } },
+    { { { 1, 4, 0 } },              { { 1, 3, 0 } } },
+    { { { 1, 5, 0 }, { 1, 7, 0 } }, { { 1, 0, 0 }, { 1, 2, 0 } } },
+};
+
+/* Reset values of MODER, OSPEEDR and PUPDR, for the debug port pins */
+static const uint32_t gpio_reset[][3] = {
+    { 0xA8000000, 0x0C000000, 0x64000000 },
+    { 0x00000280, 0x000000C0, 0x00000100 },
+};
+
 static const int exti_irq[] =  { 6, 7, 8, 9, 10, 23, 23, 23, 23, 23, 40,
                                  40, 40, 40, 40, 40} ;
 
+/*
+ * Instruction fetch latencies for the optional icount timing model.  Flash
+ * and its boot alias are read in 128-bit lines, with the wait states set in
+ * FLASH_ACR.  Fetches from SRAM go over the S-bus and take one extra cycle
+ * per word.  CCM sits on the D-bus only and cannot hold code.
+ */
+static const ARMMemLatency mem_latency[] = {
+    { FLASH_BASE_ADDRESS, FLASH_SIZE, 16, 0, false },
+    { 0, FLASH_SIZE, 16, 0, false },
+    { SRAM_BASE_ADDRESS, SRAM_SIZE, 4, 1, false },
+};
+
+/* sysbus_mmio_map(), in the address space of this instance */
+static void stm32f405_soc_map(MemoryRegion *mem, SysBusDevice *busdev, int n,
+                              hwaddr addr, int priority)
+{
+    memory_region_add_subregion_overlap(mem, addr,
+                                        sysbus_mmio_get_region(busdev, n),
+                                        priority);
+}
+
+/* create_unimplemented_device(), likewise */
+static void stm32f405_soc_unimp(MemoryRegion *mem, const char *name,
+                                hwaddr base, hwaddr size)
+{
+    DeviceState *dev = qdev_new(TYPE_UNIMPLEMENTED_DEVICE);
+
+    qdev_prop_set_string(dev, "name", name);
+    qdev_prop_set_uint64(dev, "size", size);
+    sysbus_realize_and_unref(SYS_BUS_DEVICE(dev), &error_fatal);
+    stm32f405_soc_map(mem, SYS_BUS_DEVICE(dev), 0, base, -1000);
+}
+
+static qemu_irq stm32f405_soc_dma_in(STM32F405State *s, const DmaRoute *route)
+{
+    return qdev_get_gpio_in(DEVICE(&s->dma[route->dma - 1]),
+                            STM32F4XX_DMA_REQ(route->stream, route->channel));
+}
+
+/* Connect the DMA request @name of @dev to the streams of @route */
+static bool stm32f405_soc_dma_request(STM32F405State *s, DeviceState *dev,
+                                      const char *name, const DmaRoute *route,
+                                      int *split, Error **errp)
+{
+    DeviceState *splitter;
+
+    if (!route[1].dma) {
+        qdev_connect_gpio_out_named(dev, name, 0,
+                                    stm32f405_soc_dma_in(s, &route[0]));
+        return true;
+    }
+
+    assert(*split < STM_NUM_DMA_SPLITS);
+    splitter = DEVICE(&s->dma_split[(*split)++]);
+    qdev_prop_set_uint16(splitter, "num-lines", 2);
+    if (!qdev_realize(splitter, NULL, errp)) {
+        return false;
+    }
+    qdev_connect_gpio_out_named(dev, name, 0, qdev_get_gpio_in(splitter, 0));
+    qdev_connect_gpio_out(splitter, 0, stm32f405_soc_dma_in(s, &route[0]));
+    qdev_connect_gpio_out(splitter, 1, stm32f405_soc_dma_in(s, &route[1]));
+    return true;
+}
+
+/*
+ * Plain RAM, or the memory of @memdev.  A file backend mapped privately
+ * starts the SoC from a RAM image without copying it, see "Snapshot boot"
+ * in docs/system/arm/stm32.rst.
+ */
+static MemoryRegion *stm32f405_soc_ram(DeviceState *dev, MemoryRegion *ram,
+                                       HostMemoryBackend *memdev,
+                                       Object *owner, const char *name,
+                                       uint64_t size, Error **errp)
+{
+    MemoryRegion *mr;
+
+    if (!memdev) {
+        if (!memory_region_init_ram(ram, owner, name, size, errp)) {
+            return NULL;
+        }
+        return ram;
+    }
+    if (host_memory_backend_is_mapped(memdev)) {
+        error_setg(errp, "%s: memdev is already in use", name);
+        return NULL;
+    }
+    mr = host_memory_backend_get_memory(memdev);
+    if (memory_region_size(mr) != size) {
+        error_setg(errp, "%s: memdev size must be %" PRIu64, name, size);
+        return NULL;
+    }
+    host_memory_backend_set_mapped(memdev, true);
+    vmstate_register_ram(mr, dev);
+    return mr;
+}
+
+/* Start the pin bus afresh, the ports publish their state on reset */
+static bool stm32f405_soc_pinbus(STM32F405State *s, Error **errp)
+{
+    MemoryRegion *mr = host_memory_backend_get_memory(s->pinbus);
+    STM32F4xxPinbus *bus;
+
+    if (host_memory_backend_is_mapped(s->pinbus)) {
+        error_setg(errp, "pinbus: memdev is already in use");
+        return false;
+    }
+    if (memory_region_size(mr) < sizeof(STM32F4xxPinbus)) {
+        error_setg(errp, "pinbus: memdev must hold at least %zu bytes",
+                   sizeof(STM32F4xxPinbus));
+        return false;
+    }
+    host_memory_backend_set_mapped(s->pinbus, true);
+
+    bus = memory_region_get_ram_ptr(mr);
+    memset(bus, 0, sizeof(*bus));
+    bus->version = STM32F4XX_PINBUS_VERSION;
+    bus->nports = STM_NUM_GPIOS;
+    bus->ring_size = STM32F4XX_PINBUS_RING;
+    qatomic_store_release(&bus->magic, STM32F4XX_PINBUS_MAGIC);
+    return true;
+}
 
 static void stm32f405_soc_initfn(Object *obj)
 {
@@ -59,6 +247,8 @@ static void stm32f405_soc_initfn(Object *obj)
 
     object_initialize_child(obj, "armv7m", &s->armv7m, TYPE_ARMV7M);
 
+    object_initialize_child(obj, "rcc", &s->rcc, TYPE_STM32F4XX_RCC);
+
     object_initialize_child(obj, "syscfg", &s->syscfg, TYPE_STM32F4XX_SYSCFG);
 
     for (i = 0; i < STM_NUM_USARTS; i++) {
@@ -79,20 +269,76 @@ static void stm32f405_soc_initfn(Object *obj)
         object_initialize_child(obj, "spi[*]", &s->spi[i], TYPE_STM32F2XX_SPI);
     }
 
+    /* Named like the buses they create, for -device bus=i2c1 */
+    for (i = 0; i < STM_NUM_I2CS; i++) {
+        g_autofree char *name = g_strdup_printf("i2c%d", i + 1);
+
+        object_initialize_child(obj, name, &s->i2c[i], TYPE_STM32F4XX_I2C);
+    }
+
+    for (i = 0; i < STM_NUM_CANS; i++) {
+        object_initialize_child(obj, "can[*]", &s->can[i], TYPE_STM32F4XX_CAN);
+    }
+
+    for (i = 0; i < STM_NUM_DMAS; i++) {
+        object_initialize_child(obj, "dma[*]", &s->dma[i], TYPE_STM32F4XX_DMA);
+    }
+    for (i = 0; i < STM_NUM_DMA_SPLITS; i++) {
+        object_initialize_child(obj, "dma-split[*]", &s->dma_split[i],
+                                TYPE_SPLIT_IRQ);
+    }
+
+    for (i = 0; i < STM_NUM_GPIOS; i++) {
+        object_initialize_child(obj, "gpio[*]", &s->gpio[i],
+                                TYPE_STM32F4XX_GPIO);
+    }
+
     object_initialize_child(obj, "exti", &s->exti, TYPE_STM32F4XX_EXTI);
+    object_initialize_child(obj, "crc", &s->crc, TYPE_STM32_CRC);
+    object_initialize_child(obj, "rng", &s->rng, TYPE_STM32_RNG);
+    object_initialize_child(obj, "fsmc", &s->fsmc, TYPE_STM32F4XX_FSMC);
+
+    object_initialize_child(obj, "flash-acr", &s->flash_acr,
+                            TYPE_STM32_FLASH_ACR);
+    object_initialize_child(obj, "flash-if", &s->flash_if,
+                            TYPE_STM32F4XX_FLASH);
 
-    s->sysclk = qdev_init_clock_in(DEVICE(s), "sysclk", NULL, NULL, 0);
+    s->hse = qdev_init_clock_in(DEVICE(s), "hse", NULL, NULL, 0);
     s->refclk = qdev_init_clock_in(DEVICE(s), "refclk", NULL, NULL, 0);
 }
 
+/*
+ * WFI with SCR.SLEEPDEEP set enters STOP, or STANDBY with PWR_CR.PDDS:
+ * only an interrupt or an event wakes the core up, so the idle time up to
+ * the next armed timer can be skipped.  Plain sleep mode keeps running in
+ * real time.  The boards of a farm must all be there.
+ */
+static bool stm32f405_soc_sleep_skip(void *opaque)
+{
+    CPUState *cs;
+
+    CPU_FOREACH(cs) {
+        CPUARMState *env = cpu_env(cs);
+
+        if (!cs->halted ||
+            !(env->v7m.scr[env->v7m.secure] & R_V7M_SCR_SLEEPDEEP_MASK)) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static void stm32f405_soc_realize(DeviceState *dev_soc, Error **errp)
 {
     STM32F405State *s = STM32F405_SOC(dev_soc);
-    MemoryRegion *system_memory = get_system_memory();
+    MemoryRegion *mem = s->memory ? s->memory : get_system_memory();
+    /* Keep the RAM block names of a single instance, for migration */
+    Object *ram_owner = s->memory ? OBJECT(dev_soc) : NULL;
+    MemoryRegion *ram;
     DeviceState *dev, *armv7m;
     SysBusDevice *busdev;
-    Error *err = NULL;
-    int i;
+    int split = 0;
+    int i, j;
 
     /*
      * We use s->refclk internally and only define it with qdev_init_clock_in()
@@ -104,92 +350,176 @@ static void stm32f405_soc_realize(DeviceState *dev_soc, Error **errp)
         return;
     }
 
-    if (!clock_has_source(s->sysclk)) {
-        error_setg(errp, "sysclk clock must be wired up by the board code");
+    if (!clock_has_source(s->hse)) {
+        error_setg(errp, "hse clock must be wired up by the board code");
         return;
     }
 
     /*
-     * TODO: ideally we should model the SoC RCC and its ability to
-     * change the sysclk frequency and define different sysclk sources.
+     * The RCC derives the CPU and bus clocks from the HSE crystal of the
+     * board, or from the internal 16 MHz oscillator it starts with.
      */
+    qdev_connect_clock_in(DEVICE(&s->rcc), "hse", s->hse);
+    if (!sysbus_realize(SYS_BUS_DEVICE(&s->rcc), errp)) {
+        return;
+    }
 
     /* The refclk always runs at frequency HCLK / 8 */
     clock_set_mul_div(s->refclk, 8, 1);
-    clock_set_source(s->refclk, s->sysclk);
+    clock_set_source(s->refclk, s->rcc.out[STM32F4XX_RCC_HCLK]);
 
-    memory_region_init_rom(&s->flash, OBJECT(dev_soc), "STM32F405.flash",
-                           FLASH_SIZE, &err);
-    if (err != NULL) {
-        error_propagate(errp, err);
+    /* The flash belongs to the flash interface, which programs it */
+    qdev_prop_set_uint32(DEVICE(&s->flash_if), "size", FLASH_SIZE);
+    busdev = SYS_BUS_DEVICE(&s->flash_if);
+    if (!sysbus_realize(busdev, errp)) {
         return;
     }
     memory_region_init_alias(&s->flash_alias, OBJECT(dev_soc),
-                             "STM32F405.flash.alias", &s->flash, 0,
+                             "STM32F405.flash.alias",
+                             sysbus_mmio_get_region(busdev, 1), 0,
                              FLASH_SIZE);
 
-    memory_region_add_subregion(system_memory, FLASH_BASE_ADDRESS, &s->flash);
-    memory_region_add_subregion(system_memory, 0, &s->flash_alias);
+    stm32f405_soc_map(mem, busdev, 1, FLASH_BASE_ADDRESS, 0);
+    memory_region_add_subregion(mem, 0, &s->flash_alias);
 
-    memory_region_init_ram(&s->sram, NULL, "STM32F405.sram", SRAM_SIZE,
-                           &err);
-    if (err != NULL) {
-        error_propagate(errp, err);
+    ram = stm32f405_soc_ram(dev_soc, &s->sram, s->sram_memdev, ram_owner,
+                            "STM32F405.sram", SRAM_SIZE, errp);
+    if (!ram) {
         return;
     }
-    memory_region_add_subregion(system_memory, SRAM_BASE_ADDRESS, &s->sram);
+    memory_region_add_subregion(mem, SRAM_BASE_ADDRESS, ram);
 
-    memory_region_init_ram(&s->ccm, NULL, "STM32F405.ccm", CCM_SIZE,
-                           &err);
-    if (err != NULL) {
-        error_propagate(errp, err);
+    ram = stm32f405_soc_ram(dev_soc, &s->ccm, s->ccm_memdev, ram_owner,
+                            "STM32F405.ccm", CCM_SIZE, errp);
+    if (!ram) {
         return;
     }
-    memory_region_add_subregion(system_memory, CCM_BASE_ADDRESS, &s->ccm);
+    memory_region_add_subregion(mem, CCM_BASE_ADDRESS, ram);
 
     armv7m = DEVICE(&s->armv7m);
     qdev_prop_set_uint32(armv7m, "num-irq", 96);
     qdev_prop_set_uint8(armv7m, "num-prio-bits", 4);
     qdev_prop_set_string(armv7m, "cpu-type", ARM_CPU_TYPE_NAME("cortex-m4"));
     qdev_prop_set_bit(armv7m, "enable-bitband", true);
-    qdev_connect_clock_in(armv7m, "cpuclk", s->sysclk);
+    qdev_connect_clock_in(armv7m, "cpuclk", s->rcc.out[STM32F4XX_RCC_HCLK]);
     qdev_connect_clock_in(armv7m, "refclk", s->refclk);
     object_property_set_link(OBJECT(&s->armv7m), "memory",
-                             OBJECT(system_memory), &error_abort);
+                             OBJECT(mem), &error_abort);
     if (!sysbus_realize(SYS_BUS_DEVICE(&s->armv7m), errp)) {
         return;
     }
 
+    busdev = SYS_BUS_DEVICE(&s->rcc);
+    stm32f405_soc_map(mem, busdev, 0, RCC_ADDR, 0);
+    sysbus_connect_irq(busdev, 0, qdev_get_gpio_in(armv7m, RCC_IRQ));
+
     /* System configuration controller */
     dev = DEVICE(&s->syscfg);
     if (!sysbus_realize(SYS_BUS_DEVICE(&s->syscfg), errp)) {
         return;
     }
     busdev = SYS_BUS_DEVICE(dev);
-    sysbus_mmio_map(busdev, 0, SYSCFG_ADD);
+    stm32f405_soc_map(mem, busdev, 0, SYSCFG_ADD, 0);
     sysbus_connect_irq(busdev, 0, qdev_get_gpio_in(armv7m, SYSCFG_IRQ));
 
+    /* GPIO ports, their pins go to the EXTI lines through SYSCFG */
+    if (s->pinbus && !stm32f405_soc_pinbus(s, errp)) {
+        return;
+    }
+    for (i = 0; i < STM_NUM_GPIOS; i++) {
+        dev = DEVICE(&s->gpio[i]);
+        qdev_prop_set_uint8(dev, "port", i);
+        if (i < ARRAY_SIZE(gpio_reset)) {
+            qdev_prop_set_uint32(dev, "moder-reset", gpio_reset[i][0]);
+            qdev_prop_set_uint32(dev, "ospeedr-reset", gpio_reset[i][1]);
+            qdev_prop_set_uint32(dev, "pupdr-reset", gpio_reset[i][2]);
+        }
+        if (s->pinbus) {
+            object_property_set_link(OBJECT(dev), "pinbus", OBJECT(s->pinbus),
+                                     &error_abort);
+        }
+        busdev = SYS_BUS_DEVICE(dev);
+        if (!sysbus_realize(busdev, errp)) {
+            return;
+        }
+        stm32f405_soc_map(mem, busdev, 0, GPIO_ADDR(i), 0);
+        for (j = 0; j < STM32F4XX_GPIO_NUM_PINS; j++) {
+            qdev_connect_gpio_out(dev, j,
+                                  qdev_get_gpio_in(DEVICE(&s->syscfg),
+                                                   i * 16 + j));
+        }
+    }
+
+    /* DMA controllers, only DMA2 does memory to memory transfers */
+    for (i = 0; i < STM_NUM_DMAS; i++) {
+        dev = DEVICE(&s->dma[i]);
+        object_property_set_link(OBJECT(dev), "memory", OBJECT(mem),
+                                 &error_abort);
+        qdev_prop_set_bit(dev, "mem-to-mem", i == 1);
+        busdev = SYS_BUS_DEVICE(dev);
+        if (!sysbus_realize(busdev, errp)) {
+            return;
+        }
+        stm32f405_soc_map(mem, busdev, 0, dma_addr[i], 0);
+        for (j = 0; j < STM32F4XX_DMA_NUM_STREAMS; j++) {
+            sysbus_connect_irq(busdev, j,
+                               qdev_get_gpio_in(armv7m, dma_irq[i][j]));
+        }
+    }
+
     /* Attach UART (uses USART registers) and USART controllers */
     for (i = 0; i < STM_NUM_USARTS; i++) {
+        Chardev *chr = serial_hd(i);
+
+        if (s->serial_prefix) {
+            g_autofree char *id = g_strdup_printf("%susart%d",
+                                                  s->serial_prefix, i + 1);
+
+            chr = qemu_chr_find(id);
+        }
         dev = DEVICE(&(s->usart[i]));
-        qdev_prop_set_chr(dev, "chardev", serial_hd(i));
+        qdev_prop_set_chr(dev, "chardev", chr);
+        /* USART1 and USART6 are on APB2 */
+        qdev_connect_clock_in(dev, "clk",
+                              s->rcc.out[i == 0 || i == 5 ?
+                                         STM32F4XX_RCC_PCLK2 :
+                                         STM32F4XX_RCC_PCLK1]);
         if (!sysbus_realize(SYS_BUS_DEVICE(&s->usart[i]), errp)) {
             return;
         }
         busdev = SYS_BUS_DEVICE(dev);
-        sysbus_mmio_map(busdev, 0, usart_addr[i]);
+        stm32f405_soc_map(mem, busdev, 0, usart_addr[i], 0);
         sysbus_connect_irq(busdev, 0, qdev_get_gpio_in(armv7m, usart_irq[i]));
+        if (i < ARRAY_SIZE(usart_dma) &&
+            !(stm32f405_soc_dma_request(s, dev, "dma-tx", usart_dma[i][0],
+                                        &split, errp) &&
+              stm32f405_soc_dma_request(s, dev, "dma-rx", usart_dma[i][1],
+                                        &split, errp))) {
+            return;
+        }
     }
 
-    /* Timer 2 to 5 */
+    /* Timer 2 to 5, on APB1 */
     for (i = 0; i < STM_NUM_TIMERS; i++) {
         dev = DEVICE(&(s->timer[i]));
-        qdev_prop_set_uint64(dev, "clock-frequency", 1000000000);
+        qdev_connect_clock_in(dev, "clk", s->rcc.out[STM32F4XX_RCC_TIMCLK1]);
+        qdev_prop_set_uint8(dev, "counter-bits", timer_bits[i]);
+        for (j = 0; j < STM32F2XX_TIMER_NUM_ITR; j++) {
+            char name[8];
+
+            if (timer_itr[i][j] < 0) {
+                continue;
+            }
+            snprintf(name, sizeof(name), "itr%d", j);
+            object_property_set_link(OBJECT(dev), name,
+                                     OBJECT(&s->timer[timer_itr[i][j]]),
+                                     &error_abort);
+        }
         if (!sysbus_realize(SYS_BUS_DEVICE(&s->timer[i]), errp)) {
             return;
         }
         busdev = SYS_BUS_DEVICE(dev);
-        sysbus_mmio_map(busdev, 0, timer_addr[i]);
+        stm32f405_soc_map(mem, busdev, 0, timer_addr[i], 0);
         sysbus_connect_irq(busdev, 0, qdev_get_gpio_in(armv7m, timer_irq[i]));
     }
 
@@ -213,20 +543,67 @@ static void stm32f405_soc_realize(DeviceState *dev_soc, Error **errp)
             return;
         }
         busdev = SYS_BUS_DEVICE(dev);
-        sysbus_mmio_map(busdev, 0, adc_addr[i]);
+        stm32f405_soc_map(mem, busdev, 0, adc_addr[i], 0);
         sysbus_connect_irq(busdev, 0,
                            qdev_get_gpio_in(DEVICE(&s->adc_irqs), i));
     }
 
-    /* SPI devices */
+    /* SPI devices, SPI2 and SPI3 are on APB1 */
     for (i = 0; i < STM_NUM_SPIS; i++) {
         dev = DEVICE(&(s->spi[i]));
+        qdev_connect_clock_in(dev, "clk",
+                              s->rcc.out[i == 1 || i == 2 ?
+                                         STM32F4XX_RCC_PCLK1 :
+                                         STM32F4XX_RCC_PCLK2]);
         if (!sysbus_realize(SYS_BUS_DEVICE(&s->spi[i]), errp)) {
             return;
         }
         busdev = SYS_BUS_DEVICE(dev);
-        sysbus_mmio_map(busdev, 0, spi_addr[i]);
+        stm32f405_soc_map(mem, busdev, 0, spi_addr[i], 0);
         sysbus_connect_irq(busdev, 0, qdev_get_gpio_in(armv7m, spi_irq[i]));
+        if (i < ARRAY_SIZE(spi_dma) &&
+            !(stm32f405_soc_dma_request(s, dev, "dma-tx", spi_dma[i][0],
+                                        &split, errp) &&
+              stm32f405_soc_dma_request(s, dev, "dma-rx", spi_dma[i][1],
+                                        &split, errp))) {
+            return;
+        }
+    }
+
+    /* I2C controllers */
+    for (i = 0; i < STM_NUM_I2CS; i++) {
+        busdev = SYS_BUS_DEVICE(&s->i2c[i]);
+        if (!sysbus_realize(busdev, errp)) {
+            return;
+        }
+        stm32f405_soc_map(mem, busdev, 0, i2c_addr[i], 0);
+        for (j = 0; j < 2; j++) {
+            sysbus_connect_irq(busdev, j,
+                               qdev_get_gpio_in(armv7m, i2c_irq[i][j]));
+        }
+    }
+
+    /* CAN controllers, CAN2 uses the filter banks of CAN1 */
+    for (i = 0; i < STM_NUM_CANS; i++) {
+        dev = DEVICE(&s->can[i]);
+        if (i > 0) {
+            object_property_set_link(OBJECT(dev), "master",
+                                     OBJECT(&s->can[0]), &error_abort);
+        }
+        if (s->canbus[i]) {
+            object_property_set_link(OBJECT(dev), "canbus",
+                                     OBJECT(s->canbus[i]), &error_abort);
+        }
+        qdev_connect_clock_in(dev, "clk", s->rcc.out[STM32F4XX_RCC_PCLK1]);
+        busdev = SYS_BUS_DEVICE(dev);
+        if (!sysbus_realize(busdev, errp)) {
+            return;
+        }
+        stm32f405_soc_map(mem, busdev, 0, can_addr[i], 0);
+        for (j = 0; j < STM32F4XX_CAN_NUM_IRQS; j++) {
+            sysbus_connect_irq(busdev, j,
+                               qdev_get_gpio_in(armv7m, can_irq[i][j]));
+        }
     }
 
     /* EXTI device */
@@ -235,7 +612,7 @@ static void stm32f405_soc_realize(DeviceState *dev_soc, Error **errp)
         return;
     }
     busdev = SYS_BUS_DEVICE(dev);
-    sysbus_mmio_map(busdev, 0, EXTI_ADDR);
+    stm32f405_soc_map(mem, busdev, 0, EXTI_ADDR, 0);
     for (i = 0; i < 16; i++) {
         sysbus_connect_irq(busdev, i, qdev_get_gpio_in(armv7m, exti_irq[i]));
     }
@@ -243,56 +620,101 @@ static void stm32f405_soc_realize(DeviceState *dev_soc, Error **errp)
         qdev_connect_gpio_out(DEVICE(&s->syscfg), i, qdev_get_gpio_in(dev, i));
     }
 
-    create_unimplemented_device("timer[7]",    0x40001400, 0x400);
-    create_unimplemented_device("timer[12]",   0x40001800, 0x400);
-    create_unimplemented_device("timer[6]",    0x40001000, 0x400);
-    create_unimplemented_device("timer[13]",   0x40001C00, 0x400);
-    create_unimplemented_device("timer[14]",   0x40002000, 0x400);
-    create_unimplemented_device("RTC and BKP", 0x40002800, 0x400);
-    create_unimplemented_device("WWDG",        0x40002C00, 0x400);
-    create_unimplemented_device("IWDG",        0x40003000, 0x400);
-    create_unimplemented_device("I2S2ext",     0x40003000, 0x400);
-    create_unimplemented_device("I2S3ext",     0x40004000, 0x400);
-    create_unimplemented_device("I2C1",        0x40005400, 0x400);
-    create_unimplemented_device("I2C2",        0x40005800, 0x400);
-    create_unimplemented_device("I2C3",        0x40005C00, 0x400);
-    create_unimplemented_device("CAN1",        0x40006400, 0x400);
-    create_unimplemented_device("CAN2",        0x40006800, 0x400);
-    create_unimplemented_device("PWR",         0x40007000, 0x400);
-    create_unimplemented_device("DAC",         0x40007400, 0x400);
-    create_unimplemented_device("timer[1]",    0x40010000, 0x400);
-    create_unimplemented_device("timer[8]",    0x40010400, 0x400);
-    create_unimplemented_device("SDIO",        0x40012C00, 0x400);
-    create_unimplemented_device("timer[9]",    0x40014000, 0x400);
-    create_unimplemented_device("timer[10]",   0x40014400, 0x400);
-    create_unimplemented_device("timer[11]",   0x40014800, 0x400);
-    create_unimplemented_device("GPIOA",       0x40020000, 0x400);
-    create_unimplemented_device("GPIOB",       0x40020400, 0x400);
-    create_unimplemented_device("GPIOC",       0x40020800, 0x400);
-    create_unimplemented_device("GPIOD",       0x40020C00, 0x400);
-    create_unimplemented_device("GPIOE",       0x40021000, 0x400);
-    create_unimplemented_device("GPIOF",       0x40021400, 0x400);
-    create_unimplemented_device("GPIOG",       0x40021800, 0x400);
-    create_unimplemented_device("GPIOH",       0x40021C00, 0x400);
-    create_unimplemented_device("GPIOI",       0x40022000, 0x400);
-    create_unimplemented_device("CRC",         0x40023000, 0x400);
-    create_unimplemented_device("RCC",         0x40023800, 0x400);
-    create_unimplemented_device("Flash Int",   0x40023C00, 0x400);
-    create_unimplemented_device("BKPSRAM",     0x40024000, 0x400);
-    create_unimplemented_device("DMA1",        0x40026000, 0x400);
-    create_unimplemented_device("DMA2",        0x40026400, 0x400);
-    create_unimplemented_device("Ethernet",    0x40028000, 0x1400);
-    create_unimplemented_device("USB OTG HS",  0x40040000, 0x30000);
-    create_unimplemented_device("USB OTG FS",  0x50000000, 0x31000);
-    create_unimplemented_device("DCMI",        0x50050000, 0x400);
-    create_unimplemented_device("RNG",         0x50060800, 0x400);
+    /* CRC calculation unit and random number generator */
+    busdev = SYS_BUS_DEVICE(&s->crc);
+    if (!sysbus_realize(busdev, errp)) {
+        return;
+    }
+    stm32f405_soc_map(mem, busdev, 0, CRC_ADDR, 0);
+
+    busdev = SYS_BUS_DEVICE(&s->rng);
+    if (!sysbus_realize(busdev, errp)) {
+        return;
+    }
+    stm32f405_soc_map(mem, busdev, 0, RNG_ADDR, 0);
+    sysbus_connect_irq(busdev, 0, qdev_get_gpio_in(armv7m, RNG_IRQ));
+
+    /* External memories, on the subbanks of FSMC bank 1 */
+    busdev = SYS_BUS_DEVICE(&s->fsmc);
+    if (!sysbus_realize(busdev, errp)) {
+        return;
+    }
+    stm32f405_soc_map(mem, busdev, 0, FSMC_ADDR, 0);
+    stm32f405_soc_map(mem, busdev, 1, FSMC_BANK1_ADDR, 0);
+
+    /* Flash interface, with ACR and the fetch timing model on top */
+    busdev = SYS_BUS_DEVICE(&s->flash_if);
+    stm32f405_soc_map(mem, busdev, 0, FLASH_IF_ADDR, 0);
+    sysbus_connect_irq(busdev, 0, qdev_get_gpio_in(armv7m, FLASH_IF_IRQ));
+
+    stm32_flash_acr_set_map(&s->flash_acr, mem_latency,
+                            ARRAY_SIZE(mem_latency), 2);
+    if (s->cycle_timing) {
+        object_property_set_link(OBJECT(&s->flash_acr), "cpu",
+                                 OBJECT(s->armv7m.cpu), &error_abort);
+    }
+    busdev = SYS_BUS_DEVICE(&s->flash_acr);
+    if (!sysbus_realize(busdev, errp)) {
+        return;
+    }
+    stm32f405_soc_map(mem, busdev, 0, FLASH_IF_ADDR, 1);
+
+    if (s->sleep_skip) {
+        cpu_clock_set_sleep_skip(stm32f405_soc_sleep_skip, NULL);
+    }
+
+    stm32f405_soc_unimp(mem, "timer[7]",    0x40001400, 0x400);
+    stm32f405_soc_unimp(mem, "timer[12]",   0x40001800, 0x400);
+    stm32f405_soc_unimp(mem, "timer[6]",    0x40001000, 0x400);
+    stm32f405_soc_unimp(mem, "timer[13]",   0x40001C00, 0x400);
+    stm32f405_soc_unimp(mem, "timer[14]",   0x40002000, 0x400);
+    stm32f405_soc_unimp(mem, "RTC and BKP", 0x40002800, 0x400);
+    stm32f405_soc_unimp(mem, "WWDG",        0x40002C00, 0x400);
+    stm32f405_soc_unimp(mem, "IWDG",        0x40003000, 0x400);
+    stm32f405_soc_unimp(mem, "I2S2ext",     0x40003000, 0x400);
+    stm32f405_soc_unimp(mem, "I2S3ext",     0x40004000, 0x400);
+    stm32f405_soc_unimp(mem, "PWR",         0x40007000, 0x400);
+    stm32f405_soc_unimp(mem, "DAC",         0x40007400, 0x400);
+    stm32f405_soc_unimp(mem, "timer[1]",    0x40010000, 0x400);
+    stm32f405_soc_unimp(mem, "timer[8]",    0x40010400, 0x400);
+    stm32f405_soc_unimp(mem, "SDIO",        0x40012C00, 0x400);
+    stm32f405_soc_unimp(mem, "timer[9]",    0x40014000, 0x400);
+    stm32f405_soc_unimp(mem, "timer[10]",   0x40014400, 0x400);
+    stm32f405_soc_unimp(mem, "timer[11]",   0x40014800, 0x400);
+    stm32f405_soc_unimp(mem, "BKPSRAM",     0x40024000, 0x400);
+    stm32f405_soc_unimp(mem, "Ethernet",    0x40028000, 0x1400);
+    stm32f405_soc_unimp(mem, "USB OTG HS",  0x40040000, 0x30000);
+    stm32f405_soc_unimp(mem, "USB OTG FS",  0x50000000, 0x31000);
+    stm32f405_soc_unimp(mem, "DCMI",        0x50050000, 0x400);
 }
 
+static Property stm32f405_soc_properties[] = {
+    /* Charge flash/SRAM fetch wait states to virtual time (needs icount) */
+    DEFINE_PROP_BOOL("cycle-timing", STM32F405State, cycle_timing, false),
+    /* Skip the idle time in STOP and STANDBY, see cpu_clock_sleep_skip() */
+    DEFINE_PROP_BOOL("sleep-skip", STM32F405State, sleep_skip, false),
+    DEFINE_PROP_LINK("canbus0", STM32F405State, canbus[0], TYPE_CAN_BUS,
+                     CanBusState *),
+    DEFINE_PROP_LINK("canbus1", STM32F405State, canbus[1], TYPE_CAN_BUS,
+                     CanBusState *),
+    DEFINE_PROP_LINK("memory", STM32F405State, memory, TYPE_MEMORY_REGION,
+                     MemoryRegion *),
+    DEFINE_PROP_STRING("serial-prefix", STM32F405State, serial_prefix),
+    DEFINE_PROP_LINK("sram-memdev", STM32F405State, sram_memdev,
+                     TYPE_MEMORY_BACKEND, HostMemoryBackend *),
+    DEFINE_PROP_LINK("ccm-memdev", STM32F405State, ccm_memdev,
+                     TYPE_MEMORY_BACKEND, HostMemoryBackend *),
+    DEFINE_PROP_LINK("pinbus", STM32F405State, pinbus,
+                     TYPE_MEMORY_BACKEND, HostMemoryBackend *),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void stm32f405_soc_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
 
     dc->realize = stm32f405_soc_realize;
+    device_class_set_props(dc, stm32f405_soc_properties);
     /* No vmstate or reset required: device has no internal state */
 }
 
@@ -29,6 +29,7 @@
 #include "hw/or-irq.h"
 #include "hw/arm/stm32l4x5_soc.h"
 #include "hw/qdev-clock.h"
+#include "hw/qdev-properties.h"
 #include "hw/misc/unimp.h"
 
 #define FLASH_BASE_ADDRESS 0x08000000
@@ -39,6 +40,9 @@
 
 #define EXTI_ADDR 0x40010400
 #define SYSCFG_ADDR 0x40010000
+#define FLASH_IF_ADDR 0x40022000
+/* ICEN and DCEN are set at reset */
+#define FLASH_ACR_RESET 0x00000600
 
 #define NUM_EXTI_IRQ 40
 /* Match exti line connections with their CPU IRQ number */
@@ -97,6 +101,44 @@ static const int exti_or_gate1_lines_in[EXTI_OR_GATE1_NUM_LINES_IN] = {
     16, 35, 36, 37, 38,
 };
 
+/*
+ * TIM1 to TIM8.  TIM15 on ITR0 of TIM1 and ITR2 of TIM3 is not modelled.
+ * The advanced timers have separate UP, CC, TRG_COM and BRK interrupts.
+ */
+typedef struct {
+    const char *name;
+    hwaddr addr;
+    uint8_t counter_bits;
+    uint8_t num_channels;
+    bool advanced;
+    int irq[STM32F2XX_TIMER_NUM_IRQS];
+    /* Index into tim[] of the masters on ITR0..3, -1 if there is none */
+    int itr[STM32F2XX_TIMER_NUM_ITR];
+} Stm32l4x5TimerInfo;
+
+static const Stm32l4x5TimerInfo timer_info[STM32L4X5_NUM_TIMERS] = {
+    { "tim1", 0x40012C00, 16, 4, true,  { 25, 27, 26, 24 }, { -1, 1, 2, 3 } },
+    { "tim2", 0x40000000, 32, 4, false, { 28, -1, -1, -1 }, { 0, 7, 2, 3 } },
+    { "tim3", 0x40000400, 16, 4, false, { 29, -1, -1, -1 }, { 0, 1, -1, 3 } },
+    { "tim4", 0x40000800, 16, 4, false, { 30, -1, -1, -1 }, { 0, 1, 2, 7 } },
+    { "tim5", 0x40000C00, 32, 4, false, { 50, -1, -1, -1 }, { 1, 2, 3, 7 } },
+    { "tim6", 0x40001000, 16, 0, false, { 54, -1, -1, -1 }, { -1, -1, -1, -1 } },
+    { "tim7", 0x40001400, 16, 0, false, { 55, -1, -1, -1 }, { -1, -1, -1, -1 } },
+    { "tim8", 0x40013400, 16, 4, true,  { 44, 46, 45, 43 }, { 0, 1, 3, 4 } },
+};
+
+/* I2C1 to I2C3, with their event and error interrupts */
+static const hwaddr i2c_addr[STM32L4X5_NUM_I2CS] = {
+    0x40005400, 0x40005800, 0x40005C00
+};
+static const int i2c_irq[STM32L4X5_NUM_I2CS][2] = {
+    { 31, 32 }, { 33, 34 }, { 72, 73 }
+};
+
+#define CRC_ADDR 0x40023000
+#define RNG_ADDR 0x50060800
+#define RNG_IRQ 80
+
 static void stm32l4x5_soc_initfn(Object *obj)
 {
     Stm32l4x5SocState *s = STM32L4X5_SOC(obj);
@@ -107,6 +149,19 @@ static void stm32l4x5_soc_initfn(Object *obj)
                                 TYPE_OR_IRQ);
     }
     object_initialize_child(obj, "syscfg", &s->syscfg, TYPE_STM32L4X5_SYSCFG);
+    object_initialize_child(obj, "flash-acr", &s->flash_acr,
+                            TYPE_STM32_FLASH_ACR);
+    for (unsigned i = 0; i < STM32L4X5_NUM_TIMERS; i++) {
+        object_initialize_child(obj, timer_info[i].name, &s->tim[i],
+                                TYPE_STM32F2XX_TIMER);
+    }
+    for (unsigned i = 0; i < STM32L4X5_NUM_I2CS; i++) {
+        g_autofree char *name = g_strdup_printf("i2c%u", i + 1);
+
+        object_initialize_child(obj, name, &s->i2c[i], TYPE_STM32L4X5_I2C);
+    }
+    object_initialize_child(obj, "crc", &s->crc, TYPE_STM32_CRC);
+    object_initialize_child(obj, "rng", &s->rng, TYPE_STM32_RNG);
 
     s->sysclk = qdev_init_clock_in(DEVICE(s), "sysclk", NULL, NULL, 0);
     s->refclk = qdev_init_clock_in(DEVICE(s), "refclk", NULL, NULL, 0);
@@ -244,13 +299,99 @@ static void stm32l4x5_soc_realize(DeviceState *dev_soc, Error **errp)
                               qdev_get_gpio_in(DEVICE(&s->exti), i));
     }
 
+    /*
+     * Flash interface: only ACR is modelled, for the optional icount fetch
+     * timing model.  Flash and its boot alias are read in 64-bit lines with
+     * the wait states set in ACR.  SRAM1 fetches go over the S-bus and take
+     * one extra cycle per word, SRAM2 is on the I-Code bus at zero wait.
+     */
+    {
+        const ARMMemLatency mem_latency[] = {
+            { FLASH_BASE_ADDRESS, sc->flash_size, 8, 0, false },
+            { 0, sc->flash_size, 8, 0, false },
+            { SRAM1_BASE_ADDRESS, SRAM1_SIZE, 4, 1, false },
+        };
+
+        stm32_flash_acr_set_map(&s->flash_acr, mem_latency,
+                                ARRAY_SIZE(mem_latency), 2);
+    }
+    qdev_prop_set_uint32(DEVICE(&s->flash_acr), "reset-value",
+                         FLASH_ACR_RESET);
+    if (s->cycle_timing) {
+        object_property_set_link(OBJECT(&s->flash_acr), "cpu",
+                                 OBJECT(s->armv7m.cpu), &error_abort);
+    }
+    busdev = SYS_BUS_DEVICE(&s->flash_acr);
+    if (!sysbus_realize(busdev, errp)) {
+        return;
+    }
+    sysbus_mmio_map(busdev, 0, FLASH_IF_ADDR);
+
+    /* Timers, clocked from SYSCLK until there is an RCC model */
+    for (unsigned i = 0; i < STM32L4X5_NUM_TIMERS; i++) {
+        const Stm32l4x5TimerInfo *info = &timer_info[i];
+        DeviceState *dev = DEVICE(&s->tim[i]);
+
+        qdev_prop_set_uint8(dev, "counter-bits", info->counter_bits);
+        qdev_prop_set_uint8(dev, "num-channels", info->num_channels);
+        qdev_prop_set_bit(dev, "advanced", info->advanced);
+        for (unsigned j = 0; j < STM32F2XX_TIMER_NUM_ITR; j++) {
+            g_autofree char *name = g_strdup_printf("itr%u", j);
+
+            if (info->itr[j] < 0) {
+                continue;
+            }
+            object_property_set_link(OBJECT(dev), name,
+                                     OBJECT(&s->tim[info->itr[j]]),
+                                     &error_abort);
+        }
+        qdev_connect_clock_in(dev, "clk", s->sysclk);
+        busdev = SYS_BUS_DEVICE(dev);
+        if (!sysbus_realize(busdev, errp)) {
+            return;
+        }
+        sysbus_mmio_map(busdev, 0, info->addr);
+        for (unsigned j = 0; j < STM32F2XX_TIMER_NUM_IRQS; j++) {
+            if (info->irq[j] != -1) {
+                sysbus_connect_irq(busdev, j,
+                                   qdev_get_gpio_in(armv7m, info->irq[j]));
+            }
+        }
+    }
+
+    /* I2C, with SYSCLK as the kernel clock until there is an RCC model */
+    for (unsigned i = 0; i < STM32L4X5_NUM_I2CS; i++) {
+        DeviceState *dev = DEVICE(&s->i2c[i]);
+
+        qdev_connect_clock_in(dev, "clk", s->sysclk);
+        busdev = SYS_BUS_DEVICE(dev);
+        if (!sysbus_realize(busdev, errp)) {
+            return;
+        }
+        sysbus_mmio_map(busdev, 0, i2c_addr[i]);
+        for (unsigned j = 0; j < 2; j++) {
+            sysbus_connect_irq(busdev, j,
+                               qdev_get_gpio_in(armv7m, i2c_irq[i][j]));
+        }
+    }
+
+    /* CRC with the programmable polynomial, and the RNG */
+    object_property_set_bool(OBJECT(&s->crc), "configurable", true,
+                             &error_abort);
+    busdev = SYS_BUS_DEVICE(&s->crc);
+    if (!sysbus_realize(busdev, errp)) {
+        return;
+    }
+    sysbus_mmio_map(busdev, 0, CRC_ADDR);
+
+    busdev = SYS_BUS_DEVICE(&s->rng);
+    if (!sysbus_realize(busdev, errp)) {
+        return;
+    }
+    sysbus_mmio_map(busdev, 0, RNG_ADDR);
+    sysbus_connect_irq(busdev, 0, qdev_get_gpio_in(armv7m, RNG_IRQ));
+
     /* APB1 BUS */
-    create_unimplemented_device("TIM2",      0x40000000, 0x400);
-    create_unimplemented_device("TIM3",      0x40000400, 0x400);
-    create_unimplemented_device("TIM4",      0x40000800, 0x400);
-    create_unimplemented_device("TIM5",      0x40000C00, 0x400);
-    create_unimplemented_device("TIM6",      0x40001000, 0x400);
-    create_unimplemented_device("TIM7",      0x40001400, 0x400);
     /* RESERVED:    0x40001800, 0x1000 */
     create_unimplemented_device("RTC",       0x40002800, 0x400);
     create_unimplemented_device("WWDG",      0x40002C00, 0x400);
@@ -263,9 +404,6 @@ static void stm32l4x5_soc_realize(DeviceState *dev_soc, Error **errp)
     create_unimplemented_device("USART3",    0x40004800, 0x400);
     create_unimplemented_device("UART4",     0x40004C00, 0x400);
     create_unimplemented_device("UART5",     0x40005000, 0x400);
-    create_unimplemented_device("I2C1",      0x40005400, 0x400);
-    create_unimplemented_device("I2C2",      0x40005800, 0x400);
-    create_unimplemented_device("I2C3",      0x40005C00, 0x400);
     /* RESERVED:    0x40006000, 0x400 */
     create_unimplemented_device("CAN1",      0x40006400, 0x400);
     /* RESERVED:    0x40006800, 0x400 */
@@ -287,9 +425,7 @@ static void stm32l4x5_soc_realize(DeviceState *dev_soc, Error **errp)
     create_unimplemented_device("FIREWALL",  0x40011C00, 0x400);
     /* RESERVED:    0x40012000, 0x800 */
     create_unimplemented_device("SDMMC1",    0x40012800, 0x400);
-    create_unimplemented_device("TIM1",      0x40012C00, 0x400);
     create_unimplemented_device("SPI1",      0x40013000, 0x400);
-    create_unimplemented_device("TIM8",      0x40013400, 0x400);
     create_unimplemented_device("USART1",    0x40013800, 0x400);
     /* RESERVED:    0x40013C00, 0x400 */
     create_unimplemented_device("TIM15",     0x40014000, 0x400);
@@ -310,7 +446,6 @@ static void stm32l4x5_soc_realize(DeviceState *dev_soc, Error **errp)
     /* RESERVED:    0x40021400, 0xC00 */
     create_unimplemented_device("FLASH",     0x40022000, 0x400);
     /* RESERVED:    0x40022400, 0xC00 */
-    create_unimplemented_device("CRC",       0x40023000, 0x400);
     /* RESERVED:    0x40023400, 0x400 */
     create_unimplemented_device("TSC",       0x40024000, 0x400);
 
@@ -329,19 +464,25 @@ static void stm32l4x5_soc_realize(DeviceState *dev_soc, Error **errp)
     create_unimplemented_device("OTG_FS",    0x50000000, 0x40000);
     create_unimplemented_device("ADC",       0x50040000, 0x400);
     /* RESERVED:    0x50040400, 0x20400 */
-    create_unimplemented_device("RNG",       0x50060800, 0x400);
 
     /* AHB3 BUS */
     create_unimplemented_device("FMC",       0xA0000000, 0x1000);
     create_unimplemented_device("QUADSPI",   0xA0001000, 0x400);
 }
 
+static Property stm32l4x5_soc_properties[] = {
+    /* Charge flash/SRAM fetch wait states to virtual time (needs icount) */
+    DEFINE_PROP_BOOL("cycle-timing", Stm32l4x5SocState, cycle_timing, false),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void stm32l4x5_soc_class_init(ObjectClass *klass, void *data)
 {
 
     DeviceClass *dc = DEVICE_CLASS(klass);
 
     dc->realize = stm32l4x5_soc_realize;
+    device_class_set_props(dc, stm32l4x5_soc_properties);
     /* Reason: Mapped at fixed location on the system bus */
     dc->user_creatable = false;
     /* No vmstate or reset required: device has no internal state */
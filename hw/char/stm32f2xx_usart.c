@@ -27,41 +27,192 @@
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
 #include "hw/qdev-properties-system.h"
+#include "hw/qdev-clock.h"
+#include "migration/vmstate.h"
 #include "qemu/log.h"
+#include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "trace.h"
 
-#ifndef STM_USART_ERR_DEBUG
-#define STM_USART_ERR_DEBUG 0
-#endif
+/*
+ * Bytes written to DR wait in tx_buf and go to the host in batches.  RX
+ * data from the host waits in rx_fifo, the line, and moves into DR one
+ * byte at a time.
+ *
+ * With a kernel clock and BRR set, each frame takes its time at the baud
+ * rate: DR and the shift register hold two bytes on their way out, and a
+ * byte that comes in while DR is still full is lost with ORE, like on the
+ * hardware.  In fast-forward mode, TXE only clears when tx_buf is full, and
+ * the next received byte is in DR as soon as the guest read the last one.
+ */
 
-#define DB_PRINT_L(lvl, fmt, args...) do { \
-    if (STM_USART_ERR_DEBUG >= lvl) { \
-        qemu_log("%s: " fmt, __func__, ## args); \
-    } \
-} while (0)
+/* Virtual time a frame takes at the baud rate, 0 if not paced */
+static int64_t stm32f2xx_usart_frame_ns(STM32F2XXUsartState *s)
+{
+    /* 1, 0.5, 2 and 1.5 stop bits */
+    static const uint8_t stop_half_bits[] = { 2, 1, 4, 3 };
+    unsigned half_bits;
+    uint32_t ticks;
 
-#define DB_PRINT(fmt, args...) DB_PRINT_L(1, fmt, ## args)
+    if (s->fast_forward || !clock_is_enabled(s->clk)) {
+        return 0;
+    }
+    if (s->usart_cr1 & USART_CR1_OVER8) {
+        ticks = ((s->usart_brr >> 4) << 3) | (s->usart_brr & 7);
+    } else {
+        ticks = s->usart_brr & 0xFFFF;
+    }
+    if (!ticks) {
+        return 0;
+    }
+    half_bits = 2 * (1 + (s->usart_cr1 & USART_CR1_M ? 9 : 8)) +
+                stop_half_bits[(s->usart_cr2 >> USART_CR2_STOP_SHIFT) & 3];
+    return clock_ticks_to_ns(s->clk, ticks * half_bits) / 2;
+}
 
-static int stm32f2xx_usart_can_receive(void *opaque)
+static void stm32f2xx_update_irq(STM32F2XXUsartState *s)
+{
+    uint32_t mask;
+
+    s->usart_sr &= ~USART_SR_TXE;
+    if (s->tx_len < USART_BUF_SIZE && s->tx_timed < 2) {
+        s->usart_sr |= USART_SR_TXE;
+    }
+
+    mask = s->usart_sr & s->usart_cr1;
+    if (mask & (USART_SR_TXE | USART_SR_TC | USART_SR_RXNE) ||
+        (s->usart_sr & USART_SR_ORE && s->usart_cr1 & USART_CR1_RXNEIE)) {
+        qemu_set_irq(s->irq, 1);
+    } else {
+        qemu_set_irq(s->irq, 0);
+    }
+
+    qemu_set_irq(s->dma_tx, (s->usart_cr3 & USART_CR3_DMAT) &&
+                            (s->usart_sr & USART_SR_TXE));
+    qemu_set_irq(s->dma_rx, (s->usart_cr3 & USART_CR3_DMAR) &&
+                            (s->usart_sr & USART_SR_RXNE));
+}
+
+/* Hand the bytes whose frame is over to the host */
+static gboolean stm32f2xx_usart_xmit(void *do_not_use, GIOCondition cond,
+                                     void *opaque)
 {
     STM32F2XXUsartState *s = opaque;
+    uint32_t len = s->tx_len - s->tx_timed;
+    int ret = len;
 
-    if (!(s->usart_sr & USART_SR_RXNE)) {
-        return 1;
+    s->tx_watch = 0;
+    /* instant drain when there's no back-end */
+    if (len && qemu_chr_fe_backend_connected(&s->chr)) {
+        ret = qemu_chr_fe_write(&s->chr, s->tx_buf, len);
+    }
+    if (ret > 0) {
+        s->tx_len -= ret;
+        memmove(s->tx_buf, s->tx_buf + ret, s->tx_len);
     }
 
-    return 0;
+    if (s->tx_len > s->tx_timed) {
+        s->tx_watch = qemu_chr_fe_add_watch(&s->chr, G_IO_OUT | G_IO_HUP,
+                                            stm32f2xx_usart_xmit, s);
+        if (!s->tx_watch) {
+            len = s->tx_len - s->tx_timed;
+            s->tx_len = s->tx_timed;
+            memmove(s->tx_buf, s->tx_buf + len, s->tx_len);
+        }
+    }
+    if (!s->tx_len) {
+        s->usart_sr |= USART_SR_TC;
+    }
+    stm32f2xx_update_irq(s);
+    return G_SOURCE_REMOVE;
 }
 
-static void stm32f2xx_update_irq(STM32F2XXUsartState *s)
+static void stm32f2xx_usart_flush(void *opaque)
 {
-    uint32_t mask = s->usart_sr & s->usart_cr1;
+    STM32F2XXUsartState *s = opaque;
 
-    if (mask & (USART_SR_TXE | USART_SR_TC | USART_SR_RXNE)) {
-        qemu_set_irq(s->irq, 1);
+    if (!s->tx_watch) {
+        stm32f2xx_usart_xmit(NULL, 0, s);
+    }
+}
+
+/* The frame in the shift register is out */
+static void stm32f2xx_usart_tx_timer(void *opaque)
+{
+    STM32F2XXUsartState *s = opaque;
+    int64_t frame = stm32f2xx_usart_frame_ns(s);
+
+    s->tx_timed = frame ? s->tx_timed - 1 : 0;
+    if (s->tx_timed) {
+        timer_mod(s->tx_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + frame);
+    }
+    stm32f2xx_usart_flush(s);
+}
+
+static void stm32f2xx_usart_transmit(STM32F2XXUsartState *s, uint8_t ch)
+{
+    int64_t frame = stm32f2xx_usart_frame_ns(s);
+
+    if (!(s->usart_sr & USART_SR_TXE)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: Write to DR while TXE is clear\n",
+                      __func__);
+        return;
+    }
+    s->tx_buf[s->tx_len++] = ch;
+    s->usart_sr &= ~USART_SR_TC;
+    if (frame) {
+        if (!s->tx_timed++) {
+            timer_mod(s->tx_timer,
+                      qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + frame);
+        }
     } else {
-        qemu_set_irq(s->irq, 0);
+        qemu_bh_schedule(s->tx_bh);
     }
+    stm32f2xx_update_irq(s);
+}
+
+/* Start moving the next byte on the line into DR */
+static void stm32f2xx_usart_rx_next(STM32F2XXUsartState *s)
+{
+    int64_t frame = stm32f2xx_usart_frame_ns(s);
+
+    if (fifo8_is_empty(&s->rx_fifo) || timer_pending(s->rx_timer)) {
+        return;
+    }
+    if (frame) {
+        timer_mod(s->rx_timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + frame);
+    } else if (!(s->usart_sr & USART_SR_RXNE)) {
+        s->usart_dr = fifo8_pop(&s->rx_fifo);
+        s->usart_sr |= USART_SR_RXNE;
+        trace_stm32f2xx_usart_receive(s->usart_dr);
+    }
+}
+
+/* A byte is in, DR gets it unless the guest did not read the last one */
+static void stm32f2xx_usart_rx_timer(void *opaque)
+{
+    STM32F2XXUsartState *s = opaque;
+    uint8_t ch = fifo8_pop(&s->rx_fifo);
+
+    if (s->usart_sr & USART_SR_RXNE) {
+        s->usart_sr |= USART_SR_ORE;
+        trace_stm32f2xx_usart_overrun(ch);
+    } else {
+        s->usart_dr = ch;
+        s->usart_sr |= USART_SR_RXNE;
+        trace_stm32f2xx_usart_receive(s->usart_dr);
+    }
+    stm32f2xx_usart_rx_next(s);
+    stm32f2xx_update_irq(s);
+    qemu_chr_fe_accept_input(&s->chr);
+}
+
+static int stm32f2xx_usart_can_receive(void *opaque)
+{
+    STM32F2XXUsartState *s = opaque;
+
+    return fifo8_num_free(&s->rx_fifo);
 }
 
 static void stm32f2xx_usart_receive(void *opaque, const uint8_t *buf, int size)
@@ -70,16 +221,13 @@ static void stm32f2xx_usart_receive(void *opaque, const uint8_t *buf, int size)
 
     if (!(s->usart_cr1 & USART_CR1_UE && s->usart_cr1 & USART_CR1_RE)) {
         /* USART not enabled - drop the chars */
-        DB_PRINT("Dropping the chars\n");
+        trace_stm32f2xx_usart_drop(size);
         return;
     }
 
-    s->usart_dr = *buf;
-    s->usart_sr |= USART_SR_RXNE;
-
+    fifo8_push_all(&s->rx_fifo, buf, MIN(size, fifo8_num_free(&s->rx_fifo)));
+    stm32f2xx_usart_rx_next(s);
     stm32f2xx_update_irq(s);
-
-    DB_PRINT("Receiving: %c\n", s->usart_dr);
 }
 
 static void stm32f2xx_usart_reset(DeviceState *dev)
@@ -94,26 +242,33 @@ static void stm32f2xx_usart_reset(DeviceState *dev)
     s->usart_cr3 = 0x00000000;
     s->usart_gtpr = 0x00000000;
 
+    s->tx_len = 0;
+    s->tx_timed = 0;
+    fifo8_reset(&s->rx_fifo);
+    timer_del(s->tx_timer);
+    timer_del(s->rx_timer);
+    if (s->tx_watch) {
+        g_source_remove(s->tx_watch);
+        s->tx_watch = 0;
+    }
+
     stm32f2xx_update_irq(s);
 }
 
-static uint64_t stm32f2xx_usart_read(void *opaque, hwaddr addr,
-                                       unsigned int size)
+static uint64_t stm32f2xx_usart_read_reg(STM32F2XXUsartState *s, hwaddr addr)
 {
-    STM32F2XXUsartState *s = opaque;
     uint64_t retvalue;
 
-    DB_PRINT("Read 0x%"HWADDR_PRIx"\n", addr);
-
     switch (addr) {
     case USART_SR:
         retvalue = s->usart_sr;
         qemu_chr_fe_accept_input(&s->chr);
         return retvalue;
     case USART_DR:
-        DB_PRINT("Value: 0x%" PRIx32 ", %c\n", s->usart_dr, (char) s->usart_dr);
         retvalue = s->usart_dr & 0x3FF;
-        s->usart_sr &= ~USART_SR_RXNE;
+        /* ORE is cleared by reading SR, then DR */
+        s->usart_sr &= ~(USART_SR_RXNE | USART_SR_ORE);
+        stm32f2xx_usart_rx_next(s);
         qemu_chr_fe_accept_input(&s->chr);
         stm32f2xx_update_irq(s);
         return retvalue;
@@ -136,39 +291,37 @@ static uint64_t stm32f2xx_usart_read(void *opaque, hwaddr addr,
     return 0;
 }
 
+static uint64_t stm32f2xx_usart_read(void *opaque, hwaddr addr,
+                                     unsigned int size)
+{
+    STM32F2XXUsartState *s = opaque;
+    uint64_t value = stm32f2xx_usart_read_reg(s, addr);
+
+    s->mmio_reads++;
+    trace_stm32f2xx_usart_read(addr, value);
+    return value;
+}
+
 static void stm32f2xx_usart_write(void *opaque, hwaddr addr,
                                   uint64_t val64, unsigned int size)
 {
     STM32F2XXUsartState *s = opaque;
     uint32_t value = val64;
-    unsigned char ch;
 
-    DB_PRINT("Write 0x%" PRIx32 ", 0x%"HWADDR_PRIx"\n", value, addr);
+    s->mmio_writes++;
+    trace_stm32f2xx_usart_write(addr, value);
 
     switch (addr) {
     case USART_SR:
-        if (value <= 0x3FF) {
-            /* I/O being synchronous, TXE is always set. In addition, it may
-               only be set by hardware, so keep it set here. */
-            s->usart_sr = value | USART_SR_TXE;
-        } else {
-            s->usart_sr &= value;
-        }
+        /* Only CTS, LBD, TC and RXNE can be cleared, by writing 0 */
+        s->usart_sr &= value | ~(USART_SR_CTS | USART_SR_LBD |
+                                 USART_SR_TC | USART_SR_RXNE);
+        stm32f2xx_usart_rx_next(s);
         stm32f2xx_update_irq(s);
         return;
     case USART_DR:
         if (value < 0xF000) {
-            ch = value;
-            /* XXX this blocks entire thread. Rewrite to use
-             * qemu_chr_fe_write and background I/O callbacks */
-            qemu_chr_fe_write_all(&s->chr, &ch, 1);
-            /* XXX I/O are currently synchronous, making it impossible for
-               software to observe transient states where TXE or TC aren't
-               set. Unlike TXE however, which is read-only, software may
-               clear TC by writing 0 to the SR register, so set it again
-               on each write. */
-            s->usart_sr |= USART_SR_TC;
-            stm32f2xx_update_irq(s);
+            stm32f2xx_usart_transmit(s, value);
         }
         return;
     case USART_BRR:
@@ -183,6 +336,7 @@ static void stm32f2xx_usart_write(void *opaque, hwaddr addr,
         return;
     case USART_CR3:
         s->usart_cr3 = value;
+        stm32f2xx_update_irq(s);
         return;
     case USART_GTPR:
         s->usart_gtpr = value;
@@ -199,8 +353,46 @@ static const MemoryRegionOps stm32f2xx_usart_ops = {
     .endianness = DEVICE_NATIVE_ENDIAN,
 };
 
+static int stm32f2xx_usart_post_load(void *opaque, int version_id)
+{
+    STM32F2XXUsartState *s = opaque;
+
+    if (s->tx_len > USART_BUF_SIZE || s->tx_timed > MIN(s->tx_len, 2)) {
+        return -EINVAL;
+    }
+    /* The watch on the back-end is gone */
+    qemu_bh_schedule(s->tx_bh);
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32f2xx_usart = {
+    .name = TYPE_STM32F2XX_USART,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = stm32f2xx_usart_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(usart_sr, STM32F2XXUsartState),
+        VMSTATE_UINT32(usart_dr, STM32F2XXUsartState),
+        VMSTATE_UINT32(usart_brr, STM32F2XXUsartState),
+        VMSTATE_UINT32(usart_cr1, STM32F2XXUsartState),
+        VMSTATE_UINT32(usart_cr2, STM32F2XXUsartState),
+        VMSTATE_UINT32(usart_cr3, STM32F2XXUsartState),
+        VMSTATE_UINT32(usart_gtpr, STM32F2XXUsartState),
+        VMSTATE_UINT8_ARRAY(tx_buf, STM32F2XXUsartState, USART_BUF_SIZE),
+        VMSTATE_UINT32(tx_len, STM32F2XXUsartState),
+        VMSTATE_UINT32(tx_timed, STM32F2XXUsartState),
+        VMSTATE_FIFO8(rx_fifo, STM32F2XXUsartState),
+        VMSTATE_TIMER_PTR(tx_timer, STM32F2XXUsartState),
+        VMSTATE_TIMER_PTR(rx_timer, STM32F2XXUsartState),
+        VMSTATE_CLOCK(clk, STM32F2XXUsartState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 static Property stm32f2xx_usart_properties[] = {
     DEFINE_PROP_CHR("chardev", STM32F2XXUsartState, chr),
+    DEFINE_PROP_BOOL("fast-forward", STM32F2XXUsartState, fast_forward,
+                     false),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -209,16 +401,29 @@ static void stm32f2xx_usart_init(Object *obj)
     STM32F2XXUsartState *s = STM32F2XX_USART(obj);
 
     sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq);
+    qdev_init_gpio_out_named(DEVICE(obj), &s->dma_tx, "dma-tx", 1);
+    qdev_init_gpio_out_named(DEVICE(obj), &s->dma_rx, "dma-rx", 1);
 
     memory_region_init_io(&s->mmio, obj, &stm32f2xx_usart_ops, s,
                           TYPE_STM32F2XX_USART, 0x400);
     sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+
+    s->clk = qdev_init_clock_in(DEVICE(obj), "clk", NULL, NULL, 0);
+    object_property_add_uint64_ptr(obj, "mmio-reads", &s->mmio_reads,
+                                   OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "mmio-writes", &s->mmio_writes,
+                                   OBJ_PROP_FLAG_READ);
+    fifo8_create(&s->rx_fifo, USART_BUF_SIZE);
+    s->tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, stm32f2xx_usart_tx_timer, s);
+    s->rx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, stm32f2xx_usart_rx_timer, s);
 }
 
 static void stm32f2xx_usart_realize(DeviceState *dev, Error **errp)
 {
     STM32F2XXUsartState *s = STM32F2XX_USART(dev);
 
+    s->tx_bh = qemu_bh_new_guarded(stm32f2xx_usart_flush, s,
+                                   &dev->mem_reentrancy_guard);
     qemu_chr_fe_set_handlers(&s->chr, stm32f2xx_usart_can_receive,
                              stm32f2xx_usart_receive, NULL, NULL,
                              s, NULL, true);
@@ -229,6 +434,7 @@ static void stm32f2xx_usart_class_init(ObjectClass *klass, void *data)
     DeviceClass *dc = DEVICE_CLASS(klass);
 
     dc->reset = stm32f2xx_usart_reset;
+    dc->vmsd = &vmstate_stm32f2xx_usart;
     device_class_set_props(dc, stm32f2xx_usart_properties);
     dc->realize = stm32f2xx_usart_realize;
 }
@@ -0,0 +1,632 @@
+/*
+ * STM32F4xx DMA controller
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * DMA1 and DMA2 of the STM32F40x/41x (RM0090 section 10): eight streams,
+ * each taking the request of one of eight channels, with circular and
+ * double buffer modes and the half transfer, transfer complete and
+ * transfer error interrupts.  Memory to memory transfers are only allowed
+ * with the "mem-to-mem" property, set for DMA2.
+ *
+ * The peripherals drive the requests as GPIO levels, like the hardware:
+ * the stream moves one item each time a request is up.  Items are read
+ * from or written to the peripheral one at a time, as long as its request
+ * stays up, while the memory side is accessed in blocks of up to 4 KiB.
+ * A peripheral that empties or fills its own buffer as fast as the DMA
+ * feeds it thus moves a whole buffer in one go.  A stream gives the CPU a
+ * turn after moving 64 KiB, in case its request never goes down.
+ *
+ * The FIFO is modelled as always empty: items of PSIZE are packed into
+ * memory in order, which gives the same contents as the packing to
+ * MSIZE of the hardware.  NDTR counts items of PSIZE.  Not modelled: the
+ * stream priorities and bursts, the peripheral flow control, PINCOS, and
+ * the FIFO and direct mode errors.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/main-loop.h"
+#include "qapi/error.h"
+#include "hw/irq.h"
+#include "hw/registerfields.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
+#include "hw/dma/stm32f4xx_dma.h"
+#include "trace.h"
+
+REG32(LISR, 0x00)
+REG32(HISR, 0x04)
+REG32(LIFCR, 0x08)
+REG32(HIFCR, 0x0C)
+
+/* Stream registers, at 0x10 + 0x18 * stream */
+#define STREAM_BASE 0x10
+#define STREAM_SIZE 0x18
+
+REG32(SxCR, 0x00)
+    FIELD(SxCR, EN, 0, 1)
+    FIELD(SxCR, DMEIE, 1, 1)
+    FIELD(SxCR, TEIE, 2, 1)
+    FIELD(SxCR, HTIE, 3, 1)
+    FIELD(SxCR, TCIE, 4, 1)
+    FIELD(SxCR, PFCTRL, 5, 1)
+    FIELD(SxCR, DIR, 6, 2)
+    FIELD(SxCR, CIRC, 8, 1)
+    FIELD(SxCR, PINC, 9, 1)
+    FIELD(SxCR, MINC, 10, 1)
+    FIELD(SxCR, PSIZE, 11, 2)
+    FIELD(SxCR, MSIZE, 13, 2)
+    FIELD(SxCR, DBM, 18, 1)
+    FIELD(SxCR, CT, 19, 1)
+    FIELD(SxCR, CHSEL, 25, 3)
+REG32(SxNDTR, 0x04)
+REG32(SxPAR, 0x08)
+REG32(SxM0AR, 0x0C)
+REG32(SxM1AR, 0x10)
+REG32(SxFCR, 0x14)
+    FIELD(SxFCR, FTH, 0, 2)
+    FIELD(SxFCR, DMDIS, 2, 1)
+    FIELD(SxFCR, FS, 3, 3)
+    FIELD(SxFCR, FEIE, 7, 1)
+
+#define SxCR_WRITABLE 0x0EEFFFFF
+#define SxFCR_WRITABLE (R_SxFCR_FTH_MASK | R_SxFCR_DMDIS_MASK | \
+                        R_SxFCR_FEIE_MASK)
+#define SxFCR_FS_EMPTY 4
+
+/* SxCR.DIR */
+enum {
+    DIR_P2M,
+    DIR_M2P,
+    DIR_M2M,
+};
+
+/* Interrupt flags of a stream, in LISR/HISR and LIFCR/HIFCR */
+#define FLAG_FE (1 << 0)
+#define FLAG_DME (1 << 2)
+#define FLAG_TE (1 << 3)
+#define FLAG_HT (1 << 4)
+#define FLAG_TC (1 << 5)
+#define FLAG_ALL (FLAG_FE | FLAG_DME | FLAG_TE | FLAG_HT | FLAG_TC)
+
+/* Up to this many bytes are moved before the stream is looked at again */
+#define STM32F4XX_DMA_BATCH 4096
+/* Up to this many bytes are moved before the CPU gets a turn */
+#define STM32F4XX_DMA_BUDGET (16 * STM32F4XX_DMA_BATCH)
+
+static const unsigned stm32f4xx_dma_flag_shift[] = { 0, 6, 16, 22 };
+
+static uint32_t stm32f4xx_dma_flags(STM32F4xxDmaState *s, unsigned n)
+{
+    return (s->isr[n / 4] >> stm32f4xx_dma_flag_shift[n % 4]) & FLAG_ALL;
+}
+
+static void stm32f4xx_dma_update_irq(STM32F4xxDmaState *s, unsigned n)
+{
+    STM32F4xxDmaStream *st = &s->stream[n];
+    uint32_t flags = stm32f4xx_dma_flags(s, n);
+    uint32_t enabled = 0;
+
+    if (st->cr & R_SxCR_TCIE_MASK) {
+        enabled |= FLAG_TC;
+    }
+    if (st->cr & R_SxCR_HTIE_MASK) {
+        enabled |= FLAG_HT;
+    }
+    if (st->cr & R_SxCR_TEIE_MASK) {
+        enabled |= FLAG_TE;
+    }
+    if (st->cr & R_SxCR_DMEIE_MASK) {
+        enabled |= FLAG_DME;
+    }
+    if (st->fcr & R_SxFCR_FEIE_MASK) {
+        enabled |= FLAG_FE;
+    }
+    qemu_set_irq(st->irq, !!(flags & enabled));
+}
+
+static void stm32f4xx_dma_flag(STM32F4xxDmaState *s, unsigned n, uint32_t flag)
+{
+    s->isr[n / 4] |= flag << stm32f4xx_dma_flag_shift[n % 4];
+}
+
+static bool stm32f4xx_dma_requested(STM32F4xxDmaState *s, unsigned n)
+{
+    uint32_t cr = s->stream[n].cr;
+
+    if (!(cr & R_SxCR_EN_MASK)) {
+        return false;
+    }
+    if (FIELD_EX32(cr, SxCR, DIR) == DIR_M2M) {
+        return true;
+    }
+    return s->requests &
+           BIT_ULL(STM32F4XX_DMA_REQ(n, FIELD_EX32(cr, SxCR, CHSEL)));
+}
+
+/* Move @count items at @addr, which increments or not, to or from @buf */
+static MemTxResult stm32f4xx_dma_rw(STM32F4xxDmaState *s, hwaddr addr,
+                                    bool inc, uint8_t *buf, uint32_t count,
+                                    unsigned size, bool is_write)
+{
+    MemTxResult res = MEMTX_OK;
+    uint32_t i;
+
+    if (inc) {
+        return address_space_rw(&s->as, addr, MEMTXATTRS_UNSPECIFIED, buf,
+                                (hwaddr)count * size, is_write);
+    }
+    for (i = 0; i < count && res == MEMTX_OK; i++) {
+        res = address_space_rw(&s->as, addr, MEMTXATTRS_UNSPECIFIED,
+                               buf + i * size, size, is_write);
+    }
+    return res;
+}
+
+/* Transfer a batch of items, the bytes moved or 0 if the stream waits */
+static uint32_t stm32f4xx_dma_transfer(STM32F4xxDmaState *s, unsigned n)
+{
+    STM32F4xxDmaStream *st = &s->stream[n];
+    uint32_t cr = st->cr;
+    unsigned size = 1 << FIELD_EX32(cr, SxCR, PSIZE);
+    bool pinc = cr & R_SxCR_PINC_MASK;
+    bool minc = cr & R_SxCR_MINC_MASK;
+    uint32_t half = st->ndtr_reload / 2;
+    uint32_t items = MIN(st->ndtr, STM32F4XX_DMA_BATCH / size);
+    uint32_t memory = (cr & R_SxCR_CT_MASK) ? st->m1ar : st->m0ar;
+    hwaddr paddr = st->par + (pinc ? (hwaddr)st->pos * size : 0);
+    hwaddr maddr = memory + (minc ? (hwaddr)st->pos * size : 0);
+    uint8_t buf[STM32F4XX_DMA_BATCH];
+    MemTxResult res = MEMTX_OK;
+    uint32_t done = 0;
+    uint32_t pos;
+
+    /* Stop at the half transfer point, for its flag */
+    if (st->pos < half) {
+        items = MIN(items, half - st->pos);
+    }
+
+    switch (FIELD_EX32(cr, SxCR, DIR)) {
+    case DIR_P2M:
+        /* One peripheral read per request, then the block to memory */
+        while (done < items && stm32f4xx_dma_requested(s, n)) {
+            res = stm32f4xx_dma_rw(s, paddr + (pinc ? done * size : 0),
+                                   false, buf + done * size, 1, size, false);
+            if (res != MEMTX_OK) {
+                break;
+            }
+            done++;
+        }
+        if (done && res == MEMTX_OK) {
+            res = stm32f4xx_dma_rw(s, maddr, minc, buf, done, size, true);
+        }
+        break;
+    case DIR_M2P:
+        /* Memory is read ahead: it has no side effects */
+        res = stm32f4xx_dma_rw(s, maddr, minc, buf, minc ? items : 1, size,
+                               false);
+        while (res == MEMTX_OK && done < items &&
+               stm32f4xx_dma_requested(s, n)) {
+            res = stm32f4xx_dma_rw(s, paddr + (pinc ? done * size : 0),
+                                   false, buf + (minc ? done * size : 0), 1,
+                                   size, true);
+            if (res == MEMTX_OK) {
+                done++;
+            }
+        }
+        break;
+    case DIR_M2M:
+        res = stm32f4xx_dma_rw(s, paddr, pinc, buf, items, size, false);
+        if (res == MEMTX_OK) {
+            res = stm32f4xx_dma_rw(s, maddr, minc, buf, items, size, true);
+        }
+        if (res == MEMTX_OK) {
+            done = items;
+        }
+        break;
+    }
+
+    if (res != MEMTX_OK) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: stream %u: bus error\n",
+                      __func__, n);
+        st->cr &= ~R_SxCR_EN_MASK;
+        stm32f4xx_dma_flag(s, n, FLAG_TE);
+        stm32f4xx_dma_update_irq(s, n);
+        return 0;
+    }
+    if (!done) {
+        return 0;
+    }
+
+    trace_stm32f4xx_dma_transfer(n, done, st->ndtr - done);
+    pos = st->pos;
+    st->ndtr -= done;
+    st->pos += done;
+    if (pos < half && st->pos >= half) {
+        stm32f4xx_dma_flag(s, n, FLAG_HT);
+    }
+    if (!st->ndtr) {
+        stm32f4xx_dma_flag(s, n, FLAG_TC);
+        if (cr & (R_SxCR_CIRC_MASK | R_SxCR_DBM_MASK)) {
+            st->ndtr = st->ndtr_reload;
+            st->pos = 0;
+            if (cr & R_SxCR_DBM_MASK) {
+                st->cr ^= R_SxCR_CT_MASK;
+            }
+        } else {
+            st->cr &= ~R_SxCR_EN_MASK;
+        }
+    }
+    stm32f4xx_dma_update_irq(s, n);
+    return done * size;
+}
+
+static void stm32f4xx_dma_run(STM32F4xxDmaState *s, unsigned n)
+{
+    STM32F4xxDmaStream *st = &s->stream[n];
+    uint32_t moved = 0;
+    uint32_t bytes;
+
+    /* Requests raised by our own transfers are taken by the loop below */
+    if (st->active) {
+        return;
+    }
+    st->active = true;
+    while (stm32f4xx_dma_requested(s, n)) {
+        bytes = stm32f4xx_dma_transfer(s, n);
+        if (!bytes) {
+            break;
+        }
+        moved += bytes;
+        if (moved >= STM32F4XX_DMA_BUDGET) {
+            s->resume |= 1 << n;
+            qemu_bh_schedule(s->bh);
+            break;
+        }
+    }
+    st->active = false;
+}
+
+static void stm32f4xx_dma_resume(void *opaque)
+{
+    STM32F4xxDmaState *s = opaque;
+    uint8_t resume = s->resume;
+    unsigned n;
+
+    s->resume = 0;
+    for (n = 0; n < STM32F4XX_DMA_NUM_STREAMS; n++) {
+        if (resume & (1 << n)) {
+            stm32f4xx_dma_run(s, n);
+        }
+    }
+}
+
+static void stm32f4xx_dma_request(void *opaque, int line, int level)
+{
+    STM32F4xxDmaState *s = opaque;
+    unsigned n = line / STM32F4XX_DMA_NUM_CHANNELS;
+
+    if (level) {
+        s->requests |= BIT_ULL(line);
+        stm32f4xx_dma_run(s, n);
+    } else {
+        s->requests &= ~BIT_ULL(line);
+    }
+}
+
+static void stm32f4xx_dma_enable(STM32F4xxDmaState *s, unsigned n)
+{
+    STM32F4xxDmaStream *st = &s->stream[n];
+    uint32_t cr = st->cr;
+    unsigned dir = FIELD_EX32(cr, SxCR, DIR);
+    const char *error = NULL;
+
+    if (dir > DIR_M2M) {
+        error = "reserved direction";
+    } else if (dir == DIR_M2M && !s->mem_to_mem) {
+        error = "memory to memory transfers not supported";
+    } else if (dir == DIR_M2M &&
+               (cr & (R_SxCR_CIRC_MASK | R_SxCR_DBM_MASK))) {
+        error = "circular memory to memory transfer";
+    } else if (FIELD_EX32(cr, SxCR, PSIZE) > 2 ||
+               FIELD_EX32(cr, SxCR, MSIZE) > 2) {
+        error = "reserved data size";
+    } else if (!st->ndtr) {
+        error = "nothing to transfer";
+    }
+    if (error) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: stream %u: %s\n",
+                      __func__, n, error);
+        st->cr &= ~R_SxCR_EN_MASK;
+        return;
+    }
+    if (cr & R_SxCR_PFCTRL_MASK) {
+        qemu_log_mask(LOG_UNIMP, "%s: peripheral flow control\n", __func__);
+    }
+
+    st->ndtr_reload = st->ndtr;
+    st->pos = 0;
+    stm32f4xx_dma_run(s, n);
+}
+
+static uint64_t stm32f4xx_dma_read(void *opaque, hwaddr addr, unsigned size)
+{
+    STM32F4xxDmaState *s = opaque;
+    STM32F4xxDmaStream *st;
+    uint32_t value = 0;
+
+    switch (addr) {
+    case A_LISR:
+    case A_HISR:
+        value = s->isr[addr / 4];
+        break;
+    case A_LIFCR:
+    case A_HIFCR:
+        break;
+    case STREAM_BASE ... STREAM_BASE +
+         STREAM_SIZE * STM32F4XX_DMA_NUM_STREAMS - 1:
+        st = &s->stream[(addr - STREAM_BASE) / STREAM_SIZE];
+        switch ((addr - STREAM_BASE) % STREAM_SIZE) {
+        case A_SxCR:
+            value = st->cr;
+            break;
+        case A_SxNDTR:
+            value = st->ndtr;
+            break;
+        case A_SxPAR:
+            value = st->par;
+            break;
+        case A_SxM0AR:
+            value = st->m0ar;
+            break;
+        case A_SxM1AR:
+            value = st->m1ar;
+            break;
+        case A_SxFCR:
+            value = FIELD_DP32(st->fcr, SxFCR, FS, SxFCR_FS_EMPTY);
+            break;
+        }
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%"HWADDR_PRIx"\n", __func__, addr);
+        return 0;
+    }
+
+    trace_stm32f4xx_dma_read(addr, value);
+    return value;
+}
+
+static void stm32f4xx_dma_write_stream(STM32F4xxDmaState *s, unsigned n,
+                                       hwaddr reg, uint32_t value)
+{
+    STM32F4xxDmaStream *st = &s->stream[n];
+    bool enabled = st->cr & R_SxCR_EN_MASK;
+
+    /* An enabled stream only takes EN, and the idle buffer address */
+    if (enabled) {
+        bool dbm = st->cr & R_SxCR_DBM_MASK;
+        bool ct = st->cr & R_SxCR_CT_MASK;
+
+        if (reg == A_SxCR) {
+            if (!(value & R_SxCR_EN_MASK)) {
+                st->cr &= ~R_SxCR_EN_MASK;
+            }
+            return;
+        }
+        if (dbm && ((reg == A_SxM0AR && ct) || (reg == A_SxM1AR && !ct))) {
+            /* Written by the CPU while the DMA fills the other buffer */
+        } else {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: stream %u: register 0x%"HWADDR_PRIx
+                          " written while enabled\n", __func__, n, reg);
+            return;
+        }
+    }
+
+    switch (reg) {
+    case A_SxCR:
+        st->cr = value & SxCR_WRITABLE;
+        stm32f4xx_dma_update_irq(s, n);
+        if (st->cr & R_SxCR_EN_MASK) {
+            stm32f4xx_dma_enable(s, n);
+        }
+        break;
+    case A_SxNDTR:
+        st->ndtr = value & 0xFFFF;
+        break;
+    case A_SxPAR:
+        st->par = value;
+        break;
+    case A_SxM0AR:
+        st->m0ar = value;
+        break;
+    case A_SxM1AR:
+        st->m1ar = value;
+        break;
+    case A_SxFCR:
+        st->fcr = value & SxFCR_WRITABLE;
+        stm32f4xx_dma_update_irq(s, n);
+        break;
+    }
+}
+
+static void stm32f4xx_dma_write(void *opaque, hwaddr addr, uint64_t val64,
+                                unsigned size)
+{
+    STM32F4xxDmaState *s = opaque;
+    uint32_t value = val64;
+    unsigned n;
+
+    trace_stm32f4xx_dma_write(addr, value);
+
+    switch (addr) {
+    case A_LISR:
+    case A_HISR:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: Read only register 0x%"
+                      HWADDR_PRIx "\n", __func__, addr);
+        break;
+    case A_LIFCR:
+    case A_HIFCR:
+        s->isr[addr / 4 - 2] &= ~value;
+        for (n = 0; n < 4; n++) {
+            stm32f4xx_dma_update_irq(s, (addr / 4 - 2) * 4 + n);
+        }
+        break;
+    case STREAM_BASE ... STREAM_BASE +
+         STREAM_SIZE * STM32F4XX_DMA_NUM_STREAMS - 1:
+        stm32f4xx_dma_write_stream(s, (addr - STREAM_BASE) / STREAM_SIZE,
+                                   (addr - STREAM_BASE) % STREAM_SIZE, value);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%"HWADDR_PRIx"\n", __func__, addr);
+    }
+}
+
+static const MemoryRegionOps stm32f4xx_dma_ops = {
+    .read = stm32f4xx_dma_read,
+    .write = stm32f4xx_dma_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .valid = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+    },
+};
+
+static void stm32f4xx_dma_hold_reset(Object *obj)
+{
+    STM32F4xxDmaState *s = STM32F4XX_DMA(obj);
+    unsigned n;
+
+    s->isr[0] = 0;
+    s->isr[1] = 0;
+    s->resume = 0;
+    for (n = 0; n < STM32F4XX_DMA_NUM_STREAMS; n++) {
+        STM32F4xxDmaStream *st = &s->stream[n];
+
+        st->cr = 0;
+        st->ndtr = 0;
+        st->par = 0;
+        st->m0ar = 0;
+        st->m1ar = 0;
+        st->fcr = 0x00000021;
+        st->ndtr_reload = 0;
+        st->pos = 0;
+        stm32f4xx_dma_update_irq(s, n);
+    }
+}
+
+static void stm32f4xx_dma_init(Object *obj)
+{
+    STM32F4xxDmaState *s = STM32F4XX_DMA(obj);
+    unsigned n;
+
+    memory_region_init_io(&s->mmio, obj, &stm32f4xx_dma_ops, s,
+                          TYPE_STM32F4XX_DMA, 0x400);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+    for (n = 0; n < STM32F4XX_DMA_NUM_STREAMS; n++) {
+        sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->stream[n].irq);
+    }
+    qdev_init_gpio_in(DEVICE(obj), stm32f4xx_dma_request,
+                      STM32F4XX_DMA_NUM_STREAMS * STM32F4XX_DMA_NUM_CHANNELS);
+}
+
+static void stm32f4xx_dma_realize(DeviceState *dev, Error **errp)
+{
+    STM32F4xxDmaState *s = STM32F4XX_DMA(dev);
+
+    if (!s->memory) {
+        error_setg(errp, "memory property was not set");
+        return;
+    }
+    address_space_init(&s->as, s->memory, "stm32f4xx-dma");
+    s->bh = qemu_bh_new_guarded(stm32f4xx_dma_resume, s,
+                                &dev->mem_reentrancy_guard);
+}
+
+/* The streams that were passing over their buffer go on */
+static int stm32f4xx_dma_post_load(void *opaque, int version_id)
+{
+    STM32F4xxDmaState *s = opaque;
+    unsigned n;
+
+    for (n = 0; n < STM32F4XX_DMA_NUM_STREAMS; n++) {
+        if (s->stream[n].cr & R_SxCR_EN_MASK) {
+            s->resume |= 1 << n;
+        }
+    }
+    if (s->resume) {
+        qemu_bh_schedule(s->bh);
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32f4xx_dma_stream = {
+    .name = "stm32f4xx-dma-stream",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(cr, STM32F4xxDmaStream),
+        VMSTATE_UINT32(ndtr, STM32F4xxDmaStream),
+        VMSTATE_UINT32(par, STM32F4xxDmaStream),
+        VMSTATE_UINT32(m0ar, STM32F4xxDmaStream),
+        VMSTATE_UINT32(m1ar, STM32F4xxDmaStream),
+        VMSTATE_UINT32(fcr, STM32F4xxDmaStream),
+        VMSTATE_UINT32(ndtr_reload, STM32F4xxDmaStream),
+        VMSTATE_UINT32(pos, STM32F4xxDmaStream),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_stm32f4xx_dma = {
+    .name = TYPE_STM32F4XX_DMA,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = stm32f4xx_dma_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(isr, STM32F4xxDmaState, 2),
+        VMSTATE_UINT64(requests, STM32F4xxDmaState),
+        VMSTATE_STRUCT_ARRAY(stream, STM32F4xxDmaState,
+                             STM32F4XX_DMA_NUM_STREAMS, 1,
+                             vmstate_stm32f4xx_dma_stream,
+                             STM32F4xxDmaStream),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property stm32f4xx_dma_properties[] = {
+    DEFINE_PROP_LINK("memory", STM32F4xxDmaState, memory, TYPE_MEMORY_REGION,
+                     MemoryRegion *),
+    DEFINE_PROP_BOOL("mem-to-mem", STM32F4xxDmaState, mem_to_mem, true),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void stm32f4xx_dma_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ResettableClass *rc = RESETTABLE_CLASS(klass);
+
+    dc->realize = stm32f4xx_dma_realize;
+    dc->vmsd = &vmstate_stm32f4xx_dma;
+    device_class_set_props(dc, stm32f4xx_dma_properties);
+    rc->phases.hold = stm32f4xx_dma_hold_reset;
+}
+
+static const TypeInfo stm32f4xx_dma_info[] = {
+    {
+        .name          = TYPE_STM32F4XX_DMA,
+        .parent        = TYPE_SYS_BUS_DEVICE,
+        .instance_size = sizeof(STM32F4xxDmaState),
+        .instance_init = stm32f4xx_dma_init,
+        .class_init    = stm32f4xx_dma_class_init,
+    }
+};
+
+DEFINE_TYPES(stm32f4xx_dma_info)
@@ -0,0 +1,427 @@
+/*
+ * STM32F4xx GPIO port
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * GPIOA..GPIOI of the STM32F40x/41x (RM0090 section 8).  A pin reads the
+ * level it drives as a push-pull output, or an open-drain output set low.
+ * Otherwise it reads the level driven from outside, through the GPIO
+ * inputs or the pin bus, or else its pull-up.  Analog pins read 0.  The
+ * alternate functions are not connected to the peripherals: such pins
+ * behave as inputs.  The output speeds are only stored.
+ *
+ * With the "pinbus" property, the state of the port is also published to
+ * shared memory, see include/hw/gpio/stm32f4xx_pinbus.h.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/log.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "hw/irq.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
+#include "hw/gpio/stm32f4xx_gpio.h"
+#include "trace.h"
+
+#define GPIO_MODER   0x00
+#define GPIO_OTYPER  0x04
+#define GPIO_OSPEEDR 0x08
+#define GPIO_PUPDR   0x0C
+#define GPIO_IDR     0x10
+#define GPIO_ODR     0x14
+#define GPIO_BSRR    0x18
+#define GPIO_LCKR    0x1C
+#define GPIO_AFRL    0x20
+#define GPIO_AFRH    0x24
+
+#define MODER_OUTPUT 1
+#define MODER_ANALOG 3
+#define PUPDR_UP     1
+#define LCKR_LCKK    (1 << 16)
+
+#define PINS_MASK MAKE_64BIT_MASK(0, STM32F4XX_GPIO_NUM_PINS)
+
+/*
+ * @value written to the @mask bits of the configuration register @old,
+ * which has fields of @width bits for the pins from @first_pin on.  The
+ * fields of the locked pins keep their value.
+ */
+static uint32_t stm32f4xx_gpio_config(STM32F4xxGpioState *s, uint32_t old,
+                                      uint32_t value, uint32_t mask,
+                                      unsigned width, unsigned first_pin)
+{
+    unsigned pin;
+
+    if (s->lckr & LCKR_LCKK) {
+        for (pin = first_pin; pin < STM32F4XX_GPIO_NUM_PINS &&
+             (pin - first_pin) * width < 32; pin++) {
+            if (s->lckr & BIT(pin)) {
+                mask &= ~MAKE_64BIT_MASK((pin - first_pin) * width, width);
+            }
+        }
+    }
+    return (old & ~mask) | (value & mask);
+}
+
+/* Levels of the pins */
+static uint32_t stm32f4xx_gpio_levels(STM32F4xxGpioState *s)
+{
+    uint32_t in_mask = s->in_mask;
+    uint32_t in_level = s->in_level;
+    uint32_t out = 0, analog = 0, pull_up = 0, driven;
+    unsigned pin;
+
+    if (s->pinbus) {
+        STM32F4xxPinbusPort *p = &s->pinbus->port[s->port];
+        uint32_t mask = qatomic_load_acquire(&p->in_mask) & PINS_MASK;
+
+        in_level = (in_level & ~mask) | (qatomic_read(&p->in_level) & mask);
+        in_mask |= mask;
+    }
+
+    for (pin = 0; pin < STM32F4XX_GPIO_NUM_PINS; pin++) {
+        switch (extract32(s->moder, pin * 2, 2)) {
+        case MODER_OUTPUT:
+            out |= BIT(pin);
+            break;
+        case MODER_ANALOG:
+            analog |= BIT(pin);
+            break;
+        }
+        if (extract32(s->pupdr, pin * 2, 2) == PUPDR_UP) {
+            pull_up |= BIT(pin);
+        }
+    }
+
+    /* Open-drain outputs only pull the pin low */
+    driven = out & ~(s->otyper & s->odr);
+    if (driven & in_mask & (s->odr ^ in_level)) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: GPIO%c pins 0x%04x short circuited\n", __func__,
+                      'A' + s->port, driven & in_mask & (s->odr ^ in_level));
+    }
+
+    return ((s->odr & driven) | (in_level & in_mask & ~driven) |
+            (pull_up & ~in_mask & ~driven)) & ~analog;
+}
+
+/* Write the state of the port to the pin bus, with an event for @changed */
+static void stm32f4xx_gpio_publish(STM32F4xxGpioState *s, uint32_t changed)
+{
+    STM32F4xxPinbus *bus = s->pinbus;
+    STM32F4xxPinbusPort *p;
+    STM32F4xxPinbusEvent *ev;
+    uint32_t head;
+
+    if (!bus) {
+        return;
+    }
+    p = &bus->port[s->port];
+    qatomic_set(&p->moder, s->moder);
+    qatomic_set(&p->odr, s->odr);
+    qatomic_set(&p->idr, s->idr);
+
+    if (changed) {
+        head = bus->head;
+        ev = &bus->ring[head % STM32F4XX_PINBUS_RING];
+        ev->time_ns = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+        ev->port = s->port;
+        ev->changed = changed;
+        ev->level = s->idr;
+        qatomic_store_release(&bus->head, head + 1);
+    }
+}
+
+static void stm32f4xx_gpio_update(STM32F4xxGpioState *s)
+{
+    uint32_t idr = stm32f4xx_gpio_levels(s);
+    uint32_t changed = idr ^ s->idr;
+    unsigned pin;
+
+    s->idr = idr;
+    if (changed) {
+        trace_stm32f4xx_gpio_update(s->port, idr);
+        for (pin = 0; pin < STM32F4XX_GPIO_NUM_PINS; pin++) {
+            if (changed & BIT(pin)) {
+                qemu_set_irq(s->pin[pin], extract32(idr, pin, 1));
+            }
+        }
+    }
+    stm32f4xx_gpio_publish(s, changed);
+}
+
+/* A level driven on @line from outside, or -1 to leave it floating */
+static void stm32f4xx_gpio_set(void *opaque, int line, int level)
+{
+    STM32F4xxGpioState *s = opaque;
+
+    if (level < 0) {
+        s->in_mask &= ~BIT(line);
+    } else {
+        s->in_mask |= BIT(line);
+        s->in_level = deposit32(s->in_level, line, 1, !!level);
+    }
+    stm32f4xx_gpio_update(s);
+}
+
+/*
+ * The lock sequence writes LCKK set, then cleared, then set again, with
+ * the same pins each time.  The configuration of these pins is then
+ * frozen until the next reset.  The read of LCKR that ends the sequence
+ * on the hardware is not needed.
+ */
+static void stm32f4xx_gpio_lock(STM32F4xxGpioState *s, uint32_t value)
+{
+    static const bool lckk[] = { true, false, true };
+
+    value &= LCKR_LCKK | PINS_MASK;
+    if (s->lckr & LCKR_LCKK) {
+        return;
+    }
+    /* Out of sequence, which may start again with this write */
+    if ((value & PINS_MASK) != s->lckr ||
+        !!(value & LCKR_LCKK) != lckk[s->lock_step]) {
+        s->lock_step = 0;
+    }
+    s->lckr = value & PINS_MASK;
+    if (!!(value & LCKR_LCKK) == lckk[s->lock_step] &&
+        ++s->lock_step == ARRAY_SIZE(lckk)) {
+        s->lckr |= LCKR_LCKK;
+        s->lock_step = 0;
+    }
+}
+
+static uint64_t stm32f4xx_gpio_read_reg(STM32F4xxGpioState *s, hwaddr addr)
+{
+    switch (addr) {
+    case GPIO_MODER:
+        return s->moder;
+    case GPIO_OTYPER:
+        return s->otyper;
+    case GPIO_OSPEEDR:
+        return s->ospeedr;
+    case GPIO_PUPDR:
+        return s->pupdr;
+    case GPIO_IDR:
+        /* Pick up the levels the pin bus drives */
+        stm32f4xx_gpio_update(s);
+        return s->idr;
+    case GPIO_ODR:
+        return s->odr;
+    case GPIO_BSRR:
+        return 0;
+    case GPIO_LCKR:
+        return s->lckr;
+    case GPIO_AFRL:
+        return s->afr[0];
+    case GPIO_AFRH:
+        return s->afr[1];
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%" HWADDR_PRIx "\n", __func__, addr);
+        return 0;
+    }
+}
+
+/* The registers can be accessed by bytes, half-words or words */
+static uint64_t stm32f4xx_gpio_read(void *opaque, hwaddr addr,
+                                    unsigned int size)
+{
+    STM32F4xxGpioState *s = opaque;
+    unsigned shift = (addr & 3) * 8;
+    uint64_t value;
+
+    value = extract64(stm32f4xx_gpio_read_reg(s, addr & ~3), shift, size * 8);
+    s->mmio_reads++;
+    trace_stm32f4xx_gpio_read(s->port, addr, value);
+    return value;
+}
+
+static void stm32f4xx_gpio_write(void *opaque, hwaddr addr,
+                                 uint64_t val64, unsigned int size)
+{
+    STM32F4xxGpioState *s = opaque;
+    unsigned shift = (addr & 3) * 8;
+    uint32_t mask = MAKE_64BIT_MASK(shift, size * 8);
+    uint32_t value = val64 << shift;
+
+    s->mmio_writes++;
+    trace_stm32f4xx_gpio_write(s->port, addr, val64);
+
+    switch (addr & ~3) {
+    case GPIO_MODER:
+        s->moder = stm32f4xx_gpio_config(s, s->moder, value, mask, 2, 0);
+        break;
+    case GPIO_OTYPER:
+        s->otyper = stm32f4xx_gpio_config(s, s->otyper, value,
+                                          mask & PINS_MASK, 1, 0);
+        break;
+    case GPIO_OSPEEDR:
+        s->ospeedr = stm32f4xx_gpio_config(s, s->ospeedr, value, mask, 2, 0);
+        return;
+    case GPIO_PUPDR:
+        s->pupdr = stm32f4xx_gpio_config(s, s->pupdr, value, mask, 2, 0);
+        break;
+    case GPIO_IDR:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: IDR is read-only\n", __func__);
+        return;
+    case GPIO_ODR:
+        s->odr = ((s->odr & ~mask) | (value & mask)) & PINS_MASK;
+        break;
+    case GPIO_BSRR:
+        /* Setting a pin wins over resetting it */
+        value &= mask;
+        s->odr = (s->odr & ~(value >> 16)) | (value & PINS_MASK);
+        break;
+    case GPIO_LCKR:
+        stm32f4xx_gpio_lock(s, (s->lckr & ~mask) | (value & mask));
+        return;
+    case GPIO_AFRL:
+        s->afr[0] = stm32f4xx_gpio_config(s, s->afr[0], value, mask, 4, 0);
+        return;
+    case GPIO_AFRH:
+        s->afr[1] = stm32f4xx_gpio_config(s, s->afr[1], value, mask, 4, 8);
+        return;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%" HWADDR_PRIx "\n", __func__, addr);
+        return;
+    }
+    stm32f4xx_gpio_update(s);
+}
+
+static const MemoryRegionOps stm32f4xx_gpio_ops = {
+    .read = stm32f4xx_gpio_read,
+    .write = stm32f4xx_gpio_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .valid = {
+        .min_access_size = 1,
+        .max_access_size = 4,
+    },
+};
+
+/*
+ * The new state goes to the pin bus, like any other change.  The levels
+ * driven from outside stay.
+ */
+static void stm32f4xx_gpio_hold_reset(Object *obj)
+{
+    STM32F4xxGpioState *s = STM32F4XX_GPIO(obj);
+
+    s->moder = s->moder_reset;
+    s->otyper = 0;
+    s->ospeedr = s->ospeedr_reset;
+    s->pupdr = s->pupdr_reset;
+    s->odr = 0;
+    s->lckr = 0;
+    s->lock_step = 0;
+    s->afr[0] = 0;
+    s->afr[1] = 0;
+    stm32f4xx_gpio_update(s);
+}
+
+static void stm32f4xx_gpio_init(Object *obj)
+{
+    STM32F4xxGpioState *s = STM32F4XX_GPIO(obj);
+
+    memory_region_init_io(&s->mmio, obj, &stm32f4xx_gpio_ops, s,
+                          TYPE_STM32F4XX_GPIO, 0x400);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+    qdev_init_gpio_in(DEVICE(obj), stm32f4xx_gpio_set,
+                      STM32F4XX_GPIO_NUM_PINS);
+    qdev_init_gpio_out(DEVICE(obj), s->pin, STM32F4XX_GPIO_NUM_PINS);
+
+    object_property_add_uint64_ptr(obj, "mmio-reads", &s->mmio_reads,
+                                   OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "mmio-writes", &s->mmio_writes,
+                                   OBJ_PROP_FLAG_READ);
+}
+
+static void stm32f4xx_gpio_realize(DeviceState *dev, Error **errp)
+{
+    STM32F4xxGpioState *s = STM32F4XX_GPIO(dev);
+    MemoryRegion *mr;
+
+    if (!s->pinbus_memdev) {
+        return;
+    }
+    if (s->port >= STM32F4XX_PINBUS_PORTS) {
+        error_setg(errp, "pinbus: no room for port %u", s->port);
+        return;
+    }
+    mr = host_memory_backend_get_memory(s->pinbus_memdev);
+    if (memory_region_size(mr) < sizeof(STM32F4xxPinbus)) {
+        error_setg(errp, "pinbus: memdev must hold at least %zu bytes",
+                   sizeof(STM32F4xxPinbus));
+        return;
+    }
+    s->pinbus = memory_region_get_ram_ptr(mr);
+}
+
+/* The pin bus is not migrated, it gets the state of the destination */
+static int stm32f4xx_gpio_post_load(void *opaque, int version_id)
+{
+    stm32f4xx_gpio_publish(opaque, 0);
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32f4xx_gpio = {
+    .name = TYPE_STM32F4XX_GPIO,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = stm32f4xx_gpio_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(moder, STM32F4xxGpioState),
+        VMSTATE_UINT32(otyper, STM32F4xxGpioState),
+        VMSTATE_UINT32(ospeedr, STM32F4xxGpioState),
+        VMSTATE_UINT32(pupdr, STM32F4xxGpioState),
+        VMSTATE_UINT32(odr, STM32F4xxGpioState),
+        VMSTATE_UINT32(lckr, STM32F4xxGpioState),
+        VMSTATE_UINT32_ARRAY(afr, STM32F4xxGpioState, 2),
+        VMSTATE_UINT8(lock_step, STM32F4xxGpioState),
+        VMSTATE_UINT32(idr, STM32F4xxGpioState),
+        VMSTATE_UINT32(in_mask, STM32F4xxGpioState),
+        VMSTATE_UINT32(in_level, STM32F4xxGpioState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property stm32f4xx_gpio_properties[] = {
+    DEFINE_PROP_UINT8("port", STM32F4xxGpioState, port, 0),
+    DEFINE_PROP_UINT32("moder-reset", STM32F4xxGpioState, moder_reset, 0),
+    DEFINE_PROP_UINT32("ospeedr-reset", STM32F4xxGpioState, ospeedr_reset, 0),
+    DEFINE_PROP_UINT32("pupdr-reset", STM32F4xxGpioState, pupdr_reset, 0),
+    DEFINE_PROP_LINK("pinbus", STM32F4xxGpioState, pinbus_memdev,
+                     TYPE_MEMORY_BACKEND, HostMemoryBackend *),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void stm32f4xx_gpio_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ResettableClass *rc = RESETTABLE_CLASS(klass);
+
+    dc->realize = stm32f4xx_gpio_realize;
+    dc->vmsd = &vmstate_stm32f4xx_gpio;
+    device_class_set_props(dc, stm32f4xx_gpio_properties);
+    rc->phases.hold = stm32f4xx_gpio_hold_reset;
+}
+
+static const TypeInfo stm32f4xx_gpio_info[] = {
+    {
+        .name          = TYPE_STM32F4XX_GPIO,
+        .parent        = TYPE_SYS_BUS_DEVICE,
+        .instance_size = sizeof(STM32F4xxGpioState),
+        .instance_init = stm32f4xx_gpio_init,
+        .class_init    = stm32f4xx_gpio_class_init,
+    }
+};
+
+DEFINE_TYPES(stm32f4xx_gpio_info)
@@ -0,0 +1,528 @@
+/*
+ * STM32F4xx I2C controller
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * I2C controller with the CCR register (RM0090 section 27), as found on
+ * the STM32F1, F2, F4 and L1, in master mode.
+ *
+ * Every bus operation is done when the guest asks for it, and the flags it
+ * waits for (SB, ADDR, TXE, RXNE, BTF) are set right away: there is no
+ * timer, so firmware polling SR1 sees the next state on its first read.
+ * The time the bytes would take on the wire is computed from CCR and
+ * CR2.FREQ and only shows in SR2.BUSY, which is evaluated when read.
+ *
+ * Received bytes are fetched lazily, so that the slave is not asked for
+ * more bytes than the firmware reads: the first one when ADDR is cleared,
+ * then one when DR is read, and one into the shift register (setting BTF)
+ * when SR1 is read with DR full.  Setting STOP fetches the byte the
+ * hardware would receive before the stop condition.  A byte is not
+ * acknowledged if CR1.ACK is clear when it is fetched.
+ *
+ * Not modelled: slave mode (OAR1/OAR2 are plain registers), 10-bit
+ * addressing, SMBus and PEC, arbitration and bus errors.  CR2.DMAEN is
+ * kept but there is no DMA request, as the SoC has no DMA controller
+ * model.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/module.h"
+#include "qemu/timer.h"
+#include "hw/irq.h"
+#include "hw/registerfields.h"
+#include "migration/vmstate.h"
+#include "hw/i2c/stm32f4xx_i2c.h"
+#include "trace.h"
+
+REG32(CR1, 0x00)
+    FIELD(CR1, PE, 0, 1)
+    FIELD(CR1, START, 8, 1)
+    FIELD(CR1, STOP, 9, 1)
+    FIELD(CR1, ACK, 10, 1)
+    FIELD(CR1, POS, 11, 1)
+    FIELD(CR1, SWRST, 15, 1)
+REG32(CR2, 0x04)
+    FIELD(CR2, FREQ, 0, 6)
+    FIELD(CR2, ITERREN, 8, 1)
+    FIELD(CR2, ITEVTEN, 9, 1)
+    FIELD(CR2, ITBUFEN, 10, 1)
+REG32(OAR1, 0x08)
+REG32(OAR2, 0x0C)
+REG32(DR, 0x10)
+REG32(SR1, 0x14)
+    FIELD(SR1, SB, 0, 1)
+    FIELD(SR1, ADDR, 1, 1)
+    FIELD(SR1, BTF, 2, 1)
+    FIELD(SR1, ADD10, 3, 1)
+    FIELD(SR1, STOPF, 4, 1)
+    FIELD(SR1, RXNE, 6, 1)
+    FIELD(SR1, TXE, 7, 1)
+    FIELD(SR1, BERR, 8, 1)
+    FIELD(SR1, ARLO, 9, 1)
+    FIELD(SR1, AF, 10, 1)
+    FIELD(SR1, OVR, 11, 1)
+    FIELD(SR1, PECERR, 12, 1)
+    FIELD(SR1, TIMEOUT, 14, 1)
+    FIELD(SR1, SMBALERT, 15, 1)
+REG32(SR2, 0x18)
+    FIELD(SR2, MSL, 0, 1)
+    FIELD(SR2, BUSY, 1, 1)
+    FIELD(SR2, TRA, 2, 1)
+REG32(CCR, 0x1C)
+    FIELD(CCR, CCR, 0, 12)
+    FIELD(CCR, DUTY, 14, 1)
+    FIELD(CCR, FS, 15, 1)
+REG32(TRISE, 0x20)
+REG32(FLTR, 0x24)
+
+/* Error flags, cleared by writing 0 */
+#define SR1_ERRORS (R_SR1_BERR_MASK | R_SR1_ARLO_MASK | R_SR1_AF_MASK | \
+                    R_SR1_OVR_MASK | R_SR1_PECERR_MASK | \
+                    R_SR1_TIMEOUT_MASK | R_SR1_SMBALERT_MASK)
+#define SR1_EVENTS (R_SR1_SB_MASK | R_SR1_ADDR_MASK | R_SR1_BTF_MASK | \
+                    R_SR1_ADD10_MASK | R_SR1_STOPF_MASK)
+
+/* Bit time when CCR or CR2.FREQ is not programmed, 100 kHz */
+#define DEFAULT_BIT_NS 10000
+
+static void stm32f4xx_i2c_update_irq(STM32F4xxI2CState *s)
+{
+    uint32_t sr1 = s->sr1;
+    bool ev = false;
+
+    if (s->cr2 & R_CR2_ITEVTEN_MASK) {
+        ev = (sr1 & SR1_EVENTS) ||
+             ((s->cr2 & R_CR2_ITBUFEN_MASK) &&
+              (sr1 & (R_SR1_TXE_MASK | R_SR1_RXNE_MASK)));
+    }
+    qemu_set_irq(s->ev_irq, ev);
+    qemu_set_irq(s->er_irq,
+                 (s->cr2 & R_CR2_ITERREN_MASK) && (sr1 & SR1_ERRORS));
+}
+
+/* SCL period from CCR, in periods of the APB clock given by CR2.FREQ */
+static uint64_t stm32f4xx_i2c_bit_ns(STM32F4xxI2CState *s)
+{
+    uint32_t freq = FIELD_EX32(s->cr2, CR2, FREQ);
+    uint32_t ccr = FIELD_EX32(s->ccr, CCR, CCR);
+    uint32_t periods;
+
+    if (freq < 2 || !ccr) {
+        return DEFAULT_BIT_NS;
+    }
+    if (!(s->ccr & R_CCR_FS_MASK)) {
+        periods = 2 * ccr;
+    } else if (!(s->ccr & R_CCR_DUTY_MASK)) {
+        periods = 3 * ccr;
+    } else {
+        periods = 25 * ccr;
+    }
+    return periods * 1000ULL / freq;
+}
+
+/* Account for @bytes more on the wire, for SR2.BUSY */
+static void stm32f4xx_i2c_wire(STM32F4xxI2CState *s, uint32_t bytes)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    s->busy_until = MAX(now, s->busy_until) +
+                    bytes * 9 * stm32f4xx_i2c_bit_ns(s);
+}
+
+static uint8_t stm32f4xx_i2c_recv(STM32F4xxI2CState *s)
+{
+    uint8_t value = i2c_recv(s->bus);
+
+    if (!(s->cr1 & R_CR1_ACK_MASK)) {
+        i2c_nack(s->bus);
+        s->rx_done = true;
+    }
+    stm32f4xx_i2c_wire(s, 1);
+    return value;
+}
+
+static bool stm32f4xx_i2c_receiving(STM32F4xxI2CState *s)
+{
+    return (s->sr2 & R_SR2_MSL_MASK) && !(s->sr2 & R_SR2_TRA_MASK) &&
+           !(s->sr1 & (R_SR1_SB_MASK | R_SR1_ADDR_MASK)) && !s->rx_done;
+}
+
+/* The next received byte goes to DR if it is empty, else to the shift */
+static void stm32f4xx_i2c_fetch(STM32F4xxI2CState *s)
+{
+    if (!(s->sr1 & R_SR1_RXNE_MASK)) {
+        s->dr = stm32f4xx_i2c_recv(s);
+        s->sr1 |= R_SR1_RXNE_MASK;
+    } else if (!s->shift_full) {
+        s->shift = stm32f4xx_i2c_recv(s);
+        s->shift_full = true;
+        s->sr1 |= R_SR1_BTF_MASK;
+    }
+}
+
+static void stm32f4xx_i2c_stop(STM32F4xxI2CState *s)
+{
+    if (!(s->sr2 & R_SR2_MSL_MASK)) {
+        return;
+    }
+    if (stm32f4xx_i2c_receiving(s)) {
+        /* The byte being received when STOP is set is the last one */
+        stm32f4xx_i2c_fetch(s);
+    }
+    trace_stm32f4xx_i2c_stop(DEVICE(s)->canonical_path);
+    i2c_end_transfer(s->bus);
+    stm32f4xx_i2c_wire(s, 1);
+    s->sr1 &= ~(R_SR1_SB_MASK | R_SR1_ADDR_MASK | R_SR1_TXE_MASK);
+    if (!s->shift_full) {
+        s->sr1 &= ~R_SR1_BTF_MASK;
+    }
+    s->sr2 = 0;
+    s->rx_done = false;
+}
+
+/* The first byte after a START is the address */
+static void stm32f4xx_i2c_address(STM32F4xxI2CState *s, uint8_t value)
+{
+    bool read = value & 1;
+    bool nack;
+
+    s->sr1 &= ~R_SR1_SB_MASK;
+    nack = i2c_start_transfer(s->bus, value >> 1, read);
+    trace_stm32f4xx_i2c_address(DEVICE(s)->canonical_path, value >> 1, read,
+                                nack);
+    stm32f4xx_i2c_wire(s, 1);
+    if (nack) {
+        /* The firmware is expected to set STOP */
+        s->sr1 |= R_SR1_AF_MASK;
+        s->rx_done = true;
+        return;
+    }
+    s->sr1 |= R_SR1_ADDR_MASK;
+    s->sr2 = R_SR2_MSL_MASK | (read ? 0 : R_SR2_TRA_MASK);
+    s->rx_done = false;
+}
+
+/* ADDR is cleared by reading SR1 then SR2 */
+static void stm32f4xx_i2c_clear_addr(STM32F4xxI2CState *s)
+{
+    s->sr1 &= ~R_SR1_ADDR_MASK;
+    if (s->sr2 & R_SR2_TRA_MASK) {
+        s->sr1 |= R_SR1_TXE_MASK;
+    } else {
+        stm32f4xx_i2c_fetch(s);
+    }
+}
+
+static void stm32f4xx_i2c_write_dr(STM32F4xxI2CState *s, uint8_t value)
+{
+    if (s->sr1 & R_SR1_SB_MASK) {
+        stm32f4xx_i2c_address(s, value);
+        return;
+    }
+    if (!(s->sr2 & R_SR2_TRA_MASK) || s->sr1 & R_SR1_ADDR_MASK) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: DR written with no transfer "
+                      "expecting data\n", __func__);
+        return;
+    }
+
+    s->sr1 &= ~R_SR1_BTF_MASK;
+    stm32f4xx_i2c_wire(s, 1);
+    if (i2c_send(s->bus, value)) {
+        s->sr1 &= ~R_SR1_TXE_MASK;
+        s->sr1 |= R_SR1_AF_MASK;
+        return;
+    }
+    s->sr1 |= R_SR1_TXE_MASK | R_SR1_BTF_MASK;
+}
+
+static uint32_t stm32f4xx_i2c_read_dr(STM32F4xxI2CState *s)
+{
+    uint32_t value = s->dr;
+
+    if (!(s->sr1 & R_SR1_RXNE_MASK)) {
+        return value;
+    }
+    if (s->shift_full) {
+        s->dr = s->shift;
+        s->shift_full = false;
+        s->sr1 &= ~R_SR1_BTF_MASK;
+    } else if (stm32f4xx_i2c_receiving(s)) {
+        s->dr = stm32f4xx_i2c_recv(s);
+    } else {
+        s->sr1 &= ~R_SR1_RXNE_MASK;
+    }
+    return value;
+}
+
+static uint32_t stm32f4xx_i2c_read_sr1(STM32F4xxI2CState *s)
+{
+    /* Firmware waiting for BTF: the next byte reaches the shift register */
+    if (s->sr1 & R_SR1_RXNE_MASK && stm32f4xx_i2c_receiving(s)) {
+        stm32f4xx_i2c_fetch(s);
+    }
+    return s->sr1;
+}
+
+static uint32_t stm32f4xx_i2c_read_sr2(STM32F4xxI2CState *s)
+{
+    uint32_t value = s->sr2;
+
+    if (s->sr2 & R_SR2_MSL_MASK ||
+        qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) < s->busy_until) {
+        value |= R_SR2_BUSY_MASK;
+    }
+    if (s->sr1 & R_SR1_ADDR_MASK) {
+        stm32f4xx_i2c_clear_addr(s);
+    }
+    return value;
+}
+
+/* Clearing PE, or SWRST, stops the transfer and clears the flags */
+static void stm32f4xx_i2c_disable(STM32F4xxI2CState *s)
+{
+    if (s->sr2 & R_SR2_MSL_MASK) {
+        i2c_end_transfer(s->bus);
+    }
+    s->sr1 = 0;
+    s->sr2 = 0;
+    s->shift_full = false;
+    s->rx_done = false;
+    s->cr1 &= ~(R_CR1_START_MASK | R_CR1_STOP_MASK);
+}
+
+static void stm32f4xx_i2c_reset_hold(Object *obj)
+{
+    STM32F4xxI2CState *s = STM32F4XX_I2C(obj);
+
+    stm32f4xx_i2c_disable(s);
+    s->cr1 = 0;
+    s->cr2 = 0;
+    s->oar1 = 0;
+    s->oar2 = 0;
+    s->ccr = 0;
+    s->trise = 2;
+    s->fltr = 0;
+    s->dr = 0;
+    s->busy_until = 0;
+    stm32f4xx_i2c_update_irq(s);
+}
+
+static void stm32f4xx_i2c_write_cr1(STM32F4xxI2CState *s, uint32_t value)
+{
+    if (value & R_CR1_SWRST_MASK) {
+        stm32f4xx_i2c_reset_hold(OBJECT(s));
+        s->cr1 = R_CR1_SWRST_MASK;
+        return;
+    }
+    if (s->cr1 & R_CR1_PE_MASK && !(value & R_CR1_PE_MASK)) {
+        stm32f4xx_i2c_disable(s);
+    }
+    s->cr1 = value;
+    if (!(value & R_CR1_PE_MASK)) {
+        s->cr1 &= ~(R_CR1_START_MASK | R_CR1_STOP_MASK);
+        return;
+    }
+
+    if (value & R_CR1_STOP_MASK) {
+        stm32f4xx_i2c_stop(s);
+        s->cr1 &= ~R_CR1_STOP_MASK;
+    }
+    if (value & R_CR1_START_MASK) {
+        /* A repeated start ends the reception in progress */
+        if (stm32f4xx_i2c_receiving(s)) {
+            s->rx_done = true;
+        }
+        s->shift_full = false;
+        s->sr1 &= ~(R_SR1_ADDR_MASK | R_SR1_TXE_MASK | R_SR1_BTF_MASK);
+        s->sr1 |= R_SR1_SB_MASK;
+        s->sr2 |= R_SR2_MSL_MASK;
+        s->cr1 &= ~R_CR1_START_MASK;
+    }
+}
+
+static uint64_t stm32f4xx_i2c_read(void *opaque, hwaddr addr, unsigned size)
+{
+    STM32F4xxI2CState *s = opaque;
+    uint64_t value = 0;
+
+    switch (addr) {
+    case A_CR1:
+        value = s->cr1;
+        break;
+    case A_CR2:
+        value = s->cr2;
+        break;
+    case A_OAR1:
+        value = s->oar1;
+        break;
+    case A_OAR2:
+        value = s->oar2;
+        break;
+    case A_DR:
+        value = stm32f4xx_i2c_read_dr(s);
+        break;
+    case A_SR1:
+        value = stm32f4xx_i2c_read_sr1(s);
+        break;
+    case A_SR2:
+        value = stm32f4xx_i2c_read_sr2(s);
+        break;
+    case A_CCR:
+        value = s->ccr;
+        break;
+    case A_TRISE:
+        value = s->trise;
+        break;
+    case A_FLTR:
+        value = s->fltr;
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%" HWADDR_PRIx "\n", __func__, addr);
+        break;
+    }
+
+    stm32f4xx_i2c_update_irq(s);
+    trace_stm32f4xx_i2c_read(DEVICE(s)->canonical_path, addr, value);
+    return value;
+}
+
+static void stm32f4xx_i2c_write(void *opaque, hwaddr addr,
+                                uint64_t val64, unsigned size)
+{
+    STM32F4xxI2CState *s = opaque;
+    uint32_t value = val64;
+
+    trace_stm32f4xx_i2c_write(DEVICE(s)->canonical_path, addr, value);
+
+    switch (addr) {
+    case A_CR1:
+        stm32f4xx_i2c_write_cr1(s, value & 0xBFFB);
+        break;
+    case A_CR2:
+        s->cr2 = value & 0x1F3F;
+        break;
+    case A_OAR1:
+        s->oar1 = value & 0x83FF;
+        break;
+    case A_OAR2:
+        s->oar2 = value & 0xFF;
+        break;
+    case A_DR:
+        if (s->cr1 & R_CR1_PE_MASK) {
+            stm32f4xx_i2c_write_dr(s, value);
+        }
+        break;
+    case A_SR1:
+        s->sr1 &= value | ~SR1_ERRORS;
+        break;
+    case A_CCR:
+        s->ccr = value & 0xCFFF;
+        break;
+    case A_TRISE:
+        s->trise = value & 0x3F;
+        break;
+    case A_FLTR:
+        s->fltr = value & 0x1F;
+        break;
+    case A_SR2:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Read only register 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%" HWADDR_PRIx "\n", __func__, addr);
+        break;
+    }
+
+    stm32f4xx_i2c_update_irq(s);
+}
+
+static const MemoryRegionOps stm32f4xx_i2c_ops = {
+    .read = stm32f4xx_i2c_read,
+    .write = stm32f4xx_i2c_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+    },
+    .valid = {
+        .min_access_size = 2,
+        .max_access_size = 4,
+    },
+};
+
+static void stm32f4xx_i2c_init(Object *obj)
+{
+    STM32F4xxI2CState *s = STM32F4XX_I2C(obj);
+
+    memory_region_init_io(&s->mmio, obj, &stm32f4xx_i2c_ops, s,
+                          TYPE_STM32F4XX_I2C, 0x400);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+    sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->ev_irq);
+    sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->er_irq);
+}
+
+static void stm32f4xx_i2c_realize(DeviceState *dev, Error **errp)
+{
+    STM32F4xxI2CState *s = STM32F4XX_I2C(dev);
+
+    /* Named after the SoC child, "i2c1" to "i2c3", for -device bus= */
+    s->bus = i2c_init_bus(dev,
+                          object_get_canonical_path_component(OBJECT(dev)));
+}
+
+static const VMStateDescription vmstate_stm32f4xx_i2c = {
+    .name = TYPE_STM32F4XX_I2C,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(cr1, STM32F4xxI2CState),
+        VMSTATE_UINT32(cr2, STM32F4xxI2CState),
+        VMSTATE_UINT32(oar1, STM32F4xxI2CState),
+        VMSTATE_UINT32(oar2, STM32F4xxI2CState),
+        VMSTATE_UINT32(sr1, STM32F4xxI2CState),
+        VMSTATE_UINT32(sr2, STM32F4xxI2CState),
+        VMSTATE_UINT32(ccr, STM32F4xxI2CState),
+        VMSTATE_UINT32(trise, STM32F4xxI2CState),
+        VMSTATE_UINT32(fltr, STM32F4xxI2CState),
+        VMSTATE_UINT8(dr, STM32F4xxI2CState),
+        VMSTATE_UINT8(shift, STM32F4xxI2CState),
+        VMSTATE_BOOL(shift_full, STM32F4xxI2CState),
+        VMSTATE_BOOL(rx_done, STM32F4xxI2CState),
+        VMSTATE_INT64(busy_until, STM32F4xxI2CState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void stm32f4xx_i2c_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ResettableClass *rc = RESETTABLE_CLASS(klass);
+
+    dc->realize = stm32f4xx_i2c_realize;
+    dc->vmsd = &vmstate_stm32f4xx_i2c;
+    rc->phases.hold = stm32f4xx_i2c_reset_hold;
+}
+
+static const TypeInfo stm32f4xx_i2c_info = {
+    .name          = TYPE_STM32F4XX_I2C,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(STM32F4xxI2CState),
+    .instance_init = stm32f4xx_i2c_init,
+    .class_init    = stm32f4xx_i2c_class_init,
+};
+
+static void stm32f4xx_i2c_register_types(void)
+{
+    type_register_static(&stm32f4xx_i2c_info);
+}
+
+type_init(stm32f4xx_i2c_register_types)
@@ -0,0 +1,555 @@
+/*
+ * STM32L4x5 I2C controller
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * I2C controller with the TIMINGR register (RM0351 section 39), as found
+ * on the STM32L4, F0, F3, F7, G0 and G4, in master mode.
+ *
+ * The length of a transfer, NBYTES, is known when it starts, so each
+ * NBYTES chunk is one operation on the bus: a read is received entirely
+ * when START is written, a write is sent once the last byte has been
+ * written to TXDR (TXIS is set again after each byte, as if the bus were
+ * infinitely fast).  The time the chunk takes on the wire is computed from
+ * TIMINGR and the kernel clock, and a single timer then sets RXNE and
+ * TC/TCR/STOPF: there is no per byte or per flag event, and polling
+ * firmware only sees the flags change at the end of a transfer.
+ *
+ * Not modelled: slave mode (OAR1/OAR2 are plain registers), 10-bit
+ * addressing, SMBus and PEC, the timeouts, arbitration and bus errors.
+ * TXDMAEN/RXDMAEN are kept but there is no DMA request, as the SoCs have
+ * no DMA controller model.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/module.h"
+#include "qemu/timer.h"
+#include "hw/irq.h"
+#include "hw/clock.h"
+#include "hw/qdev-clock.h"
+#include "hw/registerfields.h"
+#include "migration/vmstate.h"
+#include "hw/i2c/stm32l4x5_i2c.h"
+#include "trace.h"
+
+REG32(CR1, 0x00)
+    FIELD(CR1, PE, 0, 1)
+    FIELD(CR1, TXIE, 1, 1)
+    FIELD(CR1, RXIE, 2, 1)
+    FIELD(CR1, ADDRIE, 3, 1)
+    FIELD(CR1, NACKIE, 4, 1)
+    FIELD(CR1, STOPIE, 5, 1)
+    FIELD(CR1, TCIE, 6, 1)
+    FIELD(CR1, ERRIE, 7, 1)
+REG32(CR2, 0x04)
+    FIELD(CR2, SADD, 0, 10)
+    FIELD(CR2, RD_WRN, 10, 1)
+    FIELD(CR2, ADD10, 11, 1)
+    FIELD(CR2, START, 13, 1)
+    FIELD(CR2, STOP, 14, 1)
+    FIELD(CR2, NACK, 15, 1)
+    FIELD(CR2, NBYTES, 16, 8)
+    FIELD(CR2, RELOAD, 24, 1)
+    FIELD(CR2, AUTOEND, 25, 1)
+REG32(OAR1, 0x08)
+REG32(OAR2, 0x0C)
+REG32(TIMINGR, 0x10)
+    FIELD(TIMINGR, SCLL, 0, 8)
+    FIELD(TIMINGR, SCLH, 8, 8)
+    FIELD(TIMINGR, PRESC, 28, 4)
+REG32(TIMEOUTR, 0x14)
+REG32(ISR, 0x18)
+    FIELD(ISR, TXE, 0, 1)
+    FIELD(ISR, TXIS, 1, 1)
+    FIELD(ISR, RXNE, 2, 1)
+    FIELD(ISR, ADDR, 3, 1)
+    FIELD(ISR, NACKF, 4, 1)
+    FIELD(ISR, STOPF, 5, 1)
+    FIELD(ISR, TC, 6, 1)
+    FIELD(ISR, TCR, 7, 1)
+    FIELD(ISR, BERR, 8, 1)
+    FIELD(ISR, ARLO, 9, 1)
+    FIELD(ISR, OVR, 10, 1)
+    FIELD(ISR, PECERR, 11, 1)
+    FIELD(ISR, TIMEOUT, 12, 1)
+    FIELD(ISR, ALERT, 13, 1)
+    FIELD(ISR, BUSY, 15, 1)
+REG32(ICR, 0x1C)
+REG32(PECR, 0x20)
+REG32(RXDR, 0x24)
+REG32(TXDR, 0x28)
+
+#define ISR_ERRORS (R_ISR_BERR_MASK | R_ISR_ARLO_MASK | R_ISR_OVR_MASK | \
+                    R_ISR_PECERR_MASK | R_ISR_TIMEOUT_MASK | R_ISR_ALERT_MASK)
+/* Flags cleared through ICR */
+#define ICR_MASK (R_ISR_ADDR_MASK | R_ISR_NACKF_MASK | R_ISR_STOPF_MASK | \
+                  ISR_ERRORS)
+#define CR2_MASK 0x07FFFFFF
+
+/* Bit time when the kernel clock is not running, 100 kHz */
+#define DEFAULT_BIT_NS 10000
+
+static void stm32l4x5_i2c_update_irq(Stm32l4x5I2cState *s)
+{
+    uint32_t cr1 = s->cr1;
+    uint32_t isr = s->isr;
+    bool ev;
+
+    ev = ((cr1 & R_CR1_TXIE_MASK) && (isr & R_ISR_TXIS_MASK)) ||
+         ((cr1 & R_CR1_RXIE_MASK) && (isr & R_ISR_RXNE_MASK)) ||
+         ((cr1 & R_CR1_ADDRIE_MASK) && (isr & R_ISR_ADDR_MASK)) ||
+         ((cr1 & R_CR1_NACKIE_MASK) && (isr & R_ISR_NACKF_MASK)) ||
+         ((cr1 & R_CR1_STOPIE_MASK) && (isr & R_ISR_STOPF_MASK)) ||
+         ((cr1 & R_CR1_TCIE_MASK) &&
+          (isr & (R_ISR_TC_MASK | R_ISR_TCR_MASK)));
+    qemu_set_irq(s->ev_irq, ev);
+    qemu_set_irq(s->er_irq, (cr1 & R_CR1_ERRIE_MASK) && (isr & ISR_ERRORS));
+}
+
+/* SCL period from TIMINGR, ignoring the synchronization delays */
+static uint64_t stm32l4x5_i2c_bit_ns(Stm32l4x5I2cState *s)
+{
+    uint64_t ticks;
+
+    if (!clock_is_enabled(s->clk)) {
+        return DEFAULT_BIT_NS;
+    }
+    ticks = (FIELD_EX32(s->timingr, TIMINGR, PRESC) + 1) *
+            (FIELD_EX32(s->timingr, TIMINGR, SCLL) + 1 +
+             FIELD_EX32(s->timingr, TIMINGR, SCLH) + 1);
+    return clock_ticks_to_ns(s->clk, ticks);
+}
+
+/*
+ * The current chunk, @bytes long on the wire (with the address byte),
+ * is done on the bus: set @flags when it would be done on the wire.
+ */
+static void stm32l4x5_i2c_complete(Stm32l4x5I2cState *s, uint32_t bytes,
+                                   uint32_t flags)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    s->pending |= flags;
+    timer_mod(s->timer, now + bytes * 9 * stm32l4x5_i2c_bit_ns(s));
+}
+
+static void stm32l4x5_i2c_timer(void *opaque)
+{
+    Stm32l4x5I2cState *s = opaque;
+
+    s->isr |= s->pending;
+    s->pending = 0;
+    if (!s->active) {
+        s->isr &= ~R_ISR_BUSY_MASK;
+    }
+    stm32l4x5_i2c_update_irq(s);
+}
+
+static void stm32l4x5_i2c_stop(Stm32l4x5I2cState *s)
+{
+    trace_stm32l4x5_i2c_stop(DEVICE(s)->canonical_path);
+    i2c_end_transfer(s->bus);
+    s->active = false;
+}
+
+/* End of an NBYTES chunk, after @bytes on the wire */
+static void stm32l4x5_i2c_chunk_done(Stm32l4x5I2cState *s, uint32_t bytes)
+{
+    uint32_t flags = 0;
+
+    if (s->cr2 & R_CR2_RD_WRN_MASK && s->buf_len) {
+        flags |= R_ISR_RXNE_MASK;
+    }
+    if (s->cr2 & R_CR2_RELOAD_MASK) {
+        flags |= R_ISR_TCR_MASK;
+    } else if (s->cr2 & R_CR2_AUTOEND_MASK) {
+        stm32l4x5_i2c_stop(s);
+        flags |= R_ISR_STOPF_MASK;
+    } else {
+        flags |= R_ISR_TC_MASK;
+    }
+    stm32l4x5_i2c_complete(s, bytes, flags);
+}
+
+/* The slave did not acknowledge: a STOP follows automatically */
+static void stm32l4x5_i2c_nack(Stm32l4x5I2cState *s, uint32_t bytes)
+{
+    trace_stm32l4x5_i2c_nack(DEVICE(s)->canonical_path);
+    s->isr &= ~R_ISR_TXIS_MASK;
+    s->count = 0;
+    stm32l4x5_i2c_stop(s);
+    stm32l4x5_i2c_complete(s, bytes, R_ISR_NACKF_MASK | R_ISR_STOPF_MASK);
+}
+
+/* Start an NBYTES chunk, after @bytes already on the wire */
+static void stm32l4x5_i2c_chunk(Stm32l4x5I2cState *s, uint32_t bytes)
+{
+    uint32_t i;
+
+    s->count = FIELD_EX32(s->cr2, CR2, NBYTES);
+
+    if (!(s->cr2 & R_CR2_RD_WRN_MASK)) {
+        s->buf_len = 0;
+        s->buf_pos = 0;
+        s->tx_wire = bytes;
+        if (!s->count) {
+            stm32l4x5_i2c_chunk_done(s, bytes);
+            return;
+        }
+        /* TXDR is written byte by byte, the chunk is sent when complete */
+        s->isr |= R_ISR_TXIS_MASK;
+        return;
+    }
+
+    /*
+     * After a RELOAD, the end of the previous chunk may still be unread.
+     * The hardware would stretch the clock; keep at most one chunk.
+     */
+    s->buf_pos = MAX(s->buf_pos, s->buf_len - MIN(s->buf_len, 255));
+    s->buf_len -= s->buf_pos;
+    memmove(s->buf, s->buf + s->buf_pos, s->buf_len);
+    s->buf_pos = 0;
+    for (i = 0; i < s->count; i++) {
+        s->buf[s->buf_len++] = i2c_recv(s->bus);
+    }
+    /* The last byte before a STOP or RESTART is not acknowledged */
+    if (s->count && !(s->cr2 & R_CR2_RELOAD_MASK)) {
+        i2c_nack(s->bus);
+    }
+    bytes += s->count;
+    s->count = 0;
+    stm32l4x5_i2c_chunk_done(s, bytes);
+}
+
+static void stm32l4x5_i2c_start(Stm32l4x5I2cState *s)
+{
+    bool read = s->cr2 & R_CR2_RD_WRN_MASK;
+    uint8_t addr;
+
+    if (s->cr2 & R_CR2_ADD10_MASK) {
+        qemu_log_mask(LOG_UNIMP, "%s: 10-bit addressing\n", __func__);
+    }
+    addr = extract32(s->cr2, 1, 7);
+
+    s->cr2 &= ~R_CR2_START_MASK;
+    s->isr &= ~(R_ISR_TC_MASK | R_ISR_TCR_MASK | R_ISR_TXIS_MASK);
+    s->isr |= R_ISR_BUSY_MASK;
+    /* Data still unread from RXDR is lost */
+    s->pending = 0;
+    s->buf_len = 0;
+    s->buf_pos = 0;
+    s->isr &= ~R_ISR_RXNE_MASK;
+
+    trace_stm32l4x5_i2c_start(DEVICE(s)->canonical_path, addr, read,
+                              FIELD_EX32(s->cr2, CR2, NBYTES));
+    if (i2c_start_transfer(s->bus, addr, read)) {
+        stm32l4x5_i2c_nack(s, 1);
+        return;
+    }
+    s->active = true;
+    stm32l4x5_i2c_chunk(s, 1);
+}
+
+static void stm32l4x5_i2c_write_txdr(Stm32l4x5I2cState *s, uint8_t value)
+{
+    uint32_t i, bytes;
+
+    if (!s->active || s->cr2 & R_CR2_RD_WRN_MASK || !s->count) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: TXDR written with no transfer "
+                      "expecting data\n", __func__);
+        return;
+    }
+
+    s->buf[s->buf_len++] = value;
+    if (--s->count) {
+        return;
+    }
+
+    s->isr &= ~R_ISR_TXIS_MASK;
+    bytes = s->tx_wire + s->buf_len;
+    for (i = 0; i < s->buf_len; i++) {
+        if (i2c_send(s->bus, s->buf[i])) {
+            s->buf_len = 0;
+            stm32l4x5_i2c_nack(s, s->tx_wire + i + 1);
+            return;
+        }
+    }
+    s->buf_len = 0;
+    stm32l4x5_i2c_chunk_done(s, bytes);
+}
+
+static uint32_t stm32l4x5_i2c_read_rxdr(Stm32l4x5I2cState *s)
+{
+    uint32_t value;
+
+    if (!(s->isr & R_ISR_RXNE_MASK)) {
+        return 0;
+    }
+    value = s->buf[s->buf_pos++];
+    if (s->buf_pos >= s->buf_len) {
+        s->isr &= ~R_ISR_RXNE_MASK;
+    }
+    stm32l4x5_i2c_update_irq(s);
+    return value;
+}
+
+static void stm32l4x5_i2c_write_cr2(Stm32l4x5I2cState *s, uint32_t value)
+{
+    bool reload = s->isr & R_ISR_TCR_MASK;
+
+    s->cr2 = value & CR2_MASK;
+    if (!(s->cr1 & R_CR1_PE_MASK)) {
+        s->cr2 &= ~(R_CR2_START_MASK | R_CR2_STOP_MASK);
+        return;
+    }
+
+    if (s->cr2 & R_CR2_START_MASK) {
+        stm32l4x5_i2c_start(s);
+    } else if (reload && FIELD_EX32(s->cr2, CR2, NBYTES)) {
+        /* Next chunk of a transfer with RELOAD */
+        s->isr &= ~R_ISR_TCR_MASK;
+        stm32l4x5_i2c_chunk(s, 0);
+    } else if (s->cr2 & R_CR2_STOP_MASK && s->active) {
+        s->isr &= ~R_ISR_TC_MASK;
+        stm32l4x5_i2c_stop(s);
+        stm32l4x5_i2c_complete(s, 0, R_ISR_STOPF_MASK);
+    }
+    /* NACK only applies in slave mode */
+    s->cr2 &= ~(R_CR2_STOP_MASK | R_CR2_NACK_MASK);
+    stm32l4x5_i2c_update_irq(s);
+}
+
+/* Clearing PE resets the state machine and the flags */
+static void stm32l4x5_i2c_disable(Stm32l4x5I2cState *s)
+{
+    if (s->active) {
+        stm32l4x5_i2c_stop(s);
+    }
+    timer_del(s->timer);
+    s->pending = 0;
+    s->count = 0;
+    s->buf_len = 0;
+    s->buf_pos = 0;
+    s->isr = R_ISR_TXE_MASK;
+}
+
+static void stm32l4x5_i2c_reset_hold(Object *obj)
+{
+    Stm32l4x5I2cState *s = STM32L4X5_I2C(obj);
+
+    stm32l4x5_i2c_disable(s);
+    s->cr1 = 0;
+    s->cr2 = 0;
+    s->oar1 = 0;
+    s->oar2 = 0;
+    s->timingr = 0;
+    s->timeoutr = 0;
+    stm32l4x5_i2c_update_irq(s);
+}
+
+static uint64_t stm32l4x5_i2c_read(void *opaque, hwaddr addr, unsigned size)
+{
+    Stm32l4x5I2cState *s = opaque;
+    uint64_t value = 0;
+
+    switch (addr) {
+    case A_CR1:
+        value = s->cr1;
+        break;
+    case A_CR2:
+        value = s->cr2;
+        break;
+    case A_OAR1:
+        value = s->oar1;
+        break;
+    case A_OAR2:
+        value = s->oar2;
+        break;
+    case A_TIMINGR:
+        value = s->timingr;
+        break;
+    case A_TIMEOUTR:
+        value = s->timeoutr;
+        break;
+    case A_ISR:
+        value = s->isr;
+        break;
+    case A_ICR:
+    case A_TXDR:
+    case A_PECR:
+        break;
+    case A_RXDR:
+        value = stm32l4x5_i2c_read_rxdr(s);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%" HWADDR_PRIx "\n", __func__, addr);
+        break;
+    }
+
+    trace_stm32l4x5_i2c_read(DEVICE(s)->canonical_path, addr, value);
+    return value;
+}
+
+static void stm32l4x5_i2c_write(void *opaque, hwaddr addr,
+                                uint64_t val64, unsigned size)
+{
+    Stm32l4x5I2cState *s = opaque;
+    uint32_t value = val64;
+
+    trace_stm32l4x5_i2c_write(DEVICE(s)->canonical_path, addr, value);
+
+    switch (addr) {
+    case A_CR1:
+        if (s->cr1 & R_CR1_PE_MASK && !(value & R_CR1_PE_MASK)) {
+            stm32l4x5_i2c_disable(s);
+        }
+        s->cr1 = value;
+        break;
+    case A_CR2:
+        stm32l4x5_i2c_write_cr2(s, value);
+        return;
+    case A_OAR1:
+        s->oar1 = value;
+        break;
+    case A_OAR2:
+        s->oar2 = value;
+        break;
+    case A_TIMINGR:
+        s->timingr = value;
+        break;
+    case A_TIMEOUTR:
+        s->timeoutr = value;
+        break;
+    case A_ISR:
+        /* TXE can be set to flush TXDR, which is always empty here */
+        break;
+    case A_ICR:
+        s->isr &= ~(value & ICR_MASK);
+        break;
+    case A_TXDR:
+        stm32l4x5_i2c_write_txdr(s, value);
+        break;
+    case A_PECR:
+    case A_RXDR:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Read only register 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%" HWADDR_PRIx "\n", __func__, addr);
+        break;
+    }
+
+    stm32l4x5_i2c_update_irq(s);
+}
+
+static const MemoryRegionOps stm32l4x5_i2c_ops = {
+    .read = stm32l4x5_i2c_read,
+    .write = stm32l4x5_i2c_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+        .unaligned = false,
+    },
+};
+
+static void stm32l4x5_i2c_init(Object *obj)
+{
+    Stm32l4x5I2cState *s = STM32L4X5_I2C(obj);
+
+    memory_region_init_io(&s->mmio, obj, &stm32l4x5_i2c_ops, s,
+                          TYPE_STM32L4X5_I2C, 0x400);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+    sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->ev_irq);
+    sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->er_irq);
+    s->clk = qdev_init_clock_in(DEVICE(obj), "clk", NULL, NULL, 0);
+    s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, stm32l4x5_i2c_timer, s);
+}
+
+static void stm32l4x5_i2c_realize(DeviceState *dev, Error **errp)
+{
+    Stm32l4x5I2cState *s = STM32L4X5_I2C(dev);
+
+    /* Named after the SoC child, "i2c1" to "i2c3", for -device bus= */
+    s->bus = i2c_init_bus(dev,
+                          object_get_canonical_path_component(OBJECT(dev)));
+}
+
+static void stm32l4x5_i2c_finalize(Object *obj)
+{
+    Stm32l4x5I2cState *s = STM32L4X5_I2C(obj);
+
+    timer_free(s->timer);
+}
+
+static int stm32l4x5_i2c_post_load(void *opaque, int version_id)
+{
+    Stm32l4x5I2cState *s = opaque;
+
+    if (s->buf_len > STM32L4X5_I2C_BUF_SIZE || s->buf_pos > s->buf_len ||
+        s->count > STM32L4X5_I2C_BUF_SIZE - s->buf_len) {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32l4x5_i2c = {
+    .name = TYPE_STM32L4X5_I2C,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = stm32l4x5_i2c_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(cr1, Stm32l4x5I2cState),
+        VMSTATE_UINT32(cr2, Stm32l4x5I2cState),
+        VMSTATE_UINT32(oar1, Stm32l4x5I2cState),
+        VMSTATE_UINT32(oar2, Stm32l4x5I2cState),
+        VMSTATE_UINT32(timingr, Stm32l4x5I2cState),
+        VMSTATE_UINT32(timeoutr, Stm32l4x5I2cState),
+        VMSTATE_UINT32(isr, Stm32l4x5I2cState),
+        VMSTATE_BOOL(active, Stm32l4x5I2cState),
+        VMSTATE_UINT32(count, Stm32l4x5I2cState),
+        VMSTATE_UINT32(pending, Stm32l4x5I2cState),
+        VMSTATE_UINT32(tx_wire, Stm32l4x5I2cState),
+        VMSTATE_UINT8_ARRAY(buf, Stm32l4x5I2cState, STM32L4X5_I2C_BUF_SIZE),
+        VMSTATE_UINT32(buf_len, Stm32l4x5I2cState),
+        VMSTATE_UINT32(buf_pos, Stm32l4x5I2cState),
+        VMSTATE_TIMER_PTR(timer, Stm32l4x5I2cState),
+        VMSTATE_CLOCK(clk, Stm32l4x5I2cState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void stm32l4x5_i2c_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ResettableClass *rc = RESETTABLE_CLASS(klass);
+
+    dc->realize = stm32l4x5_i2c_realize;
+    dc->vmsd = &vmstate_stm32l4x5_i2c;
+    rc->phases.hold = stm32l4x5_i2c_reset_hold;
+}
+
+static const TypeInfo stm32l4x5_i2c_info = {
+    .name          = TYPE_STM32L4X5_I2C,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(Stm32l4x5I2cState),
+    .instance_init = stm32l4x5_i2c_init,
+    .instance_finalize = stm32l4x5_i2c_finalize,
+    .class_init    = stm32l4x5_i2c_class_init,
+};
+
+static void stm32l4x5_i2c_register_types(void)
+{
+    type_register_static(&stm32l4x5_i2c_info);
+}
+
+type_init(stm32l4x5_i2c_register_types)
@@ -221,6 +221,93 @@ static int exc_group_prio(NVICState *s, int rawprio, bool targets_secure)
     return rawprio;
 }
 
+static void nvic_prio_map_set(NVICPrioMap *m, int prio, int irq)
+{
+    set_bit(irq, m->vec[prio]);
+    if (m->count[prio]++ == 0) {
+        set_bit(prio, m->levels);
+    }
+}
+
+static void nvic_prio_map_clear(NVICPrioMap *m, int prio, int irq)
+{
+    clear_bit(irq, m->vec[prio]);
+    if (--m->count[prio] == 0) {
+        clear_bit(prio, m->levels);
+    }
+}
+
+/* Find the lowest raw priority filed in the map and, if irq is not NULL,
+ * the lowest numbered vector at that priority. Returns false if empty.
+ */
+static bool nvic_prio_map_first(NVICPrioMap *m, int *prio, int *irq)
+{
+    unsigned long lvl = find_first_bit(m->levels, NVIC_PRIO_LEVELS);
+
+    if (lvl >= NVIC_PRIO_LEVELS) {
+        return false;
+    }
+    *prio = lvl;
+    if (irq) {
+        *irq = find_first_bit(m->vec[lvl], NVIC_MAX_VECTORS);
+    }
+    return true;
+}
+
+/* Refile an external interrupt in the priority bitmaps. Must be called
+ * after changes to its enabled, pending, active, prio or ITNS state;
+ * it is a no-op for internal exceptions and if nothing changed.
+ */
+static void nvic_irq_refile(NVICState *s, int irq)
+{
+    VecInfo *vec = &s->vectors[irq];
+    NVICPrioFiled *f = &s->filed[irq];
+    bool pending, active;
+    int bank;
+
+    if (irq < NVIC_FIRST_IRQ) {
+        return;
+    }
+
+    pending = vec->enabled && vec->pending;
+    active = vec->active;
+    bank = exc_targets_secure(s, irq) ? M_REG_S : M_REG_NS;
+
+    if (f->pending == pending && f->active == active &&
+        f->prio == vec->prio && f->bank == bank) {
+        return;
+    }
+
+    if (f->pending) {
+        nvic_prio_map_clear(&s->pend_map[f->bank], f->prio, irq);
+    }
+    if (f->active) {
+        nvic_prio_map_clear(&s->active_map[f->bank], f->prio, irq);
+    }
+    f->prio = vec->prio;
+    f->bank = bank;
+    f->pending = pending;
+    f->active = active;
+    if (pending) {
+        nvic_prio_map_set(&s->pend_map[bank], f->prio, irq);
+    }
+    if (active) {
+        nvic_prio_map_set(&s->active_map[bank], f->prio, irq);
+    }
+}
+
+static void nvic_rebuild_prio_maps(NVICState *s)
+{
+    int i;
+
+    memset(s->pend_map, 0, sizeof(s->pend_map));
+    memset(s->active_map, 0, sizeof(s->active_map));
+    memset(s->filed, 0, sizeof(s->filed));
+    for (i = NVIC_FIRST_IRQ; i < s->num_irq; i++) {
+        nvic_irq_refile(s, i);
+    }
+}
+
 /* Recompute vectpending and exception_prio for a CPU which implements
  * the Security extension
  */
@@ -232,6 +319,8 @@ static void nvic_recompute_state_secure(NVICState *s)
     int pend_irq = 0;
     bool pending_is_s_banked = false;
     int pend_subprio = 0;
+    int cand_irq[M_REG_NUM_BANKS], cand_raw[M_REG_NUM_BANKS];
+    int raw, first, k;
 
     /* R_CQRV: precedence is by:
      *  - lowest group priority; if both the same then
@@ -241,8 +330,10 @@ static void nvic_recompute_state_secure(NVICState *s)
      * Compare pseudocode RawExecutionPriority.
      * Annoyingly, now we have two prigroup values (for S and NS)
      * we can't do the loop comparison on raw priority values.
+     * The internal exceptions are scanned; external interrupts come
+     * from the priority bitmaps below.
      */
-    for (i = 1; i < s->num_irq; i++) {
+    for (i = 1; i < NVIC_FIRST_IRQ; i++) {
         for (bank = M_REG_S; bank >= M_REG_NS; bank--) {
             VecInfo *vec;
             int prio, subprio;
@@ -275,6 +366,48 @@ static void nvic_recompute_state_secure(NVICState *s)
         }
     }
 
+    /* Within one target security state the group priority and then the
+     * subpriority order like the raw priority, so the lowest filed raw
+     * priority gives the best pending interrupt of that state.
+     */
+    for (bank = M_REG_S; bank >= M_REG_NS; bank--) {
+        /* cand_irq stays 0 (never an external interrupt) if none pends */
+        cand_irq[bank] = 0;
+        cand_raw[bank] = 0;
+        nvic_prio_map_first(&s->pend_map[bank], &cand_raw[bank],
+                            &cand_irq[bank]);
+        if (nvic_prio_map_first(&s->active_map[bank], &raw, NULL)) {
+            int prio = exc_group_prio(s, raw, bank == M_REG_S);
+
+            if (prio < active_prio) {
+                active_prio = prio;
+            }
+        }
+    }
+
+    /* Compare the two candidates in exception number order, as the scan
+     * over all vectors would have done.
+     */
+    first = cand_irq[M_REG_NS] &&
+        (!cand_irq[M_REG_S] || cand_irq[M_REG_NS] < cand_irq[M_REG_S]) ?
+        M_REG_NS : M_REG_S;
+    for (k = 0; k < M_REG_NUM_BANKS; k++) {
+        int prio, subprio;
+
+        bank = k ? !first : first;
+        if (!cand_irq[bank]) {
+            continue;
+        }
+        prio = exc_group_prio(s, cand_raw[bank], bank == M_REG_S);
+        subprio = cand_raw[bank] & ~nvic_gprio_mask(s, bank == M_REG_S);
+        if (prio < pend_prio || (prio == pend_prio && subprio < pend_subprio)) {
+            pend_prio = prio;
+            pend_subprio = subprio;
+            pend_irq = cand_irq[bank];
+            pending_is_s_banked = false;
+        }
+    }
+
     s->vectpending_is_s_banked = pending_is_s_banked;
     s->vectpending = pend_irq;
     s->vectpending_prio = pend_prio;
@@ -293,6 +426,7 @@ static void nvic_recompute_state(NVICState *s)
     int pend_prio = NVIC_NOEXC_PRIO;
     int active_prio = NVIC_NOEXC_PRIO;
     int pend_irq = 0;
+    int prio, irq;
 
     /* In theory we could write one function that handled both
      * the "security extension present" and "not present"; however
@@ -306,7 +440,7 @@ static void nvic_recompute_state(NVICState *s)
         return;
     }
 
-    for (i = 1; i < s->num_irq; i++) {
+    for (i = 1; i < NVIC_FIRST_IRQ; i++) {
         VecInfo *vec = &s->vectors[i];
 
         if (vec->enabled && vec->pending && vec->prio < pend_prio) {
@@ -318,6 +452,19 @@ static void nvic_recompute_state(NVICState *s)
         }
     }
 
+    /* External interrupts have higher exception numbers, so they only win
+     * with a strictly lower priority.
+     */
+    if (nvic_prio_map_first(&s->pend_map[M_REG_NS], &prio, &irq) &&
+        prio < pend_prio) {
+        pend_prio = prio;
+        pend_irq = irq;
+    }
+    if (nvic_prio_map_first(&s->active_map[M_REG_NS], &prio, NULL) &&
+        prio < active_prio) {
+        active_prio = prio;
+    }
+
     if (active_prio > 0) {
         active_prio &= nvic_gprio_mask(s, false);
     }
@@ -444,6 +591,7 @@ static void set_prio(NVICState *s, unsigned irq, bool secure, uint8_t prio)
         s->sec_vectors[irq].prio = prio;
     } else {
         s->vectors[irq].prio = prio;
+        nvic_irq_refile(s, irq);
     }
 
     trace_nvic_set_prio(irq, secure, prio);
@@ -517,6 +665,7 @@ static void armv7m_nvic_clear_pending(NVICState *s, int irq, bool secure)
     trace_nvic_clear_pending(irq, secure, vec->enabled, vec->prio);
     if (vec->pending) {
         vec->pending = 0;
+        nvic_irq_refile(s, irq);
         nvic_irq_update(s);
     }
 }
@@ -657,6 +806,7 @@ static void do_armv7m_nvic_set_pending(void *opaque, int irq, bool secure,
 
     if (!vec->pending) {
         vec->pending = 1;
+        nvic_irq_refile(s, irq);
         nvic_irq_update(s);
     }
 }
@@ -791,6 +941,9 @@ void armv7m_nvic_acknowledge_irq(NVICState *s)
 
     vec->active = 1;
     vec->pending = 0;
+    if (!s->vectpending_is_s_banked) {
+        nvic_irq_refile(s, pending);
+    }
 
     write_v7m_exception(env, s->vectpending);
 
@@ -900,6 +1053,7 @@ int armv7m_nvic_complete_irq(NVICState *s, int irq, bool secure)
         assert(irq >= NVIC_FIRST_IRQ);
         vec->pending = 1;
     }
+    nvic_irq_refile(s, irq);
 
     nvic_irq_update(s);
 
@@ -1575,6 +1729,7 @@ static void nvic_writel(NVICState *s, uint32_t offset, uint32_t value,
         }
         for (i = 0; i < 32 && startvec + i < s->num_irq; i++) {
             s->itns[startvec + i] = (value >> i) & 1;
+            nvic_irq_refile(s, startvec + i);
         }
         nvic_irq_update(s);
         break;
@@ -1872,6 +2027,7 @@ static void nvic_writel(NVICState *s, uint32_t offset, uint32_t value,
                 return;
             }
             cpu->env.pmsav8.rbar[attrs.secure][region] = value;
+            arm_mpu_cache_invalidate(cpu);
             tlb_flush(CPU(cpu));
             return;
         }
@@ -1897,6 +2053,7 @@ static void nvic_writel(NVICState *s, uint32_t offset, uint32_t value,
         }
 
         cpu->env.pmsav7.drbar[region] = value & ~0x1f;
+        arm_mpu_cache_invalidate(cpu);
         tlb_flush(CPU(cpu));
         break;
     }
@@ -1922,6 +2079,7 @@ static void nvic_writel(NVICState *s, uint32_t offset, uint32_t value,
                 return;
             }
             cpu->env.pmsav8.rlar[attrs.secure][region] = value;
+            arm_mpu_cache_invalidate(cpu);
             tlb_flush(CPU(cpu));
             return;
         }
@@ -1932,6 +2090,7 @@ static void nvic_writel(NVICState *s, uint32_t offset, uint32_t value,
 
         cpu->env.pmsav7.drsr[region] = value & 0xff3f;
         cpu->env.pmsav7.dracr[region] = (value >> 16) & 0x173f;
+        arm_mpu_cache_invalidate(cpu);
         tlb_flush(CPU(cpu));
         break;
     }
@@ -2364,6 +2523,7 @@ static MemTxResult nvic_sysreg_write(void *opaque, hwaddr addr,
             if (value & (1 << i) &&
                 (attrs.secure || s->itns[startvec + i])) {
                 s->vectors[startvec + i].enabled = setval;
+                nvic_irq_refile(s, startvec + i);
             }
         }
         nvic_irq_update(s);
@@ -2389,6 +2549,7 @@ static MemTxResult nvic_sysreg_write(void *opaque, hwaddr addr,
                 !(setval == 0 && s->vectors[startvec + i].level &&
                   !s->vectors[startvec + i].active)) {
                 s->vectors[startvec + i].pending = setval;
+                nvic_irq_refile(s, startvec + i);
             }
         }
         nvic_irq_update(s);
@@ -2489,6 +2650,7 @@ static int nvic_post_load(void *opaque, int version_id)
         }
     }
 
+    nvic_rebuild_prio_maps(s);
     nvic_recompute_state(s);
 
     return 0;
@@ -2645,6 +2807,8 @@ static void armv7m_nvic_reset(DeviceState *dev)
         }
     }
 
+    nvic_rebuild_prio_maps(s);
+
     if (tcg_enabled()) {
         /*
          * We updated state that affects the CPU's MMUidx and thus its
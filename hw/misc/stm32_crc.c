@@ -0,0 +1,362 @@
+/*
+ * STM32 CRC calculation unit
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * CRC calculation unit of the STM32F4 (RM0090 section 4) and, with the
+ * "configurable" property, of the STM32L4 (RM0351 section 14) which adds a
+ * programmable initial value and polynomial of 7, 8, 16 or 32 bits, bit
+ * reversal of the input data and of the result, and 8 or 16 bit writes.
+ *
+ * The CRC is computed MSB first with the register left aligned on 32 bits,
+ * through slicing-by-4 tables rebuilt when the polynomial changes.  When
+ * the input is reversed per item, with the default 32 bit polynomial, the
+ * data is the reflected CRC-32 of zlib which is used instead.  DR writes,
+ * including the ones of DMA streams, go through stm32_crc_write_bulk()
+ * one item at a time.
+ *
+ * Not modelled: the AHB wait states while a word is computed.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/host-utils.h"
+#include "hw/registerfields.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
+#include "hw/misc/stm32_crc.h"
+#include "trace.h"
+
+#include <zlib.h>
+
+REG32(DR, 0x00)
+REG32(IDR, 0x04)
+REG32(CR, 0x08)
+    FIELD(CR, RESET, 0, 1)
+    FIELD(CR, POLYSIZE, 3, 2)
+    FIELD(CR, REV_IN, 5, 2)
+    FIELD(CR, REV_OUT, 7, 1)
+REG32(INIT, 0x10)
+REG32(POL, 0x14)
+
+#define CR_MASK (R_CR_POLYSIZE_MASK | R_CR_REV_IN_MASK | R_CR_REV_OUT_MASK)
+
+#define CRC_INIT_RESET 0xFFFFFFFF
+#define CRC_POL_RESET 0x04C11DB7
+
+static unsigned stm32_crc_width(STM32CrcState *s)
+{
+    static const unsigned width[] = { 32, 16, 8, 7 };
+
+    return width[FIELD_EX32(s->cr, CR, POLYSIZE)];
+}
+
+static uint32_t stm32_crc_mask(STM32CrcState *s)
+{
+    return MAKE_64BIT_MASK(0, stm32_crc_width(s));
+}
+
+static void stm32_crc_update_tables(STM32CrcState *s)
+{
+    unsigned width = stm32_crc_width(s);
+    uint32_t poly = (s->pol & stm32_crc_mask(s)) << (32 - width);
+
+    for (unsigned b = 0; b < 256; b++) {
+        uint32_t crc = b << 24;
+
+        for (int i = 0; i < 8; i++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ poly : crc << 1;
+        }
+        s->table[0][b] = crc;
+    }
+    for (unsigned b = 0; b < 256; b++) {
+        for (int k = 1; k < 4; k++) {
+            uint32_t crc = s->table[k - 1][b];
+
+            s->table[k][b] = (crc << 8) ^ s->table[0][crc >> 24];
+        }
+    }
+}
+
+/* Process one item of @size bytes, MSB first, on the left aligned CRC */
+static uint32_t stm32_crc_item(STM32CrcState *s, uint32_t crc, uint32_t val,
+                               unsigned size)
+{
+    uint32_t (*t)[256] = s->table;
+    uint32_t x;
+
+    switch (size) {
+    case 4:
+        x = crc ^ val;
+        return t[3][x >> 24] ^ t[2][(x >> 16) & 0xff] ^
+               t[1][(x >> 8) & 0xff] ^ t[0][x & 0xff];
+    case 2:
+        x = crc ^ (val << 16);
+        return (x << 16) ^ t[1][x >> 24] ^ t[0][(x >> 16) & 0xff];
+    default:
+        x = crc ^ (val << 24);
+        return (x << 8) ^ t[0][x >> 24];
+    }
+}
+
+/* REV_IN: bit reversal by byte, half-word or word, within the item */
+static uint32_t stm32_crc_rev_in(STM32CrcState *s, uint32_t val,
+                                 unsigned size)
+{
+    unsigned rev = FIELD_EX32(s->cr, CR, REV_IN);
+    unsigned unit;
+
+    if (!rev) {
+        return val;
+    }
+    unit = MIN(1 << (rev - 1), size);
+    switch (unit) {
+    case 4:
+        return revbit32(val);
+    case 2:
+        return revbit16(val) | (uint32_t)revbit16(val >> 16) << 16;
+    default:
+        return revbit8(val) | revbit8(val >> 8) << 8 |
+               revbit8(val >> 16) << 16 | (uint32_t)revbit8(val >> 24) << 24;
+    }
+}
+
+/* The input is consumed LSB first in memory order, as CRC-32 does */
+static bool stm32_crc_is_crc32(STM32CrcState *s, unsigned size)
+{
+    unsigned rev = FIELD_EX32(s->cr, CR, REV_IN);
+
+    return rev && (1 << (rev - 1)) >= size && stm32_crc_width(s) == 32 &&
+           s->pol == CRC_POL_RESET;
+}
+
+size_t stm32_crc_write_bulk(void *opaque, const uint8_t *buf, size_t len,
+                            unsigned item_size)
+{
+    STM32CrcState *s = opaque;
+    unsigned width = stm32_crc_width(s);
+    uint32_t crc = s->dr << (32 - width);
+    size_t done = 0;
+
+    trace_stm32_crc_bulk(len, item_size);
+    if (!s->configurable && item_size != 4) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: DR only takes words\n", __func__);
+        return len;
+    }
+    len &= ~(size_t)(item_size - 1);
+
+    if (stm32_crc_is_crc32(s, item_size)) {
+        while (done < len) {
+            unsigned n = MIN(len - done, UINT_MAX);
+
+            crc = revbit32(~crc32(~revbit32(crc), buf + done, n));
+            done += n;
+        }
+    } else if (item_size == 1 && !FIELD_EX32(s->cr, CR, REV_IN)) {
+        /* Bytes are processed in order, four at a time */
+        for (; done + 4 <= len; done += 4) {
+            crc = stm32_crc_item(s, crc, ldl_be_p(buf + done), 4);
+        }
+    }
+    for (; done < len; done += item_size) {
+        uint32_t val = ldn_le_p(buf + done, item_size);
+
+        crc = stm32_crc_item(s, crc, stm32_crc_rev_in(s, val, item_size),
+                             item_size);
+    }
+
+    s->dr = crc >> (32 - width);
+    return len;
+}
+
+static uint32_t stm32_crc_read_dr(STM32CrcState *s)
+{
+    unsigned width = stm32_crc_width(s);
+
+    if (FIELD_EX32(s->cr, CR, REV_OUT)) {
+        return revbit32(s->dr) >> (32 - width);
+    }
+    return s->dr;
+}
+
+static uint64_t stm32_crc_read(void *opaque, hwaddr addr, unsigned size)
+{
+    STM32CrcState *s = opaque;
+    hwaddr reg = addr & ~3;
+    uint32_t val = 0;
+
+    switch (reg) {
+    case A_DR:
+        val = stm32_crc_read_dr(s);
+        break;
+    case A_IDR:
+        val = s->idr;
+        break;
+    case A_CR:
+        val = s->cr;
+        break;
+    case A_INIT:
+        if (s->configurable) {
+            val = s->init;
+            break;
+        }
+        /* fall through */
+    case A_POL:
+        if (s->configurable) {
+            val = s->pol;
+            break;
+        }
+        /* fall through */
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        break;
+    }
+    trace_stm32_crc_read(addr, val);
+    return extract32(val, (addr & 3) * 8, size * 8);
+}
+
+static void stm32_crc_write(void *opaque, hwaddr addr, uint64_t val64,
+                            unsigned size)
+{
+    STM32CrcState *s = opaque;
+    hwaddr reg = addr & ~3;
+    unsigned shift = (addr & 3) * 8;
+    uint32_t val = val64;
+    uint8_t buf[4];
+
+    trace_stm32_crc_write(addr, val);
+    switch (reg) {
+    case A_DR:
+        if (shift) {
+            qemu_log_mask(LOG_GUEST_ERROR, "%s: unaligned DR write\n",
+                          __func__);
+            break;
+        }
+        stn_le_p(buf, size, val);
+        stm32_crc_write_bulk(s, buf, size, size);
+        break;
+    case A_IDR:
+        s->idr = deposit32(s->idr, shift, size * 8, val) & 0xff;
+        break;
+    case A_CR:
+        val = deposit32(s->cr, shift, size * 8, val);
+        if (s->configurable) {
+            s->cr = val & CR_MASK;
+            stm32_crc_update_tables(s);
+        }
+        /* RESET is cleared by hardware */
+        if (FIELD_EX32(val, CR, RESET)) {
+            s->dr = s->init & stm32_crc_mask(s);
+        }
+        break;
+    case A_INIT:
+        if (s->configurable) {
+            s->init = deposit32(s->init, shift, size * 8, val);
+            s->dr = s->init & stm32_crc_mask(s);
+            break;
+        }
+        /* fall through */
+    case A_POL:
+        if (s->configurable) {
+            s->pol = deposit32(s->pol, shift, size * 8, val);
+            if (!(s->pol & 1)) {
+                qemu_log_mask(LOG_GUEST_ERROR,
+                              "%s: even polynomials are not supported\n",
+                              __func__);
+            }
+            stm32_crc_update_tables(s);
+            break;
+        }
+        /* fall through */
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        break;
+    }
+}
+
+static const MemoryRegionOps stm32_crc_ops = {
+    .read = stm32_crc_read,
+    .write = stm32_crc_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .impl.min_access_size = 1,
+    .impl.max_access_size = 4,
+    .valid.min_access_size = 1,
+    .valid.max_access_size = 4,
+};
+
+static void stm32_crc_hold_reset(Object *obj)
+{
+    STM32CrcState *s = STM32_CRC(obj);
+
+    s->dr = CRC_INIT_RESET;
+    s->idr = 0;
+    s->cr = 0;
+    s->init = CRC_INIT_RESET;
+    s->pol = CRC_POL_RESET;
+    stm32_crc_update_tables(s);
+}
+
+static void stm32_crc_init(Object *obj)
+{
+    STM32CrcState *s = STM32_CRC(obj);
+
+    memory_region_init_io(&s->mmio, obj, &stm32_crc_ops, s,
+                          TYPE_STM32_CRC, 0x400);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+}
+
+static int stm32_crc_post_load(void *opaque, int version_id)
+{
+    stm32_crc_update_tables(opaque);
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32_crc = {
+    .name = TYPE_STM32_CRC,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = stm32_crc_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(dr, STM32CrcState),
+        VMSTATE_UINT32(idr, STM32CrcState),
+        VMSTATE_UINT32(cr, STM32CrcState),
+        VMSTATE_UINT32(init, STM32CrcState),
+        VMSTATE_UINT32(pol, STM32CrcState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property stm32_crc_properties[] = {
+    /* STM32L4 and later: INIT, POL, reversal and 8/16 bit input */
+    DEFINE_PROP_BOOL("configurable", STM32CrcState, configurable, false),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void stm32_crc_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ResettableClass *rc = RESETTABLE_CLASS(klass);
+
+    dc->vmsd = &vmstate_stm32_crc;
+    device_class_set_props(dc, stm32_crc_properties);
+    rc->phases.hold = stm32_crc_hold_reset;
+}
+
+static const TypeInfo stm32_crc_info[] = {
+    {
+        .name          = TYPE_STM32_CRC,
+        .parent        = TYPE_SYS_BUS_DEVICE,
+        .instance_size = sizeof(STM32CrcState),
+        .instance_init = stm32_crc_init,
+        .class_init    = stm32_crc_class_init,
+    }
+};
+
+DEFINE_TYPES(stm32_crc_info)
@@ -0,0 +1,201 @@
+/*
+ * STM32 random number generator
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * True random number generator of the STM32F4 (RM0090 section 24), also
+ * found in the STM32L4 (RM0351 section 38).  The numbers come from
+ * qemu_guest_getrandom(), so they are reproducible with -seed.  A new
+ * number is ready 40 periods of the 48 MHz RNG clock after the previous
+ * one is read, in virtual time.  The clock and seed errors never happen.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/timer.h"
+#include "qemu/guest-random.h"
+#include "hw/irq.h"
+#include "hw/registerfields.h"
+#include "migration/vmstate.h"
+#include "hw/misc/stm32_rng.h"
+#include "trace.h"
+
+REG32(CR, 0x00)
+    FIELD(CR, RNGEN, 2, 1)
+    FIELD(CR, IE, 3, 1)
+REG32(SR, 0x04)
+    FIELD(SR, DRDY, 0, 1)
+    FIELD(SR, CECS, 1, 1)
+    FIELD(SR, SECS, 2, 1)
+    FIELD(SR, CEIS, 5, 1)
+    FIELD(SR, SEIS, 6, 1)
+REG32(DR, 0x08)
+
+#define CR_MASK (R_CR_RNGEN_MASK | R_CR_IE_MASK)
+#define SR_ERRORS (R_SR_CEIS_MASK | R_SR_SEIS_MASK)
+
+/* 40 periods of the RNG clock */
+#define RNG_READY_NS 833
+
+static void stm32_rng_update_irq(STM32RngState *s)
+{
+    bool level = FIELD_EX32(s->cr, CR, IE) &&
+                 (s->sr & (R_SR_DRDY_MASK | SR_ERRORS));
+
+    qemu_set_irq(s->irq, level);
+}
+
+static void stm32_rng_generate(STM32RngState *s)
+{
+    timer_mod(s->timer,
+              qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + RNG_READY_NS);
+}
+
+static void stm32_rng_ready(void *opaque)
+{
+    STM32RngState *s = opaque;
+
+    qemu_guest_getrandom_nofail(&s->dr, sizeof(s->dr));
+    s->sr |= R_SR_DRDY_MASK;
+    stm32_rng_update_irq(s);
+}
+
+static uint64_t stm32_rng_read(void *opaque, hwaddr addr, unsigned size)
+{
+    STM32RngState *s = opaque;
+    uint32_t val = 0;
+
+    switch (addr) {
+    case A_CR:
+        val = s->cr;
+        break;
+    case A_SR:
+        val = s->sr;
+        break;
+    case A_DR:
+        /* Reading the number starts the next one */
+        if (FIELD_EX32(s->sr, SR, DRDY)) {
+            val = s->dr;
+            s->sr &= ~R_SR_DRDY_MASK;
+            stm32_rng_generate(s);
+            stm32_rng_update_irq(s);
+        }
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        break;
+    }
+    trace_stm32_rng_read(addr, val);
+    return val;
+}
+
+static void stm32_rng_write(void *opaque, hwaddr addr, uint64_t val64,
+                            unsigned size)
+{
+    STM32RngState *s = opaque;
+    uint32_t val = val64;
+
+    trace_stm32_rng_write(addr, val);
+    switch (addr) {
+    case A_CR:
+        if (FIELD_EX32(val, CR, RNGEN) && !FIELD_EX32(s->cr, CR, RNGEN)) {
+            stm32_rng_generate(s);
+        } else if (!FIELD_EX32(val, CR, RNGEN)) {
+            timer_del(s->timer);
+            s->sr &= ~R_SR_DRDY_MASK;
+        }
+        s->cr = val & CR_MASK;
+        stm32_rng_update_irq(s);
+        break;
+    case A_SR:
+        /* CEIS and SEIS are cleared by writing 0 */
+        s->sr &= val | ~SR_ERRORS;
+        stm32_rng_update_irq(s);
+        break;
+    case A_DR:
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        break;
+    }
+}
+
+static const MemoryRegionOps stm32_rng_ops = {
+    .read = stm32_rng_read,
+    .write = stm32_rng_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl.min_access_size = 4,
+    .impl.max_access_size = 4,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+static void stm32_rng_hold_reset(Object *obj)
+{
+    STM32RngState *s = STM32_RNG(obj);
+
+    timer_del(s->timer);
+    s->cr = 0;
+    s->sr = 0;
+    s->dr = 0;
+    stm32_rng_update_irq(s);
+}
+
+static void stm32_rng_init(Object *obj)
+{
+    STM32RngState *s = STM32_RNG(obj);
+
+    memory_region_init_io(&s->mmio, obj, &stm32_rng_ops, s,
+                          TYPE_STM32_RNG, 0x400);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+    sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq);
+}
+
+static void stm32_rng_realize(DeviceState *dev, Error **errp)
+{
+    STM32RngState *s = STM32_RNG(dev);
+
+    s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, stm32_rng_ready, s);
+}
+
+static const VMStateDescription vmstate_stm32_rng = {
+    .name = TYPE_STM32_RNG,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(cr, STM32RngState),
+        VMSTATE_UINT32(sr, STM32RngState),
+        VMSTATE_UINT32(dr, STM32RngState),
+        VMSTATE_TIMER_PTR(timer, STM32RngState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void stm32_rng_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ResettableClass *rc = RESETTABLE_CLASS(klass);
+
+    dc->realize = stm32_rng_realize;
+    dc->vmsd = &vmstate_stm32_rng;
+    rc->phases.hold = stm32_rng_hold_reset;
+}
+
+static const TypeInfo stm32_rng_info[] = {
+    {
+        .name          = TYPE_STM32_RNG,
+        .parent        = TYPE_SYS_BUS_DEVICE,
+        .instance_size = sizeof(STM32RngState),
+        .instance_init = stm32_rng_init,
+        .class_init    = stm32_rng_class_init,
+    }
+};
+
+DEFINE_TYPES(stm32_rng_info)
@@ -26,18 +26,7 @@
 #include "hw/misc/stm32f2xx_syscfg.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
-
-#ifndef STM_SYSCFG_ERR_DEBUG
-#define STM_SYSCFG_ERR_DEBUG 0
-#endif
-
-#define DB_PRINT_L(lvl, fmt, args...) do { \
-    if (STM_SYSCFG_ERR_DEBUG >= lvl) { \
-        qemu_log("%s: " fmt, __func__, ## args); \
-    } \
-} while (0)
-
-#define DB_PRINT(fmt, args...) DB_PRINT_L(1, fmt, ## args)
+#include "trace.h"
 
 static void stm32f2xx_syscfg_reset(DeviceState *dev)
 {
@@ -57,7 +46,7 @@ static uint64_t stm32f2xx_syscfg_read(void *opaque, hwaddr addr,
 {
     STM32F2XXSyscfgState *s = opaque;
 
-    DB_PRINT("0x%"HWADDR_PRIx"\n", addr);
+    trace_stm32f2xx_syscfg_read(addr);
 
     switch (addr) {
     case SYSCFG_MEMRMP:
@@ -89,7 +78,7 @@ static void stm32f2xx_syscfg_write(void *opaque, hwaddr addr,
     STM32F2XXSyscfgState *s = opaque;
     uint32_t value = val64;
 
-    DB_PRINT("0x%x, 0x%"HWADDR_PRIx"\n", value, addr);
+    trace_stm32f2xx_syscfg_write(addr, value);
 
     switch (addr) {
     case SYSCFG_MEMRMP:
@@ -0,0 +1,696 @@
+/*
+ * STM32F4xx embedded flash memory interface
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Flash interface of the STM32F40x/41x/42x/43x (RM0090 section 3).
+ *
+ * The flash is mapped as a read only view of its backing memory, so that
+ * fetches and loads take the TLB fast path.  While CR.PG is set an I/O
+ * overlay traps the accesses to program the flash; erase and option byte
+ * operations act from the registers.  Each operation keeps SR.BSY set for
+ * its typical duration (datasheet, x32 parallelism) in virtual time, unless
+ * "busy-timing" is off.
+ *
+ * The backing memory can be a host memory backend ("memdev").  With a
+ * shared memory-backend-file the contents are mmap'd from the host file:
+ * they survive a restart and nothing is copied at startup.  Boards running
+ * several instances of a SoC can also point the "shared" link at the flash
+ * interface of the first one: the instances then use the same RAM block,
+ * so the firmware is loaded once and translated code is reused by all the
+ * vCPUs.  The first program or erase operation of an instance, the first
+ * one included, gives it a private copy of the memory: the others keep
+ * the memory and the code translated from it, while the writes of this
+ * instance only invalidate the code translated from its copy.  The copy
+ * is made at run time, so a VM with one cannot be migrated.
+ *
+ * Devices with 2 MiB of flash have two banks of 12 sectors, the sectors of
+ * bank 2 being numbered 16 to 27 in CR.SNB.  The option bytes are kept by
+ * the device across resets, not in the backing memory.  ACR (offset 0) is
+ * the stm32-flash-acr device, mapped over this one by the SoC.
+ *
+ * Not modelled: the bus stall when accessing the flash while BSY is set,
+ * the PCROP mode (SPRMOD), and read protection towards the debugger; only
+ * the mass erase when going back from level 1 to level 0, and the option
+ * bytes freezing at level 2, are.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "hw/irq.h"
+#include "hw/registerfields.h"
+#include "hw/qdev-properties.h"
+#include "hw/core/cpu.h"
+#include "migration/vmstate.h"
+#include "hw/misc/stm32f4xx_flash.h"
+#include "trace.h"
+
+REG32(KEYR, 0x04)
+REG32(OPTKEYR, 0x08)
+REG32(SR, 0x0C)
+    FIELD(SR, EOP, 0, 1)
+    FIELD(SR, OPERR, 1, 1)
+    FIELD(SR, WRPERR, 4, 1)
+    FIELD(SR, PGAERR, 5, 1)
+    FIELD(SR, PGPERR, 6, 1)
+    FIELD(SR, PGSERR, 7, 1)
+    FIELD(SR, BSY, 16, 1)
+REG32(CR, 0x10)
+    FIELD(CR, PG, 0, 1)
+    FIELD(CR, SER, 1, 1)
+    FIELD(CR, MER, 2, 1)
+    FIELD(CR, SNB, 3, 5)
+    FIELD(CR, PSIZE, 8, 2)
+    FIELD(CR, MER1, 15, 1)
+    FIELD(CR, STRT, 16, 1)
+    FIELD(CR, EOPIE, 24, 1)
+    FIELD(CR, ERRIE, 25, 1)
+    FIELD(CR, LOCK, 31, 1)
+REG32(OPTCR, 0x14)
+    FIELD(OPTCR, OPTLOCK, 0, 1)
+    FIELD(OPTCR, OPTSTRT, 1, 1)
+    FIELD(OPTCR, RDP, 8, 8)
+    FIELD(OPTCR, NWRP, 16, 12)
+REG32(OPTCR1, 0x18)
+    FIELD(OPTCR1, NWRP, 16, 12)
+
+#define FLASH_KEY1 0x45670123
+#define FLASH_KEY2 0xCDEF89AB
+#define FLASH_OPTKEY1 0x08192A3B
+#define FLASH_OPTKEY2 0x4C5D6E7F
+
+/* Progress of an unlock sequence */
+enum {
+    KEY_NONE,
+    KEY_FIRST,
+    /* A wrong key locks the register until reset */
+    KEY_FAILED,
+};
+
+#define SR_ERRORS (R_SR_OPERR_MASK | R_SR_WRPERR_MASK | R_SR_PGAERR_MASK | \
+                   R_SR_PGPERR_MASK | R_SR_PGSERR_MASK)
+#define CR_MASK (R_CR_PG_MASK | R_CR_SER_MASK | R_CR_MER_MASK | \
+                 R_CR_SNB_MASK | R_CR_PSIZE_MASK | R_CR_MER1_MASK | \
+                 R_CR_EOPIE_MASK | R_CR_ERRIE_MASK)
+/* BOR_LEV, BFB2, USER, RDP, nWRP, DB1M and SPRMOD */
+#define OPTCR_OPT_MASK 0xCFFFFFFC
+#define OPTCR1_OPT_MASK R_OPTCR1_NWRP_MASK
+
+#define RDP_LEVEL0 0xAA
+#define RDP_LEVEL2 0xCC
+
+#define SECTORS_PER_BANK 12
+
+/* Typical durations, from the STM32F405 datasheet */
+#define PROGRAM_NS (16 * SCALE_US)
+#define ERASE_16K_NS (250 * SCALE_MS)
+#define ERASE_64K_NS (700 * SCALE_MS)
+#define ERASE_128K_NS (1000 * SCALE_MS)
+#define ERASE_BANK_NS (8000 * SCALE_MS)
+
+static bool stm32f4xx_flash_dual_bank(STM32F4xxFlashState *s)
+{
+    return s->size == 2 * MiB;
+}
+
+static uint32_t stm32f4xx_flash_bank_size(STM32F4xxFlashState *s)
+{
+    return stm32f4xx_flash_dual_bank(s) ? s->size / 2 : s->size;
+}
+
+/*
+ * Each bank has four 16 KiB sectors, one of 64 KiB, then 128 KiB sectors.
+ * Return false if SNB does not name a sector of this device.
+ */
+static bool stm32f4xx_flash_sector(STM32F4xxFlashState *s, unsigned snb,
+                                   hwaddr *offset, uint32_t *len)
+{
+    unsigned bank = snb >> 4;
+    unsigned n = snb & 0xf;
+    hwaddr start;
+
+    if ((bank && !stm32f4xx_flash_dual_bank(s)) || n >= SECTORS_PER_BANK) {
+        return false;
+    }
+    if (n < 4) {
+        start = n * 16 * KiB;
+        *len = 16 * KiB;
+    } else if (n == 4) {
+        start = 64 * KiB;
+        *len = 64 * KiB;
+    } else {
+        start = (n - 4) * 128 * KiB;
+        *len = 128 * KiB;
+    }
+    if (start + *len > stm32f4xx_flash_bank_size(s)) {
+        return false;
+    }
+    *offset = bank * stm32f4xx_flash_bank_size(s) + start;
+    return true;
+}
+
+static bool stm32f4xx_flash_protected(STM32F4xxFlashState *s, hwaddr offset)
+{
+    uint32_t bank_size = stm32f4xx_flash_bank_size(s);
+    hwaddr o = offset % bank_size;
+    unsigned n;
+
+    if (o < 64 * KiB) {
+        n = o / (16 * KiB);
+    } else if (o < 128 * KiB) {
+        n = 4;
+    } else {
+        n = 4 + o / (128 * KiB);
+    }
+    if (offset >= bank_size) {
+        return !extract32(s->opt1, R_OPTCR1_NWRP_SHIFT + n, 1);
+    }
+    return !extract32(s->opt, R_OPTCR_NWRP_SHIFT + n, 1);
+}
+
+static void stm32f4xx_flash_update_irq(STM32F4xxFlashState *s)
+{
+    bool level = (FIELD_EX32(s->sr, SR, EOP) &&
+                  FIELD_EX32(s->cr, CR, EOPIE)) ||
+                 (FIELD_EX32(s->sr, SR, OPERR) &&
+                  FIELD_EX32(s->cr, CR, ERRIE));
+
+    qemu_set_irq(s->irq, level);
+}
+
+static void stm32f4xx_flash_update_mapping(STM32F4xxFlashState *s)
+{
+    memory_region_set_enabled(&s->prog, FIELD_EX32(s->cr, CR, PG));
+}
+
+static void stm32f4xx_flash_error(STM32F4xxFlashState *s, uint32_t flag)
+{
+    s->sr |= flag;
+    /* OPERR is only set with error interrupts enabled */
+    if (FIELD_EX32(s->cr, CR, ERRIE)) {
+        s->sr |= R_SR_OPERR_MASK;
+    }
+    stm32f4xx_flash_update_irq(s);
+}
+
+static void stm32f4xx_flash_done(STM32F4xxFlashState *s)
+{
+    s->sr &= ~R_SR_BSY_MASK;
+    /* EOP is only set with end of operation interrupts enabled */
+    if (FIELD_EX32(s->cr, CR, EOPIE)) {
+        s->sr |= R_SR_EOP_MASK;
+    }
+    stm32f4xx_flash_update_irq(s);
+}
+
+/* Operations queue up behind the one in progress */
+static void stm32f4xx_flash_busy(STM32F4xxFlashState *s, int64_t ns)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    if (!s->busy_timing) {
+        stm32f4xx_flash_done(s);
+        return;
+    }
+    s->sr |= R_SR_BSY_MASK;
+    s->busy_until = MAX(now, s->busy_until) + ns;
+    trace_stm32f4xx_flash_busy(s->busy_until - now);
+    timer_mod(s->busy_timer, s->busy_until);
+}
+
+static void stm32f4xx_flash_busy_expired(void *opaque)
+{
+    stm32f4xx_flash_done(opaque);
+}
+
+/*
+ * Before the first write to memory shared with other boards, move this
+ * one to a private copy.  The change of memory map flushes its TLB and TB
+ * jump cache, so it translates its copy, while the other boards keep
+ * running the code translated from the shared memory.
+ */
+static void stm32f4xx_flash_unshare(STM32F4xxFlashState *s)
+{
+    if (s->copied || (!s->shared && !s->nr_sharers)) {
+        return;
+    }
+    memory_region_init_ram(&s->copy, OBJECT(s), "stm32f4xx-flash.copy",
+                           s->size, &error_fatal);
+    memcpy(memory_region_get_ram_ptr(&s->copy),
+           memory_region_get_ram_ptr(s->backing), s->size);
+    memory_region_transaction_begin();
+    memory_region_del_subregion(&s->store, &s->shared_store);
+    memory_region_add_subregion(&s->store, 0, &s->copy);
+    memory_region_transaction_commit();
+    s->copied = true;
+    trace_stm32f4xx_flash_unshare(s->size);
+
+    /* Leave TBs chained within the shared memory */
+    if (current_cpu) {
+        cpu_exit(current_cpu);
+    }
+}
+
+static void stm32f4xx_flash_erase_range(STM32F4xxFlashState *s,
+                                        hwaddr offset, uint32_t len)
+{
+    stm32f4xx_flash_unshare(s);
+    trace_stm32f4xx_flash_erase(offset, len);
+    address_space_set(&s->as, offset, 0xff, len, MEMTXATTRS_UNSPECIFIED);
+}
+
+static void stm32f4xx_flash_erase(STM32F4xxFlashState *s)
+{
+    uint32_t bank_size = stm32f4xx_flash_bank_size(s);
+    bool mer = FIELD_EX32(s->cr, CR, MER);
+    bool mer1 = FIELD_EX32(s->cr, CR, MER1) && stm32f4xx_flash_dual_bank(s);
+    hwaddr offset, o;
+    uint32_t len;
+    int64_t ns = 0;
+
+    if (FIELD_EX32(s->cr, CR, PG) || (!mer && !mer1 &&
+                                      !FIELD_EX32(s->cr, CR, SER))) {
+        stm32f4xx_flash_error(s, R_SR_PGSERR_MASK);
+        return;
+    }
+
+    if (mer || mer1) {
+        /* A mass erase is refused as a whole if any sector is protected */
+        for (o = mer ? 0 : bank_size; o < (mer1 ? s->size : bank_size);
+             o += 16 * KiB) {
+            if (stm32f4xx_flash_protected(s, o)) {
+                stm32f4xx_flash_error(s, R_SR_WRPERR_MASK);
+                return;
+            }
+        }
+        if (mer) {
+            stm32f4xx_flash_erase_range(s, 0, bank_size);
+            ns += ERASE_BANK_NS;
+        }
+        if (mer1) {
+            stm32f4xx_flash_erase_range(s, bank_size, bank_size);
+            ns += ERASE_BANK_NS;
+        }
+    } else {
+        if (!stm32f4xx_flash_sector(s, FIELD_EX32(s->cr, CR, SNB),
+                                    &offset, &len)) {
+            qemu_log_mask(LOG_GUEST_ERROR, "%s: no sector %u\n", __func__,
+                          (unsigned)FIELD_EX32(s->cr, CR, SNB));
+            stm32f4xx_flash_error(s, R_SR_PGSERR_MASK);
+            return;
+        }
+        if (stm32f4xx_flash_protected(s, offset)) {
+            stm32f4xx_flash_error(s, R_SR_WRPERR_MASK);
+            return;
+        }
+        stm32f4xx_flash_erase_range(s, offset, len);
+        ns = len <= 16 * KiB ? ERASE_16K_NS :
+             len <= 64 * KiB ? ERASE_64K_NS : ERASE_128K_NS;
+    }
+    stm32f4xx_flash_busy(s, ns);
+}
+
+static void stm32f4xx_flash_program_options(STM32F4xxFlashState *s)
+{
+    uint32_t old_rdp = FIELD_EX32(s->opt, OPTCR, RDP);
+    uint32_t new_rdp = FIELD_EX32(s->optcr, OPTCR, RDP);
+
+    if (old_rdp == RDP_LEVEL2) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: option bytes are frozen at read protection "
+                      "level 2\n", __func__);
+        return;
+    }
+    /* Going back to level 0 erases the whole flash */
+    if (old_rdp != RDP_LEVEL0 && new_rdp == RDP_LEVEL0) {
+        stm32f4xx_flash_erase_range(s, 0, s->size);
+    }
+    s->opt = s->optcr & OPTCR_OPT_MASK;
+    if (stm32f4xx_flash_dual_bank(s)) {
+        s->opt1 = s->optcr1 & OPTCR1_OPT_MASK;
+    }
+    trace_stm32f4xx_flash_option_bytes(s->opt, s->opt1);
+    stm32f4xx_flash_busy(s, ERASE_16K_NS);
+}
+
+/* Unlock sequence, return true once both keys are written in order */
+static bool stm32f4xx_flash_unlock(uint32_t *state, uint32_t val,
+                                   uint32_t key1, uint32_t key2)
+{
+    if (*state == KEY_NONE && val == key1) {
+        *state = KEY_FIRST;
+        return false;
+    }
+    if (*state == KEY_FIRST && val == key2) {
+        *state = KEY_NONE;
+        return true;
+    }
+    if (*state != KEY_FAILED) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: wrong key sequence, locked until reset\n",
+                      __func__);
+    }
+    *state = KEY_FAILED;
+    return false;
+}
+
+static uint64_t stm32f4xx_flash_read(void *opaque, hwaddr addr,
+                                     unsigned size)
+{
+    STM32F4xxFlashState *s = opaque;
+    uint32_t val = 0;
+
+    switch (addr) {
+    case A_KEYR:
+    case A_OPTKEYR:
+        break;
+    case A_SR:
+        val = s->sr;
+        break;
+    case A_CR:
+        val = s->cr;
+        break;
+    case A_OPTCR:
+        val = s->optcr;
+        break;
+    case A_OPTCR1:
+        if (stm32f4xx_flash_dual_bank(s)) {
+            val = s->optcr1;
+            break;
+        }
+        /* fall through */
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        break;
+    }
+    trace_stm32f4xx_flash_read(addr, val);
+    return val;
+}
+
+static void stm32f4xx_flash_write(void *opaque, hwaddr addr, uint64_t val64,
+                                  unsigned size)
+{
+    STM32F4xxFlashState *s = opaque;
+    uint32_t val = val64;
+
+    trace_stm32f4xx_flash_write(addr, val);
+    switch (addr) {
+    case A_KEYR:
+        if (!FIELD_EX32(s->cr, CR, LOCK)) {
+            break;
+        }
+        if (stm32f4xx_flash_unlock(&s->keyr_state, val,
+                                   FLASH_KEY1, FLASH_KEY2)) {
+            s->cr &= ~R_CR_LOCK_MASK;
+        }
+        break;
+    case A_OPTKEYR:
+        if (!FIELD_EX32(s->optcr, OPTCR, OPTLOCK)) {
+            break;
+        }
+        if (stm32f4xx_flash_unlock(&s->optkeyr_state, val,
+                                   FLASH_OPTKEY1, FLASH_OPTKEY2)) {
+            s->optcr &= ~R_OPTCR_OPTLOCK_MASK;
+        }
+        break;
+    case A_SR:
+        /* BSY is read only, the other flags are cleared by writing 1 */
+        s->sr &= ~(val & (SR_ERRORS | R_SR_EOP_MASK));
+        stm32f4xx_flash_update_irq(s);
+        break;
+    case A_CR:
+        if (FIELD_EX32(s->cr, CR, LOCK)) {
+            qemu_log_mask(LOG_GUEST_ERROR, "%s: CR is locked\n", __func__);
+            break;
+        }
+        s->cr = val & CR_MASK;
+        if (FIELD_EX32(val, CR, STRT)) {
+            stm32f4xx_flash_erase(s);
+        }
+        if (FIELD_EX32(val, CR, LOCK)) {
+            s->cr |= R_CR_LOCK_MASK;
+            s->keyr_state = KEY_NONE;
+        }
+        stm32f4xx_flash_update_mapping(s);
+        stm32f4xx_flash_update_irq(s);
+        break;
+    case A_OPTCR:
+        if (FIELD_EX32(s->optcr, OPTCR, OPTLOCK)) {
+            qemu_log_mask(LOG_GUEST_ERROR, "%s: OPTCR is locked\n", __func__);
+            break;
+        }
+        s->optcr = val & OPTCR_OPT_MASK;
+        if (FIELD_EX32(val, OPTCR, OPTSTRT)) {
+            stm32f4xx_flash_program_options(s);
+        }
+        if (FIELD_EX32(val, OPTCR, OPTLOCK)) {
+            s->optcr |= R_OPTCR_OPTLOCK_MASK;
+            s->optkeyr_state = KEY_NONE;
+        }
+        break;
+    case A_OPTCR1:
+        if (stm32f4xx_flash_dual_bank(s)) {
+            if (!FIELD_EX32(s->optcr, OPTCR, OPTLOCK)) {
+                s->optcr1 = val & OPTCR1_OPT_MASK;
+            }
+            break;
+        }
+        /* fall through */
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: bad offset 0x%" HWADDR_PRIx "\n",
+                      __func__, addr);
+        break;
+    }
+}
+
+static const MemoryRegionOps stm32f4xx_flash_ops = {
+    .read = stm32f4xx_flash_read,
+    .write = stm32f4xx_flash_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .impl.min_access_size = 4,
+    .impl.max_access_size = 4,
+    .valid.min_access_size = 4,
+    .valid.max_access_size = 4,
+};
+
+static uint64_t stm32f4xx_flash_prog_read(void *opaque, hwaddr addr,
+                                          unsigned size)
+{
+    STM32F4xxFlashState *s = opaque;
+    uint8_t buf[4];
+
+    address_space_read(&s->as, addr, MEMTXATTRS_UNSPECIFIED, buf, size);
+    return ldn_le_p(buf, size);
+}
+
+static void stm32f4xx_flash_prog_write(void *opaque, hwaddr addr,
+                                       uint64_t val64, unsigned size)
+{
+    STM32F4xxFlashState *s = opaque;
+    /* x64 parallelism is done with two word accesses */
+    unsigned psize = MIN(1 << FIELD_EX32(s->cr, CR, PSIZE), 4);
+    uint8_t buf[4];
+    uint32_t val;
+
+    if (s->cr & (R_CR_SER_MASK | R_CR_MER_MASK | R_CR_MER1_MASK)) {
+        stm32f4xx_flash_error(s, R_SR_PGSERR_MASK);
+        return;
+    }
+    if (size != psize) {
+        stm32f4xx_flash_error(s, R_SR_PGPERR_MASK);
+        return;
+    }
+    if (addr & (size - 1)) {
+        stm32f4xx_flash_error(s, R_SR_PGAERR_MASK);
+        return;
+    }
+    if (stm32f4xx_flash_protected(s, addr)) {
+        stm32f4xx_flash_error(s, R_SR_WRPERR_MASK);
+        return;
+    }
+
+    /* Programming can only clear bits */
+    stm32f4xx_flash_unshare(s);
+    address_space_read(&s->as, addr, MEMTXATTRS_UNSPECIFIED, buf, size);
+    val = val64 & ldn_le_p(buf, size);
+    trace_stm32f4xx_flash_program(addr, size, val);
+    stn_le_p(buf, size, val);
+    address_space_write(&s->as, addr, MEMTXATTRS_UNSPECIFIED, buf, size);
+    stm32f4xx_flash_busy(s, PROGRAM_NS);
+}
+
+static const MemoryRegionOps stm32f4xx_flash_prog_ops = {
+    .read = stm32f4xx_flash_prog_read,
+    .write = stm32f4xx_flash_prog_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .impl.min_access_size = 1,
+    .impl.max_access_size = 4,
+    .impl.unaligned = true,
+    .valid.min_access_size = 1,
+    .valid.max_access_size = 4,
+    .valid.unaligned = true,
+};
+
+static void stm32f4xx_flash_hold_reset(Object *obj)
+{
+    STM32F4xxFlashState *s = STM32F4XX_FLASH(obj);
+
+    timer_del(s->busy_timer);
+    s->busy_until = 0;
+    s->keyr_state = KEY_NONE;
+    s->optkeyr_state = KEY_NONE;
+    s->sr = 0;
+    s->cr = R_CR_LOCK_MASK;
+    s->optcr = s->opt | R_OPTCR_OPTLOCK_MASK;
+    s->optcr1 = s->opt1;
+    stm32f4xx_flash_update_mapping(s);
+    stm32f4xx_flash_update_irq(s);
+}
+
+static void stm32f4xx_flash_init(Object *obj)
+{
+    STM32F4xxFlashState *s = STM32F4XX_FLASH(obj);
+
+    memory_region_init_io(&s->mmio, obj, &stm32f4xx_flash_ops, s,
+                          TYPE_STM32F4XX_FLASH, 0x400);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+    sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq);
+}
+
+static void stm32f4xx_flash_realize(DeviceState *dev, Error **errp)
+{
+    STM32F4xxFlashState *s = STM32F4XX_FLASH(dev);
+    Object *obj = OBJECT(dev);
+
+    if (s->size < 128 * KiB || s->size > 2 * MiB || s->size % (128 * KiB)) {
+        error_setg(errp, "unsupported flash size %" PRIu32, s->size);
+        return;
+    }
+
+    if (s->shared) {
+        if (!DEVICE(s->shared)->realized || s->shared->size != s->size) {
+            error_setg(errp, "shared flash must be realized, with the same "
+                       "size");
+            return;
+        }
+        /* A -global memdev is the one of the shared flash */
+        if (s->memdev && s->memdev != s->shared->memdev) {
+            error_setg(errp, "memdev and shared are mutually exclusive");
+            return;
+        }
+        s->backing = s->shared->backing;
+        s->shared->nr_sharers++;
+    } else if (s->memdev) {
+        if (host_memory_backend_is_mapped(s->memdev)) {
+            error_setg(errp, "memdev is already in use");
+            return;
+        }
+        s->backing = host_memory_backend_get_memory(s->memdev);
+        if (memory_region_size(s->backing) != s->size) {
+            error_setg(errp, "memdev size must be the flash size %" PRIu32,
+                       s->size);
+            return;
+        }
+        host_memory_backend_set_mapped(s->memdev, true);
+        vmstate_register_ram(s->backing, dev);
+    } else {
+        if (!memory_region_init_ram(&s->ram, obj, "stm32f4xx-flash.ram",
+                                    s->size, errp)) {
+            return;
+        }
+        s->backing = &s->ram;
+        /* Blank flash reads as ones */
+        memset(memory_region_get_ram_ptr(s->backing), 0xff, s->size);
+    }
+    memory_region_init(&s->store, obj, "stm32f4xx-flash.store", s->size);
+    memory_region_init_alias(&s->shared_store, obj, "stm32f4xx-flash.shared",
+                             s->backing, 0, s->size);
+    memory_region_add_subregion(&s->store, 0, &s->shared_store);
+    address_space_init(&s->as, &s->store, "stm32f4xx-flash");
+
+    memory_region_init(&s->container, obj, "stm32f4xx-flash", s->size);
+    memory_region_init_alias(&s->rom, obj, "stm32f4xx-flash.rom", &s->store,
+                             0, s->size);
+    memory_region_set_readonly(&s->rom, true);
+    memory_region_add_subregion(&s->container, 0, &s->rom);
+    memory_region_init_io(&s->prog, obj, &stm32f4xx_flash_prog_ops, s,
+                          "stm32f4xx-flash.prog", s->size);
+    memory_region_set_enabled(&s->prog, false);
+    memory_region_add_subregion_overlap(&s->container, 0, &s->prog, 1);
+    sysbus_init_mmio(SYS_BUS_DEVICE(dev), &s->container);
+
+    s->busy_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                 stm32f4xx_flash_busy_expired, s);
+    s->opt = s->option_bytes & OPTCR_OPT_MASK;
+    s->opt1 = OPTCR1_OPT_MASK;
+}
+
+static int stm32f4xx_flash_post_load(void *opaque, int version_id)
+{
+    stm32f4xx_flash_update_mapping(opaque);
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32f4xx_flash = {
+    .name = TYPE_STM32F4XX_FLASH,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = stm32f4xx_flash_post_load,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(keyr_state, STM32F4xxFlashState),
+        VMSTATE_UINT32(optkeyr_state, STM32F4xxFlashState),
+        VMSTATE_UINT32(sr, STM32F4xxFlashState),
+        VMSTATE_UINT32(cr, STM32F4xxFlashState),
+        VMSTATE_UINT32(optcr, STM32F4xxFlashState),
+        VMSTATE_UINT32(optcr1, STM32F4xxFlashState),
+        VMSTATE_INT64(busy_until, STM32F4xxFlashState),
+        VMSTATE_TIMER_PTR(busy_timer, STM32F4xxFlashState),
+        VMSTATE_UINT32(opt, STM32F4xxFlashState),
+        VMSTATE_UINT32(opt1, STM32F4xxFlashState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property stm32f4xx_flash_properties[] = {
+    DEFINE_PROP_UINT32("size", STM32F4xxFlashState, size, 1 * MiB),
+    /* Factory option bytes: no protection, level 0 */
+    DEFINE_PROP_UINT32("option-bytes", STM32F4xxFlashState, option_bytes,
+                       0x0FFFAAEC),
+    DEFINE_PROP_BOOL("busy-timing", STM32F4xxFlashState, busy_timing, true),
+    DEFINE_PROP_LINK("memdev", STM32F4xxFlashState, memdev,
+                     TYPE_MEMORY_BACKEND, HostMemoryBackend *),
+    DEFINE_PROP_LINK("shared", STM32F4xxFlashState, shared,
+                     TYPE_STM32F4XX_FLASH, STM32F4xxFlashState *),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void stm32f4xx_flash_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ResettableClass *rc = RESETTABLE_CLASS(klass);
+
+    dc->realize = stm32f4xx_flash_realize;
+    dc->vmsd = &vmstate_stm32f4xx_flash;
+    device_class_set_props(dc, stm32f4xx_flash_properties);
+    rc->phases.hold = stm32f4xx_flash_hold_reset;
+}
+
+static const TypeInfo stm32f4xx_flash_info[] = {
+    {
+        .name          = TYPE_STM32F4XX_FLASH,
+        .parent        = TYPE_SYS_BUS_DEVICE,
+        .instance_size = sizeof(STM32F4xxFlashState),
+        .instance_init = stm32f4xx_flash_init,
+        .class_init    = stm32f4xx_flash_class_init,
+    }
+};
+
+DEFINE_TYPES(stm32f4xx_flash_info)
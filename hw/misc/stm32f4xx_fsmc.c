@@ -0,0 +1,257 @@
+/*
+ * STM32F4xx flexible static memory controller
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * FSMC of the STM32F40x/41x (RM0090 section 36), NOR/PSRAM/SRAM bank 1
+ * only.  The memory of each subbank is a host memory backend, mapped as
+ * RAM while BCRx.MBKEN is set: the guest accesses it through the TLB fast
+ * path, and a shared memory-backend-file lets the host look at it without
+ * any copy.  The subbanks without a memory, or disabled, are left empty.
+ * With BCRx.WREN cleared, the memory is read-only.
+ *
+ * The timings and the memory type are only stored: NOR flash is accessed
+ * as plain memory.  The NAND and PC card banks are not modelled.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qapi/error.h"
+#include "hw/qdev-properties.h"
+#include "migration/vmstate.h"
+#include "hw/misc/stm32f4xx_fsmc.h"
+#include "trace.h"
+
+/* BCRx and BTRx at 8 * x, BWTRx at 0x104 + 8 * x */
+#define FSMC_BCR(n)  (8 * (n))
+#define FSMC_BTR(n)  (8 * (n) + 0x04)
+#define FSMC_BWTR(n) (8 * (n) + 0x104)
+
+#define BCR_MBKEN (1 << 0)
+#define BCR_WREN  (1 << 12)
+
+/* Reserved bits read as zero */
+#define BCR_MASK  0x000FFFFF
+#define BTR_MASK  0x3FFFFFFF
+#define BWTR_MASK 0x3FFFFFFF
+
+static void stm32f4xx_fsmc_update(STM32F4xxFsmcState *s, unsigned n)
+{
+    if (!s->mem[n]) {
+        return;
+    }
+    memory_region_transaction_begin();
+    memory_region_set_readonly(s->mem[n], !(s->bcr[n] & BCR_WREN));
+    memory_region_set_enabled(s->mem[n], s->bcr[n] & BCR_MBKEN);
+    memory_region_transaction_commit();
+}
+
+static uint64_t stm32f4xx_fsmc_read(void *opaque, hwaddr addr,
+                                    unsigned int size)
+{
+    STM32F4xxFsmcState *s = opaque;
+    uint32_t value = 0;
+    unsigned n = (addr & 0xFF) / 8;
+
+    switch (addr) {
+    case FSMC_BCR(0):
+    case FSMC_BCR(1):
+    case FSMC_BCR(2):
+    case FSMC_BCR(3):
+        value = s->bcr[n];
+        break;
+    case FSMC_BTR(0):
+    case FSMC_BTR(1):
+    case FSMC_BTR(2):
+    case FSMC_BTR(3):
+        value = s->btr[n];
+        break;
+    case FSMC_BWTR(0):
+    case FSMC_BWTR(1):
+    case FSMC_BWTR(2):
+    case FSMC_BWTR(3):
+        value = s->bwtr[n];
+        break;
+    case 0x60 ... 0xB4:
+        qemu_log_mask(LOG_UNIMP, "%s: NAND and PC card banks are not "
+                      "modelled\n", __func__);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%" HWADDR_PRIx "\n", __func__, addr);
+    }
+
+    trace_stm32f4xx_fsmc_read(addr, value);
+    return value;
+}
+
+static void stm32f4xx_fsmc_write(void *opaque, hwaddr addr,
+                                 uint64_t val64, unsigned int size)
+{
+    STM32F4xxFsmcState *s = opaque;
+    uint32_t value = val64;
+    unsigned n = (addr & 0xFF) / 8;
+
+    trace_stm32f4xx_fsmc_write(addr, value);
+
+    switch (addr) {
+    case FSMC_BCR(0):
+    case FSMC_BCR(1):
+    case FSMC_BCR(2):
+    case FSMC_BCR(3):
+        s->bcr[n] = value & BCR_MASK;
+        stm32f4xx_fsmc_update(s, n);
+        break;
+    case FSMC_BTR(0):
+    case FSMC_BTR(1):
+    case FSMC_BTR(2):
+    case FSMC_BTR(3):
+        s->btr[n] = value & BTR_MASK;
+        break;
+    case FSMC_BWTR(0):
+    case FSMC_BWTR(1):
+    case FSMC_BWTR(2):
+    case FSMC_BWTR(3):
+        s->bwtr[n] = value & BWTR_MASK;
+        break;
+    case 0x60 ... 0xB4:
+        qemu_log_mask(LOG_UNIMP, "%s: NAND and PC card banks are not "
+                      "modelled\n", __func__);
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%" HWADDR_PRIx "\n", __func__, addr);
+    }
+}
+
+static const MemoryRegionOps stm32f4xx_fsmc_ops = {
+    .read = stm32f4xx_fsmc_read,
+    .write = stm32f4xx_fsmc_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .valid = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+    },
+};
+
+static void stm32f4xx_fsmc_hold_reset(Object *obj)
+{
+    STM32F4xxFsmcState *s = STM32F4XX_FSMC(obj);
+    unsigned n;
+
+    for (n = 0; n < STM32F4XX_FSMC_NUM_SUBBANKS; n++) {
+        /* Subbank 1 is enabled, for a NOR flash to boot from */
+        s->bcr[n] = n == 0 ? 0x000030DB : 0x000030D2;
+        s->btr[n] = 0x0FFFFFFF;
+        s->bwtr[n] = 0x0FFFFFFF;
+        stm32f4xx_fsmc_update(s, n);
+    }
+}
+
+static void stm32f4xx_fsmc_init(Object *obj)
+{
+    STM32F4xxFsmcState *s = STM32F4XX_FSMC(obj);
+
+    memory_region_init_io(&s->mmio, obj, &stm32f4xx_fsmc_ops, s,
+                          TYPE_STM32F4XX_FSMC, 0x1000);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+    memory_region_init(&s->bank1, obj, "stm32f4xx-fsmc.bank1",
+                       STM32F4XX_FSMC_NUM_SUBBANKS *
+                       STM32F4XX_FSMC_SUBBANK_SIZE);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->bank1);
+}
+
+static void stm32f4xx_fsmc_realize(DeviceState *dev, Error **errp)
+{
+    STM32F4xxFsmcState *s = STM32F4XX_FSMC(dev);
+    unsigned n;
+
+    for (n = 0; n < STM32F4XX_FSMC_NUM_SUBBANKS; n++) {
+        if (!s->memdev[n]) {
+            continue;
+        }
+        if (host_memory_backend_is_mapped(s->memdev[n])) {
+            error_setg(errp, "subbank%u-memdev is already in use", n + 1);
+            return;
+        }
+        s->mem[n] = host_memory_backend_get_memory(s->memdev[n]);
+        if (memory_region_size(s->mem[n]) > STM32F4XX_FSMC_SUBBANK_SIZE) {
+            error_setg(errp, "subbank%u-memdev is larger than the 64 MiB "
+                       "of a subbank", n + 1);
+            return;
+        }
+        host_memory_backend_set_mapped(s->memdev[n], true);
+        vmstate_register_ram(s->mem[n], dev);
+        memory_region_set_enabled(s->mem[n], false);
+        memory_region_add_subregion(&s->bank1,
+                                    n * STM32F4XX_FSMC_SUBBANK_SIZE,
+                                    s->mem[n]);
+    }
+}
+
+static int stm32f4xx_fsmc_post_load(void *opaque, int version_id)
+{
+    STM32F4xxFsmcState *s = opaque;
+    unsigned n;
+
+    for (n = 0; n < STM32F4XX_FSMC_NUM_SUBBANKS; n++) {
+        stm32f4xx_fsmc_update(s, n);
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32f4xx_fsmc = {
+    .name = TYPE_STM32F4XX_FSMC,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = stm32f4xx_fsmc_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(bcr, STM32F4xxFsmcState,
+                             STM32F4XX_FSMC_NUM_SUBBANKS),
+        VMSTATE_UINT32_ARRAY(btr, STM32F4xxFsmcState,
+                             STM32F4XX_FSMC_NUM_SUBBANKS),
+        VMSTATE_UINT32_ARRAY(bwtr, STM32F4xxFsmcState,
+                             STM32F4XX_FSMC_NUM_SUBBANKS),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property stm32f4xx_fsmc_properties[] = {
+    DEFINE_PROP_LINK("subbank1-memdev", STM32F4xxFsmcState, memdev[0],
+                     TYPE_MEMORY_BACKEND, HostMemoryBackend *),
+    DEFINE_PROP_LINK("subbank2-memdev", STM32F4xxFsmcState, memdev[1],
+                     TYPE_MEMORY_BACKEND, HostMemoryBackend *),
+    DEFINE_PROP_LINK("subbank3-memdev", STM32F4xxFsmcState, memdev[2],
+                     TYPE_MEMORY_BACKEND, HostMemoryBackend *),
+    DEFINE_PROP_LINK("subbank4-memdev", STM32F4xxFsmcState, memdev[3],
+                     TYPE_MEMORY_BACKEND, HostMemoryBackend *),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void stm32f4xx_fsmc_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ResettableClass *rc = RESETTABLE_CLASS(klass);
+
+    dc->realize = stm32f4xx_fsmc_realize;
+    dc->vmsd = &vmstate_stm32f4xx_fsmc;
+    device_class_set_props(dc, stm32f4xx_fsmc_properties);
+    rc->phases.hold = stm32f4xx_fsmc_hold_reset;
+}
+
+static const TypeInfo stm32f4xx_fsmc_info[] = {
+    {
+        .name          = TYPE_STM32F4XX_FSMC,
+        .parent        = TYPE_SYS_BUS_DEVICE,
+        .instance_size = sizeof(STM32F4xxFsmcState),
+        .instance_init = stm32f4xx_fsmc_init,
+        .class_init    = stm32f4xx_fsmc_class_init,
+    }
+};
+
+DEFINE_TYPES(stm32f4xx_fsmc_info)
@@ -0,0 +1,515 @@
+/*
+ * STM32F4xx reset and clock control
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Clock tree of the RCC of the STM32F40x/41x (RM0090 section 7): the
+ * oscillators and the main PLL, the system clock switch and the AHB and
+ * APB prescalers.  The SYSCLK, HCLK, PCLK1/2 and APB timer clock outputs
+ * drive QEMU Clocks, so the CPU, SysTick and the peripherals follow the
+ * frequency changes without polling the RCC.
+ *
+ * One register write can change several clocks: switching SYSCLK to the
+ * PLL changes all of them.  The new frequencies are set on every output
+ * before any of them is propagated, in the order they derive from each
+ * other.  A peripheral is then notified once, its ClockPreUpdate and
+ * ClockUpdate callbacks seeing the old and the new frequency, and never
+ * sees a half updated tree.
+ *
+ * The oscillators and the PLLs lock as soon as they are enabled.  Not
+ * modelled: the peripheral reset and clock enable bits, which are only
+ * stored, the clock security system, the I2S PLL output and MCO1/2.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qapi/error.h"
+#include "hw/irq.h"
+#include "hw/registerfields.h"
+#include "hw/qdev-clock.h"
+#include "migration/vmstate.h"
+#include "hw/misc/stm32f4xx_rcc.h"
+#include "trace.h"
+
+REG32(CR, 0x00)
+    FIELD(CR, HSION, 0, 1)
+    FIELD(CR, HSIRDY, 1, 1)
+    FIELD(CR, HSEON, 16, 1)
+    FIELD(CR, HSERDY, 17, 1)
+    FIELD(CR, PLLON, 24, 1)
+    FIELD(CR, PLLRDY, 25, 1)
+    FIELD(CR, PLLI2SON, 26, 1)
+    FIELD(CR, PLLI2SRDY, 27, 1)
+REG32(PLLCFGR, 0x04)
+    FIELD(PLLCFGR, PLLM, 0, 6)
+    FIELD(PLLCFGR, PLLN, 6, 9)
+    FIELD(PLLCFGR, PLLP, 16, 2)
+    FIELD(PLLCFGR, PLLSRC, 22, 1)
+    FIELD(PLLCFGR, PLLQ, 24, 4)
+REG32(CFGR, 0x08)
+    FIELD(CFGR, SW, 0, 2)
+    FIELD(CFGR, SWS, 2, 2)
+    FIELD(CFGR, HPRE, 4, 4)
+    FIELD(CFGR, PPRE1, 10, 3)
+    FIELD(CFGR, PPRE2, 13, 3)
+REG32(CIR, 0x0C)
+    FIELD(CIR, RDYF, 0, 6)
+    FIELD(CIR, CSSF, 7, 1)
+    FIELD(CIR, RDYIE, 8, 6)
+    FIELD(CIR, RDYC, 16, 6)
+    FIELD(CIR, CSSC, 23, 1)
+REG32(AHB1RSTR, 0x10)
+REG32(AHB2RSTR, 0x14)
+REG32(AHB3RSTR, 0x18)
+REG32(APB1RSTR, 0x20)
+REG32(APB2RSTR, 0x24)
+REG32(AHB1ENR, 0x30)
+REG32(AHB2ENR, 0x34)
+REG32(AHB3ENR, 0x38)
+REG32(APB1ENR, 0x40)
+REG32(APB2ENR, 0x44)
+REG32(AHB1LPENR, 0x50)
+REG32(AHB2LPENR, 0x54)
+REG32(AHB3LPENR, 0x58)
+REG32(APB1LPENR, 0x60)
+REG32(APB2LPENR, 0x64)
+REG32(BDCR, 0x70)
+    FIELD(BDCR, LSEON, 0, 1)
+    FIELD(BDCR, LSERDY, 1, 1)
+    FIELD(BDCR, BDRST, 16, 1)
+REG32(CSR, 0x74)
+    FIELD(CSR, LSION, 0, 1)
+    FIELD(CSR, LSIRDY, 1, 1)
+    FIELD(CSR, RMVF, 24, 1)
+    FIELD(CSR, RSTF, 25, 7)
+REG32(SSCGR, 0x80)
+REG32(PLLI2SCFGR, 0x84)
+
+#define HSI_HZ 16000000
+
+/* CFGR.SW and SWS */
+enum {
+    SW_HSI,
+    SW_HSE,
+    SW_PLL,
+};
+
+/* The oscillators and PLLs, in the order of their CIR ready flags */
+enum {
+    OSC_LSI,
+    OSC_LSE,
+    OSC_HSI,
+    OSC_HSE,
+    OSC_PLL,
+    OSC_PLLI2S,
+    OSC_NUM
+};
+
+static const struct {
+    unsigned reg;
+    uint32_t on;
+    uint32_t ready;
+} stm32f4xx_rcc_osc[OSC_NUM] = {
+    [OSC_LSI] = { R_CSR, R_CSR_LSION_MASK, R_CSR_LSIRDY_MASK },
+    [OSC_LSE] = { R_BDCR, R_BDCR_LSEON_MASK, R_BDCR_LSERDY_MASK },
+    [OSC_HSI] = { R_CR, R_CR_HSION_MASK, R_CR_HSIRDY_MASK },
+    [OSC_HSE] = { R_CR, R_CR_HSEON_MASK, R_CR_HSERDY_MASK },
+    [OSC_PLL] = { R_CR, R_CR_PLLON_MASK, R_CR_PLLRDY_MASK },
+    [OSC_PLLI2S] = { R_CR, R_CR_PLLI2SON_MASK, R_CR_PLLI2SRDY_MASK },
+};
+
+/* Source of SYSCLK for each value of CFGR.SW */
+static const int stm32f4xx_rcc_sw_osc[] = {
+    [SW_HSI] = OSC_HSI,
+    [SW_HSE] = OSC_HSE,
+    [SW_PLL] = OSC_PLL,
+};
+
+static bool stm32f4xx_rcc_ready(STM32F4xxRccState *s, int osc)
+{
+    return s->regs[stm32f4xx_rcc_osc[osc].reg] & stm32f4xx_rcc_osc[osc].ready;
+}
+
+static int stm32f4xx_rcc_pll_source(STM32F4xxRccState *s)
+{
+    return FIELD_EX32(s->regs[R_PLLCFGR], PLLCFGR, PLLSRC) ? OSC_HSE : OSC_HSI;
+}
+
+/* Output of the main PLL, 0 for a configuration it cannot lock with */
+static uint32_t stm32f4xx_rcc_pll_hz(STM32F4xxRccState *s)
+{
+    uint32_t pllcfgr = s->regs[R_PLLCFGR];
+    unsigned m = FIELD_EX32(pllcfgr, PLLCFGR, PLLM);
+    unsigned n = FIELD_EX32(pllcfgr, PLLCFGR, PLLN);
+    unsigned p = (FIELD_EX32(pllcfgr, PLLCFGR, PLLP) + 1) * 2;
+    uint64_t in_hz = stm32f4xx_rcc_pll_source(s) == OSC_HSE ?
+                     clock_get_hz(s->hse) : HSI_HZ;
+
+    if (m < 2 || n < 50 || n > 432) {
+        return 0;
+    }
+    return in_hz * n / m / p;
+}
+
+/* The oscillators and PLLs that are on lock at once */
+static void stm32f4xx_rcc_lock(STM32F4xxRccState *s)
+{
+    unsigned sw;
+    int i;
+
+    for (i = 0; i < OSC_NUM; i++) {
+        uint32_t *reg = &s->regs[stm32f4xx_rcc_osc[i].reg];
+        uint32_t ready = stm32f4xx_rcc_osc[i].ready;
+        bool on = *reg & stm32f4xx_rcc_osc[i].on;
+
+        switch (i) {
+        case OSC_HSE:
+            /* Stays off without a crystal on the board */
+            on &= clock_is_enabled(s->hse);
+            break;
+        case OSC_PLL:
+            on &= stm32f4xx_rcc_ready(s, stm32f4xx_rcc_pll_source(s)) &&
+                  stm32f4xx_rcc_pll_hz(s);
+            break;
+        case OSC_PLLI2S:
+            on &= stm32f4xx_rcc_ready(s, stm32f4xx_rcc_pll_source(s));
+            break;
+        }
+
+        if (!on) {
+            *reg &= ~ready;
+        } else if (!(*reg & ready)) {
+            *reg |= ready;
+            s->regs[R_CIR] |= 1 << i;
+        }
+    }
+
+    /* The system clock switches over once its new source is ready */
+    sw = FIELD_EX32(s->regs[R_CFGR], CFGR, SW);
+    if (sw < ARRAY_SIZE(stm32f4xx_rcc_sw_osc) &&
+        stm32f4xx_rcc_ready(s, stm32f4xx_rcc_sw_osc[sw])) {
+        s->regs[R_CFGR] = FIELD_DP32(s->regs[R_CFGR], CFGR, SWS, sw);
+    }
+}
+
+/* The oscillators that SYSCLK runs from cannot be stopped */
+static uint32_t stm32f4xx_rcc_in_use(STM32F4xxRccState *s)
+{
+    uint32_t pll_source = stm32f4xx_rcc_pll_source(s) == OSC_HSE ?
+                          R_CR_HSEON_MASK : R_CR_HSION_MASK;
+
+    switch (FIELD_EX32(s->regs[R_CFGR], CFGR, SWS)) {
+    case SW_HSE:
+        return R_CR_HSEON_MASK;
+    case SW_PLL:
+        return R_CR_PLLON_MASK | pll_source;
+    default:
+        return R_CR_HSION_MASK;
+    }
+}
+
+static uint32_t stm32f4xx_rcc_sysclk_hz(STM32F4xxRccState *s)
+{
+    switch (FIELD_EX32(s->regs[R_CFGR], CFGR, SWS)) {
+    case SW_HSE:
+        return clock_get_hz(s->hse);
+    case SW_PLL:
+        return stm32f4xx_rcc_pll_hz(s);
+    default:
+        return HSI_HZ;
+    }
+}
+
+/* HPRE divides by 2 to 512, skipping 32 */
+static unsigned stm32f4xx_rcc_ahb_shift(unsigned hpre)
+{
+    if (hpre < 8) {
+        return 0;
+    }
+    return hpre < 12 ? hpre - 7 : hpre - 6;
+}
+
+static unsigned stm32f4xx_rcc_apb_shift(unsigned ppre)
+{
+    return ppre < 4 ? 0 : ppre - 3;
+}
+
+static void stm32f4xx_rcc_update_clocks(STM32F4xxRccState *s)
+{
+    uint32_t cfgr = s->regs[R_CFGR];
+    unsigned ppre1 = stm32f4xx_rcc_apb_shift(FIELD_EX32(cfgr, CFGR, PPRE1));
+    unsigned ppre2 = stm32f4xx_rcc_apb_shift(FIELD_EX32(cfgr, CFGR, PPRE2));
+    uint32_t hz[STM32F4XX_RCC_NUM_CLOCKS];
+    bool changed[STM32F4XX_RCC_NUM_CLOCKS];
+    bool any = false;
+    int i;
+
+    hz[STM32F4XX_RCC_SYSCLK] = stm32f4xx_rcc_sysclk_hz(s);
+    hz[STM32F4XX_RCC_HCLK] = hz[STM32F4XX_RCC_SYSCLK] >>
+        stm32f4xx_rcc_ahb_shift(FIELD_EX32(cfgr, CFGR, HPRE));
+    hz[STM32F4XX_RCC_PCLK1] = hz[STM32F4XX_RCC_HCLK] >> ppre1;
+    hz[STM32F4XX_RCC_PCLK2] = hz[STM32F4XX_RCC_HCLK] >> ppre2;
+    /* The timers run at twice the APB clock when it is divided */
+    hz[STM32F4XX_RCC_TIMCLK1] = hz[STM32F4XX_RCC_PCLK1] << !!ppre1;
+    hz[STM32F4XX_RCC_TIMCLK2] = hz[STM32F4XX_RCC_PCLK2] << !!ppre2;
+
+    /* Stage the whole tree, then notify the users of each clock once */
+    for (i = 0; i < STM32F4XX_RCC_NUM_CLOCKS; i++) {
+        changed[i] = clock_set_hz(s->out[i], hz[i]);
+        any |= changed[i];
+    }
+    if (!any) {
+        return;
+    }
+    trace_stm32f4xx_rcc_clocks(hz[STM32F4XX_RCC_SYSCLK],
+                               hz[STM32F4XX_RCC_HCLK],
+                               hz[STM32F4XX_RCC_PCLK1],
+                               hz[STM32F4XX_RCC_PCLK2]);
+    for (i = 0; i < STM32F4XX_RCC_NUM_CLOCKS; i++) {
+        if (changed[i]) {
+            clock_propagate(s->out[i]);
+        }
+    }
+}
+
+static void stm32f4xx_rcc_update_irq(STM32F4xxRccState *s)
+{
+    uint32_t cir = s->regs[R_CIR];
+
+    qemu_set_irq(s->irq, (FIELD_EX32(cir, CIR, RDYF) &
+                          FIELD_EX32(cir, CIR, RDYIE)) ||
+                         (cir & R_CIR_CSSF_MASK));
+}
+
+static void stm32f4xx_rcc_update(STM32F4xxRccState *s)
+{
+    stm32f4xx_rcc_lock(s);
+    stm32f4xx_rcc_update_clocks(s);
+    stm32f4xx_rcc_update_irq(s);
+}
+
+static bool stm32f4xx_rcc_valid(hwaddr addr)
+{
+    switch (addr) {
+    case A_CR ... A_AHB3RSTR:
+    case A_APB1RSTR ... A_APB2RSTR:
+    case A_AHB1ENR ... A_AHB3ENR:
+    case A_APB1ENR ... A_APB2ENR:
+    case A_AHB1LPENR ... A_AHB3LPENR:
+    case A_APB1LPENR ... A_APB2LPENR:
+    case A_BDCR ... A_CSR:
+    case A_SSCGR ... A_PLLI2SCFGR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static uint64_t stm32f4xx_rcc_read(void *opaque, hwaddr addr, unsigned size)
+{
+    STM32F4xxRccState *s = opaque;
+
+    if (!stm32f4xx_rcc_valid(addr)) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%"HWADDR_PRIx"\n", __func__, addr);
+        return 0;
+    }
+    trace_stm32f4xx_rcc_read(addr, s->regs[addr / 4]);
+    return s->regs[addr / 4];
+}
+
+static void stm32f4xx_rcc_write(void *opaque, hwaddr addr, uint64_t val64,
+                                unsigned size)
+{
+    STM32F4xxRccState *s = opaque;
+    uint32_t value = val64;
+    uint32_t ready;
+
+    trace_stm32f4xx_rcc_write(addr, value);
+
+    switch (addr) {
+    case A_CR:
+        ready = R_CR_HSIRDY_MASK | R_CR_HSERDY_MASK | R_CR_PLLRDY_MASK |
+                R_CR_PLLI2SRDY_MASK;
+        value |= stm32f4xx_rcc_in_use(s);
+        s->regs[R_CR] = (s->regs[R_CR] & ready) | (value & ~ready);
+        break;
+    case A_PLLCFGR:
+        if (s->regs[R_CR] & R_CR_PLLON_MASK) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: PLLCFGR written while the PLL is on\n",
+                          __func__);
+            return;
+        }
+        s->regs[R_PLLCFGR] = value;
+        if (!stm32f4xx_rcc_pll_hz(s)) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: PLLM or PLLN out of range, PLL will not lock\n",
+                          __func__);
+        }
+        break;
+    case A_CFGR:
+        s->regs[R_CFGR] = (s->regs[R_CFGR] & R_CFGR_SWS_MASK) |
+                          (value & ~R_CFGR_SWS_MASK);
+        break;
+    case A_CIR:
+        s->regs[R_CIR] &= ~FIELD_EX32(value, CIR, RDYC);
+        if (value & R_CIR_CSSC_MASK) {
+            s->regs[R_CIR] &= ~R_CIR_CSSF_MASK;
+        }
+        s->regs[R_CIR] = FIELD_DP32(s->regs[R_CIR], CIR, RDYIE,
+                                    FIELD_EX32(value, CIR, RDYIE));
+        break;
+    case A_BDCR:
+        /* A backup domain reset clears the register, BDRST aside */
+        if (value & R_BDCR_BDRST_MASK) {
+            value = R_BDCR_BDRST_MASK;
+        }
+        s->regs[R_BDCR] = (s->regs[R_BDCR] & R_BDCR_LSERDY_MASK) |
+                          (value & ~R_BDCR_LSERDY_MASK);
+        break;
+    case A_CSR:
+        value &= ~R_CSR_RSTF_MASK;
+        if (!(value & R_CSR_RMVF_MASK)) {
+            value |= s->regs[R_CSR] & R_CSR_RSTF_MASK;
+        }
+        s->regs[R_CSR] = (s->regs[R_CSR] & R_CSR_LSIRDY_MASK) |
+                         (value & ~(R_CSR_LSIRDY_MASK | R_CSR_RMVF_MASK));
+        break;
+    default:
+        if (!stm32f4xx_rcc_valid(addr)) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "%s: Bad offset 0x%"HWADDR_PRIx"\n", __func__, addr);
+            return;
+        }
+        s->regs[addr / 4] = value;
+        return;
+    }
+
+    stm32f4xx_rcc_update(s);
+}
+
+static const MemoryRegionOps stm32f4xx_rcc_ops = {
+    .read = stm32f4xx_rcc_read,
+    .write = stm32f4xx_rcc_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .valid = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+    },
+};
+
+/* The backup domain, BDCR, is not reset with the system */
+static void stm32f4xx_rcc_reset_regs(STM32F4xxRccState *s)
+{
+    uint32_t bdcr = s->regs[R_BDCR];
+
+    memset(s->regs, 0, sizeof(s->regs));
+    s->regs[R_CR] = 0x00000083;
+    s->regs[R_PLLCFGR] = 0x24003010;
+    s->regs[R_AHB1ENR] = 0x00100000;
+    s->regs[R_AHB1LPENR] = 0x7E6791FF;
+    s->regs[R_AHB2LPENR] = 0x000000F1;
+    s->regs[R_AHB3LPENR] = 0x00000001;
+    s->regs[R_APB1LPENR] = 0x36FEC9FF;
+    s->regs[R_APB2LPENR] = 0x00075F33;
+    s->regs[R_BDCR] = bdcr;
+    s->regs[R_CSR] = 0x0E000000;
+    s->regs[R_PLLI2SCFGR] = 0x20003000;
+    stm32f4xx_rcc_lock(s);
+}
+
+static void stm32f4xx_rcc_hold_reset(Object *obj)
+{
+    stm32f4xx_rcc_reset_regs(STM32F4XX_RCC(obj));
+}
+
+/* Clocks are propagated once every device is out of reset */
+static void stm32f4xx_rcc_exit_reset(Object *obj)
+{
+    STM32F4xxRccState *s = STM32F4XX_RCC(obj);
+
+    stm32f4xx_rcc_update_clocks(s);
+    stm32f4xx_rcc_update_irq(s);
+}
+
+static void stm32f4xx_rcc_hse_update(void *opaque, ClockEvent event)
+{
+    stm32f4xx_rcc_update(opaque);
+}
+
+static const char * const stm32f4xx_rcc_clocks[STM32F4XX_RCC_NUM_CLOCKS] = {
+    [STM32F4XX_RCC_SYSCLK] = "sysclk",
+    [STM32F4XX_RCC_HCLK] = "hclk",
+    [STM32F4XX_RCC_PCLK1] = "pclk1",
+    [STM32F4XX_RCC_PCLK2] = "pclk2",
+    [STM32F4XX_RCC_TIMCLK1] = "timclk1",
+    [STM32F4XX_RCC_TIMCLK2] = "timclk2",
+};
+
+static void stm32f4xx_rcc_init(Object *obj)
+{
+    STM32F4xxRccState *s = STM32F4XX_RCC(obj);
+    int i;
+
+    memory_region_init_io(&s->mmio, obj, &stm32f4xx_rcc_ops, s,
+                          TYPE_STM32F4XX_RCC, 0x400);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+    sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq);
+
+    s->hse = qdev_init_clock_in(DEVICE(obj), "hse", stm32f4xx_rcc_hse_update,
+                                s, ClockUpdate);
+    for (i = 0; i < STM32F4XX_RCC_NUM_CLOCKS; i++) {
+        s->out[i] = qdev_init_clock_out(DEVICE(obj),
+                                        stm32f4xx_rcc_clocks[i]);
+    }
+}
+
+/* The SoC wires the clocks after this, they must have their reset rates */
+static void stm32f4xx_rcc_realize(DeviceState *dev, Error **errp)
+{
+    STM32F4xxRccState *s = STM32F4XX_RCC(dev);
+
+    stm32f4xx_rcc_reset_regs(s);
+    stm32f4xx_rcc_update_clocks(s);
+}
+
+static const VMStateDescription vmstate_stm32f4xx_rcc = {
+    .name = TYPE_STM32F4XX_RCC,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32_ARRAY(regs, STM32F4xxRccState, STM32F4XX_RCC_NUM_REGS),
+        VMSTATE_CLOCK(hse, STM32F4xxRccState),
+        VMSTATE_ARRAY_CLOCK(out, STM32F4xxRccState, STM32F4XX_RCC_NUM_CLOCKS),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static void stm32f4xx_rcc_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ResettableClass *rc = RESETTABLE_CLASS(klass);
+
+    dc->realize = stm32f4xx_rcc_realize;
+    dc->vmsd = &vmstate_stm32f4xx_rcc;
+    rc->phases.hold = stm32f4xx_rcc_hold_reset;
+    rc->phases.exit = stm32f4xx_rcc_exit_reset;
+}
+
+static const TypeInfo stm32f4xx_rcc_info[] = {
+    {
+        .name          = TYPE_STM32F4XX_RCC,
+        .parent        = TYPE_SYS_BUS_DEVICE,
+        .instance_size = sizeof(STM32F4xxRccState),
+        .instance_init = stm32f4xx_rcc_init,
+        .class_init    = stm32f4xx_rcc_class_init,
+    }
+};
+
+DEFINE_TYPES(stm32f4xx_rcc_info)
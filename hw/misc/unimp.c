@@ -7,6 +7,10 @@
  * guest device driver probing such that the system will
  * come up.
  *
+ * Each device also keeps a profile of the guest accesses, to find
+ * out which missing devices the guest spends its time on: see
+ * "info unimp", and "-d unimp_profile" to print it at exit.
+ *
  * Copyright Linaro Limited, 2017
  * Written by Peter Maydell
  */
@@ -16,12 +20,153 @@
 #include "hw/misc/unimp.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
+#include "qemu/notify.h"
 #include "qapi/error.h"
+#include "hw/core/cpu.h"
+#include "exec/cpu-common.h"
+#include "sysemu/sysemu.h"
+#include "sysemu/tcg.h"
+#ifdef CONFIG_TCG
+#include "exec/target_page.h"
+#include "exec/translation-block.h"
+#include "tcg/tcg.h"
+#endif
+
+/* No target records more than three words at each instruction start */
+#define UNIMP_INSN_START_WORDS 3
+
+static void unimp_profile(UnimplementedDeviceState *s, hwaddr offset,
+                          bool is_write)
+{
+    if (is_write) {
+        s->writes++;
+    } else {
+        s->reads++;
+    }
+
+    if (offset < UNIMP_HIST_SIZE) {
+        if (!s->hist) {
+            s->hist = g_new0(uint64_t, UNIMP_HIST_SIZE / 4 * 2);
+        }
+        s->hist[(offset / 4) * 2 + is_write]++;
+    }
+
+#ifdef CONFIG_TCG
+    /*
+     * Recover the guest PC from the host return address of the access.
+     * A polling loop keeps hitting the same instruction, so the lookup
+     * is only done when the access comes from somewhere else.
+     */
+    if (tcg_enabled() && current_cpu &&
+        current_cpu->mem_io_pc != s->last_host_pc) {
+        uint64_t data[UNIMP_INSN_START_WORDS];
+
+        s->last_host_pc = current_cpu->mem_io_pc;
+        if (cpu_unwind_state_data(current_cpu, s->last_host_pc, data)) {
+            TranslationBlock *tb = tcg_tb_lookup(s->last_host_pc);
+            uint64_t pc = data[0];
+
+            /*
+             * A CF_PCREL TB only records the offset in the page, which is
+             * that of the PC it was entered at, as restore_state_to_opc
+             * of the targets does.
+             */
+            if (tb && (tb_cflags(tb) & CF_PCREL)) {
+                pc |= current_cpu->cc->get_pc(current_cpu) &
+                      qemu_target_page_mask();
+            }
+            if (!s->pc_valid) {
+                s->first_pc = pc;
+                s->pc_valid = true;
+            }
+            s->last_pc = pc;
+        }
+    }
+#endif
+}
+
+static int unimp_collect(Object *obj, void *opaque)
+{
+    UnimplementedDeviceState *s = (UnimplementedDeviceState *)
+        object_dynamic_cast(obj, TYPE_UNIMPLEMENTED_DEVICE);
+
+    if (s && (s->reads || s->writes)) {
+        g_ptr_array_add(opaque, s);
+    }
+    return 0;
+}
+
+static gint unimp_compare(gconstpointer a, gconstpointer b)
+{
+    const UnimplementedDeviceState *sa = *(UnimplementedDeviceState **)a;
+    const UnimplementedDeviceState *sb = *(UnimplementedDeviceState **)b;
+    uint64_t na = sa->reads + sa->writes;
+    uint64_t nb = sb->reads + sb->writes;
+
+    return na < nb ? 1 : na > nb ? -1 : 0;
+}
+
+GString *unimp_profile_format(void)
+{
+    g_autoptr(GPtrArray) devs = g_ptr_array_new();
+    GString *buf = g_string_new("");
+    unsigned i, j;
+
+    object_child_foreach_recursive(object_get_root(), unimp_collect, devs);
+    g_ptr_array_sort(devs, unimp_compare);
+
+    if (!devs->len) {
+        g_string_append(buf, "No access to unimplemented devices\n");
+    }
+    for (i = 0; i < devs->len; i++) {
+        UnimplementedDeviceState *s = g_ptr_array_index(devs, i);
+
+        /* Not mmio[0].addr, SoCs may map it without sysbus_mmio_map() */
+        g_string_append_printf(buf, "%s @0x%" HWADDR_PRIx ": %" PRIu64
+                               " reads, %" PRIu64 " writes",
+                               s->name, s->iomem.addr,
+                               s->reads, s->writes);
+        if (s->pc_valid) {
+            g_string_append_printf(buf, ", first pc 0x%" PRIx64
+                                   ", last pc 0x%" PRIx64,
+                                   s->first_pc, s->last_pc);
+        }
+        g_string_append_c(buf, '\n');
+
+        for (j = 0; s->hist && j < MIN(s->size, UNIMP_HIST_SIZE) / 4; j++) {
+            uint64_t r = s->hist[j * 2], w = s->hist[j * 2 + 1];
+
+            if (r || w) {
+                g_string_append_printf(buf, "  0x%0*x: %" PRIu64 " reads, %"
+                                       PRIu64 " writes\n",
+                                       s->offset_fmt_width, j * 4, r, w);
+            }
+        }
+    }
+    return buf;
+}
+
+static void unimp_profile_dump(Notifier *n, void *data)
+{
+    g_autoptr(GString) buf = NULL;
+
+    if (!qemu_loglevel_mask(LOG_UNIMP_PROFILE)) {
+        return;
+    }
+    buf = unimp_profile_format();
+    qemu_log("Unimplemented device accesses:\n%s", buf->str);
+}
+
+static Notifier unimp_exit_notifier = {
+    .notify = unimp_profile_dump,
+};
+static bool unimp_exit_notifier_added;
 
 static uint64_t unimp_read(void *opaque, hwaddr offset, unsigned size)
 {
     UnimplementedDeviceState *s = UNIMPLEMENTED_DEVICE(opaque);
 
+    unimp_profile(s, offset, false);
     qemu_log_mask(LOG_UNIMP, "%s: unimplemented device read  "
                   "(size %d, offset 0x%0*" HWADDR_PRIx ")\n",
                   s->name, size, s->offset_fmt_width, offset);
@@ -33,6 +178,7 @@ static void unimp_write(void *opaque, hwaddr offset,
 {
     UnimplementedDeviceState *s = UNIMPLEMENTED_DEVICE(opaque);
 
+    unimp_profile(s, offset, true);
     qemu_log_mask(LOG_UNIMP, "%s: unimplemented device write "
                   "(size %d, offset 0x%0*" HWADDR_PRIx
                   ", value 0x%0*" PRIx64 ")\n",
@@ -68,6 +214,18 @@ static void unimp_realize(DeviceState *dev, Error **errp)
     memory_region_init_io(&s->iomem, OBJECT(s), &unimp_ops, s,
                           s->name, s->size);
     sysbus_init_mmio(SYS_BUS_DEVICE(s), &s->iomem);
+
+    if (!unimp_exit_notifier_added) {
+        qemu_add_exit_notifier(&unimp_exit_notifier);
+        unimp_exit_notifier_added = true;
+    }
+}
+
+static void unimp_finalize(Object *obj)
+{
+    UnimplementedDeviceState *s = UNIMPLEMENTED_DEVICE(obj);
+
+    g_free(s->hist);
 }
 
 static Property unimp_properties[] = {
@@ -88,6 +246,7 @@ static const TypeInfo unimp_info = {
     .name = TYPE_UNIMPLEMENTED_DEVICE,
     .parent = TYPE_SYS_BUS_DEVICE,
     .instance_size = sizeof(UnimplementedDeviceState),
+    .instance_finalize = unimp_finalize,
     .class_init = unimp_class_init,
 };
 
@@ -0,0 +1,1007 @@
+/*
+ * STM32F4xx bxCAN controller
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * bxCAN (RM0090 section 32), with three transmit mailboxes, two receive
+ * FIFOs of three messages and 28 filter banks shared by CAN1 and CAN2.
+ * The filter registers are only in CAN1, CAN2 gets them with the "master"
+ * link and uses the banks from FMR.CAN2SB on.
+ *
+ * Frames are exchanged with a CanBusState, given with the "canbus" link.
+ * A transmit request is sent as soon as the controller is in normal mode,
+ * and frames from the bus are filtered and stored when they arrive: the
+ * time frames take on the wire is not modelled, only the timestamps count
+ * bit times from the kernel clock and BTR.
+ *
+ * The acceptance filters are compiled into one table per controller when
+ * the banks change, rather than going through the banks for each frame:
+ * the identifier lists are sorted for a bisection and the masks are kept
+ * in priority order.
+ *
+ * Not modelled: the error counters and states, bus-off, arbitration and
+ * retransmission (NART), and the time triggered mode apart from the
+ * timestamps in the last two data bytes (TGT).
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/log.h"
+#include "qemu/module.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "hw/irq.h"
+#include "hw/clock.h"
+#include "hw/qdev-clock.h"
+#include "hw/qdev-properties.h"
+#include "hw/registerfields.h"
+#include "migration/vmstate.h"
+#include "hw/net/stm32f4xx_can.h"
+#include "trace.h"
+
+REG32(MCR, 0x00)
+    FIELD(MCR, INRQ, 0, 1)
+    FIELD(MCR, SLEEP, 1, 1)
+    FIELD(MCR, TXFP, 2, 1)
+    FIELD(MCR, RFLM, 3, 1)
+    FIELD(MCR, NART, 4, 1)
+    FIELD(MCR, AWUM, 5, 1)
+    FIELD(MCR, ABOM, 6, 1)
+    FIELD(MCR, TTCM, 7, 1)
+    FIELD(MCR, RESET, 15, 1)
+    FIELD(MCR, DBF, 16, 1)
+REG32(MSR, 0x04)
+    FIELD(MSR, INAK, 0, 1)
+    FIELD(MSR, SLAK, 1, 1)
+    FIELD(MSR, ERRI, 2, 1)
+    FIELD(MSR, WKUI, 3, 1)
+    FIELD(MSR, SLAKI, 4, 1)
+REG32(TSR, 0x08)
+    FIELD(TSR, RQCP0, 0, 1)
+    FIELD(TSR, TXOK0, 1, 1)
+    FIELD(TSR, ALST0, 2, 1)
+    FIELD(TSR, TERR0, 3, 1)
+    FIELD(TSR, ABRQ0, 7, 1)
+    FIELD(TSR, CODE, 24, 2)
+    FIELD(TSR, TME0, 26, 1)
+    FIELD(TSR, LOW0, 29, 1)
+REG32(RF0R, 0x0C)
+    FIELD(RF0R, FMP, 0, 2)
+    FIELD(RF0R, FULL, 3, 1)
+    FIELD(RF0R, FOVR, 4, 1)
+    FIELD(RF0R, RFOM, 5, 1)
+REG32(RF1R, 0x10)
+REG32(IER, 0x14)
+    FIELD(IER, TMEIE, 0, 1)
+    FIELD(IER, FMPIE0, 1, 1)
+    FIELD(IER, FFIE0, 2, 1)
+    FIELD(IER, FOVIE0, 3, 1)
+    FIELD(IER, ERRIE, 15, 1)
+    FIELD(IER, WKUIE, 16, 1)
+    FIELD(IER, SLKIE, 17, 1)
+REG32(ESR, 0x18)
+    FIELD(ESR, LEC, 4, 3)
+REG32(BTR, 0x1C)
+    FIELD(BTR, BRP, 0, 10)
+    FIELD(BTR, TS1, 16, 4)
+    FIELD(BTR, TS2, 20, 3)
+    FIELD(BTR, LBKM, 30, 1)
+    FIELD(BTR, SILM, 31, 1)
+/* Transmit mailboxes, then the receive FIFOs, 0x10 apart */
+REG32(TI0R, 0x180)
+    FIELD(TIR, TXRQ, 0, 1)
+    FIELD(TIR, RTR, 1, 1)
+    FIELD(TIR, IDE, 2, 1)
+REG32(TDT0R, 0x184)
+    FIELD(TDTR, DLC, 0, 4)
+    FIELD(TDTR, TGT, 8, 1)
+    FIELD(TDTR, TIME, 16, 16)
+REG32(TDL0R, 0x188)
+REG32(TDH0R, 0x18C)
+REG32(RI0R, 0x1B0)
+REG32(FMR, 0x200)
+    FIELD(FMR, FINIT, 0, 1)
+    FIELD(FMR, CAN2SB, 8, 6)
+REG32(FM1R, 0x204)
+REG32(FS1R, 0x20C)
+REG32(FFA1R, 0x214)
+REG32(FA1R, 0x21C)
+REG32(F0R1, 0x240)
+
+#define MCR_MASK 0x000180FF
+#define IER_MASK 0x00038F7F
+#define BTR_MASK 0xC37F03FF
+#define FMR_MASK 0x00003F01
+#define BANKS_MASK MAKE_64BIT_MASK(0, STM32F4XX_CAN_NUM_BANKS)
+#define TSR_TX_BITS 8
+/* rc_w1 flags of one transmit mailbox in TSR */
+#define TSR_TX_FLAGS (R_TSR_RQCP0_MASK | R_TSR_TXOK0_MASK | \
+                      R_TSR_ALST0_MASK | R_TSR_TERR0_MASK)
+
+/* Bit time when the kernel clock is not running, 1 Mbit/s */
+#define DEFAULT_BIT_NS 1000
+
+enum {
+    CAN_IRQ_TX,
+    CAN_IRQ_RX0,
+    CAN_IRQ_RX1,
+    CAN_IRQ_SCE,
+};
+
+static void stm32f4xx_can_update_irq(STM32F4xxCanState *s)
+{
+    uint32_t ier = s->ier;
+    uint32_t msr = s->msr;
+    bool sce;
+
+    qemu_set_irq(s->irq[CAN_IRQ_TX], (ier & R_IER_TMEIE_MASK) &&
+                 (s->tsr & (R_TSR_RQCP0_MASK |
+                            R_TSR_RQCP0_MASK << TSR_TX_BITS |
+                            R_TSR_RQCP0_MASK << (2 * TSR_TX_BITS))));
+    for (unsigned f = 0; f < STM32F4XX_CAN_NUM_FIFOS; f++) {
+        /* FMPIE, FFIE and FOVIE of FIFO 1 follow those of FIFO 0 */
+        uint32_t fier = ier >> (3 * f);
+        uint32_t rfr = s->rfr[f];
+
+        qemu_set_irq(s->irq[CAN_IRQ_RX0 + f],
+                     ((fier & R_IER_FMPIE0_MASK) && (rfr & R_RF0R_FMP_MASK)) ||
+                     ((fier & R_IER_FFIE0_MASK) && (rfr & R_RF0R_FULL_MASK)) ||
+                     ((fier & R_IER_FOVIE0_MASK) &&
+                      (rfr & R_RF0R_FOVR_MASK)));
+    }
+    sce = ((ier & R_IER_ERRIE_MASK) && (msr & R_MSR_ERRI_MASK)) ||
+          ((ier & R_IER_WKUIE_MASK) && (msr & R_MSR_WKUI_MASK)) ||
+          ((ier & R_IER_SLKIE_MASK) && (msr & R_MSR_SLAKI_MASK));
+    qemu_set_irq(s->irq[CAN_IRQ_SCE], sce);
+}
+
+/* The identifier of a frame in the layout of the 32-bit filters */
+static uint32_t stm32f4xx_can_id32(const qemu_can_frame *frame)
+{
+    uint32_t id;
+
+    if (frame->can_id & QEMU_CAN_EFF_FLAG) {
+        id = (frame->can_id & QEMU_CAN_EFF_MASK) << 3 | R_TIR_IDE_MASK;
+    } else {
+        id = (frame->can_id & QEMU_CAN_SFF_MASK) << 21;
+    }
+    if (frame->can_id & QEMU_CAN_RTR_FLAG) {
+        id |= R_TIR_RTR_MASK;
+    }
+    return id;
+}
+
+/* ... and of the 16-bit filters: STID, RTR, IDE and EXID[17:15] */
+static uint32_t stm32f4xx_can_id16(uint32_t id32)
+{
+    return (id32 >> 16 & 0xFFE0) | (id32 & R_TIR_RTR_MASK) << 3 |
+           (id32 & R_TIR_IDE_MASK) << 1 | (id32 >> 18 & 0x7);
+}
+
+static int stm32f4xx_can_filter_cmp(const void *a, const void *b)
+{
+    const STM32F4xxCanFilter *fa = a;
+    const STM32F4xxCanFilter *fb = b;
+
+    return fa->id < fb->id ? -1 : fa->id > fb->id;
+}
+
+/* Identifiers in several lists match the filter with the lowest number */
+static void stm32f4xx_can_add_list(STM32F4xxCanFilter *list, unsigned *n,
+                                   uint32_t id, uint8_t fmi, uint8_t fifo)
+{
+    for (unsigned i = 0; i < *n; i++) {
+        if (list[i].id == id) {
+            return;
+        }
+    }
+    list[*n] = (STM32F4xxCanFilter) { id, UINT32_MAX, fmi, fifo };
+    (*n)++;
+}
+
+static void stm32f4xx_can_add_mask(STM32F4xxCanFilter *list, unsigned *n,
+                                   uint32_t id, uint32_t mask, uint8_t fmi,
+                                   uint8_t fifo)
+{
+    list[*n] = (STM32F4xxCanFilter) { id & mask, mask, fmi, fifo };
+    (*n)++;
+}
+
+/*
+ * Compile the banks of one controller.  Filter numbers (FMI) count the
+ * filters of the banks assigned to each FIFO, active or not.
+ */
+static void stm32f4xx_can_compile_filters(STM32F4xxCanState *s,
+                                          STM32F4xxCanFilters *t,
+                                          unsigned first, unsigned last)
+{
+    uint8_t fmi[STM32F4XX_CAN_NUM_FIFOS] = { 0, 0 };
+
+    memset(t, 0, sizeof(*t));
+    for (unsigned b = first; b < last; b++) {
+        uint8_t fifo = extract32(s->ffa1r, b, 1);
+        bool active = extract32(s->fa1r, b, 1);
+        bool list = extract32(s->fm1r, b, 1);
+        uint32_t r1 = s->fr[b][0];
+        uint32_t r2 = s->fr[b][1];
+
+        if (extract32(s->fs1r, b, 1)) {
+            if (list && active) {
+                stm32f4xx_can_add_list(t->list32, &t->n_list32, r1 & ~1,
+                                       fmi[fifo], fifo);
+                stm32f4xx_can_add_list(t->list32, &t->n_list32, r2 & ~1,
+                                       fmi[fifo] + 1, fifo);
+            } else if (active) {
+                stm32f4xx_can_add_mask(t->mask32, &t->n_mask32, r1,
+                                       r2 & ~1, fmi[fifo], fifo);
+            }
+            fmi[fifo] += list ? 2 : 1;
+        } else {
+            if (list && active) {
+                stm32f4xx_can_add_list(t->list16, &t->n_list16,
+                                       r1 & 0xFFFF, fmi[fifo], fifo);
+                stm32f4xx_can_add_list(t->list16, &t->n_list16,
+                                       r1 >> 16, fmi[fifo] + 1, fifo);
+                stm32f4xx_can_add_list(t->list16, &t->n_list16,
+                                       r2 & 0xFFFF, fmi[fifo] + 2, fifo);
+                stm32f4xx_can_add_list(t->list16, &t->n_list16,
+                                       r2 >> 16, fmi[fifo] + 3, fifo);
+            } else if (active) {
+                stm32f4xx_can_add_mask(t->mask16, &t->n_mask16, r1 & 0xFFFF,
+                                       r1 >> 16, fmi[fifo], fifo);
+                stm32f4xx_can_add_mask(t->mask16, &t->n_mask16, r2 & 0xFFFF,
+                                       r2 >> 16, fmi[fifo] + 1, fifo);
+            }
+            fmi[fifo] += list ? 4 : 2;
+        }
+    }
+    qsort(t->list32, t->n_list32, sizeof(t->list32[0]),
+          stm32f4xx_can_filter_cmp);
+    qsort(t->list16, t->n_list16, sizeof(t->list16[0]),
+          stm32f4xx_can_filter_cmp);
+}
+
+/* Only called on CAN1, which has the banks for both controllers */
+static void stm32f4xx_can_update_filters(STM32F4xxCanState *s)
+{
+    unsigned can2sb = MIN(FIELD_EX32(s->fmr, FMR, CAN2SB),
+                          STM32F4XX_CAN_NUM_BANKS);
+
+    stm32f4xx_can_compile_filters(s, &s->filters[0], 0, can2sb);
+    stm32f4xx_can_compile_filters(s, &s->filters[1], can2sb,
+                                  STM32F4XX_CAN_NUM_BANKS);
+    trace_stm32f4xx_can_filters(DEVICE(s)->canonical_path,
+                                s->filters[0].n_list32 +
+                                s->filters[0].n_list16,
+                                s->filters[0].n_mask32 +
+                                s->filters[0].n_mask16,
+                                s->filters[1].n_list32 +
+                                s->filters[1].n_list16,
+                                s->filters[1].n_mask32 +
+                                s->filters[1].n_mask16);
+}
+
+static const STM32F4xxCanFilter *
+stm32f4xx_can_match(const STM32F4xxCanFilters *t, uint32_t id32)
+{
+    STM32F4xxCanFilter key = { .id = id32 };
+    const STM32F4xxCanFilter *f;
+    uint32_t id16 = stm32f4xx_can_id16(id32);
+
+    /* 32-bit filters first, then lists before masks */
+    f = bsearch(&key, t->list32, t->n_list32, sizeof(key),
+                stm32f4xx_can_filter_cmp);
+    if (f) {
+        return f;
+    }
+    for (unsigned i = 0; i < t->n_mask32; i++) {
+        if ((id32 & t->mask32[i].mask) == t->mask32[i].id) {
+            return &t->mask32[i];
+        }
+    }
+    key.id = id16;
+    f = bsearch(&key, t->list16, t->n_list16, sizeof(key),
+                stm32f4xx_can_filter_cmp);
+    if (f) {
+        return f;
+    }
+    for (unsigned i = 0; i < t->n_mask16; i++) {
+        if ((id16 & t->mask16[i].mask) == t->mask16[i].id) {
+            return &t->mask16[i];
+        }
+    }
+    return NULL;
+}
+
+/* The 16-bit counter of CAN bit times used for the timestamps */
+static uint16_t stm32f4xx_can_time(STM32F4xxCanState *s)
+{
+    uint64_t ticks = (FIELD_EX32(s->btr, BTR, BRP) + 1) *
+                     (3 + FIELD_EX32(s->btr, BTR, TS1) +
+                      FIELD_EX32(s->btr, BTR, TS2));
+    uint64_t bit_ns = DEFAULT_BIT_NS;
+
+    if (clock_is_enabled(s->clk)) {
+        bit_ns = MAX(clock_ticks_to_ns(s->clk, ticks), 1);
+    }
+    return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) / bit_ns;
+}
+
+static bool stm32f4xx_can_normal(STM32F4xxCanState *s)
+{
+    return !(s->msr & (R_MSR_INAK_MASK | R_MSR_SLAK_MASK));
+}
+
+static void stm32f4xx_can_receive_frame(STM32F4xxCanState *s,
+                                        const qemu_can_frame *frame)
+{
+    STM32F4xxCanState *m = s->master ? s->master : s;
+    const STM32F4xxCanFilter *filter;
+    STM32F4xxCanMailbox *mb;
+    uint32_t id32, rfr, fmp;
+    unsigned f;
+
+    /* Reception is deactivated while the filters are initialized */
+    if (m->fmr & R_FMR_FINIT_MASK) {
+        return;
+    }
+    id32 = stm32f4xx_can_id32(frame);
+    filter = stm32f4xx_can_match(&m->filters[s->master ? 1 : 0], id32);
+    if (!filter) {
+        trace_stm32f4xx_can_reject(DEVICE(s)->canonical_path, frame->can_id);
+        return;
+    }
+
+    f = filter->fifo;
+    rfr = s->rfr[f];
+    fmp = FIELD_EX32(rfr, RF0R, FMP);
+    trace_stm32f4xx_can_rx(DEVICE(s)->canonical_path, frame->can_id,
+                           frame->can_dlc, f, filter->fmi);
+    if (fmp == STM32F4XX_CAN_FIFO_DEPTH) {
+        rfr |= R_RF0R_FOVR_MASK;
+        if (s->mcr & R_MCR_RFLM_MASK) {
+            /* Locked: the new message is discarded */
+            s->rfr[f] = rfr;
+            return;
+        }
+        /* Else the last message is overwritten */
+        fmp--;
+    }
+    mb = &s->rx[f][(s->rx_head[f] + fmp) % STM32F4XX_CAN_FIFO_DEPTH];
+    mb->ir = id32;
+    mb->dtr = (uint32_t)stm32f4xx_can_time(s) << R_TDTR_TIME_SHIFT |
+              filter->fmi << 8 | MIN(frame->can_dlc, 8);
+    mb->dlr = ldl_le_p(&frame->data[0]);
+    mb->dhr = ldl_le_p(&frame->data[4]);
+    fmp++;
+    rfr = FIELD_DP32(rfr, RF0R, FMP, fmp);
+    if (fmp == STM32F4XX_CAN_FIFO_DEPTH) {
+        rfr |= R_RF0R_FULL_MASK;
+    }
+    s->rfr[f] = rfr;
+}
+
+static bool stm32f4xx_can_tx_pending(STM32F4xxCanState *s, unsigned n)
+{
+    return s->tx[n].ir & R_TIR_TXRQ_MASK;
+}
+
+/* Mailbox @a is sent before @b, by request order or identifier (TXFP) */
+static bool stm32f4xx_can_tx_before(STM32F4xxCanState *s, unsigned a,
+                                    unsigned b)
+{
+    uint32_t ida = s->tx[a].ir & ~R_TIR_TXRQ_MASK;
+    uint32_t idb = s->tx[b].ir & ~R_TIR_TXRQ_MASK;
+
+    if (s->mcr & R_MCR_TXFP_MASK) {
+        return s->tx_seq[a] - s->tx_seq[b] > INT32_MAX;
+    }
+    /* The lower identifier wins, then the lower mailbox number */
+    return ida < idb || (ida == idb && a < b);
+}
+
+static void stm32f4xx_can_send(STM32F4xxCanState *s, unsigned n)
+{
+    STM32F4xxCanMailbox *mb = &s->tx[n];
+    qemu_can_frame frame = {};
+    uint32_t time = stm32f4xx_can_time(s);
+    uint32_t tsr_shift = n * TSR_TX_BITS;
+
+    if (mb->ir & R_TIR_IDE_MASK) {
+        frame.can_id = (mb->ir >> 3) | QEMU_CAN_EFF_FLAG;
+    } else {
+        frame.can_id = mb->ir >> 21;
+    }
+    if (mb->ir & R_TIR_RTR_MASK) {
+        frame.can_id |= QEMU_CAN_RTR_FLAG;
+    }
+    frame.can_dlc = MIN(FIELD_EX32(mb->dtr, TDTR, DLC), 8);
+    if (s->mcr & R_MCR_TTCM_MASK && mb->dtr & R_TDTR_TGT_MASK &&
+        frame.can_dlc == 8) {
+        mb->dhr = deposit32(mb->dhr, 16, 16, time);
+    }
+    mb->dtr = FIELD_DP32(mb->dtr, TDTR, TIME, time);
+    stl_le_p(&frame.data[0], mb->dlr);
+    stl_le_p(&frame.data[4], mb->dhr);
+
+    trace_stm32f4xx_can_tx(DEVICE(s)->canonical_path, frame.can_id,
+                           frame.can_dlc);
+    if (!(s->btr & R_BTR_SILM_MASK) && s->bus_client.bus) {
+        can_bus_client_send(&s->bus_client, &frame, 1);
+    }
+    if (s->btr & R_BTR_LBKM_MASK) {
+        stm32f4xx_can_receive_frame(s, &frame);
+    }
+
+    mb->ir &= ~R_TIR_TXRQ_MASK;
+    s->tsr &= ~(TSR_TX_FLAGS << tsr_shift);
+    s->tsr |= (R_TSR_RQCP0_MASK | R_TSR_TXOK0_MASK) << tsr_shift;
+    s->tsr |= R_TSR_TME0_MASK << n;
+}
+
+/* Send the pending requests, in priority order */
+static void stm32f4xx_can_transmit(STM32F4xxCanState *s)
+{
+    /* In silent mode, only the loop back can take the frames */
+    if (!stm32f4xx_can_normal(s) ||
+        (s->btr & (R_BTR_SILM_MASK | R_BTR_LBKM_MASK)) == R_BTR_SILM_MASK) {
+        return;
+    }
+    for (;;) {
+        int next = -1;
+
+        for (unsigned n = 0; n < STM32F4XX_CAN_NUM_TX; n++) {
+            if (stm32f4xx_can_tx_pending(s, n) &&
+                (next < 0 || stm32f4xx_can_tx_before(s, n, next))) {
+                next = n;
+            }
+        }
+        if (next < 0) {
+            break;
+        }
+        stm32f4xx_can_send(s, next);
+    }
+}
+
+static uint32_t stm32f4xx_can_read_tsr(STM32F4xxCanState *s)
+{
+    uint32_t tsr = s->tsr & ~(R_TSR_CODE_MASK | 7 << R_TSR_LOW0_SHIFT);
+    unsigned pending = 0;
+    int code = -1;
+    int low = -1;
+
+    for (unsigned n = 0; n < STM32F4XX_CAN_NUM_TX; n++) {
+        if (!stm32f4xx_can_tx_pending(s, n)) {
+            if (code < 0) {
+                code = n;
+            }
+            continue;
+        }
+        pending++;
+        if (low < 0 || stm32f4xx_can_tx_before(s, low, n)) {
+            low = n;
+        }
+    }
+    if (pending > 1) {
+        tsr |= R_TSR_LOW0_MASK << low;
+    }
+    /* With all mailboxes pending, CODE is the one of lowest priority */
+    return FIELD_DP32(tsr, TSR, CODE, code < 0 ? low : code);
+}
+
+static void stm32f4xx_can_write_tsr(STM32F4xxCanState *s, uint32_t value)
+{
+    for (unsigned n = 0; n < STM32F4XX_CAN_NUM_TX; n++) {
+        uint32_t v = value >> (n * TSR_TX_BITS);
+
+        if (v & R_TSR_RQCP0_MASK) {
+            s->tsr &= ~(TSR_TX_FLAGS << (n * TSR_TX_BITS));
+        }
+        if (v & R_TSR_ABRQ0_MASK && stm32f4xx_can_tx_pending(s, n)) {
+            s->tx[n].ir &= ~R_TIR_TXRQ_MASK;
+            s->tsr &= ~(TSR_TX_FLAGS << (n * TSR_TX_BITS));
+            s->tsr |= R_TSR_RQCP0_MASK << (n * TSR_TX_BITS);
+            s->tsr |= R_TSR_TME0_MASK << n;
+        }
+    }
+}
+
+static void stm32f4xx_can_write_rfr(STM32F4xxCanState *s, unsigned f,
+                                    uint32_t value)
+{
+    uint32_t fmp = FIELD_EX32(s->rfr[f], RF0R, FMP);
+
+    s->rfr[f] &= ~(value & (R_RF0R_FULL_MASK | R_RF0R_FOVR_MASK));
+    if (value & R_RF0R_RFOM_MASK && fmp) {
+        s->rx_head[f] = (s->rx_head[f] + 1) % STM32F4XX_CAN_FIFO_DEPTH;
+        s->rfr[f] = FIELD_DP32(s->rfr[f], RF0R, FMP, fmp - 1);
+    }
+}
+
+static void stm32f4xx_can_write_mailbox(STM32F4xxCanState *s, hwaddr addr,
+                                        uint32_t value)
+{
+    unsigned n = (addr - A_TI0R) / 0x10;
+    STM32F4xxCanMailbox *mb = &s->tx[n];
+
+    /* The mailbox registers are write protected while it is pending */
+    if (stm32f4xx_can_tx_pending(s, n)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: mailbox %u is pending\n",
+                      __func__, n);
+        return;
+    }
+    switch (addr & 0xC) {
+    case A_TI0R & 0xC:
+        mb->ir = value;
+        if (value & R_TIR_TXRQ_MASK) {
+            s->tsr &= ~(R_TSR_TME0_MASK << n);
+            s->tsr &= ~(TSR_TX_FLAGS << (n * TSR_TX_BITS));
+            s->tx_seq[n] = s->tx_next_seq++;
+            stm32f4xx_can_transmit(s);
+        }
+        break;
+    case A_TDT0R & 0xC:
+        mb->dtr = value & (R_TDTR_DLC_MASK | R_TDTR_TGT_MASK |
+                           R_TDTR_TIME_MASK);
+        break;
+    case A_TDL0R & 0xC:
+        mb->dlr = value;
+        break;
+    case A_TDH0R & 0xC:
+        mb->dhr = value;
+        break;
+    }
+}
+
+static uint32_t stm32f4xx_can_read_mailbox(STM32F4xxCanState *s,
+                                           hwaddr addr)
+{
+    STM32F4xxCanMailbox *mb;
+
+    if (addr < A_RI0R) {
+        mb = &s->tx[(addr - A_TI0R) / 0x10];
+    } else {
+        unsigned f = (addr - A_RI0R) / 0x10;
+
+        mb = &s->rx[f][s->rx_head[f]];
+    }
+    switch (addr & 0xC) {
+    case A_TI0R & 0xC:
+        return mb->ir;
+    case A_TDT0R & 0xC:
+        return mb->dtr;
+    case A_TDL0R & 0xC:
+        return mb->dlr;
+    default:
+        return mb->dhr;
+    }
+}
+
+static void stm32f4xx_can_write_mcr(STM32F4xxCanState *s, uint32_t value)
+{
+    uint32_t msr = s->msr;
+
+    s->mcr = value & MCR_MASK & ~R_MCR_RESET_MASK;
+    if (value & R_MCR_INRQ_MASK) {
+        msr = (msr & ~R_MSR_SLAK_MASK) | R_MSR_INAK_MASK;
+    } else if (value & R_MCR_SLEEP_MASK) {
+        if (!(msr & R_MSR_SLAK_MASK)) {
+            msr |= R_MSR_SLAKI_MASK;
+        }
+        msr = (msr & ~R_MSR_INAK_MASK) | R_MSR_SLAK_MASK;
+    } else {
+        msr &= ~(R_MSR_INAK_MASK | R_MSR_SLAK_MASK);
+    }
+    s->msr = msr;
+    stm32f4xx_can_transmit(s);
+}
+
+/* MCR.RESET resets the controller, but not the filter banks */
+static void stm32f4xx_can_reset_controller(STM32F4xxCanState *s)
+{
+    s->mcr = R_MCR_DBF_MASK | R_MCR_SLEEP_MASK;
+    s->msr = 0x00000C02;
+    s->tsr = R_TSR_TME0_MASK * 7;
+    s->rfr[0] = 0;
+    s->rfr[1] = 0;
+    s->ier = 0;
+    s->esr = 0;
+    s->btr = 0x01230000;
+    memset(s->tx, 0, sizeof(s->tx));
+    memset(s->tx_seq, 0, sizeof(s->tx_seq));
+    s->tx_next_seq = 0;
+    memset(s->rx, 0, sizeof(s->rx));
+    memset(s->rx_head, 0, sizeof(s->rx_head));
+}
+
+static void stm32f4xx_can_reset_hold(Object *obj)
+{
+    STM32F4xxCanState *s = STM32F4XX_CAN(obj);
+
+    stm32f4xx_can_reset_controller(s);
+    s->fmr = 0x2A1C0E01;
+    s->fm1r = 0;
+    s->fs1r = 0;
+    s->ffa1r = 0;
+    s->fa1r = 0;
+    memset(s->fr, 0, sizeof(s->fr));
+    if (!s->master) {
+        stm32f4xx_can_update_filters(s);
+    }
+    stm32f4xx_can_update_irq(s);
+}
+
+static uint64_t stm32f4xx_can_read_filter(STM32F4xxCanState *s, hwaddr addr)
+{
+    switch (addr) {
+    case A_FMR:
+        return s->fmr;
+    case A_FM1R:
+        return s->fm1r;
+    case A_FS1R:
+        return s->fs1r;
+    case A_FFA1R:
+        return s->ffa1r;
+    case A_FA1R:
+        return s->fa1r;
+    }
+    if (addr >= A_F0R1 && addr < A_F0R1 + STM32F4XX_CAN_NUM_BANKS * 8) {
+        return s->fr[(addr - A_F0R1) / 8][(addr / 4) & 1];
+    }
+    return 0;
+}
+
+static void stm32f4xx_can_write_filter(STM32F4xxCanState *s, hwaddr addr,
+                                       uint32_t value)
+{
+    bool finit = s->fmr & R_FMR_FINIT_MASK;
+    unsigned b;
+
+    switch (addr) {
+    case A_FMR:
+        s->fmr = (s->fmr & ~FMR_MASK) | (value & FMR_MASK);
+        if (finit && !(value & R_FMR_FINIT_MASK)) {
+            stm32f4xx_can_update_filters(s);
+        }
+        return;
+    case A_FA1R:
+        s->fa1r = value & BANKS_MASK;
+        if (!finit) {
+            stm32f4xx_can_update_filters(s);
+        }
+        return;
+    case A_FM1R:
+    case A_FS1R:
+    case A_FFA1R:
+        if (!finit) {
+            qemu_log_mask(LOG_GUEST_ERROR, "%s: 0x%" HWADDR_PRIx " written "
+                          "out of filter initialization\n", __func__, addr);
+            return;
+        }
+        if (addr == A_FM1R) {
+            s->fm1r = value & BANKS_MASK;
+        } else if (addr == A_FS1R) {
+            s->fs1r = value & BANKS_MASK;
+        } else {
+            s->ffa1r = value & BANKS_MASK;
+        }
+        return;
+    }
+
+    if (addr < A_F0R1 || addr >= A_F0R1 + STM32F4XX_CAN_NUM_BANKS * 8) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%" HWADDR_PRIx "\n", __func__, addr);
+        return;
+    }
+    b = (addr - A_F0R1) / 8;
+    /* The banks can be changed in initialization or when inactive */
+    if (!finit && extract32(s->fa1r, b, 1)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: filter bank %u is active\n",
+                      __func__, b);
+        return;
+    }
+    s->fr[b][(addr / 4) & 1] = value;
+}
+
+static uint64_t stm32f4xx_can_read(void *opaque, hwaddr addr, unsigned size)
+{
+    STM32F4xxCanState *s = opaque;
+    uint64_t value = 0;
+
+    switch (addr) {
+    case A_MCR:
+        value = s->mcr;
+        break;
+    case A_MSR:
+        value = s->msr;
+        break;
+    case A_TSR:
+        value = stm32f4xx_can_read_tsr(s);
+        break;
+    case A_RF0R:
+    case A_RF1R:
+        value = s->rfr[(addr - A_RF0R) / 4];
+        break;
+    case A_IER:
+        value = s->ier;
+        break;
+    case A_ESR:
+        value = s->esr;
+        break;
+    case A_BTR:
+        value = s->btr;
+        break;
+    case A_TI0R ... A_RI0R + 0x1F:
+        value = stm32f4xx_can_read_mailbox(s, addr);
+        break;
+    case A_FMR ... 0x3FF:
+        if (!s->master) {
+            value = stm32f4xx_can_read_filter(s, addr);
+            break;
+        }
+        /* fallthrough */
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%" HWADDR_PRIx "\n", __func__, addr);
+        break;
+    }
+
+    trace_stm32f4xx_can_read(DEVICE(s)->canonical_path, addr, value);
+    return value;
+}
+
+static void stm32f4xx_can_write(void *opaque, hwaddr addr,
+                                uint64_t val64, unsigned size)
+{
+    STM32F4xxCanState *s = opaque;
+    uint32_t value = val64;
+
+    trace_stm32f4xx_can_write(DEVICE(s)->canonical_path, addr, value);
+
+    switch (addr) {
+    case A_MCR:
+        if (value & R_MCR_RESET_MASK) {
+            stm32f4xx_can_reset_controller(s);
+            break;
+        }
+        stm32f4xx_can_write_mcr(s, value);
+        break;
+    case A_MSR:
+        s->msr &= ~(value & (R_MSR_ERRI_MASK | R_MSR_WKUI_MASK |
+                             R_MSR_SLAKI_MASK));
+        break;
+    case A_TSR:
+        stm32f4xx_can_write_tsr(s, value);
+        break;
+    case A_RF0R:
+    case A_RF1R:
+        stm32f4xx_can_write_rfr(s, (addr - A_RF0R) / 4, value);
+        break;
+    case A_IER:
+        s->ier = value & IER_MASK;
+        break;
+    case A_ESR:
+        s->esr = FIELD_DP32(s->esr, ESR, LEC, FIELD_EX32(value, ESR, LEC));
+        break;
+    case A_BTR:
+        /* Only writable in initialization mode */
+        if (s->msr & R_MSR_INAK_MASK) {
+            s->btr = value & BTR_MASK;
+        }
+        break;
+    case A_TI0R ... A_TDH0R + 0x20:
+        stm32f4xx_can_write_mailbox(s, addr, value);
+        break;
+    case A_FMR ... 0x3FF:
+        if (!s->master) {
+            stm32f4xx_can_write_filter(s, addr, value);
+            break;
+        }
+        /* fallthrough */
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "%s: Bad offset 0x%" HWADDR_PRIx "\n", __func__, addr);
+        break;
+    }
+
+    stm32f4xx_can_update_irq(s);
+}
+
+static const MemoryRegionOps stm32f4xx_can_ops = {
+    .read = stm32f4xx_can_read,
+    .write = stm32f4xx_can_write,
+    .endianness = DEVICE_NATIVE_ENDIAN,
+    .valid = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+        .unaligned = false,
+    },
+};
+
+static bool stm32f4xx_can_can_receive(CanBusClientState *client)
+{
+    STM32F4xxCanState *s = container_of(client, STM32F4xxCanState,
+                                        bus_client);
+
+    /* In loop back mode, the RX pin is not sampled */
+    return !(s->msr & R_MSR_INAK_MASK) && !(s->btr & R_BTR_LBKM_MASK);
+}
+
+static ssize_t stm32f4xx_can_receive(CanBusClientState *client,
+                                     const qemu_can_frame *frames,
+                                     size_t frames_cnt)
+{
+    STM32F4xxCanState *s = container_of(client, STM32F4xxCanState,
+                                        bus_client);
+
+    if (s->msr & R_MSR_SLAK_MASK) {
+        /* Bus activity wakes the controller up, the frame is lost */
+        s->msr |= R_MSR_WKUI_MASK;
+        if (s->mcr & R_MCR_AWUM_MASK) {
+            s->mcr &= ~R_MCR_SLEEP_MASK;
+            s->msr &= ~R_MSR_SLAK_MASK;
+            stm32f4xx_can_transmit(s);
+        }
+        stm32f4xx_can_update_irq(s);
+        return 1;
+    }
+
+    for (size_t i = 0; i < frames_cnt; i++) {
+        /* Only classic data and remote frames */
+        if (frames[i].flags & QEMU_CAN_FRMF_TYPE_FD ||
+            frames[i].can_id & QEMU_CAN_ERR_FLAG) {
+            continue;
+        }
+        stm32f4xx_can_receive_frame(s, &frames[i]);
+    }
+    stm32f4xx_can_update_irq(s);
+    return 1;
+}
+
+static CanBusClientInfo stm32f4xx_can_bus_client_info = {
+    .can_receive = stm32f4xx_can_can_receive,
+    .receive = stm32f4xx_can_receive,
+};
+
+static void stm32f4xx_can_init(Object *obj)
+{
+    STM32F4xxCanState *s = STM32F4XX_CAN(obj);
+
+    memory_region_init_io(&s->mmio, obj, &stm32f4xx_can_ops, s,
+                          TYPE_STM32F4XX_CAN, 0x400);
+    sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
+    for (unsigned i = 0; i < STM32F4XX_CAN_NUM_IRQS; i++) {
+        sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq[i]);
+    }
+    s->clk = qdev_init_clock_in(DEVICE(obj), "clk", NULL, NULL, 0);
+}
+
+static void stm32f4xx_can_realize(DeviceState *dev, Error **errp)
+{
+    STM32F4xxCanState *s = STM32F4XX_CAN(dev);
+
+    if (s->master && s->master->master) {
+        error_setg(errp, "the master of CAN2 must be CAN1");
+        return;
+    }
+    if (s->canbus) {
+        s->bus_client.info = &stm32f4xx_can_bus_client_info;
+        if (can_bus_insert_client(s->canbus, &s->bus_client) < 0) {
+            error_setg(errp, "cannot connect to the CAN bus");
+            return;
+        }
+    }
+}
+
+static void stm32f4xx_can_unrealize(DeviceState *dev)
+{
+    STM32F4xxCanState *s = STM32F4XX_CAN(dev);
+
+    can_bus_remove_client(&s->bus_client);
+}
+
+static int stm32f4xx_can_post_load(void *opaque, int version_id)
+{
+    STM32F4xxCanState *s = opaque;
+
+    for (unsigned f = 0; f < STM32F4XX_CAN_NUM_FIFOS; f++) {
+        if (s->rx_head[f] >= STM32F4XX_CAN_FIFO_DEPTH ||
+            FIELD_EX32(s->rfr[f], RF0R, FMP) > STM32F4XX_CAN_FIFO_DEPTH) {
+            return -EINVAL;
+        }
+    }
+    if (!s->master) {
+        stm32f4xx_can_update_filters(s);
+    }
+    return 0;
+}
+
+static const VMStateDescription vmstate_stm32f4xx_can_mailbox = {
+    .name = TYPE_STM32F4XX_CAN "-mailbox",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(ir, STM32F4xxCanMailbox),
+        VMSTATE_UINT32(dtr, STM32F4xxCanMailbox),
+        VMSTATE_UINT32(dlr, STM32F4xxCanMailbox),
+        VMSTATE_UINT32(dhr, STM32F4xxCanMailbox),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_stm32f4xx_can = {
+    .name = TYPE_STM32F4XX_CAN,
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .post_load = stm32f4xx_can_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(mcr, STM32F4xxCanState),
+        VMSTATE_UINT32(msr, STM32F4xxCanState),
+        VMSTATE_UINT32(tsr, STM32F4xxCanState),
+        VMSTATE_UINT32_ARRAY(rfr, STM32F4xxCanState,
+                             STM32F4XX_CAN_NUM_FIFOS),
+        VMSTATE_UINT32(ier, STM32F4xxCanState),
+        VMSTATE_UINT32(esr, STM32F4xxCanState),
+        VMSTATE_UINT32(btr, STM32F4xxCanState),
+        VMSTATE_STRUCT_ARRAY(tx, STM32F4xxCanState, STM32F4XX_CAN_NUM_TX, 1,
+                             vmstate_stm32f4xx_can_mailbox,
+                             STM32F4xxCanMailbox),
+        VMSTATE_UINT32_ARRAY(tx_seq, STM32F4xxCanState, STM32F4XX_CAN_NUM_TX),
+        VMSTATE_UINT32(tx_next_seq, STM32F4xxCanState),
+        VMSTATE_STRUCT_2DARRAY(rx, STM32F4xxCanState, STM32F4XX_CAN_NUM_FIFOS,
+                               STM32F4XX_CAN_FIFO_DEPTH, 1,
+                               vmstate_stm32f4xx_can_mailbox,
+                               STM32F4xxCanMailbox),
+        VMSTATE_UINT8_ARRAY(rx_head, STM32F4xxCanState,
+                            STM32F4XX_CAN_NUM_FIFOS),
+        VMSTATE_UINT32(fmr, STM32F4xxCanState),
+        VMSTATE_UINT32(fm1r, STM32F4xxCanState),
+        VMSTATE_UINT32(fs1r, STM32F4xxCanState),
+        VMSTATE_UINT32(ffa1r, STM32F4xxCanState),
+        VMSTATE_UINT32(fa1r, STM32F4xxCanState),
+        VMSTATE_UINT32_2DARRAY(fr, STM32F4xxCanState,
+                               STM32F4XX_CAN_NUM_BANKS, 2),
+        VMSTATE_CLOCK(clk, STM32F4xxCanState),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static Property stm32f4xx_can_properties[] = {
+    DEFINE_PROP_LINK("canbus", STM32F4xxCanState, canbus, TYPE_CAN_BUS,
+                     CanBusState *),
+    DEFINE_PROP_LINK("master", STM32F4xxCanState, master, TYPE_STM32F4XX_CAN,
+                     STM32F4xxCanState *),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void stm32f4xx_can_class_init(ObjectClass *klass, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(klass);
+    ResettableClass *rc = RESETTABLE_CLASS(klass);
+
+    dc->realize = stm32f4xx_can_realize;
+    dc->unrealize = stm32f4xx_can_unrealize;
+    dc->vmsd = &vmstate_stm32f4xx_can;
+    device_class_set_props(dc, stm32f4xx_can_properties);
+    rc->phases.hold = stm32f4xx_can_reset_hold;
+}
+
+static const TypeInfo stm32f4xx_can_info = {
+    .name          = TYPE_STM32F4XX_CAN,
+    .parent        = TYPE_SYS_BUS_DEVICE,
+    .instance_size = sizeof(STM32F4xxCanState),
+    .instance_init = stm32f4xx_can_init,
+    .class_init    = stm32f4xx_can_class_init,
+};
+
+static void stm32f4xx_can_register_types(void)
+{
+    type_register_static(&stm32f4xx_can_info);
+}
+
+type_init(stm32f4xx_can_register_types)
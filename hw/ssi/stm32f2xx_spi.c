@@ -25,20 +25,50 @@
 #include "qemu/osdep.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
+#include "hw/irq.h"
+#include "hw/qdev-clock.h"
 #include "hw/ssi/stm32f2xx_spi.h"
 #include "migration/vmstate.h"
+#include "trace.h"
 
-#ifndef STM_SPI_ERR_DEBUG
-#define STM_SPI_ERR_DEBUG 0
-#endif
+/*
+ * Frames written to DR are queued in a FIFO and clocked out when the bus
+ * time they take, from the APB clock and CR1.BR, has passed.  A burst, fed
+ * by the CPU or by DMA while the FIFO has room, completes at once when its
+ * last frame is out, and what came back waits in the RX FIFO.  Without a
+ * clock, frames go out as soon as they are written.
+ */
+static void stm32f2xx_spi_update(STM32F2XXSPIState *s)
+{
+    uint32_t mask = 0;
 
-#define DB_PRINT_L(lvl, fmt, args...) do { \
-    if (STM_SPI_ERR_DEBUG >= lvl) { \
-        qemu_log("%s: " fmt, __func__, ## args); \
-    } \
-} while (0)
+    s->spi_sr &= ~(STM_SPI_SR_TXE | STM_SPI_SR_RXNE | STM_SPI_SR_BSY);
+    if (!fifo32_is_full(&s->tx_fifo)) {
+        s->spi_sr |= STM_SPI_SR_TXE;
+    }
+    if (!fifo32_is_empty(&s->rx_fifo)) {
+        s->spi_sr |= STM_SPI_SR_RXNE;
+    }
+    if (!fifo32_is_empty(&s->tx_fifo)) {
+        s->spi_sr |= STM_SPI_SR_BSY;
+    }
 
-#define DB_PRINT(fmt, args...) DB_PRINT_L(1, fmt, ## args)
+    if (s->spi_cr2 & STM_SPI_CR2_TXEIE) {
+        mask |= STM_SPI_SR_TXE;
+    }
+    if (s->spi_cr2 & STM_SPI_CR2_RXNEIE) {
+        mask |= STM_SPI_SR_RXNE;
+    }
+    if (s->spi_cr2 & STM_SPI_CR2_ERRIE) {
+        mask |= STM_SPI_SR_OVR;
+    }
+    qemu_set_irq(s->irq, !!(s->spi_sr & mask));
+
+    qemu_set_irq(s->dma_tx, (s->spi_cr2 & STM_SPI_CR2_TXDMAEN) &&
+                            (s->spi_sr & STM_SPI_SR_TXE));
+    qemu_set_irq(s->dma_rx, (s->spi_cr2 & STM_SPI_CR2_RXDMAEN) &&
+                            (s->spi_sr & STM_SPI_SR_RXNE));
+}
 
 static void stm32f2xx_spi_reset(DeviceState *dev)
 {
@@ -53,37 +83,78 @@ static void stm32f2xx_spi_reset(DeviceState *dev)
     s->spi_txcrcr = 0x00000000;
     s->spi_i2scfgr = 0x00000000;
     s->spi_i2spr = 0x00000002;
+
+    fifo32_reset(&s->tx_fifo);
+    fifo32_reset(&s->rx_fifo);
+    timer_del(s->timer);
+    s->busy_until = 0;
+
+    stm32f2xx_spi_update(s);
 }
 
+/* Clock all the queued frames out, and in */
 static void stm32f2xx_spi_transfer(STM32F2XXSPIState *s)
 {
-    DB_PRINT("Data to send: 0x%x\n", s->spi_dr);
+    uint32_t tx, rx;
 
-    s->spi_dr = ssi_transfer(s->ssi, s->spi_dr);
-    s->spi_sr |= STM_SPI_SR_RXNE;
+    while (!fifo32_is_empty(&s->tx_fifo)) {
+        tx = fifo32_pop(&s->tx_fifo);
+        rx = ssi_transfer(s->ssi, tx);
+        trace_stm32f2xx_spi_transfer(tx, rx);
+        if (fifo32_is_full(&s->rx_fifo)) {
+            s->spi_sr |= STM_SPI_SR_OVR;
+        } else {
+            fifo32_push(&s->rx_fifo, rx);
+        }
+    }
+    stm32f2xx_spi_update(s);
+}
 
-    DB_PRINT("Data received: 0x%x\n", s->spi_dr);
+static void stm32f2xx_spi_timer(void *opaque)
+{
+    stm32f2xx_spi_transfer(opaque);
 }
 
-static uint64_t stm32f2xx_spi_read(void *opaque, hwaddr addr,
-                                     unsigned int size)
+/* Queue a frame, which goes out after the ones before it */
+static void stm32f2xx_spi_queue(STM32F2XXSPIState *s, uint32_t value)
 {
-    STM32F2XXSPIState *s = opaque;
+    unsigned bits = s->spi_cr1 & STM_SPI_CR1_DFF ? 16 : 8;
+    unsigned br = (s->spi_cr1 & STM_SPI_CR1_BR) >> STM_SPI_CR1_BR_SHIFT;
+    int64_t now;
+
+    if (fifo32_is_full(&s->tx_fifo)) {
+        qemu_log_mask(LOG_GUEST_ERROR, "%s: Write to DR while TXE is clear\n",
+                      __func__);
+        return;
+    }
+    fifo32_push(&s->tx_fifo, bits == 16 ? value & 0xFFFF : value & 0xFF);
 
-    DB_PRINT("Address: 0x%" HWADDR_PRIx "\n", addr);
+    if (!clock_is_enabled(s->clk)) {
+        stm32f2xx_spi_transfer(s);
+        return;
+    }
+    now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    s->busy_until = MAX(s->busy_until, now) +
+                    clock_ticks_to_ns(s->clk, bits << (br + 1));
+    timer_mod(s->timer, s->busy_until);
+    stm32f2xx_spi_update(s);
+}
 
+static uint64_t stm32f2xx_spi_read_reg(STM32F2XXSPIState *s, hwaddr addr)
+{
     switch (addr) {
     case STM_SPI_CR1:
         return s->spi_cr1;
     case STM_SPI_CR2:
-        qemu_log_mask(LOG_UNIMP, "%s: Interrupts and DMA are not implemented\n",
-                      __func__);
         return s->spi_cr2;
     case STM_SPI_SR:
         return s->spi_sr;
     case STM_SPI_DR:
-        stm32f2xx_spi_transfer(s);
-        s->spi_sr &= ~STM_SPI_SR_RXNE;
+        /* Only writes clock data out: reads take what was received */
+        if (!fifo32_is_empty(&s->rx_fifo)) {
+            s->spi_dr = fifo32_pop(&s->rx_fifo);
+            stm32f2xx_spi_update(s);
+        }
         return s->spi_dr;
     case STM_SPI_CRCPR:
         qemu_log_mask(LOG_UNIMP, "%s: CRC is not implemented, the registers " \
@@ -113,31 +184,44 @@ static uint64_t stm32f2xx_spi_read(void *opaque, hwaddr addr,
     return 0;
 }
 
+static uint64_t stm32f2xx_spi_read(void *opaque, hwaddr addr,
+                                   unsigned int size)
+{
+    STM32F2XXSPIState *s = opaque;
+    uint64_t value = stm32f2xx_spi_read_reg(s, addr);
+
+    s->mmio_reads++;
+    trace_stm32f2xx_spi_read(addr, value);
+    return value;
+}
+
 static void stm32f2xx_spi_write(void *opaque, hwaddr addr,
                                 uint64_t val64, unsigned int size)
 {
     STM32F2XXSPIState *s = opaque;
     uint32_t value = val64;
 
-    DB_PRINT("Address: 0x%" HWADDR_PRIx ", Value: 0x%x\n", addr, value);
+    s->mmio_writes++;
+    trace_stm32f2xx_spi_write(addr, value);
 
     switch (addr) {
     case STM_SPI_CR1:
         s->spi_cr1 = value;
         return;
     case STM_SPI_CR2:
-        qemu_log_mask(LOG_UNIMP, "%s: " \
-                      "Interrupts and DMA are not implemented\n", __func__);
         s->spi_cr2 = value;
+        stm32f2xx_spi_update(s);
         return;
     case STM_SPI_SR:
         /* Read only register, except for clearing the CRCERR bit, which
-         * is not supported
+         * is not supported.  OVR is cleared here rather than by reading
+         * DR then SR.
          */
+        s->spi_sr &= ~STM_SPI_SR_OVR;
+        stm32f2xx_spi_update(s);
         return;
     case STM_SPI_DR:
-        s->spi_dr = value;
-        stm32f2xx_spi_transfer(s);
+        stm32f2xx_spi_queue(s, value);
         return;
     case STM_SPI_CRCPR:
         qemu_log_mask(LOG_UNIMP, "%s: CRC is not implemented\n", __func__);
@@ -172,8 +256,8 @@ static const MemoryRegionOps stm32f2xx_spi_ops = {
 
 static const VMStateDescription vmstate_stm32f2xx_spi = {
     .name = TYPE_STM32F2XX_SPI,
-    .version_id = 1,
-    .minimum_version_id = 1,
+    .version_id = 2,
+    .minimum_version_id = 2,
     .fields = (const VMStateField[]) {
         VMSTATE_UINT32(spi_cr1, STM32F2XXSPIState),
         VMSTATE_UINT32(spi_cr2, STM32F2XXSPIState),
@@ -184,6 +268,11 @@ static const VMStateDescription vmstate_stm32f2xx_spi = {
         VMSTATE_UINT32(spi_txcrcr, STM32F2XXSPIState),
         VMSTATE_UINT32(spi_i2scfgr, STM32F2XXSPIState),
         VMSTATE_UINT32(spi_i2spr, STM32F2XXSPIState),
+        VMSTATE_FIFO32(tx_fifo, STM32F2XXSPIState),
+        VMSTATE_FIFO32(rx_fifo, STM32F2XXSPIState),
+        VMSTATE_INT64(busy_until, STM32F2XXSPIState),
+        VMSTATE_TIMER_PTR(timer, STM32F2XXSPIState),
+        VMSTATE_CLOCK(clk, STM32F2XXSPIState),
         VMSTATE_END_OF_LIST()
     }
 };
@@ -198,8 +287,19 @@ static void stm32f2xx_spi_init(Object *obj)
     sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->mmio);
 
     sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq);
+    qdev_init_gpio_out_named(dev, &s->dma_tx, "dma-tx", 1);
+    qdev_init_gpio_out_named(dev, &s->dma_rx, "dma-rx", 1);
 
     s->ssi = ssi_create_bus(dev, "ssi");
+
+    fifo32_create(&s->tx_fifo, STM_SPI_FIFO_DEPTH);
+    fifo32_create(&s->rx_fifo, STM_SPI_FIFO_DEPTH);
+    s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, stm32f2xx_spi_timer, s);
+    s->clk = qdev_init_clock_in(dev, "clk", NULL, NULL, 0);
+    object_property_add_uint64_ptr(obj, "mmio-reads", &s->mmio_reads,
+                                   OBJ_PROP_FLAG_READ);
+    object_property_add_uint64_ptr(obj, "mmio-writes", &s->mmio_writes,
+                                   OBJ_PROP_FLAG_READ);
 }
 
 static void stm32f2xx_spi_class_init(ObjectClass *klass, void *data)
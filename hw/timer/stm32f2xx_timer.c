@@ -25,14 +25,13 @@
 #include "qemu/osdep.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-clock.h"
 #include "hw/timer/stm32f2xx_timer.h"
 #include "migration/vmstate.h"
 #include "qemu/log.h"
 #include "qemu/module.h"
-
-#ifndef STM_TIMER_ERR_DEBUG
-#define STM_TIMER_ERR_DEBUG 0
-#endif
+#include "qapi/error.h"
+#include "trace.h"
 
 /*******************  Bit definition for TIM_CR1 register  ********************/
 #define  TIM_CR1_CEN                         ((uint16_t)0x0001)            /*!<Counter enable        */
@@ -230,72 +229,1037 @@
 #define  TIM_CCER_CC4P                       ((uint16_t)0x2000)            /*!<Capture/Compare 4 output Polarity               */
 #define  TIM_CCER_CC4NP                      ((uint16_t)0x8000)            /*!<Capture/Compare 4 Complementary output Polarity */
 
+/* Not in the CMSIS header excerpt above */
+#define  TIM_CR1_UIFREMAP                    ((uint16_t)0x0800)
+#define  TIM_SMCR_SMS                        ((uint16_t)0x0007)
+#define  TIM_SMCR_TS                         ((uint16_t)0x0070)
+#define  TIM_BDTR_AOE                        ((uint16_t)0x4000)
+#define  TIM_BDTR_MOE                        ((uint16_t)0x8000)
+#define  TIM_DCR_DBA                         ((uint16_t)0x001F)
+#define  TIM_DCR_DBL                         ((uint16_t)0x1F00)
+
+#define TIM_CR1_WRITABLE    (TIM_CR1_CEN | TIM_CR1_UDIS | TIM_CR1_URS | \
+                             TIM_CR1_OPM | TIM_CR1_DIR | TIM_CR1_CMS | \
+                             TIM_CR1_ARPE | TIM_CR1_CKD | TIM_CR1_UIFREMAP)
+#define TIM_SR_CCIF(ch)     (TIM_SR_CC1IF << (ch))
+#define TIM_SR_CCOF(ch)     (TIM_SR_CC1OF << (ch))
+#define TIM_DIER_CCDE(ch)   (TIM_DIER_CC1DE << (ch))
+#define TIM_DIER_CCDE_ALL   (TIM_DIER_CC1DE | TIM_DIER_CC2DE | \
+                             TIM_DIER_CC3DE | TIM_DIER_CC4DE)
+#define TIM_SR_CCIF_ALL     (TIM_SR_CC1IF | TIM_SR_CC2IF | \
+                             TIM_SR_CC3IF | TIM_SR_CC4IF)
+
+/* Per channel bits of CCER */
+#define TIM_CCER_CCE        0x1
+#define TIM_CCER_CCP        0x2
+#define TIM_CCER_CCNE       0x4
+#define TIM_CCER_CCNP       0x8
+
+/* CCxS: output, or input capture from TIx, from the paired TI or TRC */
+enum {
+    TIM_CCS_OUTPUT,
+    TIM_CCS_TI,
+    TIM_CCS_TI_PAIR,
+    TIM_CCS_TRC,
+};
 
+/* OCxM */
+enum {
+    TIM_OCM_FROZEN,
+    TIM_OCM_ACTIVE,
+    TIM_OCM_INACTIVE,
+    TIM_OCM_TOGGLE,
+    TIM_OCM_FORCE_INACTIVE,
+    TIM_OCM_FORCE_ACTIVE,
+    TIM_OCM_PWM1,
+    TIM_OCM_PWM2,
+};
 
-#define DB_PRINT_L(lvl, fmt, args...) do { \
-    if (STM_TIMER_ERR_DEBUG >= lvl) { \
-        qemu_log("%s: " fmt, __func__, ## args); \
-    } \
-} while (0)
+/* SMCR.SMS, encoder modes 1 to 3 are not modelled */
+enum {
+    TIM_SMS_DISABLED,
+    TIM_SMS_RESET = 4,
+    TIM_SMS_GATED,
+    TIM_SMS_TRIGGER,
+    TIM_SMS_EXT_CLOCK,
+};
 
-#define DB_PRINT(fmt, args...) DB_PRINT_L(1, fmt, ## args)
+/* SMCR.TS: ITR0..3, then inputs of the timer itself */
+enum {
+    TIM_TS_TI1F_ED = 4,
+    TIM_TS_TI1FP1,
+    TIM_TS_TI2FP2,
+    TIM_TS_ETRF,
+};
 
-static void stm32f2xx_timer_set_alarm(STM32F2XXTimerState *s, int64_t now);
+/* CR2.MMS */
+enum {
+    TIM_MMS_RESET,
+    TIM_MMS_ENABLE,
+    TIM_MMS_UPDATE,
+    TIM_MMS_COMPARE_PULSE,
+    TIM_MMS_OC1REF,
+};
 
-static void stm32f2xx_timer_interrupt(void *opaque)
+static void stm32f2xx_timer_set_trgi(STM32F2XXTimerState *s, bool level);
+
+/* CCMRx holds 8 bits per channel */
+static unsigned stm32f2xx_timer_ccmr(STM32F2XXTimerState *s, unsigned ch)
 {
-    STM32F2XXTimerState *s = opaque;
+    uint32_t ccmr = ch < 2 ? s->tim_ccmr1 : s->tim_ccmr2;
+
+    return extract32(ccmr, (ch & 1) * 8, 8);
+}
+
+static unsigned stm32f2xx_timer_ccs(STM32F2XXTimerState *s, unsigned ch)
+{
+    return stm32f2xx_timer_ccmr(s, ch) & TIM_CCMR1_CC1S;
+}
+
+static unsigned stm32f2xx_timer_ocm(STM32F2XXTimerState *s, unsigned ch)
+{
+    return (stm32f2xx_timer_ccmr(s, ch) & TIM_CCMR1_OC1M) >> 4;
+}
+
+static unsigned stm32f2xx_timer_ccer(STM32F2XXTimerState *s, unsigned ch)
+{
+    return extract32(s->tim_ccer, ch * 4, 4);
+}
+
+static bool stm32f2xx_timer_is_output(STM32F2XXTimerState *s, unsigned ch)
+{
+    return stm32f2xx_timer_ccs(s, ch) == TIM_CCS_OUTPUT;
+}
+
+static bool stm32f2xx_timer_is_pwm(STM32F2XXTimerState *s, unsigned ch)
+{
+    return stm32f2xx_timer_ocm(s, ch) >= TIM_OCM_PWM1;
+}
+
+static unsigned stm32f2xx_timer_sms(STM32F2XXTimerState *s)
+{
+    return s->tim_smcr & TIM_SMCR_SMS;
+}
+
+static unsigned stm32f2xx_timer_ts(STM32F2XXTimerState *s)
+{
+    return (s->tim_smcr & TIM_SMCR_TS) >> 4;
+}
+
+static unsigned stm32f2xx_timer_mms(STM32F2XXTimerState *s)
+{
+    return (s->tim_cr2 & TIM_CR2_MMS) >> 4;
+}
+
+static uint32_t stm32f2xx_timer_max(STM32F2XXTimerState *s)
+{
+    return MAKE_64BIT_MASK(0, s->counter_bits);
+}
+
+static bool stm32f2xx_timer_center(STM32F2XXTimerState *s)
+{
+    return s->tim_cr1 & TIM_CR1_CMS;
+}
+
+static bool stm32f2xx_timer_down(STM32F2XXTimerState *s)
+{
+    return s->tim_cr1 & TIM_CR1_DIR;
+}
+
+/*
+ * The counter is modelled as a phase within its cycle, which only ever
+ * grows:
+ *  - edge aligned up:    phase = CNT,           cycle ARR + 1
+ *  - edge aligned down:  phase = ARR - CNT,     cycle ARR + 1
+ *  - center aligned:     phase = CNT going up, 2 * ARR - CNT going down,
+ *                        cycle 2 * ARR
+ * Overflows and underflows happen every "step" ticks, at phase 0 (and at
+ * phase ARR in center aligned mode).
+ */
+static uint64_t stm32f2xx_timer_cycle(STM32F2XXTimerState *s)
+{
+    uint64_t arr = s->arr_active;
+
+    return stm32f2xx_timer_center(s) ? 2 * arr : arr + 1;
+}
+
+static uint64_t stm32f2xx_timer_step(STM32F2XXTimerState *s)
+{
+    uint64_t arr = s->arr_active;
+
+    return stm32f2xx_timer_center(s) ? arr : arr + 1;
+}
+
+static uint64_t stm32f2xx_timer_phase(STM32F2XXTimerState *s)
+{
+    uint64_t arr = s->arr_active;
+    uint64_t cnt = MIN(s->tim_cnt, arr);
+
+    if (stm32f2xx_timer_center(s)) {
+        return stm32f2xx_timer_down(s) ? (2 * arr - cnt) % (2 * arr) : cnt;
+    }
+    return stm32f2xx_timer_down(s) ? arr - cnt : cnt;
+}
+
+static void stm32f2xx_timer_set_phase(STM32F2XXTimerState *s, uint64_t phase)
+{
+    uint64_t arr = s->arr_active;
+
+    if (stm32f2xx_timer_center(s)) {
+        if (phase >= arr) {
+            s->tim_cr1 |= TIM_CR1_DIR;
+            s->tim_cnt = 2 * arr - phase;
+        } else {
+            s->tim_cr1 &= ~TIM_CR1_DIR;
+            s->tim_cnt = phase;
+        }
+    } else {
+        s->tim_cnt = stm32f2xx_timer_down(s) ? arr - phase : phase;
+    }
+}
+
+/*
+ * A counter written above ARR while counting up first runs to the end of
+ * its range.  Returns the ticks to that overflow, or 0.
+ */
+static uint64_t stm32f2xx_timer_lead(STM32F2XXTimerState *s)
+{
+    if (stm32f2xx_timer_center(s) || stm32f2xx_timer_down(s) ||
+        s->tim_cnt <= s->arr_active) {
+        return 0;
+    }
+    return (uint64_t)stm32f2xx_timer_max(s) - s->tim_cnt + 1;
+}
+
+/* Ticks from phase p to the next phase t, both below the cycle c */
+static uint64_t stm32f2xx_timer_first(uint64_t p, uint64_t t, uint64_t c)
+{
+    return t > p ? t - p : t + c - p;
+}
+
+/* Number of phases t (mod c) in (p, p + n] */
+static uint64_t stm32f2xx_timer_hits(uint64_t p, uint64_t n, uint64_t t,
+                                     uint64_t c)
+{
+    uint64_t first = stm32f2xx_timer_first(p, t, c);
+
+    return n < first ? 0 : (n - first) / c + 1;
+}
+
+/*
+ * Phases at which the counter matches CCRx.  In center aligned mode this
+ * happens once counting up and once counting down; *flag tells whether a
+ * match sets CCxIF, which CMS restricts to one direction.
+ */
+static unsigned stm32f2xx_timer_cc_targets(STM32F2XXTimerState *s,
+                                           unsigned ch, uint64_t t[2],
+                                           bool flag[2])
+{
+    uint64_t arr = s->arr_active;
+    uint64_t v = s->ccr_active[ch];
+    unsigned cms = (s->tim_cr1 & TIM_CR1_CMS) >> 5;
+    unsigned n = 0;
+
+    if (v > arr) {
+        return 0;
+    }
+    if (!stm32f2xx_timer_center(s)) {
+        t[0] = stm32f2xx_timer_down(s) ? arr - v : v;
+        flag[0] = true;
+        return 1;
+    }
+    if (v > 0) {
+        /* reached counting up (CCR = ARR is the turning point) */
+        t[n] = v;
+        flag[n++] = cms & 2;
+    }
+    if (v < arr) {
+        /* reached counting down (CCR = 0 is the turning point) */
+        t[n] = (2 * arr - v) % (2 * arr);
+        flag[n++] = cms & 1;
+    }
+    return n;
+}
+
+static bool stm32f2xx_timer_counting(STM32F2XXTimerState *s)
+{
+    unsigned sms = stm32f2xx_timer_sms(s);
+
+    return (s->tim_cr1 & TIM_CR1_CEN) && s->arr_active && s->freq_hz &&
+           sms != TIM_SMS_EXT_CLOCK && (sms != TIM_SMS_GATED || s->gate);
+}
+
+static uint64_t stm32f2xx_timer_ticks_at(STM32F2XXTimerState *s, int64_t now)
+{
+    if (now <= s->base_ns) {
+        return 0;
+    }
+    return muldiv64(now - s->base_ns, s->freq_hz, NANOSECONDS_PER_SECOND) /
+           (s->psc_active + 1);
+}
+
+static int64_t stm32f2xx_timer_ns_at(STM32F2XXTimerState *s, uint64_t ticks)
+{
+    uint64_t ns;
+
+    if (ticks > UINT64_MAX / (s->psc_active + 1)) {
+        return INT64_MAX;
+    }
+    ns = muldiv64_round_up(ticks * (s->psc_active + 1),
+                           NANOSECONDS_PER_SECOND, s->freq_hz);
+    return ns > INT64_MAX - s->base_ns ? INT64_MAX : s->base_ns + ns;
+}
+
+static void stm32f2xx_timer_rebase(STM32F2XXTimerState *s, int64_t now)
+{
+    s->base_ns = now;
+    s->synced_ticks = 0;
+}
+
+/* An update event changes more than the flags: split the span there */
+static bool stm32f2xx_timer_update_pending(STM32F2XXTimerState *s)
+{
+    unsigned ch;
+
+    if (s->tim_cr1 & TIM_CR1_UDIS) {
+        return false;
+    }
+    if ((s->tim_cr1 & TIM_CR1_OPM) || s->tim_psc != s->psc_active ||
+        s->tim_arr != s->arr_active || s->tim_rcr != s->rcr_active) {
+        return true;
+    }
+    if (s->advanced && (s->tim_bdtr & (TIM_BDTR_AOE | TIM_BDTR_MOE)) ==
+        TIM_BDTR_AOE) {
+        return true;
+    }
+    for (ch = 0; ch < s->num_channels; ch++) {
+        if (stm32f2xx_timer_is_output(s, ch) &&
+            s->tim_ccr[ch] != s->ccr_active[ch]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Ticks until the next update event, UINT64_MAX if there is none */
+static uint64_t stm32f2xx_timer_ticks_to_update(STM32F2XXTimerState *s)
+{
+    uint64_t lead = stm32f2xx_timer_lead(s);
+    uint64_t step = stm32f2xx_timer_step(s);
+
+    if (s->tim_cr1 & TIM_CR1_UDIS) {
+        return UINT64_MAX;
+    }
+    if (lead) {
+        return lead + s->rep_cnt * step;
+    }
+    return stm32f2xx_timer_first(stm32f2xx_timer_phase(s) % step, 0, step) +
+           s->rep_cnt * step;
+}
+
+static void stm32f2xx_timer_update_flags(STM32F2XXTimerState *s)
+{
+    unsigned ch;
+
+    s->tim_sr |= TIM_SR_UIF;
+    if (s->tim_dier & TIM_DIER_UDE) {
+        s->dma_raise |= BIT(STM32F2XX_TIMER_DMA_UP);
+    }
+    if (s->tim_cr2 & TIM_CR2_CCDS) {
+        for (ch = 0; ch < s->num_channels; ch++) {
+            if (s->tim_dier & TIM_DIER_CCDE(ch)) {
+                s->dma_raise |= BIT(STM32F2XX_TIMER_DMA_CC1 + ch);
+            }
+        }
+    }
+}
+
+static void stm32f2xx_timer_cc_flags(STM32F2XXTimerState *s, unsigned ch,
+                                     uint64_t events)
+{
+    if (s->tim_sr & TIM_SR_CCIF(ch) && !stm32f2xx_timer_is_output(s, ch)) {
+        s->tim_sr |= TIM_SR_CCOF(ch);
+    }
+    s->tim_sr |= TIM_SR_CCIF(ch);
+    if ((s->tim_dier & TIM_DIER_CCDE(ch)) && !(s->tim_cr2 & TIM_CR2_CCDS)) {
+        s->dma_raise |= BIT(STM32F2XX_TIMER_DMA_CC1 + ch);
+    }
+    if (ch == 0 && stm32f2xx_timer_mms(s) == TIM_MMS_COMPARE_PULSE) {
+        s->trgo_pulses += MIN(events, UINT32_MAX - s->trgo_pulses);
+    }
+}
+
+/*
+ * Move the counter n ticks ahead, setting the flags of the compare matches
+ * and update events on the way.  Returns the number of update events; the
+ * callers make sure that at most the last one loads new shadow registers.
+ */
+static uint64_t stm32f2xx_timer_advance(STM32F2XXTimerState *s, uint64_t n)
+{
+    uint64_t lead = stm32f2xx_timer_lead(s);
+    uint64_t cycle, step, p, raw = 0, uev = 0;
+    unsigned ch, i;
+
+    if (!n) {
+        return 0;
+    }
+    if (lead) {
+        if (n < lead) {
+            s->tim_cnt += n;
+            return 0;
+        }
+        n -= lead;
+        s->tim_cnt = 0;
+        raw = 1;
+    }
+
+    cycle = stm32f2xx_timer_cycle(s);
+    step = stm32f2xx_timer_step(s);
+    p = stm32f2xx_timer_phase(s);
+    raw += stm32f2xx_timer_hits(p % step, n, 0, step);
+
+    for (ch = 0; ch < s->num_channels; ch++) {
+        uint64_t t[2], hits = 0, flagged = 0;
+        bool flag[2];
+        unsigned targets;
+
+        if (!stm32f2xx_timer_is_output(s, ch)) {
+            continue;
+        }
+        targets = stm32f2xx_timer_cc_targets(s, ch, t, flag);
+        for (i = 0; i < targets; i++) {
+            uint64_t h = stm32f2xx_timer_hits(p, n, t[i], cycle);
+
+            hits += h;
+            flagged += flag[i] ? h : 0;
+        }
+        if (flagged) {
+            stm32f2xx_timer_cc_flags(s, ch, flagged);
+        }
+        if (!hits) {
+            continue;
+        }
+        switch (stm32f2xx_timer_ocm(s, ch)) {
+        case TIM_OCM_ACTIVE:
+            s->ocref |= BIT(ch);
+            break;
+        case TIM_OCM_INACTIVE:
+            s->ocref &= ~BIT(ch);
+            break;
+        case TIM_OCM_TOGGLE:
+            s->ocref ^= (hits & 1) << ch;
+            break;
+        }
+    }
+    stm32f2xx_timer_set_phase(s, (p + n) % cycle);
+
+    /* The repetition counter lets only every RCR + 1st one through */
+    if (raw && !(s->tim_cr1 & TIM_CR1_UDIS)) {
+        if (raw > s->rep_cnt) {
+            uint64_t rest = raw - s->rep_cnt - 1;
+
+            uev = 1 + rest / (s->rcr_active + 1);
+            s->rep_cnt = s->rcr_active - rest % (s->rcr_active + 1);
+        } else {
+            s->rep_cnt -= raw;
+        }
+    }
+    if (uev) {
+        stm32f2xx_timer_update_flags(s);
+        if (stm32f2xx_timer_mms(s) == TIM_MMS_UPDATE) {
+            s->trgo_pulses += MIN(uev, UINT32_MAX - s->trgo_pulses);
+        }
+    }
+    return uev;
+}
 
-    DB_PRINT("Interrupt\n");
+/* Update event: load the shadow registers from the preload registers */
+static void stm32f2xx_timer_load_shadows(STM32F2XXTimerState *s,
+                                         bool overflow)
+{
+    unsigned ch;
+
+    s->psc_active = s->tim_psc;
+    s->arr_active = s->tim_arr;
+    s->rcr_active = s->tim_rcr;
+    s->rep_cnt = s->rcr_active;
+    for (ch = 0; ch < s->num_channels; ch++) {
+        if (stm32f2xx_timer_is_output(s, ch)) {
+            s->ccr_active[ch] = s->tim_ccr[ch];
+        }
+    }
+    if (!stm32f2xx_timer_center(s) && stm32f2xx_timer_down(s)) {
+        s->tim_cnt = s->arr_active;
+    }
+    if (s->advanced && (s->tim_bdtr & TIM_BDTR_AOE)) {
+        s->tim_bdtr |= TIM_BDTR_MOE;
+    }
+    if (overflow && (s->tim_cr1 & TIM_CR1_OPM)) {
+        s->tim_cr1 &= ~TIM_CR1_CEN;
+    }
+    trace_stm32f2xx_timer_update(s->tim_cnt, s->arr_active, s->psc_active);
+}
 
-    if (s->tim_dier & TIM_DIER_UIE && s->tim_cr1 & TIM_CR1_CEN) {
-        s->tim_sr |= 1;
-        qemu_irq_pulse(s->irq);
-        stm32f2xx_timer_set_alarm(s, s->hit_time);
+/*
+ * Bring the counter and the flags up to date with the virtual clock.
+ * Returns true if the counter moved.
+ */
+static bool stm32f2xx_timer_sync(STM32F2XXTimerState *s, int64_t now)
+{
+    bool moved = false;
+
+    while (s->running) {
+        uint64_t target = stm32f2xx_timer_ticks_at(s, now);
+        uint64_t n, to_update;
+
+        if (target <= s->synced_ticks) {
+            break;
+        }
+        n = target - s->synced_ticks;
+        moved = true;
+
+        if (stm32f2xx_timer_update_pending(s)) {
+            to_update = stm32f2xx_timer_ticks_to_update(s);
+            if (to_update <= n) {
+                stm32f2xx_timer_advance(s, to_update);
+                /* The prescaler restarts with its new value here */
+                stm32f2xx_timer_rebase(s, stm32f2xx_timer_ns_at(s,
+                                       s->synced_ticks + to_update));
+                stm32f2xx_timer_load_shadows(s, true);
+                s->running = stm32f2xx_timer_counting(s);
+                continue;
+            }
+        }
+        stm32f2xx_timer_advance(s, n);
+        s->synced_ticks = target;
     }
+    return moved;
+}
+
+/* UG, or a reset from the slave mode controller */
+static void stm32f2xx_timer_reinit(STM32F2XXTimerState *s, int64_t now)
+{
+    unsigned mms = stm32f2xx_timer_mms(s);
 
-    if (s->tim_ccmr1 & (TIM_CCMR1_OC2M2 | TIM_CCMR1_OC2M1) &&
-        !(s->tim_ccmr1 & TIM_CCMR1_OC2M0) &&
-        s->tim_ccmr1 & TIM_CCMR1_OC2PE &&
-        s->tim_ccer & TIM_CCER_CC2E) {
-        /* PWM 2 - Mode 1 */
-        DB_PRINT("PWM2 Duty Cycle: %d%%\n",
-                s->tim_ccr2 / (100 * (s->tim_psc + 1)));
+    if (!(s->tim_cr1 & TIM_CR1_UDIS)) {
+        stm32f2xx_timer_load_shadows(s, false);
+        if (!(s->tim_cr1 & TIM_CR1_URS)) {
+            stm32f2xx_timer_update_flags(s);
+        }
+        if (mms == TIM_MMS_UPDATE) {
+            s->trgo_pulses++;
+        }
+    }
+    if (mms == TIM_MMS_RESET) {
+        s->trgo_pulses++;
     }
+
+    if (stm32f2xx_timer_center(s)) {
+        s->tim_cr1 &= ~TIM_CR1_DIR;
+        s->tim_cnt = 0;
+    } else {
+        s->tim_cnt = stm32f2xx_timer_down(s) ? s->arr_active : 0;
+    }
+    s->ext_psc_cnt = 0;
+    stm32f2xx_timer_rebase(s, now);
 }
 
-static inline int64_t stm32f2xx_ns_to_ticks(STM32F2XXTimerState *s, int64_t t)
+/* One edge of the external clock (slave mode 7) */
+static void stm32f2xx_timer_ext_tick(STM32F2XXTimerState *s)
 {
-    return muldiv64(t, s->freq_hz, 1000000000ULL) / (s->tim_psc + 1);
+    if (!(s->tim_cr1 & TIM_CR1_CEN) || !s->arr_active) {
+        return;
+    }
+    if (s->ext_psc_cnt++ < s->psc_active) {
+        return;
+    }
+    s->ext_psc_cnt = 0;
+    if (stm32f2xx_timer_advance(s, 1)) {
+        stm32f2xx_timer_load_shadows(s, true);
+    }
+}
+
+static void stm32f2xx_timer_capture(STM32F2XXTimerState *s, unsigned ch)
+{
+    s->tim_ccr[ch] = s->ccr_active[ch] = s->tim_cnt;
+    stm32f2xx_timer_cc_flags(s, ch, 1);
+    trace_stm32f2xx_timer_capture(ch, s->tim_cnt);
+}
+
+/* Input capture prescaler: capture every 1, 2, 4 or 8 events */
+static void stm32f2xx_timer_ic_event(STM32F2XXTimerState *s, unsigned ch)
+{
+    unsigned psc = (stm32f2xx_timer_ccmr(s, ch) & TIM_CCMR1_IC1PSC) >> 2;
+
+    if (++s->ic_psc_cnt[ch] < (1 << psc)) {
+        return;
+    }
+    s->ic_psc_cnt[ch] = 0;
+    stm32f2xx_timer_capture(s, ch);
+}
+
+/* OCxREF, also for the modes where it is a function of the counter */
+static bool stm32f2xx_timer_ocref(STM32F2XXTimerState *s, unsigned ch)
+{
+    bool ref;
+
+    switch (stm32f2xx_timer_ocm(s, ch)) {
+    case TIM_OCM_FORCE_INACTIVE:
+        return false;
+    case TIM_OCM_FORCE_ACTIVE:
+        return true;
+    case TIM_OCM_PWM1:
+    case TIM_OCM_PWM2:
+        if (stm32f2xx_timer_down(s)) {
+            ref = s->tim_cnt <= s->ccr_active[ch];
+        } else {
+            ref = s->tim_cnt < s->ccr_active[ch];
+        }
+        return ref ^ (stm32f2xx_timer_ocm(s, ch) == TIM_OCM_PWM2);
+    default:
+        return s->ocref & BIT(ch);
+    }
 }
 
-static void stm32f2xx_timer_set_alarm(STM32F2XXTimerState *s, int64_t now)
+/* Ticks per cycle during which OCxREF of a PWM channel is active */
+static uint64_t stm32f2xx_timer_pwm_active(STM32F2XXTimerState *s,
+                                           unsigned ch)
+{
+    uint64_t arr = s->arr_active;
+    uint64_t v = s->ccr_active[ch];
+    uint64_t active;
+
+    if (stm32f2xx_timer_center(s)) {
+        active = 2 * MIN(v, arr);
+    } else if (stm32f2xx_timer_down(s)) {
+        active = MIN(v + 1, arr + 1);
+    } else {
+        active = MIN(v, arr + 1);
+    }
+    if (stm32f2xx_timer_ocm(s, ch) == TIM_OCM_PWM2) {
+        active = stm32f2xx_timer_cycle(s) - active;
+    }
+    return active;
+}
+
+static bool stm32f2xx_timer_outputs_enabled(STM32F2XXTimerState *s)
+{
+    /* Idle states and dead time of advanced timers are not modelled */
+    return !s->advanced || (s->tim_bdtr & TIM_BDTR_MOE);
+}
+
+static void stm32f2xx_timer_update_outputs(STM32F2XXTimerState *s)
+{
+    unsigned ch;
+
+    for (ch = 0; ch < s->num_channels; ch++) {
+        unsigned ccer = stm32f2xx_timer_ccer(s, ch);
+        bool enabled = stm32f2xx_timer_outputs_enabled(s) &&
+                       stm32f2xx_timer_is_output(s, ch);
+        bool ref = false, oc = false, ocn = false;
+        uint32_t duty;
+
+        if (stm32f2xx_timer_is_output(s, ch)) {
+            ref = stm32f2xx_timer_ocref(s, ch);
+            s->ocref = deposit32(s->ocref, ch, 1, ref);
+        }
+        if (enabled && (ccer & TIM_CCER_CCE)) {
+            oc = ref ^ !!(ccer & TIM_CCER_CCP);
+        }
+        if (enabled && s->advanced && (ccer & TIM_CCER_CCNE)) {
+            ocn = !ref ^ !!(ccer & TIM_CCER_CCNP);
+        }
+
+        /*
+         * A running PWM is reported by its duty cycle: toggling the output
+         * line at every edge would cost two host timer events per period.
+         */
+        if (enabled && (ccer & TIM_CCER_CCE) && s->running &&
+            stm32f2xx_timer_is_pwm(s, ch)) {
+            uint64_t cycle = stm32f2xx_timer_cycle(s);
+            uint64_t high = stm32f2xx_timer_pwm_active(s, ch);
+
+            if (ccer & TIM_CCER_CCP) {
+                high = cycle - high;
+            }
+            duty = muldiv64(high, STM32F2XX_TIMER_DUTY_MAX, cycle);
+        } else {
+            duty = oc ? STM32F2XX_TIMER_DUTY_MAX : 0;
+        }
+
+        if (oc != extract32(s->oc_level, ch, 1)) {
+            s->oc_level = deposit32(s->oc_level, ch, 1, oc);
+            qemu_set_irq(s->oc[ch], oc);
+        }
+        if (ocn != extract32(s->ocn_level, ch, 1)) {
+            s->ocn_level = deposit32(s->ocn_level, ch, 1, ocn);
+            qemu_set_irq(s->ocn[ch], ocn);
+        }
+        if (duty != s->duty_level[ch]) {
+            s->duty_level[ch] = duty;
+            qemu_set_irq(s->duty[ch], duty);
+            trace_stm32f2xx_timer_duty(ch, duty);
+        }
+    }
+}
+
+static void stm32f2xx_timer_update_irq(STM32F2XXTimerState *s)
+{
+    uint32_t active = s->tim_sr & s->tim_dier & 0xff;
+
+    if (!s->advanced) {
+        qemu_set_irq(s->irq[STM32F2XX_TIMER_IRQ_UP], !!active);
+        return;
+    }
+    qemu_set_irq(s->irq[STM32F2XX_TIMER_IRQ_UP], !!(active & TIM_SR_UIF));
+    qemu_set_irq(s->irq[STM32F2XX_TIMER_IRQ_CC], !!(active & TIM_SR_CCIF_ALL));
+    qemu_set_irq(s->irq[STM32F2XX_TIMER_IRQ_TRG_COM],
+                 !!(active & (TIM_SR_COMIF | TIM_SR_TIF)));
+    qemu_set_irq(s->irq[STM32F2XX_TIMER_IRQ_BRK], !!(active & TIM_SR_BIF));
+}
+
+/* Does anybody listen to TRGO? */
+static bool stm32f2xx_timer_trgo_wanted(STM32F2XXTimerState *s)
+{
+    unsigned i;
+
+    if (s->trgo) {
+        return true;
+    }
+    for (i = 0; i < s->num_slaves; i++) {
+        STM32F2XXTimerState *slave = s->slave[i].tim;
+
+        if (stm32f2xx_timer_sms(slave) != TIM_SMS_DISABLED &&
+            stm32f2xx_timer_ts(slave) == s->slave[i].itr) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Ticks until the next event somebody can observe as it happens: an
+ * enabled interrupt or DMA request, an edge on a connected output or on
+ * TRGO, or an update that changes the timer setup.  Flags nobody waits for
+ * are set lazily when the registers are read.
+ */
+static uint64_t stm32f2xx_timer_next_event(STM32F2XXTimerState *s)
+{
+    bool trgo = stm32f2xx_timer_trgo_wanted(s);
+    unsigned mms = stm32f2xx_timer_mms(s);
+    bool want_uev, want_raw = false, want_cc = false;
+    bool want[STM32F2XX_TIMER_NUM_CHANNELS] = { false };
+    uint64_t best = UINT64_MAX, lead, cycle, step, p;
+    unsigned ch, i;
+
+    want_uev = (s->tim_dier & (TIM_DIER_UIE | TIM_DIER_UDE)) ||
+               (trgo && mms == TIM_MMS_UPDATE) ||
+               ((s->tim_cr2 & TIM_CR2_CCDS) &&
+                (s->tim_dier & TIM_DIER_CCDE_ALL)) ||
+               stm32f2xx_timer_update_pending(s);
+
+    for (ch = 0; ch < s->num_channels; ch++) {
+        bool ref_out = trgo && mms == TIM_MMS_OC1REF + ch;
+        bool connected = s->oc[ch] || s->ocn[ch] || ref_out;
+        bool ref = s->ocref & BIT(ch);
+
+        if (!stm32f2xx_timer_is_output(s, ch)) {
+            continue;
+        }
+        if ((s->tim_dier & (TIM_DIER_CC1IE << ch)) ||
+            ((s->tim_dier & TIM_DIER_CCDE(ch)) &&
+             !(s->tim_cr2 & TIM_CR2_CCDS)) ||
+            (ch == 0 && trgo && mms == TIM_MMS_COMPARE_PULSE)) {
+            want[ch] = true;
+        }
+        if (!connected) {
+            continue;
+        }
+        switch (stm32f2xx_timer_ocm(s, ch)) {
+        case TIM_OCM_ACTIVE:
+            want[ch] |= !ref;
+            break;
+        case TIM_OCM_INACTIVE:
+            want[ch] |= ref;
+            break;
+        case TIM_OCM_TOGGLE:
+            want[ch] = true;
+            break;
+        case TIM_OCM_PWM1:
+        case TIM_OCM_PWM2:
+            if (s->pwm_edges || ref_out) {
+                want[ch] = true;
+                want_raw = true;
+            }
+            break;
+        }
+    }
+    for (ch = 0; ch < s->num_channels; ch++) {
+        want_cc |= want[ch];
+    }
+
+    if (want_uev) {
+        best = stm32f2xx_timer_ticks_to_update(s);
+    }
+    lead = stm32f2xx_timer_lead(s);
+    if (lead) {
+        return want_cc || want_raw ? MIN(best, lead) : best;
+    }
+
+    cycle = stm32f2xx_timer_cycle(s);
+    step = stm32f2xx_timer_step(s);
+    p = stm32f2xx_timer_phase(s);
+    if (want_raw) {
+        best = MIN(best, stm32f2xx_timer_first(p % step, 0, step));
+    }
+    for (ch = 0; ch < s->num_channels; ch++) {
+        uint64_t t[2];
+        bool flag[2];
+        unsigned targets;
+
+        if (!want[ch]) {
+            continue;
+        }
+        targets = stm32f2xx_timer_cc_targets(s, ch, t, flag);
+        for (i = 0; i < targets; i++) {
+            best = MIN(best, stm32f2xx_timer_first(p, t[i], cycle));
+        }
+    }
+    return best;
+}
+
+static void stm32f2xx_timer_schedule(STM32F2XXTimerState *s)
 {
     uint64_t ticks;
-    int64_t now_ticks;
 
-    if (s->tim_arr == 0) {
+    if (!s->timer) {
+        return;
+    }
+    ticks = s->running ? stm32f2xx_timer_next_event(s) : UINT64_MAX;
+    if (ticks == UINT64_MAX) {
+        timer_del(s->timer);
+        return;
+    }
+    timer_mod(s->timer, stm32f2xx_timer_ns_at(s, s->synced_ticks + ticks));
+}
+
+/* Level of the TRGI source selected by TS, without acting on edges */
+static bool stm32f2xx_timer_trgi_source(STM32F2XXTimerState *s)
+{
+    unsigned ts = stm32f2xx_timer_ts(s);
+
+    switch (ts) {
+    case TIM_TS_TI1FP1:
+        return (s->ti_level & 1) ^ !!(s->tim_ccer & TIM_CCER_CC1P);
+    case TIM_TS_TI2FP2:
+        return !!(s->ti_level & 2) ^ !!(s->tim_ccer & TIM_CCER_CC2P);
+    case TIM_TS_TI1F_ED:
+    case TIM_TS_ETRF:
+        return false;
+    default:
+        return s->itr[ts] && s->itr[ts]->trgo_level;
+    }
+}
+
+static void stm32f2xx_timer_notify_slaves(STM32F2XXTimerState *s, bool level)
+{
+    unsigned i;
+
+    for (i = 0; i < s->num_slaves; i++) {
+        STM32F2XXTimerState *slave = s->slave[i].tim;
+
+        if (stm32f2xx_timer_ts(slave) == s->slave[i].itr) {
+            stm32f2xx_timer_set_trgi(slave, level);
+        }
+    }
+}
+
+static void stm32f2xx_timer_update_trgo(STM32F2XXTimerState *s)
+{
+    unsigned mms = stm32f2xx_timer_mms(s);
+    uint32_t pulses = s->trgo_pulses;
+    bool level = false;
+
+    s->trgo_pulses = 0;
+    if (mms == TIM_MMS_ENABLE) {
+        level = s->tim_cr1 & TIM_CR1_CEN;
+    } else if (mms >= TIM_MMS_OC1REF) {
+        level = s->ocref & BIT(mms - TIM_MMS_OC1REF);
+    }
+
+    if (level != s->trgo_level) {
+        s->trgo_level = level;
+        qemu_set_irq(s->trgo, level);
+        stm32f2xx_timer_notify_slaves(s, level);
+    }
+    if (!pulses || level || !stm32f2xx_timer_trgo_wanted(s)) {
         return;
     }
+    while (pulses--) {
+        s->trgo_level = true;
+        qemu_irq_raise(s->trgo);
+        stm32f2xx_timer_notify_slaves(s, true);
+        s->trgo_level = false;
+        qemu_irq_lower(s->trgo);
+        stm32f2xx_timer_notify_slaves(s, false);
+    }
+}
 
-    DB_PRINT("Alarm set at: 0x%x\n", s->tim_cr1);
+/*
+ * A request stays high until the controller accesses the timer, which is
+ * how the hardware acknowledges it.  The DMA may access the timer from
+ * within qemu_irq_raise(), so this comes last.
+ */
+static void stm32f2xx_timer_raise_dma(STM32F2XXTimerState *s)
+{
+    uint8_t raise = s->dma_raise & ~s->dma_pending;
+    unsigned i;
+
+    s->dma_raise = 0;
+    for (i = 0; i < STM32F2XX_TIMER_NUM_DMA; i++) {
+        if ((raise & BIT(i)) && s->dma[i]) {
+            s->dma_pending |= BIT(i);
+            qemu_irq_raise(s->dma[i]);
+        }
+    }
+}
 
-    now_ticks = stm32f2xx_ns_to_ticks(s, now);
-    ticks = s->tim_arr - (now_ticks - s->tick_offset);
+static void stm32f2xx_timer_dma_ack(STM32F2XXTimerState *s)
+{
+    uint8_t pending = s->dma_pending;
+    unsigned i;
 
-    DB_PRINT("Alarm set in %d ticks\n", (int) ticks);
+    s->dma_pending = 0;
+    for (i = 0; i < STM32F2XX_TIMER_NUM_DMA; i++) {
+        if (pending & BIT(i)) {
+            qemu_irq_lower(s->dma[i]);
+        }
+    }
+}
+
+/* Propagate a state change to the interrupt, output and trigger lines */
+static void stm32f2xx_timer_commit(STM32F2XXTimerState *s, int64_t now)
+{
+    bool counting = stm32f2xx_timer_counting(s);
+
+    if (counting && !s->running) {
+        stm32f2xx_timer_rebase(s, now);
+    }
+    s->running = counting;
 
-    s->hit_time = muldiv64((ticks + (uint64_t) now_ticks) * (s->tim_psc + 1),
-                               1000000000ULL, s->freq_hz);
+    stm32f2xx_timer_update_irq(s);
+    stm32f2xx_timer_update_outputs(s);
+    stm32f2xx_timer_schedule(s);
+    stm32f2xx_timer_update_trgo(s);
+    stm32f2xx_timer_raise_dma(s);
+}
+
+static void stm32f2xx_timer_interrupt(void *opaque)
+{
+    STM32F2XXTimerState *s = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
 
-    timer_mod(s->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + s->hit_time);
-    DB_PRINT("Wait Time: %" PRId64 " ticks\n", s->hit_time);
+    stm32f2xx_timer_sync(s, now);
+    stm32f2xx_timer_commit(s, now);
+}
+
+/* Trigger input from the slave mode controller's point of view */
+static void stm32f2xx_timer_set_trgi(STM32F2XXTimerState *s, bool level)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    unsigned sms = stm32f2xx_timer_sms(s);
+    bool rising = level && !s->trgi;
+    unsigned ch;
+
+    /* Masters and slaves may be chained in a loop */
+    if (s->in_trigger || level == s->trgi) {
+        return;
+    }
+    s->in_trigger = true;
+
+    stm32f2xx_timer_sync(s, now);
+    s->trgi = level;
+    trace_stm32f2xx_timer_trigger(level);
+
+    if (sms == TIM_SMS_GATED) {
+        s->gate = level;
+    }
+    if (sms != TIM_SMS_DISABLED && (rising || sms == TIM_SMS_GATED)) {
+        s->tim_sr |= TIM_SR_TIF;
+        if (s->tim_dier & TIM_DIER_TDE) {
+            s->dma_raise |= BIT(STM32F2XX_TIMER_DMA_TRIG);
+        }
+    }
+    if (rising) {
+        switch (sms) {
+        case TIM_SMS_RESET:
+            stm32f2xx_timer_reinit(s, now);
+            break;
+        case TIM_SMS_TRIGGER:
+            s->tim_cr1 |= TIM_CR1_CEN;
+            break;
+        case TIM_SMS_EXT_CLOCK:
+            stm32f2xx_timer_ext_tick(s);
+            break;
+        }
+        for (ch = 0; ch < s->num_channels; ch++) {
+            if (stm32f2xx_timer_ccs(s, ch) == TIM_CCS_TRC &&
+                (stm32f2xx_timer_ccer(s, ch) & TIM_CCER_CCE)) {
+                stm32f2xx_timer_ic_event(s, ch);
+            }
+        }
+    }
+
+    stm32f2xx_timer_commit(s, now);
+    s->in_trigger = false;
+}
+
+/* TIx inputs, from the pins */
+static void stm32f2xx_timer_ic(void *opaque, int n, int level)
+{
+    STM32F2XXTimerState *s = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    bool rising = level;
+    unsigned ch, ts;
+
+    if (!!level == extract32(s->ti_level, n, 1)) {
+        return;
+    }
+    stm32f2xx_timer_sync(s, now);
+    s->ti_level = deposit32(s->ti_level, n, 1, !!level);
+
+    for (ch = 0; ch < s->num_channels; ch++) {
+        unsigned ccs = stm32f2xx_timer_ccs(s, ch);
+        unsigned ccer = stm32f2xx_timer_ccer(s, ch);
+        bool falling_edge = ccer & TIM_CCER_CCP;
+        bool both_edges = falling_edge && (ccer & TIM_CCER_CCNP);
+
+        if (!(ccer & TIM_CCER_CCE) ||
+            !((ccs == TIM_CCS_TI && n == ch) ||
+              (ccs == TIM_CCS_TI_PAIR && n == (ch ^ 1)))) {
+            continue;
+        }
+        if (both_edges || rising != falling_edge) {
+            stm32f2xx_timer_ic_event(s, ch);
+        }
+    }
+    stm32f2xx_timer_commit(s, now);
+
+    ts = stm32f2xx_timer_ts(s);
+    if (ts == TIM_TS_TI1F_ED && n == 0) {
+        stm32f2xx_timer_set_trgi(s, true);
+        stm32f2xx_timer_set_trgi(s, false);
+    } else if ((ts == TIM_TS_TI1FP1 && n == 0) ||
+               (ts == TIM_TS_TI2FP2 && n == 1)) {
+        stm32f2xx_timer_set_trgi(s, stm32f2xx_timer_trgi_source(s));
+    }
 }
 
 static void stm32f2xx_timer_reset(DeviceState *dev)
 {
     STM32F2XXTimerState *s = STM32F2XXTIMER(dev);
     int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    unsigned ch;
 
     s->tim_cr1 = 0;
     s->tim_cr2 = 0;
@@ -306,25 +1270,42 @@ static void stm32f2xx_timer_reset(DeviceState *dev)
     s->tim_ccmr1 = 0;
     s->tim_ccmr2 = 0;
     s->tim_ccer = 0;
+    s->tim_cnt = 0;
     s->tim_psc = 0;
-    s->tim_arr = 0;
-    s->tim_ccr1 = 0;
-    s->tim_ccr2 = 0;
-    s->tim_ccr3 = 0;
-    s->tim_ccr4 = 0;
+    s->tim_arr = stm32f2xx_timer_max(s);
+    s->tim_rcr = 0;
+    s->tim_bdtr = 0;
     s->tim_dcr = 0;
     s->tim_dmar = 0;
     s->tim_or = 0;
 
-    s->tick_offset = stm32f2xx_ns_to_ticks(s, now);
+    s->psc_active = 0;
+    s->arr_active = s->tim_arr;
+    s->rcr_active = 0;
+    s->rep_cnt = 0;
+    for (ch = 0; ch < STM32F2XX_TIMER_NUM_CHANNELS; ch++) {
+        s->tim_ccr[ch] = 0;
+        s->ccr_active[ch] = 0;
+        s->ic_psc_cnt[ch] = 0;
+    }
+    s->ocref = 0;
+    s->ext_psc_cnt = 0;
+    s->gate = false;
+    s->trgi = false;
+    s->trgo_pulses = 0;
+    s->dma_raise = 0;
+    s->dma_burst = 0;
+    stm32f2xx_timer_dma_ack(s);
+
+    s->running = false;
+    stm32f2xx_timer_rebase(s, now);
+    stm32f2xx_timer_commit(s, now);
 }
 
-static uint64_t stm32f2xx_timer_read(void *opaque, hwaddr offset,
-                           unsigned size)
+static uint32_t stm32f2xx_timer_read_reg(STM32F2XXTimerState *s,
+                                         hwaddr offset)
 {
-    STM32F2XXTimerState *s = opaque;
-
-    DB_PRINT("Read 0x%"HWADDR_PRIx"\n", offset);
+    unsigned ch;
 
     switch (offset) {
     case TIM_CR1:
@@ -338,7 +1319,7 @@ static uint64_t stm32f2xx_timer_read(void *opaque, hwaddr offset,
     case TIM_SR:
         return s->tim_sr;
     case TIM_EGR:
-        return s->tim_egr;
+        return 0;
     case TIM_CCMR1:
         return s->tim_ccmr1;
     case TIM_CCMR2:
@@ -346,20 +1327,28 @@ static uint64_t stm32f2xx_timer_read(void *opaque, hwaddr offset,
     case TIM_CCER:
         return s->tim_ccer;
     case TIM_CNT:
-        return stm32f2xx_ns_to_ticks(s, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL)) -
-               s->tick_offset;
+        if ((s->tim_cr1 & TIM_CR1_UIFREMAP) && s->counter_bits < 32) {
+            return s->tim_cnt | (s->tim_sr & TIM_SR_UIF) << 31;
+        }
+        return s->tim_cnt;
     case TIM_PSC:
         return s->tim_psc;
     case TIM_ARR:
         return s->tim_arr;
+    case TIM_RCR:
+        return s->tim_rcr;
     case TIM_CCR1:
-        return s->tim_ccr1;
     case TIM_CCR2:
-        return s->tim_ccr2;
     case TIM_CCR3:
-        return s->tim_ccr3;
     case TIM_CCR4:
-        return s->tim_ccr4;
+        ch = (offset - TIM_CCR1) / 4;
+        /* Reading a captured value clears the capture flag */
+        if (!stm32f2xx_timer_is_output(s, ch)) {
+            s->tim_sr &= ~TIM_SR_CCIF(ch);
+        }
+        return s->tim_ccr[ch];
+    case TIM_BDTR:
+        return s->tim_bdtr;
     case TIM_DCR:
         return s->tim_dcr;
     case TIM_DMAR:
@@ -374,25 +1363,46 @@ static uint64_t stm32f2xx_timer_read(void *opaque, hwaddr offset,
     return 0;
 }
 
-static void stm32f2xx_timer_write(void *opaque, hwaddr offset,
-                        uint64_t val64, unsigned size)
+static void stm32f2xx_timer_write_reg(STM32F2XXTimerState *s, hwaddr offset,
+                                      uint32_t value, int64_t now)
 {
-    STM32F2XXTimerState *s = opaque;
-    uint32_t value = val64;
-    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
-    uint32_t timer_val = 0;
-
-    DB_PRINT("Write 0x%x, 0x%"HWADDR_PRIx"\n", value, offset);
+    uint32_t max = stm32f2xx_timer_max(s);
+    unsigned ch;
 
     switch (offset) {
     case TIM_CR1:
-        s->tim_cr1 = value;
+        if (stm32f2xx_timer_center(s) && (value & TIM_CR1_CMS)) {
+            /* DIR is read only in center aligned mode */
+            value = (value & ~TIM_CR1_DIR) | (s->tim_cr1 & TIM_CR1_DIR);
+        }
+        s->tim_cr1 = value & TIM_CR1_WRITABLE;
+        if (!(s->tim_cr1 & TIM_CR1_ARPE)) {
+            s->arr_active = s->tim_arr;
+        }
         return;
     case TIM_CR2:
         s->tim_cr2 = value;
         return;
     case TIM_SMCR:
+        if ((value & TIM_SMCR_SMS) && (value & TIM_SMCR_SMS) < TIM_SMS_RESET) {
+            qemu_log_mask(LOG_UNIMP, "%s: encoder modes not supported\n",
+                          __func__);
+        }
+        if (((value & TIM_SMCR_TS) >> 4) == TIM_TS_ETRF &&
+            (value & TIM_SMCR_SMS)) {
+            qemu_log_mask(LOG_UNIMP, "%s: ETR input not supported\n",
+                          __func__);
+        }
         s->tim_smcr = value;
+        s->trgi = stm32f2xx_timer_trgi_source(s);
+        s->gate = s->trgi;
+        /* Our masters may have to start or stop sending TRGO edges */
+        for (ch = 0; ch < STM32F2XX_TIMER_NUM_ITR; ch++) {
+            if (s->itr[ch] && s->itr[ch] != s) {
+                stm32f2xx_timer_sync(s->itr[ch], now);
+                stm32f2xx_timer_commit(s->itr[ch], now);
+            }
+        }
         return;
     case TIM_DIER:
         s->tim_dier = value;
@@ -402,43 +1412,86 @@ static void stm32f2xx_timer_write(void *opaque, hwaddr offset,
         s->tim_sr &= value;
         return;
     case TIM_EGR:
-        s->tim_egr = value;
-        if (s->tim_egr & TIM_EGR_UG) {
-            timer_val = 0;
-            break;
+        if (value & TIM_EGR_UG) {
+            stm32f2xx_timer_reinit(s, now);
+        }
+        for (ch = 0; ch < s->num_channels; ch++) {
+            if (!(value & (TIM_EGR_CC1G << ch))) {
+                continue;
+            }
+            if (stm32f2xx_timer_is_output(s, ch)) {
+                stm32f2xx_timer_cc_flags(s, ch, 1);
+            } else {
+                stm32f2xx_timer_capture(s, ch);
+            }
+        }
+        if (value & TIM_EGR_COMG) {
+            s->tim_sr |= TIM_SR_COMIF;
+            if (s->tim_dier & TIM_DIER_COMDE) {
+                s->dma_raise |= BIT(STM32F2XX_TIMER_DMA_COM);
+            }
+        }
+        if (value & TIM_EGR_TG) {
+            s->tim_sr |= TIM_SR_TIF;
+            if (s->tim_dier & TIM_DIER_TDE) {
+                s->dma_raise |= BIT(STM32F2XX_TIMER_DMA_TRIG);
+            }
+        }
+        if (value & TIM_EGR_BG) {
+            s->tim_sr |= TIM_SR_BIF;
+            s->tim_bdtr &= ~TIM_BDTR_MOE;
         }
         return;
     case TIM_CCMR1:
-        s->tim_ccmr1 = value;
-        return;
     case TIM_CCMR2:
-        s->tim_ccmr2 = value;
+        if (offset == TIM_CCMR1) {
+            s->tim_ccmr1 = value;
+        } else {
+            s->tim_ccmr2 = value;
+        }
+        /* Clearing OCxPE makes a pending CCRx value take effect */
+        for (ch = 0; ch < s->num_channels; ch++) {
+            if (!(stm32f2xx_timer_ccmr(s, ch) & TIM_CCMR1_OC1PE)) {
+                s->ccr_active[ch] = s->tim_ccr[ch];
+            }
+        }
         return;
     case TIM_CCER:
         s->tim_ccer = value;
         return;
+    case TIM_CNT:
+        s->tim_cnt = value & max;
+        stm32f2xx_timer_rebase(s, now);
+        return;
     case TIM_PSC:
-        timer_val = stm32f2xx_ns_to_ticks(s, now) - s->tick_offset;
+        /* Preloaded, takes effect on the next update event */
         s->tim_psc = value & 0xFFFF;
-        break;
-    case TIM_CNT:
-        timer_val = value;
-        break;
+        return;
     case TIM_ARR:
-        s->tim_arr = value;
-        stm32f2xx_timer_set_alarm(s, now);
+        s->tim_arr = value & max;
+        if (!(s->tim_cr1 & TIM_CR1_ARPE)) {
+            s->arr_active = s->tim_arr;
+        }
         return;
-    case TIM_CCR1:
-        s->tim_ccr1 = value;
+    case TIM_RCR:
+        s->tim_rcr = value & 0xFF;
         return;
+    case TIM_CCR1:
     case TIM_CCR2:
-        s->tim_ccr2 = value;
-        return;
     case TIM_CCR3:
-        s->tim_ccr3 = value;
-        return;
     case TIM_CCR4:
-        s->tim_ccr4 = value;
+        ch = (offset - TIM_CCR1) / 4;
+        if (!stm32f2xx_timer_is_output(s, ch)) {
+            /* Read only in input capture mode */
+            return;
+        }
+        s->tim_ccr[ch] = value & max;
+        if (!(stm32f2xx_timer_ccmr(s, ch) & TIM_CCMR1_OC1PE)) {
+            s->ccr_active[ch] = s->tim_ccr[ch];
+        }
+        return;
+    case TIM_BDTR:
+        s->tim_bdtr = value;
         return;
     case TIM_DCR:
         s->tim_dcr = value;
@@ -454,12 +1507,66 @@ static void stm32f2xx_timer_write(void *opaque, hwaddr offset,
                       "%s: Bad offset 0x%"HWADDR_PRIx"\n", __func__, offset);
         return;
     }
+}
+
+/*
+ * Any access acknowledges the pending DMA requests.  Accesses to DMAR go
+ * to the register DBA + n of a burst of DBL + 1 transfers, and only the
+ * last one acknowledges.
+ */
+static hwaddr stm32f2xx_timer_dma_access(STM32F2XXTimerState *s,
+                                         hwaddr offset)
+{
+    unsigned dba = s->tim_dcr & TIM_DCR_DBA;
+    unsigned dbl = (s->tim_dcr & TIM_DCR_DBL) >> 8;
+
+    if (offset != TIM_DMAR) {
+        s->dma_burst = 0;
+        stm32f2xx_timer_dma_ack(s);
+        return offset;
+    }
+    offset = (dba + s->dma_burst) * 4;
+    if (++s->dma_burst > dbl) {
+        s->dma_burst = 0;
+        stm32f2xx_timer_dma_ack(s);
+    }
+    /* A burst does not wrap around to DMAR itself */
+    return offset == TIM_DMAR ? TIM_OR + 4 : offset;
+}
+
+static uint64_t stm32f2xx_timer_read(void *opaque, hwaddr offset,
+                           unsigned size)
+{
+    STM32F2XXTimerState *s = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    uint32_t sr, value;
+    bool moved;
+
+    offset = stm32f2xx_timer_dma_access(s, offset);
+    moved = stm32f2xx_timer_sync(s, now);
+    sr = s->tim_sr;
+    value = stm32f2xx_timer_read_reg(s, offset);
+    /* Polling CNT or SR must not re-arm the timer every time */
+    if (moved || sr != s->tim_sr) {
+        stm32f2xx_timer_commit(s, now);
+    }
+
+    trace_stm32f2xx_timer_read(offset, value);
+    return value;
+}
+
+static void stm32f2xx_timer_write(void *opaque, hwaddr offset,
+                        uint64_t val64, unsigned size)
+{
+    STM32F2XXTimerState *s = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
 
-    /* This means that a register write has affected the timer in a way that
-     * requires a refresh of both tick_offset and the alarm.
-     */
-    s->tick_offset = stm32f2xx_ns_to_ticks(s, now) - timer_val;
-    stm32f2xx_timer_set_alarm(s, now);
+    offset = stm32f2xx_timer_dma_access(s, offset);
+    trace_stm32f2xx_timer_write(offset, val64);
+
+    stm32f2xx_timer_sync(s, now);
+    stm32f2xx_timer_write_reg(s, offset, val64, now);
+    stm32f2xx_timer_commit(s, now);
 }
 
 static const MemoryRegionOps stm32f2xx_timer_ops = {
@@ -470,10 +1577,33 @@ static const MemoryRegionOps stm32f2xx_timer_ops = {
 
 static const VMStateDescription vmstate_stm32f2xx_timer = {
     .name = TYPE_STM32F2XX_TIMER,
-    .version_id = 1,
-    .minimum_version_id = 1,
+    .version_id = 2,
+    .minimum_version_id = 2,
     .fields = (const VMStateField[]) {
-        VMSTATE_INT64(tick_offset, STM32F2XXTimerState),
+        VMSTATE_TIMER_PTR(timer, STM32F2XXTimerState),
+        VMSTATE_INT64(base_ns, STM32F2XXTimerState),
+        VMSTATE_UINT64(synced_ticks, STM32F2XXTimerState),
+        VMSTATE_BOOL(running, STM32F2XXTimerState),
+        VMSTATE_UINT32(ext_psc_cnt, STM32F2XXTimerState),
+        VMSTATE_BOOL(gate, STM32F2XXTimerState),
+        VMSTATE_BOOL(trgi, STM32F2XXTimerState),
+        VMSTATE_UINT32(psc_active, STM32F2XXTimerState),
+        VMSTATE_UINT32(arr_active, STM32F2XXTimerState),
+        VMSTATE_UINT32(rcr_active, STM32F2XXTimerState),
+        VMSTATE_UINT32_ARRAY(ccr_active, STM32F2XXTimerState,
+                             STM32F2XX_TIMER_NUM_CHANNELS),
+        VMSTATE_UINT32(rep_cnt, STM32F2XXTimerState),
+        VMSTATE_UINT8(ocref, STM32F2XXTimerState),
+        VMSTATE_UINT8(ti_level, STM32F2XXTimerState),
+        VMSTATE_UINT8_ARRAY(ic_psc_cnt, STM32F2XXTimerState,
+                            STM32F2XX_TIMER_NUM_CHANNELS),
+        VMSTATE_UINT8(oc_level, STM32F2XXTimerState),
+        VMSTATE_UINT8(ocn_level, STM32F2XXTimerState),
+        VMSTATE_UINT32_ARRAY(duty_level, STM32F2XXTimerState,
+                             STM32F2XX_TIMER_NUM_CHANNELS),
+        VMSTATE_BOOL(trgo_level, STM32F2XXTimerState),
+        VMSTATE_UINT8(dma_pending, STM32F2XXTimerState),
+        VMSTATE_UINT8(dma_burst, STM32F2XXTimerState),
         VMSTATE_UINT32(tim_cr1, STM32F2XXTimerState),
         VMSTATE_UINT32(tim_cr2, STM32F2XXTimerState),
         VMSTATE_UINT32(tim_smcr, STM32F2XXTimerState),
@@ -483,12 +1613,13 @@ static const VMStateDescription vmstate_stm32f2xx_timer = {
         VMSTATE_UINT32(tim_ccmr1, STM32F2XXTimerState),
         VMSTATE_UINT32(tim_ccmr2, STM32F2XXTimerState),
         VMSTATE_UINT32(tim_ccer, STM32F2XXTimerState),
+        VMSTATE_UINT32(tim_cnt, STM32F2XXTimerState),
         VMSTATE_UINT32(tim_psc, STM32F2XXTimerState),
         VMSTATE_UINT32(tim_arr, STM32F2XXTimerState),
-        VMSTATE_UINT32(tim_ccr1, STM32F2XXTimerState),
-        VMSTATE_UINT32(tim_ccr2, STM32F2XXTimerState),
-        VMSTATE_UINT32(tim_ccr3, STM32F2XXTimerState),
-        VMSTATE_UINT32(tim_ccr4, STM32F2XXTimerState),
+        VMSTATE_UINT32(tim_rcr, STM32F2XXTimerState),
+        VMSTATE_UINT32_ARRAY(tim_ccr, STM32F2XXTimerState,
+                             STM32F2XX_TIMER_NUM_CHANNELS),
+        VMSTATE_UINT32(tim_bdtr, STM32F2XXTimerState),
         VMSTATE_UINT32(tim_dcr, STM32F2XXTimerState),
         VMSTATE_UINT32(tim_dmar, STM32F2XXTimerState),
         VMSTATE_UINT32(tim_or, STM32F2XXTimerState),
@@ -499,23 +1630,110 @@ static const VMStateDescription vmstate_stm32f2xx_timer = {
 static Property stm32f2xx_timer_properties[] = {
     DEFINE_PROP_UINT64("clock-frequency", struct STM32F2XXTimerState,
                        freq_hz, 1000000000),
+    DEFINE_PROP_UINT8("num-channels", STM32F2XXTimerState, num_channels,
+                      STM32F2XX_TIMER_NUM_CHANNELS),
+    DEFINE_PROP_UINT8("counter-bits", STM32F2XXTimerState, counter_bits, 16),
+    /* TIM1/TIM8: repetition counter, break, complementary outputs */
+    DEFINE_PROP_BOOL("advanced", STM32F2XXTimerState, advanced, false),
+    /* Drive every PWM edge on the "oc" lines, at two events per period */
+    DEFINE_PROP_BOOL("pwm-edges", STM32F2XXTimerState, pwm_edges, false),
+    DEFINE_PROP_LINK("itr0", STM32F2XXTimerState, itr[0],
+                     TYPE_STM32F2XX_TIMER, STM32F2XXTimerState *),
+    DEFINE_PROP_LINK("itr1", STM32F2XXTimerState, itr[1],
+                     TYPE_STM32F2XX_TIMER, STM32F2XXTimerState *),
+    DEFINE_PROP_LINK("itr2", STM32F2XXTimerState, itr[2],
+                     TYPE_STM32F2XX_TIMER, STM32F2XXTimerState *),
+    DEFINE_PROP_LINK("itr3", STM32F2XXTimerState, itr[3],
+                     TYPE_STM32F2XX_TIMER, STM32F2XXTimerState *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
+/*
+ * The optional "clk" input overrides the "clock-frequency" property, so the
+ * counter follows RCC prescaler changes without polling.  Keep the counter
+ * value continuous across the change and re-arm the pending event.
+ */
+static void stm32f2xx_timer_clk_update(void *opaque, ClockEvent event)
+{
+    STM32F2XXTimerState *s = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    unsigned freq_hz = clock_get_hz(s->clk);
+
+    if (freq_hz == 0 || freq_hz == s->freq_hz) {
+        return;
+    }
+
+    stm32f2xx_timer_sync(s, now);
+    s->freq_hz = freq_hz;
+    stm32f2xx_timer_rebase(s, now);
+    stm32f2xx_timer_commit(s, now);
+}
+
 static void stm32f2xx_timer_init(Object *obj)
 {
     STM32F2XXTimerState *s = STM32F2XXTIMER(obj);
+    DeviceState *dev = DEVICE(obj);
+    unsigned i;
+
+    s->clk = qdev_init_clock_in(dev, "clk",
+                                stm32f2xx_timer_clk_update, s, ClockUpdate);
 
-    sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq);
+    for (i = 0; i < STM32F2XX_TIMER_NUM_IRQS; i++) {
+        sysbus_init_irq(SYS_BUS_DEVICE(obj), &s->irq[i]);
+    }
+    qdev_init_gpio_in_named(dev, stm32f2xx_timer_ic, "ic",
+                            STM32F2XX_TIMER_NUM_CHANNELS);
+    qdev_init_gpio_out_named(dev, s->oc, "oc", STM32F2XX_TIMER_NUM_CHANNELS);
+    qdev_init_gpio_out_named(dev, s->ocn, "ocn",
+                             STM32F2XX_TIMER_NUM_CHANNELS);
+    qdev_init_gpio_out_named(dev, s->duty, "duty",
+                             STM32F2XX_TIMER_NUM_CHANNELS);
+    qdev_init_gpio_out_named(dev, &s->trgo, "trgo", 1);
+    qdev_init_gpio_out_named(dev, s->dma, "dma", STM32F2XX_TIMER_NUM_DMA);
 
     memory_region_init_io(&s->iomem, obj, &stm32f2xx_timer_ops, s,
                           "stm32f2xx_timer", 0x400);
+    /* DMA bursts triggered by a register write come back to the timer */
+    s->iomem.disable_reentrancy_guard = true;
+    /* CNT and, with no interrupt or DMA enabled, SR move without a timer */
+    s->iomem.disable_poll_park = true;
     sysbus_init_mmio(SYS_BUS_DEVICE(obj), &s->iomem);
 }
 
 static void stm32f2xx_timer_realize(DeviceState *dev, Error **errp)
 {
     STM32F2XXTimerState *s = STM32F2XXTIMER(dev);
+    unsigned i;
+
+    if (s->num_channels > STM32F2XX_TIMER_NUM_CHANNELS) {
+        error_setg(errp, "num-channels must be at most %d",
+                   STM32F2XX_TIMER_NUM_CHANNELS);
+        return;
+    }
+    if (s->counter_bits != 16 && s->counter_bits != 32) {
+        error_setg(errp, "counter-bits must be 16 or 32");
+        return;
+    }
+
+    /* Register with our masters, so that they know who listens to TRGO */
+    for (i = 0; i < STM32F2XX_TIMER_NUM_ITR; i++) {
+        STM32F2XXTimerState *master = s->itr[i];
+
+        if (!master) {
+            continue;
+        }
+        if (master->num_slaves == STM32F2XX_TIMER_MAX_SLAVES) {
+            error_setg(errp, "too many slaves on the master of itr%u", i);
+            return;
+        }
+        master->slave[master->num_slaves].tim = s;
+        master->slave[master->num_slaves].itr = i;
+        master->num_slaves++;
+    }
+
+    if (clock_has_source(s->clk) && clock_get_hz(s->clk)) {
+        s->freq_hz = clock_get_hz(s->clk);
+    }
     s->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, stm32f2xx_timer_interrupt, s);
 }
 
@@ -829,6 +829,12 @@ struct MemoryRegion {
 
     /* For devices designed to perform re-entrant IO into their own IO MRs */
     bool disable_reentrancy_guard;
+
+    /*
+     * For devices computing registers from the clock on read, with no
+     * timer to wake a vCPU polling them, see accel/tcg/poll-park.c
+     */
+    bool disable_poll_park;
 };
 
 struct IOMMUMemoryRegion {
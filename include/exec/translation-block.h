@@ -87,6 +87,8 @@ struct TranslationBlock {
     /* size of target code for this block (1 <= size <= TARGET_PAGE_SIZE) */
     uint16_t size;
     uint16_t icount;
+    /* executions, counted until the TB is hot enough for a superblock */
+    uint32_t exec_count;
 
     struct tb_tc tc;
 
@@ -20,6 +20,7 @@
 
 #include "qemu/bswap.h"
 #include "exec/cpu_ldst.h"	/* for abi_ptr */
+#include "tcg/tcg.h"		/* for TCGv_i64 */
 
 /**
  * gen_intermediate_code
@@ -74,6 +75,18 @@ typedef enum DisasJumpType {
  * @singlestep_enabled: "Hardware" single stepping enabled.
  * @saved_can_do_io: Known value of cpu->neg.can_do_io, or -1 for unknown.
  * @plugin_enabled: TCG plugin enabled in this TB.
+ * @count_stalls: Set by the target's init_disas_context hook to charge
+ *                @stall_cycles against the icount budget on entry to the
+ *                TB.  Only honoured with icount.
+ * @stall_cycles: Extra cycles the target accumulated for this TB, e.g.
+ *                memory wait states of its instruction fetches.
+ * @superblock_capable: Set by the target's init_disas_context hook if it
+ *                      can go on translating at the target of a branch.
+ * @superblock: This TB is hot: translate it as a superblock, following
+ *              the direct branches the target can.
+ * @pc_max: Set by the target when a superblock goes back to code it has
+ *          already translated: the end of the guest code translated so
+ *          far, which @pc_next no longer tells.
  *
  * Architecture-agnostic disassembly context.
  */
@@ -87,6 +100,11 @@ typedef struct DisasContextBase {
     bool singlestep_enabled;
     int8_t saved_can_do_io;
     bool plugin_enabled;
+    bool count_stalls;
+    bool superblock_capable;
+    bool superblock;
+    vaddr pc_max;
+    uint32_t stall_cycles;
     void *host_addr[2];
 } DisasContextBase;
 
@@ -159,6 +177,50 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
  */
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest);
 
+/**
+ * translator_use_return_stack
+ * @db: Disassembly context
+ *
+ * Return true if the "return-stack" TCG property is set and this TB may
+ * use the shadow return stack.  Otherwise the target must emit the same
+ * code as without it.
+ */
+bool translator_use_return_stack(DisasContextBase *db);
+
+/**
+ * translator_push_return
+ * @db: Disassembly context
+ * @pc: return address of the call, as the return branches to it
+ * @flags: flags of the TB returned to
+ * @cs_base: cs_base of the TB returned to
+ * @state: offsets from env of the 32-bit words the TB flags derive from
+ * @nb_state: number of @state words, at most CPU_RET_STATE_WORDS
+ *
+ * Emit the push of a call on the shadow return stack.  The target knows
+ * the TB flags of the return as long as the @state words do not change.
+ * Nothing is emitted unless translator_use_return_stack().
+ */
+void translator_push_return(DisasContextBase *db, TCGv_i64 pc,
+                            uint32_t flags, uint64_t cs_base,
+                            const intptr_t *state, int nb_state);
+
+/**
+ * translator_goto_return
+ * @db: Disassembly context
+ * @pc: address the return branches to
+ * @state: as for translator_push_return()
+ * @nb_state: as for translator_push_return()
+ *
+ * Emit the end of a TB returning from a call, in place of
+ * tcg_gen_lookup_and_goto_ptr(): pop the last call and, if @pc and the
+ * @state words match it, look the TB up with the cs_base and flags the
+ * call noted instead of computing the cpu state.  The cpu state
+ * must be written back as for tcg_gen_lookup_and_goto_ptr().  Only call
+ * if translator_use_return_stack().
+ */
+void translator_goto_return(DisasContextBase *db, TCGv_i64 pc,
+                            const intptr_t *state, int nb_state);
+
 /**
  * translator_io_start
  * @db: Disassembly context
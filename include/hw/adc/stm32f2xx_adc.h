@@ -82,6 +82,10 @@ struct STM32F2XXADCState {
     uint32_t adc_jdr[4];
     uint32_t adc_dr;
 
+    /* Guest accesses, for profiling */
+    uint64_t mmio_reads;
+    uint64_t mmio_writes;
+
     qemu_irq irq;
 };
 
@@ -0,0 +1,49 @@
+/*
+ * STM32 flash access control register and instruction fetch timing
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_ARM_STM32_FLASH_ACR_H
+#define HW_ARM_STM32_FLASH_ACR_H
+
+#include "hw/sysbus.h"
+#include "qom/object.h"
+#include "target/arm/cpu.h"
+
+#define TYPE_STM32_FLASH_ACR "stm32-flash-acr"
+OBJECT_DECLARE_SIMPLE_TYPE(STM32FlashAcrState, STM32_FLASH_ACR)
+
+#define STM32_FLASH_ACR_MAX_REGIONS 8
+
+struct STM32FlashAcrState {
+    SysBusDevice parent_obj;
+
+    MemoryRegion mmio;
+
+    /* Properties */
+    uint32_t reset_value;
+    ARMCPU *cpu;
+
+    uint32_t acr;
+
+    /*
+     * Fetch latency table of the SoC.  The first nflash entries are the
+     * flash and its aliases, whose wait states follow ACR.
+     */
+    ARMMemLatency map[STM32_FLASH_ACR_MAX_REGIONS];
+    unsigned map_len;
+    unsigned nflash;
+};
+
+/*
+ * Set the fetch latency table of the SoC, before realize.  Without a
+ * "cpu" link the register is still modelled but nothing is charged.
+ */
+void stm32_flash_acr_set_map(STM32FlashAcrState *s, const ARMMemLatency *map,
+                             unsigned len, unsigned nflash);
+
+#endif
@@ -31,8 +31,20 @@
 #include "hw/adc/stm32f2xx_adc.h"
 #include "hw/misc/stm32f4xx_exti.h"
 #include "hw/or-irq.h"
+#include "hw/core/split-irq.h"
+#include "hw/dma/stm32f4xx_dma.h"
 #include "hw/ssi/stm32f2xx_spi.h"
+#include "hw/gpio/stm32f4xx_gpio.h"
 #include "hw/arm/armv7m.h"
+#include "hw/arm/stm32_flash_acr.h"
+#include "hw/misc/stm32f4xx_flash.h"
+#include "hw/misc/stm32f4xx_rcc.h"
+#include "hw/misc/stm32f4xx_fsmc.h"
+#include "hw/i2c/stm32f4xx_i2c.h"
+#include "hw/net/stm32f4xx_can.h"
+#include "hw/misc/stm32_crc.h"
+#include "hw/misc/stm32_rng.h"
+#include "sysemu/hostmem.h"
 #include "qom/object.h"
 
 #define TYPE_STM32F405_SOC "stm32f405-soc"
@@ -42,6 +54,12 @@ OBJECT_DECLARE_SIMPLE_TYPE(STM32F405State, STM32F405_SOC)
 #define STM_NUM_TIMERS 4
 #define STM_NUM_ADCS 6
 #define STM_NUM_SPIS 6
+#define STM_NUM_I2CS 3
+#define STM_NUM_CANS 2
+#define STM_NUM_DMAS 2
+#define STM_NUM_GPIOS 9
+/* DMA requests going to two streams */
+#define STM_NUM_DMA_SPLITS 8
 
 #define FLASH_BASE_ADDRESS 0x08000000
 #define FLASH_SIZE (1024 * 1024)
@@ -55,21 +73,44 @@ struct STM32F405State {
 
     ARMv7MState armv7m;
 
+    STM32F4xxRccState rcc;
     STM32F4xxSyscfgState syscfg;
     STM32F4xxExtiState exti;
+    STM32F4xxDmaState dma[STM_NUM_DMAS];
+    SplitIRQ dma_split[STM_NUM_DMA_SPLITS];
+    STM32F4xxGpioState gpio[STM_NUM_GPIOS];
     STM32F2XXUsartState usart[STM_NUM_USARTS];
     STM32F2XXTimerState timer[STM_NUM_TIMERS];
     OrIRQState adc_irqs;
     STM32F2XXADCState adc[STM_NUM_ADCS];
     STM32F2XXSPIState spi[STM_NUM_SPIS];
+    STM32F4xxI2CState i2c[STM_NUM_I2CS];
+    STM32F4xxCanState can[STM_NUM_CANS];
+    STM32FlashAcrState flash_acr;
+    STM32F4xxFlashState flash_if;
+    STM32CrcState crc;
+    STM32RngState rng;
+    STM32F4xxFsmcState fsmc;
 
     MemoryRegion ccm;
     MemoryRegion sram;
-    MemoryRegion flash;
     MemoryRegion flash_alias;
 
-    Clock *sysclk;
+    Clock *hse;
     Clock *refclk;
+
+    CanBusState *canbus[STM_NUM_CANS];
+    /* Host memory backends for the SRAM and CCM, instead of plain RAM */
+    HostMemoryBackend *sram_memdev;
+    HostMemoryBackend *ccm_memdev;
+    /* Shared memory for the state of the GPIO pins, see stm32f4xx_pinbus.h */
+    HostMemoryBackend *pinbus;
+    /* Address space of this instance, the system memory by default */
+    MemoryRegion *memory;
+    /* USARTs use the chardevs "<prefix>usart1"... instead of -serial */
+    char *serial_prefix;
+    bool cycle_timing;
+    bool sleep_skip;
 };
 
 #endif
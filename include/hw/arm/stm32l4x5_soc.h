@@ -26,9 +26,14 @@
 
 #include "exec/memory.h"
 #include "hw/arm/armv7m.h"
+#include "hw/arm/stm32_flash_acr.h"
 #include "hw/or-irq.h"
 #include "hw/misc/stm32l4x5_syscfg.h"
 #include "hw/misc/stm32l4x5_exti.h"
+#include "hw/timer/stm32f2xx_timer.h"
+#include "hw/i2c/stm32l4x5_i2c.h"
+#include "hw/misc/stm32_crc.h"
+#include "hw/misc/stm32_rng.h"
 #include "qom/object.h"
 
 #define TYPE_STM32L4X5_SOC "stm32l4x5-soc"
@@ -38,6 +43,8 @@
 OBJECT_DECLARE_TYPE(Stm32l4x5SocState, Stm32l4x5SocClass, STM32L4X5_SOC)
 
 #define NUM_EXTI_OR_GATES 4
+#define STM32L4X5_NUM_TIMERS 8
+#define STM32L4X5_NUM_I2CS 3
 
 struct Stm32l4x5SocState {
     SysBusDevice parent_obj;
@@ -47,6 +54,11 @@ struct Stm32l4x5SocState {
     Stm32l4x5ExtiState exti;
     OrIRQState exti_or_gates[NUM_EXTI_OR_GATES];
     Stm32l4x5SyscfgState syscfg;
+    STM32FlashAcrState flash_acr;
+    STM32F2XXTimerState tim[STM32L4X5_NUM_TIMERS];
+    Stm32l4x5I2cState i2c[STM32L4X5_NUM_I2CS];
+    STM32CrcState crc;
+    STM32RngState rng;
 
     MemoryRegion sram1;
     MemoryRegion sram2;
@@ -55,6 +67,8 @@ struct Stm32l4x5SocState {
 
     Clock *sysclk;
     Clock *refclk;
+
+    bool cycle_timing;
 };
 
 struct Stm32l4x5SocClass {
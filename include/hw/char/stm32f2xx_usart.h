@@ -27,6 +27,9 @@
 
 #include "hw/sysbus.h"
 #include "chardev/char-fe.h"
+#include "hw/clock.h"
+#include "qemu/fifo8.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 
 #define USART_SR   0x00
@@ -44,17 +47,30 @@
  */
 #define USART_SR_RESET (USART_SR_TXE | USART_SR_TC)
 
+#define USART_SR_CTS  (1 << 9)
+#define USART_SR_LBD  (1 << 8)
 #define USART_SR_TXE  (1 << 7)
 #define USART_SR_TC   (1 << 6)
 #define USART_SR_RXNE (1 << 5)
+#define USART_SR_ORE  (1 << 3)
 
+#define USART_CR1_OVER8  (1 << 15)
 #define USART_CR1_UE     (1 << 13)
+#define USART_CR1_M      (1 << 12)
 #define USART_CR1_TXEIE  (1 << 7)
 #define USART_CR1_TCEIE  (1 << 6)
 #define USART_CR1_RXNEIE (1 << 5)
 #define USART_CR1_TE     (1 << 3)
 #define USART_CR1_RE     (1 << 2)
 
+#define USART_CR2_STOP_SHIFT 12
+
+#define USART_CR3_DMAT   (1 << 7)
+#define USART_CR3_DMAR   (1 << 6)
+
+/* Bytes on their way to the host, or from it */
+#define USART_BUF_SIZE 256
+
 #define TYPE_STM32F2XX_USART "stm32f2xx-usart"
 OBJECT_DECLARE_SIMPLE_TYPE(STM32F2XXUsartState, STM32F2XX_USART)
 
@@ -73,7 +89,30 @@ struct STM32F2XXUsartState {
     uint32_t usart_cr3;
     uint32_t usart_gtpr;
 
+    /* Written to DR, the last tx_timed ones are still being shifted out */
+    uint8_t tx_buf[USART_BUF_SIZE];
+    uint32_t tx_len;
+    uint32_t tx_timed;
+    /* Received from the host, not in DR yet */
+    Fifo8 rx_fifo;
+    QEMUTimer *tx_timer;
+    QEMUTimer *rx_timer;
+    QEMUBH *tx_bh;
+    guint tx_watch;
+
+    /* Kernel clock, the baud rate is not modelled without it */
+    Clock *clk;
+    /* Bytes go out and in as fast as the host and guest take them */
+    bool fast_forward;
+
+    /* Guest accesses, for profiling */
+    uint64_t mmio_reads;
+    uint64_t mmio_writes;
+
     CharBackend chr;
     qemu_irq irq;
+    /* DMA requests */
+    qemu_irq dma_tx;
+    qemu_irq dma_rx;
 };
 #endif /* HW_STM32F2XX_USART_H */
@@ -394,6 +394,61 @@ typedef void (*run_on_cpu_func)(CPUState *cpu, run_on_cpu_data data);
 
 struct qemu_work_item;
 
+/**
+ * CPUPollState: detection of a vCPU busy-waiting on a device register
+ * @mr: region of the last MMIO read
+ * @offset: offset of the last MMIO read in @mr
+ * @value: value returned by the last MMIO read
+ * @retaddr: host return address of the guest load doing the read
+ * @cpu_state: digest of the guest registers at the time of the read
+ * @size: size of the last MMIO read
+ * @count: identical reads in a row, 0 once a write or interrupt happened
+ * @generation: main loop generation when the vCPU was parked
+ * @parked: the vCPU left the TB loop to wait for a device change
+ */
+typedef struct CPUPollState {
+    MemoryRegion *mr;
+    hwaddr offset;
+    uint64_t value;
+    uintptr_t retaddr;
+    uint64_t cpu_state;
+    unsigned size;
+    unsigned count;
+    unsigned generation;
+    bool parked;
+} CPUPollState;
+
+#define CPU_RET_STACK_SIZE  16
+#define CPU_RET_STATE_WORDS 6
+
+/**
+ * CPUReturnEntry: a call on the shadow return stack
+ * @pc: return address, i.e. pc of the TB returned to
+ * @cs_base: cs_base of the TB returned to
+ * @flags: flags of the TB returned to
+ * @state: target state words at the call, which the TB flags derive from
+ */
+typedef struct CPUReturnEntry {
+    vaddr pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t state[CPU_RET_STATE_WORDS];
+} CPUReturnEntry;
+
+/**
+ * CPUReturnStack: shadow return stack, see translator_push_return()
+ * @top: index of the last call pushed in @entry, which wraps around
+ * @hits: returns which found their TB with the flags their call noted
+ * @misses: returns which looked their TB up from the cpu state instead
+ * @entry: calls not returned from yet
+ */
+typedef struct CPUReturnStack {
+    uint32_t top;
+    uintptr_t hits;
+    uintptr_t misses;
+    CPUReturnEntry entry[CPU_RET_STACK_SIZE];
+} CPUReturnStack;
+
 #define CPU_UNSET_NUMA_NODE_ID -1
 
 /**
@@ -421,6 +476,9 @@ struct qemu_work_item;
  * @crash_occurred: Indicates the OS reported a crash (panic) for this CPU
  * @singlestep_enabled: Flags for single-stepping.
  * @icount_extra: Instructions until next timer event.
+ * @icount_stall: Cycles charged by the target's memory timing model that
+ *                did not fit in the instruction decrementer; they advance
+ *                the virtual clock at the next icount update.
  * @neg.can_do_io: True if memory-mapped IO is allowed.
  * @cpu_ases: Pointer to array of CPUAddressSpaces (which define the
  *            AddressSpaces this CPU has)
@@ -433,6 +491,8 @@ struct qemu_work_item;
  * @node: QTAILQ of CPUs sharing TB cache.
  * @opaque: User data.
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
+ * @poll: Polling loop detection, see accel/tcg/poll-park.c.
+ * @ret_stack: Calls predicting the TB of their return, under TCG.
  * @accel: Pointer to accelerator specific state.
  * @kvm_fd: vCPU file descriptor for KVM.
  * @work_mutex: Lock to prevent multiple access to @work_list.
@@ -486,6 +546,7 @@ struct CPUState {
     int singlestep_enabled;
     int64_t icount_budget;
     int64_t icount_extra;
+    uint32_t icount_stall;
     uint64_t random_seed;
     sigjmp_buf jmp_env;
 
@@ -498,6 +559,7 @@ struct CPUState {
     MemoryRegion *memory;
 
     CPUJumpCache *tb_jmp_cache;
+    CPUReturnStack ret_stack;
 
     GArray *gdb_regs;
     int gdb_num_regs;
@@ -517,6 +579,8 @@ struct CPUState {
      */
     uintptr_t mem_io_pc;
 
+    CPUPollState poll;
+
     /* Only used in KVM */
     int kvm_fd;
     struct KVMState *kvm_state;
@@ -48,6 +48,14 @@ struct TCGCPUOps {
     void (*cpu_exec_exit)(CPUState *cpu);
     /** @debug_excp_handler: Callback for handling debug exceptions */
     void (*debug_excp_handler)(CPUState *cpu);
+    /**
+     * @poll_state: Digest of the guest registers a polling loop could change
+     *
+     * Two MMIO reads from the same load with the same digest, and nothing
+     * else in between, are taken as iterations of a loop waiting for the
+     * device.  When this is NULL, such loops are never parked.
+     */
+    uint64_t (*poll_state)(CPUState *cpu);
 
 #ifdef NEED_CPU_H
 #ifdef CONFIG_USER_ONLY
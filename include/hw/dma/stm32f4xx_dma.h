@@ -0,0 +1,65 @@
+/*
+ * STM32F4xx DMA controller
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_DMA_STM32F4XX_DMA_H
+#define HW_DMA_STM32F4XX_DMA_H
+
+#include "hw/sysbus.h"
+#include "qom/object.h"
+
+#define TYPE_STM32F4XX_DMA "stm32f4xx-dma"
+OBJECT_DECLARE_SIMPLE_TYPE(STM32F4xxDmaState, STM32F4XX_DMA)
+
+#define STM32F4XX_DMA_NUM_STREAMS 8
+#define STM32F4XX_DMA_NUM_CHANNELS 8
+
+/* GPIO input for the request of @channel to @stream */
+#define STM32F4XX_DMA_REQ(stream, channel) \
+    ((stream) * STM32F4XX_DMA_NUM_CHANNELS + (channel))
+
+typedef struct STM32F4xxDmaStream {
+    uint32_t cr;
+    uint32_t ndtr;
+    uint32_t par;
+    uint32_t m0ar;
+    uint32_t m1ar;
+    uint32_t fcr;
+
+    /* NDTR when the stream was enabled, reloaded in circular mode */
+    uint32_t ndtr_reload;
+    /* Items transferred since the stream was enabled or reloaded */
+    uint32_t pos;
+    /* Transferring, the requests raised meanwhile are served in the loop */
+    bool active;
+
+    qemu_irq irq;
+} STM32F4xxDmaStream;
+
+struct STM32F4xxDmaState {
+    SysBusDevice parent_obj;
+
+    MemoryRegion mmio;
+    /* The bus matrix, as seen by the DMA */
+    MemoryRegion *memory;
+    AddressSpace as;
+
+    /* Properties */
+    bool mem_to_mem;
+
+    uint32_t isr[2];
+    /* Levels of the request inputs */
+    uint64_t requests;
+    STM32F4xxDmaStream stream[STM32F4XX_DMA_NUM_STREAMS];
+
+    /* Streams to go on with, once the CPU had a turn */
+    QEMUBH *bh;
+    uint8_t resume;
+};
+
+#endif
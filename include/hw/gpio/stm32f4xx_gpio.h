@@ -0,0 +1,73 @@
+/*
+ * STM32F4xx GPIO port
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * QEMU interface:
+ * + sysbus MMIO region 0: GPIO registers
+ * + Unnamed GPIO inputs 0-15: level driven on the pin from outside, -1 when
+ *   the pin is left floating
+ * + Unnamed GPIO outputs 0-15: level of the pin, as read from IDR
+ * + Property "port": index of the port, GPIOA is 0
+ * + Properties "moder-reset", "ospeedr-reset" and "pupdr-reset": values of
+ *   the registers out of reset, which are not the same for all the ports
+ * + Property "pinbus": memory backend holding a STM32F4xxPinbus, shared
+ *   with a co-simulation
+ */
+
+#ifndef HW_GPIO_STM32F4XX_GPIO_H
+#define HW_GPIO_STM32F4XX_GPIO_H
+
+#include "hw/sysbus.h"
+#include "hw/gpio/stm32f4xx_pinbus.h"
+#include "sysemu/hostmem.h"
+#include "qom/object.h"
+
+#define TYPE_STM32F4XX_GPIO "stm32f4xx-gpio"
+OBJECT_DECLARE_SIMPLE_TYPE(STM32F4xxGpioState, STM32F4XX_GPIO)
+
+#define STM32F4XX_GPIO_NUM_PINS 16
+
+struct STM32F4xxGpioState {
+    SysBusDevice parent_obj;
+
+    MemoryRegion mmio;
+
+    uint32_t moder;
+    uint32_t otyper;
+    uint32_t ospeedr;
+    uint32_t pupdr;
+    uint32_t odr;
+    uint32_t lckr;
+    uint32_t afr[2];
+    /* Writes of the LCKR lock sequence done so far */
+    uint8_t lock_step;
+    /* Pin levels, as last seen by the guest and the outputs */
+    uint32_t idr;
+    /* Pins driven through the GPIO inputs, and their levels */
+    uint32_t in_mask;
+    uint32_t in_level;
+
+    /* Guest accesses, for profiling */
+    uint64_t mmio_reads;
+    uint64_t mmio_writes;
+
+    /* Properties */
+    uint8_t port;
+    uint32_t moder_reset;
+    uint32_t ospeedr_reset;
+    uint32_t pupdr_reset;
+    HostMemoryBackend *pinbus_memdev;
+
+    /* The memory of @pinbus_memdev */
+    STM32F4xxPinbus *pinbus;
+
+    qemu_irq pin[STM32F4XX_GPIO_NUM_PINS];
+};
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * STM32F4xx GPIO pin bus, shared with a co-simulation process
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Layout of the memory backend given to the "pinbus" property of the
+ * STM32F405 SoC.  It only uses fixed size types, so that the process on
+ * the other side can map the same file and include this header.
+ *
+ * QEMU writes the port[].moder, odr and idr words whenever they change and
+ * on reset, and appends an event to the ring for each change of the pin
+ * levels.  An event is complete once @head, the number of events written
+ * so far modulo 2^32, went past it: the reader loads @head with acquire
+ * semantics and reads the events up to it.  A reader more than
+ * STM32F4XX_PINBUS_RING events behind lost the oldest ones.  All the
+ * words are in host byte order.
+ *
+ * The co-simulation drives the pins set in port[].in_mask to the levels of
+ * port[].in_level, writing in_level first.  The guest sees them the next
+ * time it reads IDR.
+ */
+
+#ifndef HW_GPIO_STM32F4XX_PINBUS_H
+#define HW_GPIO_STM32F4XX_PINBUS_H
+
+#define STM32F4XX_PINBUS_MAGIC 0x53503233
+#define STM32F4XX_PINBUS_VERSION 1
+#define STM32F4XX_PINBUS_PORTS 16
+#define STM32F4XX_PINBUS_RING 4096
+
+typedef struct STM32F4xxPinbusPort {
+    /* Written by QEMU */
+    uint32_t moder;
+    uint32_t odr;
+    uint32_t idr;
+    /* Written by the co-simulation */
+    uint32_t in_mask;
+    uint32_t in_level;
+    uint32_t reserved[3];
+} STM32F4xxPinbusPort;
+
+typedef struct STM32F4xxPinbusEvent {
+    /* QEMU_CLOCK_VIRTUAL */
+    uint64_t time_ns;
+    uint16_t port;
+    /* Pins that changed, and the new levels of all the pins of the port */
+    uint16_t changed;
+    uint16_t level;
+    uint16_t reserved;
+} STM32F4xxPinbusEvent;
+
+typedef struct STM32F4xxPinbus {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nports;
+    uint32_t ring_size;
+    uint32_t head;
+    uint32_t reserved[11];
+    STM32F4xxPinbusPort port[STM32F4XX_PINBUS_PORTS];
+    STM32F4xxPinbusEvent ring[STM32F4XX_PINBUS_RING];
+} STM32F4xxPinbus;
+
+#endif
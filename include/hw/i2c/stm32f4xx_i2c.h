@@ -0,0 +1,49 @@
+/*
+ * STM32F4xx I2C controller
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_I2C_STM32F4XX_I2C_H
+#define HW_I2C_STM32F4XX_I2C_H
+
+#include "hw/sysbus.h"
+#include "hw/i2c/i2c.h"
+#include "qom/object.h"
+
+#define TYPE_STM32F4XX_I2C "stm32f4xx-i2c"
+OBJECT_DECLARE_SIMPLE_TYPE(STM32F4xxI2CState, STM32F4XX_I2C)
+
+struct STM32F4xxI2CState {
+    SysBusDevice parent_obj;
+
+    MemoryRegion mmio;
+    I2CBus *bus;
+    qemu_irq ev_irq;
+    qemu_irq er_irq;
+
+    uint32_t cr1;
+    uint32_t cr2;
+    uint32_t oar1;
+    uint32_t oar2;
+    uint32_t sr1;
+    /* MSL and TRA, BUSY is computed from busy_until */
+    uint32_t sr2;
+    uint32_t ccr;
+    uint32_t trise;
+    uint32_t fltr;
+
+    /* Received data: DR, and the shift register once BTF is set */
+    uint8_t dr;
+    uint8_t shift;
+    bool shift_full;
+    /* The last byte has been received and not acknowledged */
+    bool rx_done;
+    /* When the bytes transferred so far would be done on the wire */
+    int64_t busy_until;
+};
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * STM32L4x5 I2C controller
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_I2C_STM32L4X5_I2C_H
+#define HW_I2C_STM32L4X5_I2C_H
+
+#include "hw/sysbus.h"
+#include "hw/i2c/i2c.h"
+#include "qom/object.h"
+
+#define TYPE_STM32L4X5_I2C "stm32l4x5-i2c"
+OBJECT_DECLARE_SIMPLE_TYPE(Stm32l4x5I2cState, STM32L4X5_I2C)
+
+/*
+ * NBYTES is 8 bits wide.  With RELOAD, the end of a chunk can still be
+ * unread when the next one is received.
+ */
+#define STM32L4X5_I2C_BUF_SIZE (2 * 255)
+
+struct Stm32l4x5I2cState {
+    SysBusDevice parent_obj;
+
+    MemoryRegion mmio;
+    I2CBus *bus;
+    /* Completion of the transfer in progress, from its length and TIMINGR */
+    QEMUTimer *timer;
+    Clock *clk;
+    qemu_irq ev_irq;
+    qemu_irq er_irq;
+
+    uint32_t cr1;
+    uint32_t cr2;
+    uint32_t oar1;
+    uint32_t oar2;
+    uint32_t timingr;
+    uint32_t timeoutr;
+    uint32_t isr;
+
+    /* A transfer is addressed and not stopped yet */
+    bool active;
+    /* Bytes left in the current NBYTES chunk */
+    uint32_t count;
+    /* ISR flags set once the timer fires */
+    uint32_t pending;
+    /* Bytes on the wire before the first TXDR byte (the address) */
+    uint32_t tx_wire;
+    /* Bytes written to TXDR, or received and not yet read from RXDR */
+    uint8_t buf[STM32L4X5_I2C_BUF_SIZE];
+    uint32_t buf_len;
+    uint32_t buf_pos;
+};
+
+#endif
@@ -10,6 +10,7 @@
 #ifndef HW_ARM_ARMV7M_NVIC_H
 #define HW_ARM_ARMV7M_NVIC_H
 
+#include "qemu/bitops.h"
 #include "target/arm/cpu-qom.h"
 #include "hw/sysbus.h"
 #include "hw/timer/armv7m_systick.h"
@@ -23,6 +24,27 @@ OBJECT_DECLARE_SIMPLE_TYPE(NVICState, NVIC)
 /* Number of internal exceptions */
 #define NVIC_INTERNAL_VECTORS 16
 
+/* Raw priority levels of the external interrupts */
+#define NVIC_PRIO_LEVELS 256
+
+/*
+ * Bitmap of external interrupts per raw priority level, with a summary
+ * bitmap of the non-empty levels.
+ */
+typedef struct NVICPrioMap {
+    unsigned long vec[NVIC_PRIO_LEVELS][BITS_TO_LONGS(NVIC_MAX_VECTORS)];
+    uint16_t count[NVIC_PRIO_LEVELS];
+    unsigned long levels[BITS_TO_LONGS(NVIC_PRIO_LEVELS)];
+} NVICPrioMap;
+
+/* Where an external interrupt is currently filed in the NVICPrioMaps */
+typedef struct NVICPrioFiled {
+    uint8_t prio;
+    uint8_t bank;
+    bool pending;
+    bool active;
+} NVICPrioFiled;
+
 typedef struct VecInfo {
     /* Exception priorities can range from -3 to 255; only the unmodifiable
      * priority values for RESET, NMI and HardFault can be negative.
@@ -76,6 +98,16 @@ struct NVICState {
     int exception_prio; /* group prio of the highest prio active exception */
     int vectpending_prio; /* group prio of the exception in vectpending */
 
+    /* The external interrupts are also filed by raw priority in bitmaps of
+     * enabled&pending and of active vectors, one per target security state
+     * (indexed by M_REG_S/M_REG_NS), so that finding the highest priority
+     * one is a find-first-set rather than a scan of all num_irq vectors.
+     * This is cached state too, rebuilt on reset and migration.
+     */
+    NVICPrioMap pend_map[M_REG_NUM_BANKS];
+    NVICPrioMap active_map[M_REG_NUM_BANKS];
+    NVICPrioFiled filed[NVIC_MAX_VECTORS];
+
     MemoryRegion sysregmem;
 
     uint32_t num_irq;
@@ -0,0 +1,44 @@
+/*
+ * STM32 CRC calculation unit
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_MISC_STM32_CRC_H
+#define HW_MISC_STM32_CRC_H
+
+#include "hw/sysbus.h"
+#include "qom/object.h"
+
+#define TYPE_STM32_CRC "stm32-crc"
+OBJECT_DECLARE_SIMPLE_TYPE(STM32CrcState, STM32_CRC)
+
+struct STM32CrcState {
+    SysBusDevice parent_obj;
+
+    MemoryRegion mmio;
+
+    /* Properties */
+    bool configurable;
+
+    uint32_t dr;
+    uint32_t idr;
+    uint32_t cr;
+    uint32_t init;
+    uint32_t pol;
+
+    /* Slicing-by-4 tables for the current polynomial, MSB first */
+    uint32_t table[4][256];
+};
+
+/*
+ * Feed @len bytes of data written in items of @item_size bytes, as that
+ * many writes to DR would.  Returns the number of bytes consumed.
+ */
+size_t stm32_crc_write_bulk(void *opaque, const uint8_t *buf, size_t len,
+                            unsigned item_size);
+
+#endif
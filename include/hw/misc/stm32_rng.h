@@ -0,0 +1,31 @@
+/*
+ * STM32 random number generator
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_MISC_STM32_RNG_H
+#define HW_MISC_STM32_RNG_H
+
+#include "hw/sysbus.h"
+#include "qom/object.h"
+
+#define TYPE_STM32_RNG "stm32-rng"
+OBJECT_DECLARE_SIMPLE_TYPE(STM32RngState, STM32_RNG)
+
+struct STM32RngState {
+    SysBusDevice parent_obj;
+
+    MemoryRegion mmio;
+    QEMUTimer *timer;
+    qemu_irq irq;
+
+    uint32_t cr;
+    uint32_t sr;
+    uint32_t dr;
+};
+
+#endif
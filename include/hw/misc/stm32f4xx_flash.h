@@ -0,0 +1,70 @@
+/*
+ * STM32F4xx embedded flash memory interface
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_MISC_STM32F4XX_FLASH_H
+#define HW_MISC_STM32F4XX_FLASH_H
+
+#include "hw/sysbus.h"
+#include "qom/object.h"
+#include "sysemu/hostmem.h"
+
+#define TYPE_STM32F4XX_FLASH "stm32f4xx-flash"
+OBJECT_DECLARE_SIMPLE_TYPE(STM32F4xxFlashState, STM32F4XX_FLASH)
+
+struct STM32F4xxFlashState {
+    SysBusDevice parent_obj;
+
+    /* Registers (sysbus mmio 0) and the flash itself (sysbus mmio 1) */
+    MemoryRegion mmio;
+    MemoryRegion container;
+    /* Read only view of the backing memory, the fast path */
+    MemoryRegion rom;
+    /* Overlay trapping accesses while CR.PG is set */
+    MemoryRegion prog;
+    /* Backing memory when there is no memdev */
+    MemoryRegion ram;
+    MemoryRegion *backing;
+    /*
+     * The memory of this board: an alias of the backing memory, replaced
+     * by a private copy on the first write when it is shared
+     */
+    MemoryRegion store;
+    MemoryRegion shared_store;
+    MemoryRegion copy;
+    bool copied;
+    /* Writes go through here so translated code is invalidated */
+    AddressSpace as;
+
+    QEMUTimer *busy_timer;
+    qemu_irq irq;
+
+    /* Properties */
+    uint32_t size;
+    uint32_t option_bytes;
+    bool busy_timing;
+    HostMemoryBackend *memdev;
+    /* Flash interface of another board whose memory this one uses */
+    STM32F4xxFlashState *shared;
+    /* Boards using the memory of this one */
+    unsigned nr_sharers;
+
+    uint32_t keyr_state;
+    uint32_t optkeyr_state;
+    uint32_t sr;
+    uint32_t cr;
+    uint32_t optcr;
+    uint32_t optcr1;
+    int64_t busy_until;
+
+    /* Option bytes as programmed, loaded into OPTCR/OPTCR1 at reset */
+    uint32_t opt;
+    uint32_t opt1;
+};
+
+#endif
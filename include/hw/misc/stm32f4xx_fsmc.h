@@ -0,0 +1,50 @@
+/*
+ * STM32F4xx flexible static memory controller
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * QEMU interface:
+ * + sysbus MMIO region 0: FSMC registers
+ * + sysbus MMIO region 1: bank 1, the four NOR/PSRAM/SRAM subbanks
+ * + Properties "subbank1-memdev" to "subbank4-memdev": memory backends of
+ *   the memories on the subbanks, none by default
+ */
+
+#ifndef HW_MISC_STM32F4XX_FSMC_H
+#define HW_MISC_STM32F4XX_FSMC_H
+
+#include "qemu/units.h"
+#include "hw/sysbus.h"
+#include "sysemu/hostmem.h"
+#include "qom/object.h"
+
+#define TYPE_STM32F4XX_FSMC "stm32f4xx-fsmc"
+OBJECT_DECLARE_SIMPLE_TYPE(STM32F4xxFsmcState, STM32F4XX_FSMC)
+
+#define STM32F4XX_FSMC_NUM_SUBBANKS 4
+#define STM32F4XX_FSMC_SUBBANK_SIZE (64 * MiB)
+
+struct STM32F4xxFsmcState {
+    SysBusDevice parent_obj;
+
+    MemoryRegion mmio;
+    /* Bank 1, with the memories of the subbanks that have one */
+    MemoryRegion bank1;
+
+    uint32_t bcr[STM32F4XX_FSMC_NUM_SUBBANKS];
+    uint32_t btr[STM32F4XX_FSMC_NUM_SUBBANKS];
+    uint32_t bwtr[STM32F4XX_FSMC_NUM_SUBBANKS];
+
+    /* Properties */
+    HostMemoryBackend *memdev[STM32F4XX_FSMC_NUM_SUBBANKS];
+
+    /* The memories of @memdev, mapped in @bank1 */
+    MemoryRegion *mem[STM32F4XX_FSMC_NUM_SUBBANKS];
+};
+
+#endif
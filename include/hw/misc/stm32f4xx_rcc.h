@@ -0,0 +1,46 @@
+/*
+ * STM32F4xx reset and clock control
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_MISC_STM32F4XX_RCC_H
+#define HW_MISC_STM32F4XX_RCC_H
+
+#include "hw/sysbus.h"
+#include "hw/clock.h"
+#include "qom/object.h"
+
+#define TYPE_STM32F4XX_RCC "stm32f4xx-rcc"
+OBJECT_DECLARE_SIMPLE_TYPE(STM32F4xxRccState, STM32F4XX_RCC)
+
+/* Clock outputs, in the order they are derived from each other */
+typedef enum STM32F4xxRccClock {
+    STM32F4XX_RCC_SYSCLK,
+    STM32F4XX_RCC_HCLK,
+    STM32F4XX_RCC_PCLK1,
+    STM32F4XX_RCC_PCLK2,
+    STM32F4XX_RCC_TIMCLK1,
+    STM32F4XX_RCC_TIMCLK2,
+    STM32F4XX_RCC_NUM_CLOCKS
+} STM32F4xxRccClock;
+
+#define STM32F4XX_RCC_NUM_REGS (0x88 / 4)
+
+struct STM32F4xxRccState {
+    SysBusDevice parent_obj;
+
+    MemoryRegion mmio;
+    qemu_irq irq;
+
+    /* The external oscillator, given by the board */
+    Clock *hse;
+    Clock *out[STM32F4XX_RCC_NUM_CLOCKS];
+
+    uint32_t regs[STM32F4XX_RCC_NUM_REGS];
+};
+
+#endif
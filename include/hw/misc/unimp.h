@@ -17,14 +17,36 @@
 
 OBJECT_DECLARE_SIMPLE_TYPE(UnimplementedDeviceState, UNIMPLEMENTED_DEVICE)
 
+/* Accesses are counted per 32-bit word in the first 1 KiB of the device */
+#define UNIMP_HIST_SIZE 0x400
+
 struct UnimplementedDeviceState {
     SysBusDevice parent_obj;
     MemoryRegion iomem;
     unsigned offset_fmt_width;
     char *name;
     uint64_t size;
+
+    /* Access profile */
+    uint64_t reads;
+    uint64_t writes;
+    /* Read then write counts per word, allocated on the first access */
+    uint64_t *hist;
+    uint64_t first_pc;
+    uint64_t last_pc;
+    bool pc_valid;
+    uintptr_t last_host_pc;
 };
 
+/**
+ * unimp_profile_format: describe the accesses to unimplemented devices
+ *
+ * Return the read/write counts, the first and last guest PC and the
+ * offset histogram of each unimplemented device that has been accessed,
+ * busiest device first.
+ */
+GString *unimp_profile_format(void);
+
 /**
  * create_unimplemented_device: create and map a dummy device
  * @name: name of the device for debug logging
@@ -0,0 +1,101 @@
+/*
+ * STM32F4xx bxCAN controller
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_NET_STM32F4XX_CAN_H
+#define HW_NET_STM32F4XX_CAN_H
+
+#include "hw/sysbus.h"
+#include "net/can_emu.h"
+#include "qom/object.h"
+
+#define TYPE_STM32F4XX_CAN "stm32f4xx-can"
+OBJECT_DECLARE_SIMPLE_TYPE(STM32F4xxCanState, STM32F4XX_CAN)
+
+#define STM32F4XX_CAN_NUM_IRQS 4
+#define STM32F4XX_CAN_NUM_TX 3
+#define STM32F4XX_CAN_NUM_FIFOS 2
+#define STM32F4XX_CAN_FIFO_DEPTH 3
+/* Filter banks shared by CAN1 and CAN2, in CAN1 */
+#define STM32F4XX_CAN_NUM_BANKS 28
+
+typedef struct STM32F4xxCanMailbox {
+    uint32_t ir;
+    uint32_t dtr;
+    uint32_t dlr;
+    uint32_t dhr;
+} STM32F4xxCanMailbox;
+
+/*
+ * One filter of a bank.  @id is in the layout of the FxRy registers for
+ * the scale of the filter, and @mask is all ones in list mode.
+ */
+typedef struct STM32F4xxCanFilter {
+    uint32_t id;
+    uint32_t mask;
+    uint8_t fmi;
+    uint8_t fifo;
+} STM32F4xxCanFilter;
+
+/*
+ * The active filters of one controller, compiled from the banks when
+ * they change, in the order of the priority rules (RM0090 32.7.4): the
+ * lists are sorted by identifier and looked up by bisection, the masks
+ * are tried by filter number.
+ */
+typedef struct STM32F4xxCanFilters {
+    STM32F4xxCanFilter list32[STM32F4XX_CAN_NUM_BANKS * 2];
+    STM32F4xxCanFilter mask32[STM32F4XX_CAN_NUM_BANKS];
+    STM32F4xxCanFilter list16[STM32F4XX_CAN_NUM_BANKS * 4];
+    STM32F4xxCanFilter mask16[STM32F4XX_CAN_NUM_BANKS * 2];
+    unsigned n_list32;
+    unsigned n_mask32;
+    unsigned n_list16;
+    unsigned n_mask16;
+} STM32F4xxCanFilters;
+
+struct STM32F4xxCanState {
+    SysBusDevice parent_obj;
+
+    MemoryRegion mmio;
+    /* TX, RX0, RX1 and SCE */
+    qemu_irq irq[STM32F4XX_CAN_NUM_IRQS];
+    Clock *clk;
+    CanBusClientState bus_client;
+
+    /* Properties */
+    CanBusState *canbus;
+    /* CAN1, which has the filter banks, for CAN2; NULL on CAN1 */
+    STM32F4xxCanState *master;
+
+    uint32_t mcr;
+    uint32_t msr;
+    uint32_t tsr;
+    uint32_t rfr[STM32F4XX_CAN_NUM_FIFOS];
+    uint32_t ier;
+    uint32_t esr;
+    uint32_t btr;
+    STM32F4xxCanMailbox tx[STM32F4XX_CAN_NUM_TX];
+    /* Order of the transmit requests, for MCR.TXFP */
+    uint32_t tx_seq[STM32F4XX_CAN_NUM_TX];
+    uint32_t tx_next_seq;
+    STM32F4xxCanMailbox rx[STM32F4XX_CAN_NUM_FIFOS][STM32F4XX_CAN_FIFO_DEPTH];
+    uint8_t rx_head[STM32F4XX_CAN_NUM_FIFOS];
+
+    /* Filter banks, only used in CAN1 */
+    uint32_t fmr;
+    uint32_t fm1r;
+    uint32_t fs1r;
+    uint32_t ffa1r;
+    uint32_t fa1r;
+    uint32_t fr[STM32F4XX_CAN_NUM_BANKS][2];
+    /* Compiled from the banks, for CAN1 and CAN2 */
+    STM32F4xxCanFilters filters[2];
+};
+
+#endif
@@ -27,6 +27,9 @@
 
 #include "hw/sysbus.h"
 #include "hw/ssi/ssi.h"
+#include "hw/clock.h"
+#include "qemu/fifo32.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 
 #define STM_SPI_CR1     0x00
@@ -39,11 +42,26 @@
 #define STM_SPI_I2SCFGR 0x1C
 #define STM_SPI_I2SPR   0x20
 
+#define STM_SPI_CR1_DFF  (1 << 11)
 #define STM_SPI_CR1_SPE  (1 << 6)
+#define STM_SPI_CR1_BR_SHIFT 3
+#define STM_SPI_CR1_BR   (7 << STM_SPI_CR1_BR_SHIFT)
 #define STM_SPI_CR1_MSTR (1 << 2)
 
+#define STM_SPI_CR2_TXEIE   (1 << 7)
+#define STM_SPI_CR2_RXNEIE  (1 << 6)
+#define STM_SPI_CR2_ERRIE   (1 << 5)
+#define STM_SPI_CR2_TXDMAEN (1 << 1)
+#define STM_SPI_CR2_RXDMAEN (1 << 0)
+
+#define STM_SPI_SR_BSY    (1 << 7)
+#define STM_SPI_SR_OVR    (1 << 6)
+#define STM_SPI_SR_TXE    (1 << 1)
 #define STM_SPI_SR_RXNE   1
 
+/* Frames queued for and received from the bus */
+#define STM_SPI_FIFO_DEPTH 32
+
 #define TYPE_STM32F2XX_SPI "stm32f2xx-spi"
 OBJECT_DECLARE_SIMPLE_TYPE(STM32F2XXSPIState, STM32F2XX_SPI)
 
@@ -64,7 +82,22 @@ struct STM32F2XXSPIState {
     uint32_t spi_i2scfgr;
     uint32_t spi_i2spr;
 
+    Fifo32 tx_fifo;
+    Fifo32 rx_fifo;
+    /* End of the last frame queued, frames complete when it is reached */
+    int64_t busy_until;
+    QEMUTimer *timer;
+    /* APB clock, transfers complete at once without it */
+    Clock *clk;
+
+    /* Guest accesses, for profiling */
+    uint64_t mmio_reads;
+    uint64_t mmio_writes;
+
     qemu_irq irq;
+    /* DMA requests */
+    qemu_irq dma_tx;
+    qemu_irq dma_rx;
     SSIBus *ssi;
 };
 
@@ -26,6 +26,7 @@
 #define HW_STM32F2XX_TIMER_H
 
 #include "hw/sysbus.h"
+#include "hw/clock.h"
 #include "qemu/timer.h"
 #include "qom/object.h"
 
@@ -41,10 +42,12 @@
 #define TIM_CNT      0x24
 #define TIM_PSC      0x28
 #define TIM_ARR      0x2C
+#define TIM_RCR      0x30
 #define TIM_CCR1     0x34
 #define TIM_CCR2     0x38
 #define TIM_CCR3     0x3C
 #define TIM_CCR4     0x40
+#define TIM_BDTR     0x44
 #define TIM_DCR      0x48
 #define TIM_DMAR     0x4C
 #define TIM_OR       0x50
@@ -53,6 +56,34 @@
 #define TIM_CCMR1_OC2M1 (1 << 13)
 #define TIM_CCMR1_OC2M0 (1 << 12)
 
+#define STM32F2XX_TIMER_NUM_CHANNELS 4
+#define STM32F2XX_TIMER_NUM_ITR 4
+#define STM32F2XX_TIMER_MAX_SLAVES 8
+
+/* Interrupt lines: general purpose timers raise everything on the first */
+enum {
+    STM32F2XX_TIMER_IRQ_UP,
+    STM32F2XX_TIMER_IRQ_CC,
+    STM32F2XX_TIMER_IRQ_TRG_COM,
+    STM32F2XX_TIMER_IRQ_BRK,
+    STM32F2XX_TIMER_NUM_IRQS
+};
+
+/* DMA request lines ("dma" GPIO outputs) */
+enum {
+    STM32F2XX_TIMER_DMA_UP,
+    STM32F2XX_TIMER_DMA_CC1,
+    STM32F2XX_TIMER_DMA_CC2,
+    STM32F2XX_TIMER_DMA_CC3,
+    STM32F2XX_TIMER_DMA_CC4,
+    STM32F2XX_TIMER_DMA_COM,
+    STM32F2XX_TIMER_DMA_TRIG,
+    STM32F2XX_TIMER_NUM_DMA
+};
+
+/* The "duty" outputs carry the mean level of a channel in parts per million */
+#define STM32F2XX_TIMER_DUTY_MAX 1000000
+
 #define TYPE_STM32F2XX_TIMER "stm32f2xx-timer"
 typedef struct STM32F2XXTimerState STM32F2XXTimerState;
 DECLARE_INSTANCE_CHECKER(STM32F2XXTimerState, STM32F2XXTIMER,
@@ -65,11 +96,73 @@ struct STM32F2XXTimerState {
     /* <public> */
     MemoryRegion iomem;
     QEMUTimer *timer;
-    qemu_irq irq;
+    qemu_irq irq[STM32F2XX_TIMER_NUM_IRQS];
+    Clock *clk;
+
+    /* Outputs: OCx, OCxN, mean level of OCx, TRGO and DMA requests */
+    qemu_irq oc[STM32F2XX_TIMER_NUM_CHANNELS];
+    qemu_irq ocn[STM32F2XX_TIMER_NUM_CHANNELS];
+    qemu_irq duty[STM32F2XX_TIMER_NUM_CHANNELS];
+    qemu_irq trgo;
+    qemu_irq dma[STM32F2XX_TIMER_NUM_DMA];
 
-    int64_t tick_offset;
-    uint64_t hit_time;
+    /* Properties */
     uint64_t freq_hz;
+    uint8_t num_channels;
+    uint8_t counter_bits;
+    bool advanced;
+    bool pwm_edges;
+    /* Masters on the internal trigger inputs ITR0..3 */
+    STM32F2XXTimerState *itr[STM32F2XX_TIMER_NUM_ITR];
+
+    /* Timers using this one as a master, filled in when they are realized */
+    struct {
+        STM32F2XXTimerState *tim;
+        unsigned itr;
+    } slave[STM32F2XX_TIMER_MAX_SLAVES];
+    unsigned num_slaves;
+
+    /*
+     * The counter is not ticked: it is evaluated from QEMU_CLOCK_VIRTUAL
+     * when accessed.  tim_cnt holds its value at the last evaluation,
+     * base_ns anchors the prescaled clock and synced_ticks counts the ticks
+     * since base_ns already applied to tim_cnt.  Only events that somebody
+     * observes (an enabled interrupt or DMA request, a connected output in
+     * a non PWM mode, a slave) arm the QEMU timer.
+     */
+    int64_t base_ns;
+    uint64_t synced_ticks;
+    bool running;
+    /* External clock mode: trigger edges not yet reaching the prescaler */
+    uint32_t ext_psc_cnt;
+    bool gate;
+    bool trgi;
+
+    /* Shadow registers, loaded from the preload registers on update */
+    uint32_t psc_active;
+    uint32_t arr_active;
+    uint32_t rcr_active;
+    uint32_t ccr_active[STM32F2XX_TIMER_NUM_CHANNELS];
+    uint32_t rep_cnt;
+
+    /* Output compare reference levels and input capture state */
+    uint8_t ocref;
+    uint8_t ti_level;
+    uint8_t ic_psc_cnt[STM32F2XX_TIMER_NUM_CHANNELS];
+    /* Levels last driven on the output lines */
+    uint8_t oc_level;
+    uint8_t ocn_level;
+    uint32_t duty_level[STM32F2XX_TIMER_NUM_CHANNELS];
+    bool trgo_level;
+
+    /* Pending DMA requests, acknowledged by the next register access */
+    uint8_t dma_pending;
+    uint8_t dma_burst;
+
+    /* Signals collected while updating the state, sent out afterwards */
+    uint8_t dma_raise;
+    uint32_t trgo_pulses;
+    bool in_trigger;
 
     uint32_t tim_cr1;
     uint32_t tim_cr2;
@@ -80,12 +173,12 @@ struct STM32F2XXTimerState {
     uint32_t tim_ccmr1;
     uint32_t tim_ccmr2;
     uint32_t tim_ccer;
+    uint32_t tim_cnt;
     uint32_t tim_psc;
     uint32_t tim_arr;
-    uint32_t tim_ccr1;
-    uint32_t tim_ccr2;
-    uint32_t tim_ccr3;
-    uint32_t tim_ccr4;
+    uint32_t tim_rcr;
+    uint32_t tim_ccr[STM32F2XX_TIMER_NUM_CHANNELS];
+    uint32_t tim_bdtr;
     uint32_t tim_dcr;
     uint32_t tim_dmar;
     uint32_t tim_or;
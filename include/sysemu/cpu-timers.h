@@ -88,6 +88,18 @@ void cpu_disable_ticks(void);
  */
 int64_t cpu_get_ticks(void);
 
+/*
+ * Sleep skip: when every vCPU is idle and @allowed returns true, move
+ * QEMU_CLOCK_VIRTUAL straight to its next deadline instead of waiting
+ * for it in real time.  The board decides when the guest sleeps deeply
+ * enough for this.  Not used with icount, where -icount sleep=off does
+ * the same for every idle period.
+ */
+void cpu_clock_set_sleep_skip(bool (*allowed)(void *opaque), void *opaque);
+bool cpu_clock_sleep_skip_enabled(void);
+/* Called by the main loop; caller must hold BQL */
+void cpu_clock_sleep_skip(void);
+
 /*
  * Returns the monotonic time elapsed in VM, i.e.,
  * the time between vm_start and vm_stop
@@ -17,4 +17,12 @@ extern bool tcg_allowed;
 #define tcg_enabled() 0
 #endif
 
+/*
+ * tcg_poll_unpark_all: wake up the vCPUs parked in a polling loop
+ *
+ * Called by the main loop after each iteration, as the devices they
+ * poll may have changed.
+ */
+void tcg_poll_unpark_all(void);
+
 #endif
@@ -36,6 +36,26 @@
  */
 void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus);
 
+/**
+ * tcg_region_set_eviction: Reclaim the JIT buffer a region at a time
+ * @enable: reclaim the oldest region instead of the whole buffer
+ *
+ * When the JIT buffer is full, let the oldest region be emptied and
+ * reused, see tcg_region_evict(), rather than resetting the whole buffer.
+ * This divides the buffer into more regions.  Call before tcg_init().
+ */
+void tcg_region_set_eviction(bool enable);
+
+/**
+ * tcg_reserve_threads: Reserve TCG contexts for helper threads
+ * @n: number of threads translating on behalf of the vCPUs
+ *
+ * Such threads are not counted in the @max_cpus of tcg_init(), and get
+ * a region of the JIT buffer each like the vCPU threads, once they call
+ * tcg_register_thread().  Call before tcg_init().
+ */
+void tcg_reserve_threads(unsigned n);
+
 /**
  * tcg_register_thread: Register this thread with the TCG runtime
  *
@@ -74,6 +74,15 @@ void tcg_gen_goto_tb(unsigned idx);
  */
 void tcg_gen_lookup_and_goto_ptr(void);
 
+/**
+ * tcg_gen_goto_ptr() - jump to a TB the translated code looked up itself
+ * @ptr: Host code pointer (tc.ptr) of the target TB
+ *
+ * The caller must have checked that the TB matches the current cpu state,
+ * as helper_lookup_tb_ptr() would, and that goto_ptr is allowed.
+ */
+void tcg_gen_goto_ptr(TCGv_ptr ptr);
+
 void tcg_gen_plugin_cb_start(unsigned from, unsigned type, unsigned wr);
 void tcg_gen_plugin_cb_end(void);
 
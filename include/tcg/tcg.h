@@ -499,6 +499,13 @@ struct TCGContext {
     TCGTemp *frame_temp;
 
     TranslationBlock *gen_tb;     /* tb for which code is being generated */
+    bool host_ptr_used;           /* tb embeds a host pointer constant */
+    bool stall_counted;           /* tb charges instruction fetch stalls */
+    bool translating_ahead;       /* context of a translate-ahead thread */
+    unsigned ahead_write_gen;     /* tb_page_write_gen() of the job */
+    int nb_gen_succ;
+    uint64_t gen_succ[2];         /* goto_tb destinations of gen_tb */
+    struct TCGHostReloc *host_relocs; /* host addresses in the code */
     tcg_insn_unit *code_buf;      /* pointer for start of tb */
     tcg_insn_unit *code_ptr;      /* pointer for running end of tb */
 
@@ -755,6 +762,47 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_evict(GTraverseFunc func, gpointer user_data);
+
+/* Code buffer layout, for the persistent translation cache */
+typedef struct TCGRegionLayout {
+    void *start;            /* rw view, beginning with the prologue */
+    size_t prologue_size;
+    size_t n;
+    size_t stride;
+    size_t total_size;
+} TCGRegionLayout;
+
+void tcg_region_set_hint(const void *rx);
+void tcg_region_get_layout(TCGRegionLayout *l);
+size_t tcg_region_used(void **start, void **end);
+void tcg_region_restore(void *end);
+
+/*
+ * Host addresses, of the QEMU image or of the code buffer, found in the
+ * code generated for a TB, noted when tcg_record_host_relocs is set, for
+ * the code to be loaded at another address.  @ptr is in the rw view, and
+ * @type is a relocation of the backend, or TCG_HOST_RELOC_PTR for a
+ * pointer stored as data.  Backends noting them define
+ * TCG_TARGET_HOST_RELOCS.
+ */
+typedef struct TCGHostReloc {
+    struct TCGHostReloc *next;
+    tcg_insn_unit *ptr;
+    uintptr_t value;
+    intptr_t addend;
+    int type;
+} TCGHostReloc;
+
+#define TCG_HOST_RELOC_PTR  -1
+
+#ifndef TCG_TARGET_HOST_RELOCS
+#define TCG_TARGET_HOST_RELOCS  0
+#endif
+
+extern bool tcg_record_host_relocs;
+bool tcg_patch_host_reloc(tcg_insn_unit *ptr, int type, uintptr_t value,
+                          intptr_t addend);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
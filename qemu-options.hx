@@ -185,12 +185,18 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
+    "                poll-park=on|off (sleep in guest loops polling a device register, default=off)\n"
+    "                return-stack=on|off (predict the TCG translation returned to, default=off)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
+    "                superblock-threshold=n (retranslate TBs run n times as superblocks)\n"
+    "                tb-cache=file (keep TCG translations in file across runs)\n"
+    "                tb-eviction=on|off (drop the oldest TCG translations when full, default=off)\n"
     "                tb-size=n (TCG translation block cache size)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                translate-ahead=n (translate branch targets on n more threads, default=0)\n"
     "                device=path (KVM device path, default /dev/kvm)\n", QEMU_ARCH_ALL)
 SRST
 ``-accel name[,prop=value[,...]]``
@@ -221,12 +227,59 @@ SRST
         can be useful in some situations, such as when trying to analyse
         the logs produced by the ``-d`` option.
 
+    ``poll-park=on|off``
+        Makes a TCG vCPU which keeps reading the same value from the same
+        device register, with no other change to its registers, sleep
+        until the main loop, an interrupt or the next timer deadline
+        wakes it up instead of spinning. This saves host CPU time with firmware busy-waiting on
+        device status flags. It has no effect with icount, and with
+        ``thread=single`` only when there is one vCPU (default=off).
+
+    ``return-stack=on|off``
+        Makes the TCG accelerator note the return address of each
+        function call, with the translation block found there, so that
+        the function return jumps to it directly as long as the return
+        address and the CPU state match, instead of looking it up from
+        the full CPU state. Only M-profile Arm CPUs without MVE use it
+        for now (default=off).
+
     ``split-wx=on|off``
         Controls the use of split w^x mapping for the TCG code generation
         buffer. Some operating systems require this to be enabled, and in
         such a case this will default on. On other operating systems, this
         will default off, but one may enable this for testing or debugging.
 
+    ``superblock-threshold=n``
+        Translates a TCG translation block again once it has been run n
+        times, as a superblock continuing across the direct branches
+        within its page, so that hot loops are optimized as a whole.
+        Conditional branches forward are assumed not taken, loop back
+        edges are assumed taken and unroll the loop. Only Thumb code
+        without icount is handled for now (default=0, disabled).
+
+    ``tb-cache=file``
+        Saves the TCG translations to file on exit, and reuses them in
+        the next runs as long as the guest code they come from is
+        unchanged. This speeds up running the same firmware many times,
+        e.g. in a test suite. The translations can only be reused by the
+        same QEMU binary, with the same ``tb-size`` and CPU model;
+        otherwise the file is rewritten. On x86-64 hosts, the host
+        addresses in the translations are moved along with the QEMU
+        binary and the translation buffer. On other hosts, they must
+        be loaded at the same addresses, i.e. QEMU built without PIE or
+        run with address space randomization disabled (``setarch -R``).
+        ``info jit`` shows how many saved translations were reused.
+
+    ``tb-eviction=on|off``
+        When the TCG translation block cache is full, drops only the
+        translations made the longest time ago, an eighth of the cache
+        or less, instead of all of them. Code still in use is then
+        translated again into the newest part of the cache, where it
+        stays, which avoids translating everything again after each
+        flush with guests running more code than the cache holds. The
+        evictions and the share of translations done again appear in
+        ``info jit`` (default=off).
+
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
@@ -238,6 +291,16 @@ SRST
         incompatible TCG features have been enabled (e.g.
         icount/replay).
 
+    ``translate-ahead=n``
+        Starts n threads which translate the blocks that new TCG
+        translation blocks branch to directly, within the same page,
+        while the vCPU goes on running, so that it seldom has to wait for
+        the translation of the next block. This speeds up firmware
+        startup, when most of the code runs for the first time, on hosts
+        with idle cores. Each thread takes a part of the translation
+        block cache. It has no effect on the vCPUs instrumented by TCG
+        plugins (default=0, disabled).
+
     ``dirty-ring-size=n``
         When the KVM accelerator is used, it controls the size of the per-vCPU
         dirty page ring buffer (number of entries for each vCPU). It should
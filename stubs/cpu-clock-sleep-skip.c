@@ -0,0 +1,11 @@
+#include "qemu/osdep.h"
+#include "sysemu/cpu-timers.h"
+
+bool cpu_clock_sleep_skip_enabled(void)
+{
+    return false;
+}
+
+void cpu_clock_sleep_skip(void)
+{
+}
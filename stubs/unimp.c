@@ -0,0 +1,7 @@
+#include "qemu/osdep.h"
+#include "hw/misc/unimp.h"
+
+GString *unimp_profile_format(void)
+{
+    return g_string_new("No access to unimplemented devices\n");
+}
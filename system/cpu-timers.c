@@ -37,6 +37,8 @@
 #include "sysemu/cpu-timers.h"
 #include "sysemu/cpu-throttle.h"
 #include "sysemu/cpu-timers-internal.h"
+#include "sysemu/tcg.h"
+#include "trace.h"
 
 /* clock and ticks */
 
@@ -135,6 +137,56 @@ void cpu_disable_ticks(void)
                          &timers_state.vm_clock_lock);
 }
 
+static bool (*sleep_skip_allowed)(void *opaque);
+static void *sleep_skip_opaque;
+
+void cpu_clock_set_sleep_skip(bool (*allowed)(void *opaque), void *opaque)
+{
+    sleep_skip_allowed = allowed;
+    sleep_skip_opaque = opaque;
+}
+
+bool cpu_clock_sleep_skip_enabled(void)
+{
+    /* The qtest accelerator moves the clock itself, but qtests on TCG can */
+    return sleep_skip_allowed && tcg_enabled() && !icount_enabled() &&
+           replay_mode == REPLAY_MODE_NONE;
+}
+
+void cpu_clock_sleep_skip(void)
+{
+    int64_t deadline;
+
+    if (!cpu_clock_sleep_skip_enabled() || !runstate_is_running() ||
+        !all_cpu_threads_idle() || !sleep_skip_allowed(sleep_skip_opaque)) {
+        return;
+    }
+
+    /*
+     * Nothing armed means the guest waits for an outside event, which
+     * has to come in real time.
+     */
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL,
+                                          QEMU_TIMER_ATTR_ALL);
+    if (deadline <= 0) {
+        return;
+    }
+
+    seqlock_write_lock(&timers_state.vm_clock_seqlock,
+                       &timers_state.vm_clock_lock);
+    timers_state.cpu_clock_offset += deadline;
+    seqlock_write_unlock(&timers_state.vm_clock_seqlock,
+                         &timers_state.vm_clock_lock);
+    trace_cpu_clock_sleep_skip(deadline);
+
+    /*
+     * The main loop runs the expired timers next.  If none of them wakes
+     * a vCPU, the notification makes it come back here at once instead of
+     * sleeping until the following deadline.
+     */
+    qemu_clock_notify(QEMU_CLOCK_VIRTUAL);
+}
+
 static bool icount_state_needed(void *opaque)
 {
     return icount_enabled();
@@ -447,6 +447,10 @@ void qemu_wait_io_event(CPUState *cpu)
         if (!slept) {
             slept = true;
             qemu_plugin_vcpu_idle_cb(cpu);
+            if (cpu_clock_sleep_skip_enabled() && all_cpu_threads_idle()) {
+                /* Let the main loop skip the idle time */
+                qemu_notify_event();
+            }
         }
         qemu_cond_wait(cpu->halt_cond, &bql);
     }
@@ -19,6 +19,8 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
 #include "qemu/qemu-print.h"
 #include "qemu/timer.h"
 #include "qemu/log.h"
@@ -120,6 +122,31 @@ void arm_restore_state_to_opc(CPUState *cs,
         env->exception.syndrome = data[2] << ARM_INSN_START_WORD2_SHIFT;
     }
 }
+
+uint64_t arm_cpu_poll_state(CPUState *cs)
+{
+    CPUARMState *env = cpu_env(cs);
+    uint64_t h = 0;
+    int i;
+
+    /*
+     * The general purpose registers and the flags; the PC is not up to
+     * date here, but the load it came from is known to the caller.
+     */
+    if (is_a64(env)) {
+        for (i = 0; i < 31; i++) {
+            h = (h ^ env->xregs[i]) * 0x100000001b3ULL;
+        }
+    } else {
+        for (i = 0; i < 15; i++) {
+            h = (h ^ env->regs[i]) * 0x100000001b3ULL;
+        }
+    }
+    h = (h ^ env->NF) * 0x100000001b3ULL;
+    h = (h ^ env->ZF) * 0x100000001b3ULL;
+    h = (h ^ env->CF) * 0x100000001b3ULL;
+    return (h ^ env->VF) * 0x100000001b3ULL;
+}
 #endif /* CONFIG_TCG */
 
 static bool arm_cpu_has_work(CPUState *cs)
@@ -517,6 +544,7 @@ static void arm_cpu_reset_hold(Object *obj)
                    sizeof(*env->pmsav8.hprlar) * cpu->pmsav8r_hdregion);
         }
 
+        arm_mpu_cache_invalidate(cpu);
         env->pmsav7.rnr[M_REG_NS] = 0;
         env->pmsav7.rnr[M_REG_S] = 0;
         env->pmsav8.mair0[M_REG_NS] = 0;
@@ -1326,6 +1354,90 @@ uint64_t arm_cpu_mp_affinity(ARMCPU *cpu)
     return cpu->mp_affinity;
 }
 
+/*
+ * The distinct memory latency maps set up so far, never freed.  Keys are
+ * their index plus one, 0 being no map.  Added to under the BQL, read by
+ * the translators of any thread.
+ */
+#define ARM_MEM_LATENCY_MAX_MAPS 255
+
+typedef struct ARMMemLatencyMap {
+    unsigned count;
+    ARMMemLatency entry[];
+} ARMMemLatencyMap;
+
+static ARMMemLatencyMap *arm_mem_latency_maps[ARM_MEM_LATENCY_MAX_MAPS];
+static unsigned arm_mem_latency_nr_maps;
+
+static bool arm_mem_latency_equal(const ARMMemLatencyMap *m,
+                                  const ARMMemLatency *map, unsigned count)
+{
+    if (m->count != count) {
+        return false;
+    }
+    for (unsigned i = 0; i < count; i++) {
+        if (m->entry[i].base != map[i].base ||
+            m->entry[i].size != map[i].size ||
+            m->entry[i].line_size != map[i].line_size ||
+            m->entry[i].wait_states != map[i].wait_states ||
+            m->entry[i].prefetch != map[i].prefetch) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static unsigned arm_mem_latency_intern(const ARMMemLatency *map,
+                                       unsigned count)
+{
+    ARMMemLatencyMap *m;
+    unsigned i;
+
+    assert(bql_locked());
+    for (i = 0; i < arm_mem_latency_nr_maps; i++) {
+        if (arm_mem_latency_equal(arm_mem_latency_maps[i], map, count)) {
+            return i + 1;
+        }
+    }
+    if (i == ARM_MEM_LATENCY_MAX_MAPS) {
+        warn_report_once("Too many memory latency setups, "
+                         "instruction fetch timing disabled");
+        return 0;
+    }
+
+    m = g_malloc(sizeof(*m) + count * sizeof(*map));
+    m->count = count;
+    memcpy(m->entry, map, count * sizeof(*map));
+    qatomic_store_release(&arm_mem_latency_maps[i], m);
+    arm_mem_latency_nr_maps++;
+    return i + 1;
+}
+
+const ARMMemLatency *arm_mem_latency_map(unsigned key, unsigned *count)
+{
+    const ARMMemLatencyMap *m;
+
+    if (!key) {
+        *count = 0;
+        return NULL;
+    }
+    m = qatomic_load_acquire(&arm_mem_latency_maps[key - 1]);
+    *count = m->count;
+    return m->entry;
+}
+
+void arm_cpu_set_mem_latency(ARMCPU *cpu, const ARMMemLatency *map,
+                             unsigned count)
+{
+    unsigned key = count ? arm_mem_latency_intern(map, count) : 0;
+
+    if (key != cpu->mem_latency_key) {
+        cpu->mem_latency_key = key;
+        /* Stop following the goto_tb links of TBs with the old key */
+        cpu_exit(CPU(cpu));
+    }
+}
+
 static void arm_cpu_initfn(Object *obj)
 {
     ARMCPU *cpu = ARM_CPU(obj);
@@ -1734,6 +1846,7 @@ static void arm_cpu_finalizefn(Object *obj)
 {
     ARMCPU *cpu = ARM_CPU(obj);
     ARMELChangeHook *hook, *next;
+    int i;
 
     g_hash_table_destroy(cpu->cp_regs);
 
@@ -1750,6 +1863,9 @@ static void arm_cpu_finalizefn(Object *obj)
         timer_free(cpu->pmu_timer);
     }
 #endif
+    for (i = 0; i < ARM_MPU_CACHE_NUM; i++) {
+        g_free(cpu->mpu_cache[i].seg);
+    }
 }
 
 void arm_cpu_finalize_features(ARMCPU *cpu, Error **errp)
@@ -2472,6 +2588,7 @@ static const TCGCPUOps arm_tcg_ops = {
     .synchronize_from_tb = arm_cpu_synchronize_from_tb,
     .debug_excp_handler = arm_debug_excp_handler,
     .restore_state_to_opc = arm_restore_state_to_opc,
+    .poll_state = arm_cpu_poll_state,
 
 #ifdef CONFIG_USER_ONLY
     .record_sigsegv = arm_cpu_record_sigsegv,
@@ -822,6 +822,48 @@ typedef struct {
     uint32_t map, init, supported;
 } ARMVQMap;
 
+/**
+ * ARMMemLatency:
+ * @base: start of the memory range
+ * @size: size of the memory range in bytes
+ * @line_size: instruction fetch line size in bytes, a power of two
+ * @wait_states: extra cycles to fetch one line from this range
+ * @prefetch: sequential lines are prefetched, only the first line
+ *            fetched by a TB (the branch target) stalls
+ *
+ * One entry of the optional instruction fetch timing model of an
+ * M-profile SoC, see arm_cpu_set_mem_latency().
+ */
+typedef struct ARMMemLatency {
+    uint32_t base;
+    uint32_t size;
+    uint32_t line_size;
+    uint32_t wait_states;
+    bool prefetch;
+} ARMMemLatency;
+
+/* Start of an address range and the MPU region it hits */
+typedef struct ARMMPUSegment {
+    uint32_t base;
+    int32_t region;
+} ARMMPUSegment;
+
+/*
+ * The address space split into ranges hitting the same MPU region,
+ * sorted by address.  Built from an MPU region table on the first TLB
+ * fill after a write to it, see ptw.c.
+ */
+typedef struct ARMMPUCache {
+    ARMMPUSegment *seg;
+    unsigned nseg;
+    unsigned alloc;
+    bool valid;
+} ARMMPUCache;
+
+/* Indexes of ARMCPU::mpu_cache, M_REG_NS and M_REG_S for the other two */
+#define ARM_MPU_CACHE_HYP 2
+#define ARM_MPU_CACHE_NUM 3
+
 /**
  * ARMCPU:
  * @env: #CPUARMState
@@ -919,6 +961,11 @@ struct ArchCPU {
     uint32_t pmsav8r_hdregion;
     /* v8M SAU number of supported regions */
     uint32_t sau_sregion;
+    /* Lookup structures for the MPU region tables */
+    ARMMPUCache mpu_cache[ARM_MPU_CACHE_NUM];
+
+    /* Instruction fetch timing model, see arm_cpu_set_mem_latency() */
+    unsigned mem_latency_key;
 
     /* PSCI conduit used to invoke PSCI methods
      * 0 - disabled, 1 - smc, 2 - hvc
@@ -1093,6 +1140,20 @@ struct ArchCPU {
     uint64_t gt_cntfrq_hz;
 };
 
+/*
+ * arm_mpu_cache_invalidate: discard the MPU region lookup structures
+ *
+ * Must be called after any change to the MPU region registers.
+ */
+static inline void arm_mpu_cache_invalidate(ARMCPU *cpu)
+{
+    int i;
+
+    for (i = 0; i < ARM_MPU_CACHE_NUM; i++) {
+        cpu->mpu_cache[i].valid = false;
+    }
+}
+
 typedef struct ARMCPUInfo {
     const char *name;
     void (*initfn)(Object *obj);
@@ -1130,6 +1191,22 @@ void gt_rme_post_el_change(ARMCPU *cpu, void *opaque);
 
 void arm_cpu_post_init(Object *obj);
 
+/**
+ * arm_cpu_set_mem_latency:
+ * @cpu: CPU to configure
+ * @map: latency table, owned by the caller and kept alive
+ * @count: number of entries in @map, 0 to disable the timing model
+ *
+ * Under icount, charge the wait states of instruction fetches from the
+ * memory ranges in @map as extra cycles of virtual time.  The cost is
+ * computed per TB at translation time, from a copy of @map which the TBs
+ * are looked up with (see ARM_TBFLAG_MEM_LATENCY_SHIFT), so that CPUs
+ * with different setups can share the code buffer; call it again after
+ * changing the contents of @map.
+ */
+void arm_cpu_set_mem_latency(ARMCPU *cpu, const ARMMemLatency *map,
+                             unsigned count);
+
 #define ARM_AFF0_SHIFT 0
 #define ARM_AFF0_MASK  (0xFFULL << ARM_AFF0_SHIFT)
 #define ARM_AFF1_SHIFT 8
@@ -3184,6 +3261,11 @@ FIELD(TBFLAG_M32, FPCCR_S_WRONG, 4, 1)          /* Not cached. */
 FIELD(TBFLAG_M32, MVE_NO_PRED, 5, 1)            /* Not cached. */
 /* Set if in secure mode */
 FIELD(TBFLAG_M32, SECURE, 6, 1)
+/*
+ * cs_base bits above flags2, for M-profile only: the memory latency map
+ * the TB is translated with, see arm_mem_latency_map().
+ */
+#define ARM_TBFLAG_MEM_LATENCY_SHIFT 32
 
 /*
  * Bit usage when in AArch64 state
@@ -3864,6 +3864,7 @@ static void pmsav7_write(CPUARMState *env, const ARMCPRegInfo *ri,
 
     u32p += env->pmsav7.rnr[M_REG_NS];
     tlb_flush(CPU(cpu)); /* Mappings may have changed - purge! */
+    arm_mpu_cache_invalidate(cpu);
     *u32p = value;
 }
 
@@ -3889,6 +3890,7 @@ static void prbar_write(CPUARMState *env, const ARMCPRegInfo *ri,
     ARMCPU *cpu = env_archcpu(env);
 
     tlb_flush(CPU(cpu)); /* Mappings may have changed - purge! */
+    arm_mpu_cache_invalidate(cpu);
     env->pmsav8.rbar[M_REG_NS][env->pmsav7.rnr[M_REG_NS]] = value;
 }
 
@@ -3903,6 +3905,7 @@ static void prlar_write(CPUARMState *env, const ARMCPRegInfo *ri,
     ARMCPU *cpu = env_archcpu(env);
 
     tlb_flush(CPU(cpu)); /* Mappings may have changed - purge! */
+    arm_mpu_cache_invalidate(cpu);
     env->pmsav8.rlar[M_REG_NS][env->pmsav7.rnr[M_REG_NS]] = value;
 }
 
@@ -3933,6 +3936,7 @@ static void hprbar_write(CPUARMState *env, const ARMCPRegInfo *ri,
     ARMCPU *cpu = env_archcpu(env);
 
     tlb_flush(CPU(cpu)); /* Mappings may have changed - purge! */
+    arm_mpu_cache_invalidate(cpu);
     env->pmsav8.hprbar[env->pmsav8.hprselr] = value;
 }
 
@@ -3947,6 +3951,7 @@ static void hprlar_write(CPUARMState *env, const ARMCPRegInfo *ri,
     ARMCPU *cpu = env_archcpu(env);
 
     tlb_flush(CPU(cpu)); /* Mappings may have changed - purge! */
+    arm_mpu_cache_invalidate(cpu);
     env->pmsav8.hprlar[env->pmsav8.hprselr] = value;
 }
 
@@ -3967,6 +3972,7 @@ static void hprenr_write(CPUARMState *env, const ARMCPRegInfo *ri,
     value &= MAKE_64BIT_MASK(0, rmax);
 
     tlb_flush(CPU(cpu)); /* Mappings may have changed - purge! */
+    arm_mpu_cache_invalidate(cpu);
 
     /* Register alias is only valid for first 32 indexes */
     for (n = 0; n < rmax; ++n) {
@@ -4015,6 +4021,7 @@ static void pmsav8r_regn_write(CPUARMState *env, const ARMCPRegInfo *ri,
                     (extract32(ri->crm, 0, 3) << 1) | extract32(ri->opc2, 2, 1);
 
     tlb_flush(CPU(cpu)); /* Mappings may have changed - purge! */
+    arm_mpu_cache_invalidate(cpu);
 
     if (ri->opc1 & 4) {
         if (index >= cpu->pmsav8r_hdregion) {
@@ -12450,7 +12457,9 @@ void cpu_get_tb_cpu_state(CPUARMState *env, vaddr *pc,
     }
 
     *pflags = flags.flags;
-    *cs_base = flags.flags2;
+    *cs_base = flags.flags2 |
+        ((uint64_t)env_archcpu(env)->mem_latency_key <<
+         ARM_TBFLAG_MEM_LATENCY_SHIFT);
 }
 
 #ifdef TARGET_AARCH64
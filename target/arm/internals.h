@@ -203,8 +203,12 @@ void arm_restore_state_to_opc(CPUState *cs,
 
 #ifdef CONFIG_TCG
 void arm_cpu_synchronize_from_tb(CPUState *cs, const TranslationBlock *tb);
+uint64_t arm_cpu_poll_state(CPUState *cs);
 #endif /* CONFIG_TCG */
 
+/* The map of arm_cpu_set_mem_latency() keyed @key, NULL for 0 */
+const ARMMemLatency *arm_mem_latency_map(unsigned key, unsigned *count);
+
 typedef enum ARMFPRounding {
     FPROUNDING_TIEEVEN,
     FPROUNDING_POSINF,
@@ -1250,7 +1254,8 @@ bool get_phys_addr_with_space_nogpc(CPUARMState *env, target_ulong address,
 
 bool pmsav8_mpu_lookup(CPUARMState *env, uint32_t address,
                        MMUAccessType access_type, ARMMMUIdx mmu_idx,
-                       bool is_secure, GetPhysAddrResult *result,
+                       bool is_secure, bool in_debug,
+                       GetPhysAddrResult *result,
                        ARMMMUFaultInfo *fi, uint32_t *mregion);
 
 void arm_log_exception(CPUState *cs);
@@ -854,6 +854,7 @@ static int cpu_post_load(void *opaque, int version_id)
     if (tcg_enabled()) {
         hw_breakpoint_update_all(cpu);
         hw_watchpoint_update_all(cpu);
+        arm_mpu_cache_invalidate(cpu);
     }
 
     /*
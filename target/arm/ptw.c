@@ -2317,6 +2317,187 @@ static bool pmsav7_use_background_region(ARMCPU *cpu, ARMMMUIdx mmu_idx,
     return regime_sctlr(env, mmu_idx) & SCTLR_BR;
 }
 
+/*
+ * MPU region lookup
+ *
+ * Rather than walking the region table on every TLB fill, each table is
+ * turned into a sorted list of address ranges hitting a single region
+ * (or none, or several for PMSAv8) the first time it is needed after a
+ * change, and a TLB fill is a binary search.  With an RTOS reprogramming
+ * a few regions on each context switch, and so flushing the TLB, the
+ * table is rebuilt once and then serves all the refills.
+ *
+ * The cache belongs to the vCPU thread.  Debug accesses, which may come
+ * from the gdbstub or the monitor, walk the region table instead.
+ */
+#define MPU_REGION_NONE -1
+/* PMSAv8 only: several regions hit, which is a fault */
+#define MPU_REGION_MULTI -2
+
+typedef int MPURegionAt(const uint32_t *rbar, const uint32_t *rlar,
+                        int nr, uint32_t bitmask, uint32_t address);
+
+static int mpu_cache_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Build @c from the @npts range boundaries in @pts, which need be neither
+ * sorted nor unique but must include 0.
+ */
+static void mpu_cache_build(ARMMPUCache *c, MPURegionAt *region_at,
+                            const uint32_t *rbar, const uint32_t *rlar,
+                            int nr, uint32_t bitmask,
+                            uint64_t *pts, int npts)
+{
+    int i, region;
+
+    qsort(pts, npts, sizeof(*pts), mpu_cache_cmp);
+    if (c->alloc < npts) {
+        c->alloc = npts;
+        c->seg = g_renew(ARMMPUSegment, c->seg, npts);
+    }
+
+    c->nseg = 0;
+    for (i = 0; i < npts && pts[i] <= UINT32_MAX; i++) {
+        if (i && pts[i] == pts[i - 1]) {
+            continue;
+        }
+        region = region_at(rbar, rlar, nr, bitmask, pts[i]);
+        if (c->nseg && c->seg[c->nseg - 1].region == region) {
+            continue;
+        }
+        c->seg[c->nseg].base = pts[i];
+        c->seg[c->nseg].region = region;
+        c->nseg++;
+    }
+    c->valid = true;
+}
+
+/*
+ * Return the region hit by @address, and in @subpage whether the range
+ * it belongs to does not cover the whole page, in which case the TLB
+ * entry must not either.
+ */
+static int mpu_cache_lookup(const ARMMPUCache *c, uint32_t address,
+                            bool *subpage)
+{
+    uint32_t page = address & TARGET_PAGE_MASK;
+    unsigned lo = 0, hi = c->nseg, mid;
+    uint64_t end;
+
+    /* seg[0].base is 0, so seg[lo].base <= address < seg[hi].base */
+    while (hi - lo > 1) {
+        mid = (lo + hi) / 2;
+        if (c->seg[mid].base <= address) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    end = lo + 1 < c->nseg ? c->seg[lo + 1].base : 1ull << 32;
+    *subpage = c->seg[lo].base > page ||
+               end < (uint64_t)page + TARGET_PAGE_SIZE;
+    return c->seg[lo].region;
+}
+
+static bool pmsav7_region_usable(uint32_t drbar, uint32_t drsr, int n,
+                                 bool log)
+{
+    uint32_t rsize = extract32(drsr, 1, 5);
+    uint64_t rmask;
+
+    if (!(drsr & 0x1)) {
+        return false;
+    }
+
+    if (!rsize) {
+        if (log) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "DRSR[%d]: Rsize field cannot be 0\n", n);
+        }
+        return false;
+    }
+    rmask = (1ull << (rsize + 1)) - 1;
+
+    if (drbar & rmask) {
+        if (log) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "DRBAR[%d]: 0x%" PRIx32 " misaligned "
+                          "to DRSR region size, mask = 0x%" PRIx64 "\n",
+                          n, drbar, rmask);
+        }
+        return false;
+    }
+    return true;
+}
+
+/* The highest numbered region hit, ignoring disabled subregions */
+static int pmsav7_region_at(const uint32_t *drbar, const uint32_t *drsr,
+                            int nr, uint32_t bitmask, uint32_t address)
+{
+    int n;
+
+    for (n = nr - 1; n >= 0; n--) {
+        uint32_t base = drbar[n];
+        int rsize = extract32(drsr[n], 1, 5) + 1;
+        uint32_t offset = address - base;
+
+        if (!pmsav7_region_usable(base, drsr[n], n, false) ||
+            address < base || offset > (1ull << rsize) - 1) {
+            continue;
+        }
+        /* no subregions for regions < 256 bytes */
+        if (rsize >= 8 &&
+            extract32(drsr[n], (offset >> (rsize - 3)) + 8, 1)) {
+            continue;
+        }
+        return n;
+    }
+    return MPU_REGION_NONE;
+}
+
+static const ARMMPUCache *pmsav7_mpu_cache(ARMCPU *cpu)
+{
+    CPUARMState *env = &cpu->env;
+    ARMMPUCache *c = &cpu->mpu_cache[M_REG_NS];
+    int nr = cpu->pmsav7_dregion;
+    uint64_t *pts;
+    int n, k, npts = 0;
+
+    if (c->valid) {
+        return c;
+    }
+
+    /* Region start and end, and subregion boundaries */
+    pts = g_new(uint64_t, 1 + nr * 9);
+    pts[npts++] = 0;
+    for (n = 0; n < nr; n++) {
+        uint32_t base = env->pmsav7.drbar[n];
+        uint32_t drsr = env->pmsav7.drsr[n];
+        int rsize = extract32(drsr, 1, 5) + 1;
+
+        if (!pmsav7_region_usable(base, drsr, n, true)) {
+            continue;
+        }
+        pts[npts++] = base;
+        pts[npts++] = (uint64_t)base + (1ull << rsize);
+        for (k = 1; k < 8 && rsize >= 8; k++) {
+            pts[npts++] = base + ((uint64_t)k << (rsize - 3));
+        }
+    }
+
+    mpu_cache_build(c, pmsav7_region_at, env->pmsav7.drbar, env->pmsav7.drsr,
+                    nr, 0, pts, npts);
+    g_free(pts);
+    return c;
+}
+
 static bool get_phys_addr_pmsav7(CPUARMState *env,
                                  S1Translate *ptw,
                                  uint32_t address,
@@ -2346,90 +2527,20 @@ static bool get_phys_addr_pmsav7(CPUARMState *env,
          */
         get_phys_addr_pmsav7_default(env, mmu_idx, address, &result->f.prot);
     } else { /* MPU enabled */
-        for (n = (int)cpu->pmsav7_dregion - 1; n >= 0; n--) {
-            /* region search */
-            uint32_t base = env->pmsav7.drbar[n];
-            uint32_t rsize = extract32(env->pmsav7.drsr[n], 1, 5);
-            uint32_t rmask;
-            bool srdis = false;
-
-            if (!(env->pmsav7.drsr[n] & 0x1)) {
-                continue;
-            }
-
-            if (!rsize) {
-                qemu_log_mask(LOG_GUEST_ERROR,
-                              "DRSR[%d]: Rsize field cannot be 0\n", n);
-                continue;
-            }
-            rsize++;
-            rmask = (1ull << rsize) - 1;
-
-            if (base & rmask) {
-                qemu_log_mask(LOG_GUEST_ERROR,
-                              "DRBAR[%d]: 0x%" PRIx32 " misaligned "
-                              "to DRSR region size, mask = 0x%" PRIx32 "\n",
-                              n, base, rmask);
-                continue;
-            }
-
-            if (address < base || address > base + rmask) {
-                /*
-                 * Address not in this region. We must check whether the
-                 * region covers addresses in the same page as our address.
-                 * In that case we must not report a size that covers the
-                 * whole page for a subsequent hit against a different MPU
-                 * region or the background region, because it would result in
-                 * incorrect TLB hits for subsequent accesses to addresses that
-                 * are in this MPU region.
-                 */
-                if (ranges_overlap(base, rmask,
-                                   address & TARGET_PAGE_MASK,
-                                   TARGET_PAGE_SIZE)) {
-                    result->f.lg_page_size = 0;
-                }
-                continue;
-            }
-
-            /* Region matched */
-
-            if (rsize >= 8) { /* no subregions for regions < 256 bytes */
-                int i, snd;
-                uint32_t srdis_mask;
-
-                rsize -= 3; /* sub region size (power of 2) */
-                snd = ((address - base) >> rsize) & 0x7;
-                srdis = extract32(env->pmsav7.drsr[n], snd + 8, 1);
+        bool subpage;
 
-                srdis_mask = srdis ? 0x3 : 0x0;
-                for (i = 2; i <= 8 && rsize < TARGET_PAGE_BITS; i *= 2) {
-                    /*
-                     * This will check in groups of 2, 4 and then 8, whether
-                     * the subregion bits are consistent. rsize is incremented
-                     * back up to give the region size, considering consistent
-                     * adjacent subregions as one region. Stop testing if rsize
-                     * is already big enough for an entire QEMU page.
-                     */
-                    int snd_rounded = snd & ~(i - 1);
-                    uint32_t srdis_multi = extract32(env->pmsav7.drsr[n],
-                                                     snd_rounded + 8, i);
-                    if (srdis_mask ^ srdis_multi) {
-                        break;
-                    }
-                    srdis_mask = (srdis_mask << i) | srdis_mask;
-                    rsize++;
-                }
-            }
-            if (srdis) {
-                continue;
-            }
-            if (rsize < TARGET_PAGE_BITS) {
-                result->f.lg_page_size = rsize;
-            }
-            break;
+        if (unlikely(ptw->in_debug)) {
+            n = pmsav7_region_at(env->pmsav7.drbar, env->pmsav7.drsr,
+                                 cpu->pmsav7_dregion, 0, address);
+            subpage = true;
+        } else {
+            n = mpu_cache_lookup(pmsav7_mpu_cache(cpu), address, &subpage);
+        }
+        if (subpage) {
+            result->f.lg_page_size = 0;
         }
 
-        if (n == -1) { /* no hits */
+        if (n == MPU_REGION_NONE) { /* no hits */
             if (!pmsav7_use_background_region(cpu, mmu_idx, secure, is_user)) {
                 /* background fault */
                 fi->type = ARMFault_Background;
@@ -2530,9 +2641,67 @@ static uint32_t *regime_rlar(CPUARMState *env, ARMMMUIdx mmu_idx,
     }
 }
 
+/*
+ * The region hit; unlike PMSAv7 where the highest numbered region wins,
+ * hitting several regions is a fault.  The base address is bits [31:x]
+ * from RBAR with bits [x-1:0] all zeroes, but the limit address is bits
+ * [31:x] from RLAR with bits [x:0] all ones, where x is 5 for Cortex-M
+ * and 6 for Cortex-R.
+ */
+static int pmsav8_region_at(const uint32_t *rbar, const uint32_t *rlar,
+                            int nr, uint32_t bitmask, uint32_t address)
+{
+    int n, match = MPU_REGION_NONE;
+
+    for (n = nr - 1; n >= 0; n--) {
+        if (!(rlar[n] & 0x1)) {
+            /* Region disabled */
+            continue;
+        }
+        if (address < (rbar[n] & ~bitmask) || address > (rlar[n] | bitmask)) {
+            continue;
+        }
+        if (match != MPU_REGION_NONE) {
+            return MPU_REGION_MULTI;
+        }
+        match = n;
+    }
+    return match;
+}
+
+static const ARMMPUCache *pmsav8_mpu_cache(CPUARMState *env,
+                                           ARMMMUIdx mmu_idx, bool secure,
+                                           int nr, uint32_t bitmask)
+{
+    ARMCPU *cpu = env_archcpu(env);
+    bool hyp = regime_el(env, mmu_idx) == 2;
+    ARMMPUCache *c = &cpu->mpu_cache[hyp ? ARM_MPU_CACHE_HYP : secure];
+    uint32_t *rbar = regime_rbar(env, mmu_idx, secure);
+    uint32_t *rlar = regime_rlar(env, mmu_idx, secure);
+    uint64_t *pts;
+    int n, npts = 0;
+
+    if (c->valid) {
+        return c;
+    }
+
+    pts = g_new(uint64_t, 1 + nr * 2);
+    pts[npts++] = 0;
+    for (n = 0; n < nr; n++) {
+        if (rlar[n] & 0x1) {
+            pts[npts++] = rbar[n] & ~bitmask;
+            pts[npts++] = (uint64_t)(rlar[n] | bitmask) + 1;
+        }
+    }
+
+    mpu_cache_build(c, pmsav8_region_at, rbar, rlar, nr, bitmask, pts, npts);
+    g_free(pts);
+    return c;
+}
+
 bool pmsav8_mpu_lookup(CPUARMState *env, uint32_t address,
                        MMUAccessType access_type, ARMMMUIdx mmu_idx,
-                       bool secure, GetPhysAddrResult *result,
+                       bool secure, bool in_debug, GetPhysAddrResult *result,
                        ARMMMUFaultInfo *fi, uint32_t *mregion)
 {
     /*
@@ -2544,14 +2713,15 @@ bool pmsav8_mpu_lookup(CPUARMState *env, uint32_t address,
      * If the region hit doesn't cover the entire TARGET_PAGE the address
      * is within, then we set the result page_size to 1 to force the
      * memory system to use a subpage.
+     * Debug lookups (in_debug) walk the region table rather than use the
+     * lookup cache, which belongs to the vCPU thread.
      */
     ARMCPU *cpu = env_archcpu(env);
     bool is_user = regime_is_user(env, mmu_idx);
     int n;
     int matchregion = -1;
     bool hit = false;
-    uint32_t addr_page_base = address & TARGET_PAGE_MASK;
-    uint32_t addr_page_limit = addr_page_base + (TARGET_PAGE_SIZE - 1);
+    bool subpage;
     int region_counter;
 
     if (regime_el(env, mmu_idx) == 2) {
@@ -2596,57 +2766,28 @@ bool pmsav8_mpu_lookup(CPUARMState *env, uint32_t address,
             fi->level = 0;
         }
 
-        for (n = region_counter - 1; n >= 0; n--) {
-            /* region search */
-            /*
-             * Note that the base address is bits [31:x] from the register
-             * with bits [x-1:0] all zeroes, but the limit address is bits
-             * [31:x] from the register with bits [x:0] all ones. Where x is
-             * 5 for Cortex-M and 6 for Cortex-R
-             */
-            uint32_t base = regime_rbar(env, mmu_idx, secure)[n] & ~bitmask;
-            uint32_t limit = regime_rlar(env, mmu_idx, secure)[n] | bitmask;
-
-            if (!(regime_rlar(env, mmu_idx, secure)[n] & 0x1)) {
-                /* Region disabled */
-                continue;
-            }
-
-            if (address < base || address > limit) {
-                /*
-                 * Address not in this region. We must check whether the
-                 * region covers addresses in the same page as our address.
-                 * In that case we must not report a size that covers the
-                 * whole page for a subsequent hit against a different MPU
-                 * region or the background region, because it would result in
-                 * incorrect TLB hits for subsequent accesses to addresses that
-                 * are in this MPU region.
-                 */
-                if (limit >= base &&
-                    ranges_overlap(base, limit - base + 1,
-                                   addr_page_base,
-                                   TARGET_PAGE_SIZE)) {
-                    result->f.lg_page_size = 0;
-                }
-                continue;
-            }
-
-            if (base > addr_page_base || limit < addr_page_limit) {
-                result->f.lg_page_size = 0;
-            }
+        if (unlikely(in_debug)) {
+            n = pmsav8_region_at(regime_rbar(env, mmu_idx, secure),
+                                 regime_rlar(env, mmu_idx, secure),
+                                 region_counter, bitmask, address);
+            subpage = true;
+        } else {
+            n = mpu_cache_lookup(pmsav8_mpu_cache(env, mmu_idx, secure,
+                                                  region_counter, bitmask),
+                                 address, &subpage);
+        }
+        if (subpage) {
+            result->f.lg_page_size = 0;
+        }
 
-            if (matchregion != -1) {
-                /*
-                 * Multiple regions match -- always a failure (unlike
-                 * PMSAv7 where highest-numbered-region wins)
-                 */
-                fi->type = ARMFault_Permission;
-                if (arm_feature(env, ARM_FEATURE_M)) {
-                    fi->level = 1;
-                }
-                return true;
+        if (n == MPU_REGION_MULTI) {
+            fi->type = ARMFault_Permission;
+            if (arm_feature(env, ARM_FEATURE_M)) {
+                fi->level = 1;
             }
-
+            return true;
+        }
+        if (n != MPU_REGION_NONE) {
             matchregion = n;
             hit = true;
         }
@@ -2923,7 +3064,7 @@ static bool get_phys_addr_pmsav8(CPUARMState *env,
     }
 
     ret = pmsav8_mpu_lookup(env, address, access_type, mmu_idx, secure,
-                            result, fi, NULL);
+                            ptw->in_debug, result, fi, NULL);
     if (sattrs.subpage) {
         result->f.lg_page_size = 0;
     }
@@ -2821,7 +2821,7 @@ uint32_t HELPER(v7m_tt)(CPUARMState *env, uint32_t addr, uint32_t op)
 
         /* We can ignore the return value as prot is always set */
         pmsav8_mpu_lookup(env, addr, MMU_DATA_LOAD, mmu_idx, targetsec,
-                          &res, &fi, &mregion);
+                          false, &res, &fi, &mregion);
         if (mregion == -1) {
             mrvalid = false;
             mregion = 0;
@@ -751,6 +751,87 @@ void gen_update_pc(DisasContext *s, target_long diff)
     s->pc_save = s->pc_curr + diff;
 }
 
+/*
+ * The state the M-profile TB flags derive from, other than the PC and
+ * the IT bits: see cpu_get_tb_cpu_state().  The shadow return stack
+ * checks that a return finds it as the call left it.  The Thumb bit is
+ * also written by the return branch, and must still be set.
+ */
+static int arm_ret_state(intptr_t *state)
+{
+    int n = 0;
+
+    state[n++] = offsetof(CPUARMState, hflags.flags);
+#if TARGET_LONG_BITS == 64
+    state[n++] = offsetoflow32(CPUARMState, hflags.flags2);
+#else
+    state[n++] = offsetof(CPUARMState, hflags.flags2);
+#endif
+    state[n++] = offsetof(CPUARMState, thumb);
+    state[n++] = offsetof(CPUARMState, v7m.control[M_REG_S]);
+    state[n++] = offsetof(CPUARMState, v7m.fpccr[M_REG_NS]);
+    state[n++] = offsetof(CPUARMState, v7m.fpccr[M_REG_S]);
+    return n;
+}
+
+static bool arm_use_ret_stack(DisasContext *s)
+{
+    /* MVE_NO_PRED depends on the vector registers */
+    return arm_dc_feature(s, ARM_FEATURE_M) && !dc_isar_feature(aa32_mve, s) &&
+           translator_use_return_stack(&s->base);
+}
+
+/* Can the TB end with gen_goto_return()?  The call pushed no IT bits. */
+static bool arm_use_goto_return(DisasContext *s)
+{
+    return s->v7m_return && !s->condexec_mask && arm_use_ret_stack(s);
+}
+
+/*
+ * A call returning to the next insn: push the TB flags found there, i.e.
+ * those of this TB once out of the IT block, with the FP context state
+ * as the insns translated so far left it.
+ */
+static void gen_push_return(DisasContext *s)
+{
+    CPUARMTBFlags ret = {
+        .flags = s->base.tb->flags,
+        .flags2 = s->base.tb->cs_base,
+    };
+    intptr_t state[CPU_RET_STATE_WORDS];
+    TCGv_i64 pc;
+    int nb_state;
+
+    if (!arm_use_ret_stack(s)) {
+        return;
+    }
+    DP_TBFLAG_AM32(ret, CONDEXEC, 0);
+    DP_TBFLAG_M32(ret, LSPACT, s->v7m_lspact);
+    DP_TBFLAG_M32(ret, NEW_FP_CTXT_NEEDED, s->v7m_new_fp_ctxt_needed);
+    DP_TBFLAG_M32(ret, FPCCR_S_WRONG, s->v8m_fpccr_s_wrong);
+    /* DP_TBFLAG_M32 drops the memory latency key */
+    ret.flags2 = deposit64(s->base.tb->cs_base, 0, 32, ret.flags2);
+
+    /* LR, as written with CF_PCREL, without the Thumb bit */
+    pc = tcg_temp_new_i64();
+    tcg_gen_extu_i32_i64(pc, cpu_R[14]);
+    tcg_gen_andi_i64(pc, pc, ~1);
+    nb_state = arm_ret_state(state);
+    translator_push_return(&s->base, pc, ret.flags, ret.flags2,
+                           state, nb_state);
+}
+
+/* End the TB of a return from a call, PC and Thumb bit written */
+static void gen_goto_return(DisasContext *s)
+{
+    intptr_t state[CPU_RET_STATE_WORDS];
+    TCGv_i64 pc = tcg_temp_new_i64();
+    int nb_state = arm_ret_state(state);
+
+    tcg_gen_extu_i32_i64(pc, cpu_R[15]);
+    translator_goto_return(&s->base, pc, state, nb_state);
+}
+
 /* Set PC and Thumb state from var.  var is marked as dead.  */
 static inline void gen_bx(DisasContext *s, TCGv_i32 var)
 {
@@ -816,6 +897,8 @@ static inline void gen_bx_excret_final_code(DisasContext *s)
     /* No: end the TB as we would for a DISAS_JMP */
     if (s->ss_active) {
         gen_singlestep_exception(s);
+    } else if (arm_use_goto_return(s)) {
+        gen_goto_return(s);
     } else {
         tcg_gen_exit_tb(NULL, 0);
     }
@@ -2558,6 +2641,59 @@ static void gen_goto_tb(DisasContext *s, int n, target_long diff)
     s->base.is_jmp = DISAS_NORETURN;
 }
 
+/*
+ * In a superblock, go on translating after a direct branch within the
+ * TB's page, so that the TB still covers one range of guest code.
+ *
+ * An unconditional branch is followed.  A conditional branch forward is
+ * assumed not taken, and leaves the TB through a side exit when it is.
+ * A branch back into the code already translated is the back edge of a
+ * loop: it is assumed taken, which unrolls the loop body in the TB, and
+ * the fall through is the side exit.  It is only followed while the body
+ * fits in what is left of the TB; the last back edge chains with
+ * goto_tb, often to this very TB.
+ */
+static bool gen_jmp_superblock(DisasContext *s, target_long diff)
+{
+    vaddr dest = s->pc_curr + diff;
+    bool backward = dest < s->base.pc_next;
+
+    if (s->condexec_mask || !translator_use_goto_tb(&s->base, dest)) {
+        return false;
+    }
+    if (backward &&
+        (dest < s->base.pc_first ||
+         s->base.num_insns + (s->base.pc_next - dest) / 2 >
+         s->base.max_insns)) {
+        return false;
+    }
+    if (s->condjmp && !backward) {
+        /* The condition failed path, from condlabel, is the superblock */
+        gen_update_pc(s, diff);
+        gen_goto_ptr();
+        s->pc_save = s->condlabel.pc_save;
+        return true;
+    }
+    if (s->condjmp) {
+        /* The taken path is the superblock, around the condition failed one */
+        TCGLabel *taken = gen_new_label();
+        target_ulong pc_save = s->pc_save;
+
+        tcg_gen_br(taken);
+        set_disas_label(s, s->condlabel);
+        gen_update_pc(s, curr_insn_len(s));
+        gen_goto_ptr();
+        gen_set_label(taken);
+        s->pc_save = pc_save;
+        s->condjmp = 0;
+    }
+    if (backward) {
+        s->base.pc_max = MAX(s->base.pc_max, s->base.pc_next);
+    }
+    s->base.pc_next = dest;
+    return true;
+}
+
 /* Jump, specifying which TB number to use if we gen_goto_tb() */
 static void gen_jmp_tb(DisasContext *s, target_long diff, int tbno)
 {
@@ -2567,6 +2703,10 @@ static void gen_jmp_tb(DisasContext *s, target_long diff, int tbno)
         s->base.is_jmp = DISAS_JUMP;
         return;
     }
+    if (s->base.superblock && s->base.is_jmp == DISAS_NEXT &&
+        gen_jmp_superblock(s, diff)) {
+        return;
+    }
     switch (s->base.is_jmp) {
     case DISAS_NEXT:
     case DISAS_TOO_MANY:
@@ -6290,6 +6430,7 @@ static bool trans_BX(DisasContext *s, arg_BX *a)
     if (!ENABLE_ARCH_4T) {
         return false;
     }
+    s->v7m_return = a->rm == 14;
     gen_bx_excret(s, load_reg(s, a->rm));
     return true;
 }
@@ -6325,6 +6466,7 @@ static bool trans_BLX_r(DisasContext *s, arg_BLX_r *a)
     }
     tmp = load_reg(s, a->rm);
     gen_pc_plus_diff(s, cpu_R[14], curr_insn_len(s) | s->thumb);
+    gen_push_return(s);
     gen_bx(s, tmp);
     return true;
 }
@@ -6714,6 +6856,8 @@ static bool op_load_ri(DisasContext *s, arg_ldst_ri *a,
      * ensure correct behavior with overlapping index registers.
      */
     op_addr_ri_post(s, a, addr, 0);
+    /* POP {pc} */
+    s->v7m_return = a->rt == 15 && a->rn == 13;
     store_reg_from_load(s, a->rt, tmp);
     return true;
 }
@@ -8025,6 +8169,10 @@ static bool do_ldm(DisasContext *s, arg_ldst_block *a)
         } else if (i == 15 && exc_return) {
             store_pc_exc_ret(s, tmp);
         } else {
+            if (i == 15) {
+                /* POP {..., pc} */
+                s->v7m_return = a->rn == 13;
+            }
             store_reg_from_load(s, i, tmp);
         }
 
@@ -8150,6 +8298,7 @@ static bool trans_B_cond_thumb(DisasContext *s, arg_ci *a)
 static bool trans_BL(DisasContext *s, arg_i *a)
 {
     gen_pc_plus_diff(s, cpu_R[14], curr_insn_len(s) | s->thumb);
+    gen_push_return(s);
     gen_jmp(s, jmp_diff(s, a->imm));
     return true;
 }
@@ -9161,6 +9310,7 @@ static void arm_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
         dc->v7m_new_fp_ctxt_needed =
             EX_TBFLAG_M32(tb_flags, NEW_FP_CTXT_NEEDED);
         dc->v7m_lspact = EX_TBFLAG_M32(tb_flags, LSPACT);
+        dc->v7m_return = false;
         dc->mve_no_pred = EX_TBFLAG_M32(tb_flags, MVE_NO_PRED);
     } else {
         dc->sctlr_b = EX_TBFLAG_A32(tb_flags, SCTLR__B);
@@ -9206,6 +9356,18 @@ static void arm_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
         dc->base.max_insns = 1;
     }
 
+    dc->mem_latency = arm_mem_latency_map(dc->base.tb->cs_base >>
+                                          ARM_TBFLAG_MEM_LATENCY_SHIFT,
+                                          &dc->mem_latency_count);
+    dc->fetch_started = false;
+    dc->base.count_stalls = dc->mem_latency_count != 0;
+    /*
+     * Thumb code stops at the end of the page even after a branch, see
+     * gen_jmp_superblock().  Following branches would upset the fetch
+     * timing.
+     */
+    dc->base.superblock_capable = dc->thumb && !dc->base.count_stalls;
+
     /* ARM is a fixed-length ISA.  Bound the number of insns to execute
        to those left on the page.  */
     if (!dc->thumb) {
@@ -9420,6 +9582,39 @@ static bool thumb_insn_is_unconditional(DisasContext *s, uint32_t insn)
     return false;
 }
 
+/*
+ * Charge the wait states of the fetch lines in [start, end) that this TB
+ * has not fetched yet, for the timing model of arm_cpu_set_mem_latency().
+ * With prefetch only the first line of the TB stalls.
+ */
+static void arm_charge_fetch(DisasContext *dc, uint32_t start, uint32_t end)
+{
+    const ARMMemLatency *m = NULL;
+    uint32_t line;
+    unsigned i;
+
+    for (i = 0; i < dc->mem_latency_count; i++) {
+        if (start - dc->mem_latency[i].base < dc->mem_latency[i].size) {
+            m = &dc->mem_latency[i];
+            break;
+        }
+    }
+    if (!m || !m->wait_states) {
+        return;
+    }
+
+    for (line = start & -m->line_size; line < end; line += m->line_size) {
+        if (dc->fetch_started && line == dc->fetch_line) {
+            continue;
+        }
+        if (!dc->fetch_started || !m->prefetch) {
+            dc->base.stall_cycles += m->wait_states;
+        }
+        dc->fetch_started = true;
+        dc->fetch_line = line;
+    }
+}
+
 static void thumb_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
 {
     DisasContext *dc = container_of(dcbase, DisasContext, base);
@@ -9451,6 +9646,10 @@ static void thumb_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
     dc->base.pc_next = pc;
     dc->insn = insn;
 
+    if (dc->base.count_stalls) {
+        arm_charge_fetch(dc, dc->pc_curr, pc);
+    }
+
     if (dc->pstate_il) {
         /*
          * Illegal execution state. This has priority over BTI
@@ -9618,7 +9817,11 @@ static void arm_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
             gen_update_pc(dc, curr_insn_len(dc));
             /* fall through */
         case DISAS_JUMP:
-            gen_goto_ptr();
+            if (dc->base.is_jmp == DISAS_JUMP && arm_use_goto_return(dc)) {
+                gen_goto_return(dc);
+            } else {
+                gen_goto_ptr();
+            }
             break;
         case DISAS_UPDATE_EXIT:
             gen_update_pc(dc, curr_insn_len(dc));
@@ -81,6 +81,12 @@ typedef struct DisasContext {
     bool v8m_fpccr_s_wrong; /* true if v8M FPCCR.S != v8m_secure */
     bool v7m_new_fp_ctxt_needed; /* ASPEN set but no active FP context */
     bool v7m_lspact; /* FPCCR.LSPACT set */
+    bool v7m_return; /* the branch ending the TB returns from a call */
+    /* Instruction fetch timing model, see arm_cpu_set_mem_latency() */
+    const ARMMemLatency *mem_latency;
+    unsigned mem_latency_count;
+    bool fetch_started;  /* fetch_line is valid */
+    uint32_t fetch_line; /* last fetch line charged in this TB */
     /* Immediate value in AArch32 SVC insn; must be set if is_jmp == DISAS_SWI
      * so that top level loop can generate correct syndrome information.
      */
@@ -248,5 +248,6 @@ typedef enum {
 #define TCG_TARGET_DEFAULT_MO (TCG_MO_ALL & ~TCG_MO_ST_LD)
 #define TCG_TARGET_NEED_LDST_LABELS
 #define TCG_TARGET_NEED_POOL_LABELS
+#define TCG_TARGET_HOST_RELOCS (TCG_TARGET_REG_BITS == 64)
 
 #endif
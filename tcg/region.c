@@ -31,6 +31,7 @@
 #include "qemu/qtree.h"
 #include "qapi/error.h"
 #include "tcg/tcg.h"
+#include "tcg/startup.h"
 #include "exec/translation-block.h"
 #include "tcg-internal.h"
 #include "host/cpuinfo.h"
@@ -72,10 +73,30 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    /*
+     * Generation at which each region was last assigned to a context,
+     * 0 for the regions emptied by tcg_region_evict.
+     */
+    uint64_t *gen;
+    uint64_t next_gen;
+    size_t n_free; /* regions below current emptied by tcg_region_evict */
 };
 
 static struct tcg_region_state region;
 
+/* Preferred address of the rx view of the buffer, see tcg_region_set_hint */
+static void *region_hint;
+
+/* Regions may be reclaimed one at a time, see tcg_region_evict */
+static bool region_eviction;
+
+/*
+ * With eviction, the minimum number of regions not held by a context.
+ * The buffer being reclaimed one region at a time, this bounds the part
+ * of the translations dropped by each eviction.
+ */
+#define TCG_EVICT_MIN_REGIONS 8
+
 /*
  * This is an array of struct tcg_region_tree's, with padding.
  * We use void * to simplify the computation of region_trees[i]; each
@@ -359,11 +380,21 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
+    size_t curr_region;
+
+    if (region.n_free) {
+        /* Reuse a region emptied by tcg_region_evict */
+        for (curr_region = 0; region.gen[curr_region]; curr_region++) {
+            g_assert(curr_region < region.current);
+        }
+        region.n_free--;
+    } else if (region.current == region.n) {
         return true;
+    } else {
+        curr_region = region.current++;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, curr_region);
+    region.gen[curr_region] = ++region.next_gen;
     return false;
 }
 
@@ -412,6 +443,8 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    region.n_free = 0;
+    memset(region.gen, 0, region.n * sizeof(*region.gen));
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -422,12 +455,78 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
-static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
+void tcg_region_set_eviction(bool enable)
+{
+    region_eviction = enable;
+}
+
+/*
+ * Make room for a context which has filled its region and found no other:
+ * call @func on each TB of the full region assigned the longest time ago,
+ * which must invalidate it, then empty the region for the next
+ * tcg_region_alloc.  The regions filled since, and thus the code
+ * translated again after the previous evictions, stay.
+ * Returns false if the whole buffer must be reset instead.
+ * Call from a safe-work context.
+ */
+bool tcg_region_evict(GTraverseFunc func, gpointer user_data)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    g_autofree bool *held = NULL;
+    struct tcg_region_tree *rt;
+    size_t victim = region.n;
+    void *start, *end;
+
+    if (!region_eviction) {
+        return false;
+    }
+
+    qemu_mutex_lock(&region.lock);
+    if (region.n_free || region.current < region.n) {
+        /* Another context got there first */
+        qemu_mutex_unlock(&region.lock);
+        return true;
+    }
+    held = g_new0(bool, region.n);
+    for (unsigned int i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        held[(s->code_gen_buffer - region.start_aligned) / region.stride] = true;
+    }
+    for (size_t i = 0; i < region.n; i++) {
+        if (!held[i] &&
+            (victim == region.n || region.gen[i] < region.gen[victim])) {
+            victim = i;
+        }
+    }
+    if (victim == region.n) {
+        qemu_mutex_unlock(&region.lock);
+        return false;
+    }
+    tcg_region_bounds(victim, &start, &end);
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    region.gen[victim] = 0;
+    region.n_free++;
+    qemu_mutex_unlock(&region.lock);
+
+    rt = region_trees + victim * tree_size;
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, func, user_data);
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+    return true;
+}
+
+static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus,
+                            unsigned extra_threads)
 {
 #ifdef CONFIG_USER_ONLY
     return 1;
 #else
     size_t n_regions;
+    unsigned n_threads;
 
     /*
      * It is likely that some vCPUs will translate more code than others,
@@ -437,18 +536,25 @@ static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
      */
     /* Use a single region if all we have is one vCPU thread */
     if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
+        n_threads = 1;
+    } else {
+        n_threads = max_cpus;
+    }
+    /* Helper threads translate into regions of their own */
+    n_threads += extra_threads;
+    if (n_threads == 1) {
         return 1;
     }
 
     /*
-     * Try to have more regions than max_cpus, with each region being >= 2 MB.
-     * If we can't, then just allocate one region per vCPU thread.
+     * Try to have more regions than threads, with each region being >= 2 MB.
+     * If we can't, then just allocate one region per TCG thread.
      */
     n_regions = tb_size / (2 * MiB);
-    if (n_regions <= max_cpus) {
-        return max_cpus;
+    if (n_regions <= n_threads) {
+        return n_threads;
     }
-    return MIN(n_regions, max_cpus * 8);
+    return MIN(n_regions, n_threads * 8);
 #endif
 }
 
@@ -556,7 +662,7 @@ static int alloc_code_gen_buffer_anon(size_t size, int prot,
 {
     void *buf;
 
-    buf = mmap(NULL, size, prot, flags, -1, 0);
+    buf = mmap(region_hint, size, prot, flags, -1, 0);
     if (buf == MAP_FAILED) {
         error_setg_errno(errp, errno,
                          "allocate %zu bytes for jit buffer", size);
@@ -582,7 +688,7 @@ static int alloc_code_gen_buffer_splitwx_memfd(size_t size, Error **errp)
         goto fail;
     }
 
-    buf_rx = mmap(NULL, size, host_prot_read_exec(), MAP_SHARED, fd, 0);
+    buf_rx = mmap(region_hint, size, host_prot_read_exec(), MAP_SHARED, fd, 0);
     if (buf_rx == MAP_FAILED) {
         error_setg_errno(errp, errno,
                          "failed to map shared memory for execute");
@@ -733,6 +839,7 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  *
  * In system-mode the number of TCG threads is bounded by max_cpus, so we use at
  * least max_cpus regions in MTTCG. In !MTTCG we use a single region.
+ * The extra_threads of tcg_reserve_threads() add one region each.
  * Note that the TCG options from the command-line (i.e. -accel accel=tcg,[...])
  * must have been parsed before calling this function, since it calls
  * qemu_tcg_mttcg_enabled().
@@ -749,7 +856,8 @@ static int alloc_code_gen_buffer(size_t size, int splitwx, Error **errp)
  * in practice. Multi-threaded guests share most if not all of their translated
  * code, which makes parallel code generation less appealing than in system-mode
  */
-void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
+void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus,
+                     unsigned extra_threads)
 {
     const size_t page_size = qemu_real_host_page_size();
     size_t region_size;
@@ -787,7 +895,15 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
      * As a result of this we might end up with a few extra pages at the end of
      * the buffer; we will assign those to the last region.
      */
-    region.n = tcg_n_regions(tb_size, max_cpus);
+    region.n = tcg_n_regions(tb_size, max_cpus, extra_threads);
+#ifndef CONFIG_USER_ONLY
+    if (region_eviction) {
+        /* Each TCG thread holds a region it is filling */
+        region.n = MAX(region.n,
+                       TCG_EVICT_MIN_REGIONS + max_cpus + extra_threads);
+        region.n = MIN(region.n, tb_size / (2 * page_size));
+    }
+#endif
     region_size = tb_size / region.n;
     region_size = QEMU_ALIGN_DOWN(region_size, page_size);
 
@@ -808,6 +924,7 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.gen = g_new0(uint64_t, region.n);
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
@@ -875,6 +992,81 @@ void tcg_region_prologue_set(TCGContext *s)
                      region.after_prologue);
 }
 
+/*
+ * Ask for the rx view of the buffer to be mapped at @rx, so that code
+ * saved by an earlier run can be used as is.  Call before tcg_init().
+ * This is only a hint: the caller checks where the buffer ended up.
+ */
+void tcg_region_set_hint(const void *rx)
+{
+    region_hint = (void *)rx;
+}
+
+void tcg_region_get_layout(TCGRegionLayout *l)
+{
+    l->start = region.start_aligned;
+    l->prologue_size = region.after_prologue - region.start_aligned;
+    l->n = region.n;
+    l->stride = region.stride;
+    l->total_size = region.total_size;
+}
+
+/*
+ * Fill @start and @end, arrays of region.n entries, with the part of the
+ * buffer holding code: the prologue and the allocated regions, up to the
+ * code pointer of the context filling each one.  Returns the number of
+ * entries.  Call from a safe-work context.
+ */
+size_t tcg_region_used(void **start, void **end)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    size_t i;
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < region.current; i++) {
+        tcg_region_bounds(i, &start[i], &end[i]);
+        if (i == 0) {
+            start[i] = region.start_aligned;
+        }
+    }
+    for (unsigned int j = 0; j < n_ctxs; j++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[j]);
+        size_t curr = (s->code_gen_buffer - region.start_aligned) /
+                      region.stride;
+
+        if (curr < region.current) {
+            end[curr] = s->code_gen_ptr;
+        }
+    }
+    qemu_mutex_unlock(&region.lock);
+    return i;
+}
+
+/*
+ * The buffer has been filled with code up to @end: leave the initial
+ * context after it, in the region holding @end, and the regions before
+ * it full.  Call between tcg_prologue_init() and the first vCPU thread.
+ */
+void tcg_region_restore(void *end)
+{
+    size_t curr = (end - region.start_aligned) / region.stride;
+    void *start, *bound;
+
+    g_assert(curr < region.n);
+    qemu_mutex_lock(&region.lock);
+    for (size_t i = 0; i < curr; i++) {
+        tcg_region_bounds(i, &start, &bound);
+        region.agg_size_full += bound - start - TCG_HIGHWATER;
+    }
+    for (size_t i = 0; i <= curr; i++) {
+        region.gen[i] = ++region.next_gen;
+    }
+    tcg_region_assign(&tcg_init_ctx, curr);
+    tcg_init_ctx.code_gen_ptr = MAX(end, tcg_init_ctx.code_gen_buffer);
+    region.current = curr + 1;
+    qemu_mutex_unlock(&region.lock);
+}
+
 /*
  * Returns the size (in bytes) of all translated code (i.e. from all regions)
  * currently in the cache.
@@ -244,6 +244,7 @@ unsigned int tcg_max_ctxs;
 TCGv_env tcg_env;
 const void *tcg_code_gen_epilogue;
 uintptr_t tcg_splitwx_diff;
+bool tcg_record_host_relocs;
 
 #ifndef CONFIG_TCG_INTERPRETER
 tcg_prologue_fn *tcg_qemu_tb_exec;
@@ -347,6 +348,37 @@ static void tcg_out_reloc(TCGContext *s, tcg_insn_unit *code_ptr, int type,
     QSIMPLEQ_INSERT_TAIL(&l->relocs, r, next);
 }
 
+/* Note the host address @value at @code_ptr, see TCGHostReloc */
+static void __attribute__((unused))
+tcg_out_host_reloc(TCGContext *s, tcg_insn_unit *code_ptr, int type,
+                   uintptr_t value, intptr_t addend)
+{
+    TCGHostReloc *r;
+
+    if (!tcg_record_host_relocs) {
+        return;
+    }
+    r = tcg_malloc(sizeof(TCGHostReloc));
+    r->ptr = code_ptr;
+    r->value = value;
+    r->addend = addend;
+    r->type = type;
+    r->next = s->host_relocs;
+    s->host_relocs = r;
+}
+
+/* Patch the host address noted by tcg_out_host_reloc() to @value */
+bool tcg_patch_host_reloc(tcg_insn_unit *ptr, int type, uintptr_t value,
+                          intptr_t addend)
+{
+    if (type == TCG_HOST_RELOC_PTR) {
+        value += addend;
+        memcpy(ptr, &value, sizeof(value));
+        return true;
+    }
+    return patch_reloc(ptr, type, value, addend);
+}
+
 static void tcg_out_label(TCGContext *s, TCGLabel *l)
 {
     tcg_debug_assert(!l->has_value);
@@ -1384,10 +1416,18 @@ static void tcg_context_init(unsigned max_cpus)
     tcg_env = temp_tcgv_ptr(ts);
 }
 
+/* Non-vCPU threads with a TCG context, see tcg_reserve_threads */
+static unsigned tcg_extra_threads;
+
+void tcg_reserve_threads(unsigned n)
+{
+    tcg_extra_threads = n;
+}
+
 void tcg_init(size_t tb_size, int splitwx, unsigned max_cpus)
 {
-    tcg_context_init(max_cpus);
-    tcg_region_init(tb_size, splitwx, max_cpus);
+    tcg_context_init(max_cpus + tcg_extra_threads);
+    tcg_region_init(tb_size, splitwx, max_cpus, tcg_extra_threads);
 }
 
 /*
@@ -1514,6 +1554,9 @@ void tcg_func_start(TCGContext *s)
     s->nb_ops = 0;
     s->nb_labels = 0;
     s->current_frame_offset = s->frame_start;
+    s->host_ptr_used = false;
+    s->stall_counted = false;
+    s->nb_gen_succ = 0;
 
 #ifdef CONFIG_DEBUG_TCG
     s->goto_tb_issue_mask = 0;
@@ -1907,6 +1950,7 @@ TCGv_i64 tcg_constant_i64(int64_t val)
 
 TCGv_ptr tcg_constant_ptr_int(intptr_t val)
 {
+    tcg_ctx->host_ptr_used = true;
     return temp_tcgv_ptr(tcg_constant_internal(TCG_TYPE_PTR, val));
 }
 
@@ -6153,6 +6197,7 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb, uint64_t pc_start)
 #ifdef TCG_TARGET_NEED_POOL_LABELS
     s->pool_labels = NULL;
 #endif
+    s->host_relocs = NULL;
 
     start_words = s->insn_start_words;
     s->gen_insn_data =
@@ -0,0 +1,79 @@
+/*
+ * Raw ARMv7M firmware images for TCG qtests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "armv7m-image.h"
+
+void armv7m_image_init(ARMv7MImage *img, uint32_t base, uint32_t stack,
+                       const uint8_t *code, size_t code_size)
+{
+    img->base = base;
+    img->size = ARMV7M_IMAGE_CODE_OFFSET + code_size;
+    img->data = g_malloc0(img->size);
+    img->kernel = false;
+
+    stl_le_p(&img->data[0], stack);
+    memcpy(&img->data[ARMV7M_IMAGE_CODE_OFFSET], code, code_size);
+    armv7m_image_set_vector(img, 1, 0);
+}
+
+void armv7m_image_init_netduino(ARMv7MImage *img, const uint8_t *code,
+                                size_t code_size)
+{
+    armv7m_image_init(img, NETDUINO_FLASH_BASE, NETDUINO_SRAM_BASE + 0x1000,
+                      code, code_size);
+}
+
+uint32_t armv7m_image_addr(const ARMv7MImage *img, size_t offset)
+{
+    return img->base + ARMV7M_IMAGE_CODE_OFFSET + offset;
+}
+
+void armv7m_image_set_vector(ARMv7MImage *img, unsigned exc, size_t offset)
+{
+    g_assert(exc > 0 && exc < ARMV7M_IMAGE_VECTORS);
+    stl_le_p(&img->data[exc * 4], armv7m_image_addr(img, offset) | 1);
+}
+
+QTestState *armv7m_image_boot(const ARMv7MImage *img, const char *fmt, ...)
+{
+    GError *err = NULL;
+    QTestState *qts;
+    va_list ap;
+    char *path, *args;
+    int fd;
+
+    fd = g_file_open_tmp("armv7m-image-XXXXXX.bin", &path, &err);
+    g_assert_no_error(err);
+    close(fd);
+    g_file_set_contents(path, (char *)img->data, img->size, &err);
+    g_assert_no_error(err);
+
+    va_start(ap, fmt);
+    args = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+
+    /* Both keep a copy of the file for resets */
+    if (img->kernel) {
+        qts = qtest_initf("%s -kernel %s", args, path);
+    } else {
+        qts = qtest_initf("%s -device loader,file=%s,addr=0x%" PRIx32
+                          ",force-raw=on", args, path, img->base);
+    }
+
+    unlink(path);
+    g_free(path);
+    g_free(args);
+    return qts;
+}
+
+void armv7m_image_free(ARMv7MImage *img)
+{
+    g_free(img->data);
+    img->data = NULL;
+}
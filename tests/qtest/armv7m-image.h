@@ -0,0 +1,61 @@
+/*
+ * Raw ARMv7M firmware images for TCG qtests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef TEST_ARMV7M_IMAGE_H
+#define TEST_ARMV7M_IMAGE_H
+
+#include "libqtest.h"
+
+/* The code follows a vector table with room for 128 exceptions */
+#define ARMV7M_IMAGE_CODE_OFFSET 0x200
+#define ARMV7M_IMAGE_VECTORS (ARMV7M_IMAGE_CODE_OFFSET / 4)
+
+/* netduinoplus2 (STM32F405) */
+#define NETDUINO_FLASH_BASE 0x08000000
+#define NETDUINO_SRAM_BASE 0x20000000
+
+typedef struct ARMv7MImage {
+    uint32_t base;
+    uint8_t *data;
+    size_t size;
+    /*
+     * Load with -kernel, through the CPU address space, rather than with
+     * the generic loader into the system address space.  Needed when the
+     * image goes to memory only the CPU sees, like the SSE-300 ITCM.
+     */
+    bool kernel;
+} ARMv7MImage;
+
+/*
+ * Lay out an image loaded at @base: a vector table with the initial SP
+ * @stack and the reset vector pointing at the start of @code, then @code
+ * at ARMV7M_IMAGE_CODE_OFFSET.  The other vectors are zero.
+ */
+void armv7m_image_init(ARMv7MImage *img, uint32_t base, uint32_t stack,
+                       const uint8_t *code, size_t code_size);
+
+/* Shorthand for a netduinoplus2 image, with the stack in the first 4 KiB */
+void armv7m_image_init_netduino(ARMv7MImage *img, const uint8_t *code,
+                                size_t code_size);
+
+/* Address of @offset in the code */
+uint32_t armv7m_image_addr(const ARMv7MImage *img, size_t offset);
+
+/* Point exception @exc at @offset in the code, in Thumb state */
+void armv7m_image_set_vector(ARMv7MImage *img, unsigned exc, size_t offset);
+
+/*
+ * Start QEMU with @fmt, which selects the machine and accelerator, and
+ * load the image.  The temporary image file is removed before this
+ * returns.
+ */
+QTestState *armv7m_image_boot(const ARMv7MImage *img, const char *fmt, ...)
+    G_GNUC_PRINTF(2, 3);
+
+void armv7m_image_free(ARMv7MImage *img);
+
+#endif /* TEST_ARMV7M_IMAGE_H */
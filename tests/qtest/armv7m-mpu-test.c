@@ -0,0 +1,268 @@
+/*
+ * QTest for the M-profile MPU
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A tiny guest programs the MPU from a table of register writes, then
+ * makes a list of loads and stores and records which of them fault.  The
+ * MemManage/HardFault handler sets a flag and skips the 32-bit access.
+ * The tables live in RAM, written by the test while the CPU is stopped:
+ *
+ *   RAM_BASE + 0x000: (register, value) pairs, up to a zero register
+ *   RAM_BASE + 0x100: (address, is_write) pairs, up to a zero address
+ *   RAM_BASE + 0x200: for each access, 1 if it faulted
+ *   RAM_BASE + 0x300: set once all accesses are done
+ *
+ * The accesses go back and forth between regions that share a 1 KiB
+ * page, so that a TLB entry wrongly covering the whole page gives the
+ * wrong answer for the next one.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "libqtest.h"
+#include "armv7m-image.h"
+
+#define FAULT_HANDLER_OFFSET 0x50
+#define CONFIG_OFFSET 0x000
+#define PROBE_OFFSET 0x100
+#define RESULT_OFFSET 0x200
+#define DONE_OFFSET 0x300
+
+#define AN547_DTCM_BASE 0x20000000
+#define AN547_SRAM2_BASE 0x21000000
+
+#define SHCSR 0xe000ed24
+#define SHCSR_MEMFAULTENA (1 << 16)
+#define MPU_CTRL 0xe000ed94
+#define MPU_CTRL_ENABLE_PRIVDEFENA 5
+#define MPU_RNR 0xe000ed98
+#define MPU_RBAR 0xe000ed9c
+#define MPU_RASR 0xe000eda0
+#define MPU_RLAR 0xe000eda0
+
+/* PMSAv7 RASR */
+#define RASR(ap, srd, size_log2) \
+    (((ap) << 24) | ((srd) << 8) | (((size_log2) - 1) << 1) | 1)
+#define AP_V7_RW 3
+#define AP_V7_RO 6
+#define AP_V7_NONE 0
+
+/* PMSAv8 RBAR and RLAR */
+#define RBAR(base, ap) ((base) | ((ap) << 1))
+#define RLAR(limit, en) (((limit) & ~0x1f) | (en))
+#define AP_V8_RW 1
+#define AP_V8_RO 3
+
+typedef struct MPUProbe {
+    uint32_t addr;
+    bool write;
+    bool fault;
+} MPUProbe;
+
+static const uint8_t mpu_code[] = {
+    /* reset: */
+    0x17, 0x4e,                 /* ldr   r6, ram (RAM_BASE, patched) */
+    0x35, 0x46,                 /* mov   r5, r6 (register writes) */
+    /* config: */
+    0x55, 0xf8, 0x04, 0x0b,     /* ldr   r0, [r5], #4 */
+    0x18, 0xb1,                 /* cbz   r0, probes */
+    0x55, 0xf8, 0x04, 0x1b,     /* ldr   r1, [r5], #4 */
+    0x01, 0x60,                 /* str   r1, [r0] */
+    0xf8, 0xe7,                 /* b     config */
+    /* probes: */
+    0xbf, 0xf3, 0x4f, 0x8f,     /* dsb */
+    0xbf, 0xf3, 0x6f, 0x8f,     /* isb */
+    0x06, 0xf5, 0x80, 0x75,     /* add   r5, r6, #0x100 (probes) */
+    0x06, 0xf5, 0x00, 0x74,     /* add   r4, r6, #0x200 (results) */
+    /* probe: */
+    0x55, 0xf8, 0x04, 0x0b,     /* ldr   r0, [r5], #4 */
+    0x78, 0xb1,                 /* cbz   r0, done */
+    0x55, 0xf8, 0x04, 0x1b,     /* ldr   r1, [r5], #4 */
+    0x00, 0x22,                 /* movs  r2, #0 */
+    0xc6, 0xf8, 0x04, 0x23,     /* str   r2, [r6, #0x304] (fault flag) */
+    0x11, 0xb1,                 /* cbz   r1, load */
+    0xc0, 0xf8, 0x00, 0x20,     /* str.w r2, [r0] */
+    0x01, 0xe0,                 /* b     check */
+    /* load: */
+    0xd0, 0xf8, 0x00, 0x20,     /* ldr.w r2, [r0] */
+    /* check: */
+    0xd6, 0xf8, 0x04, 0x23,     /* ldr   r2, [r6, #0x304] */
+    0x44, 0xf8, 0x04, 0x2b,     /* str   r2, [r4], #4 */
+    0xec, 0xe7,                 /* b     probe */
+    /* done: */
+    0x01, 0x20,                 /* movs  r0, #1 */
+    0xc6, 0xf8, 0x00, 0x03,     /* str   r0, [r6, #0x300] */
+    /* halt: */
+    0xfe, 0xe7,                 /* b     halt */
+    /* fault: */
+    0x03, 0x49,                 /* ldr   r1, ram */
+    0x01, 0x20,                 /* movs  r0, #1 */
+    0xc1, 0xf8, 0x04, 0x03,     /* str   r0, [r1, #0x304] */
+    0x06, 0x98,                 /* ldr   r0, [sp, #24] (stacked PC) */
+    0x04, 0x30,                 /* adds  r0, #4 */
+    0x06, 0x90,                 /* str   r0, [sp, #24] */
+    0x70, 0x47,                 /* bx    lr */
+    /* ram: */
+    0x00, 0x00, 0x00, 0x00,     /* .word 0 */
+};
+
+static void run_probes(const char *machine, uint32_t ram_base,
+                       const uint32_t (*config)[2], size_t nconfig,
+                       const MPUProbe *probes, size_t nprobes)
+{
+    uint8_t code[sizeof(mpu_code)];
+    ARMv7MImage img;
+    QTestState *qts;
+    int64_t start;
+    size_t i;
+
+    memcpy(code, mpu_code, sizeof(code));
+    stl_le_p(&code[sizeof(code) - 4], ram_base);
+    if (ram_base == NETDUINO_SRAM_BASE) {
+        armv7m_image_init_netduino(&img, code, sizeof(code));
+    } else {
+        armv7m_image_init(&img, 0, AN547_DTCM_BASE + 0x1000,
+                          code, sizeof(code));
+        img.kernel = true;
+    }
+    armv7m_image_set_vector(&img, 3, FAULT_HANDLER_OFFSET);
+    armv7m_image_set_vector(&img, 4, FAULT_HANDLER_OFFSET);
+    qts = armv7m_image_boot(&img, "-M %s -accel tcg -S", machine);
+    armv7m_image_free(&img);
+
+    for (i = 0; i < nconfig; i++) {
+        qtest_writel(qts, ram_base + CONFIG_OFFSET + i * 8, config[i][0]);
+        qtest_writel(qts, ram_base + CONFIG_OFFSET + i * 8 + 4,
+                     config[i][1]);
+    }
+    qtest_writel(qts, ram_base + CONFIG_OFFSET + i * 8, 0);
+    for (i = 0; i < nprobes; i++) {
+        qtest_writel(qts, ram_base + PROBE_OFFSET + i * 8, probes[i].addr);
+        qtest_writel(qts, ram_base + PROBE_OFFSET + i * 8 + 4,
+                     probes[i].write);
+    }
+    qtest_writel(qts, ram_base + PROBE_OFFSET + i * 8, 0);
+    qtest_qmp_assert_success(qts, "{'execute': 'cont'}");
+
+    start = g_get_monotonic_time();
+    while (!qtest_readl(qts, ram_base + DONE_OFFSET)) {
+        g_assert_cmpint(g_get_monotonic_time() - start, <,
+                        10 * G_USEC_PER_SEC);
+        g_usleep(10 * 1000);
+    }
+
+    for (i = 0; i < nprobes; i++) {
+        g_test_message("%s 0x%08" PRIx32 ": %s", probes[i].write ? "store" :
+                       "load", probes[i].addr,
+                       probes[i].fault ? "fault" : "ok");
+        g_assert_cmpuint(qtest_readl(qts, ram_base + RESULT_OFFSET + i * 4),
+                         ==, probes[i].fault);
+    }
+
+    qtest_quit(qts);
+}
+
+/*
+ * PMSAv7: a 4 KiB RW region, a 1 KiB read-only region over it with its
+ * third 128-byte subregion disabled, and a 256-byte no-access region
+ * over that.  The highest numbered region hit wins.
+ */
+static void test_pmsav7(void)
+{
+    static const uint32_t config[][2] = {
+        { SHCSR, SHCSR_MEMFAULTENA },
+        { MPU_RNR, 0 },
+        { MPU_RBAR, 0x20004000 },
+        { MPU_RASR, RASR(AP_V7_RW, 0, 12) },
+        { MPU_RNR, 1 },
+        { MPU_RBAR, 0x20004400 },
+        { MPU_RASR, RASR(AP_V7_RO, 1 << 2, 10) },
+        { MPU_RNR, 2 },
+        { MPU_RBAR, 0x20004600 },
+        { MPU_RASR, RASR(AP_V7_NONE, 0, 8) },
+        { MPU_CTRL, MPU_CTRL_ENABLE_PRIVDEFENA },
+    };
+    static const MPUProbe probes[] = {
+        { 0x20004000, true, false },
+        { 0x20004400, false, false },
+        { 0x20004400, true, true },
+        /* disabled subregion: region 0, in the same page */
+        { 0x20004500, true, false },
+        { 0x20004480, true, true },
+        { 0x20004500, true, false },
+        { 0x20004580, true, true },
+        /* region 2 wins over region 1 */
+        { 0x20004600, false, true },
+        { 0x20004700, false, false },
+        { 0x20004800, true, false },
+        /* background region */
+        { 0x20005000, true, false },
+    };
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+
+    run_probes("netduinoplus2", NETDUINO_SRAM_BASE, config,
+               ARRAY_SIZE(config), probes, ARRAY_SIZE(probes));
+}
+
+/*
+ * PMSAv8: a 4 KiB RW region with a 256-byte read-only region inside it,
+ * and a disabled region inside it as well.  Hitting two enabled regions
+ * faults, whatever their permissions; a disabled one does not count.
+ */
+static void test_pmsav8(void)
+{
+    static const uint32_t config[][2] = {
+        { SHCSR, SHCSR_MEMFAULTENA },
+        { MPU_RNR, 0 },
+        { MPU_RBAR, RBAR(0x21004000, AP_V8_RW) },
+        { MPU_RLAR, RLAR(0x21004fff, 1) },
+        { MPU_RNR, 1 },
+        { MPU_RBAR, RBAR(0x21004400, AP_V8_RO) },
+        { MPU_RLAR, RLAR(0x210044ff, 1) },
+        { MPU_RNR, 2 },
+        { MPU_RBAR, RBAR(0x21004800, AP_V8_RO) },
+        { MPU_RLAR, RLAR(0x2100483f, 0) },
+        { MPU_CTRL, MPU_CTRL_ENABLE_PRIVDEFENA },
+    };
+    static const MPUProbe probes[] = {
+        { 0x21004000, true, false },
+        /* regions 0 and 1 both hit */
+        { 0x21004400, false, true },
+        { 0x21004500, true, false },
+        { 0x210044f0, false, true },
+        { 0x21004700, false, false },
+        /* region 2 is disabled */
+        { 0x21004800, true, false },
+        /* background region */
+        { 0x21005000, true, false },
+    };
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+    if (!qtest_has_machine("mps3-an547")) {
+        g_test_skip("mps3-an547 not available");
+        return;
+    }
+
+    run_probes("mps3-an547", AN547_SRAM2_BASE, config, ARRAY_SIZE(config),
+               probes, ARRAY_SIZE(probes));
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/armv7m/mpu/pmsav7", test_pmsav7);
+    qtest_add_func("/armv7m/mpu/pmsav8", test_pmsav8);
+    return g_test_run();
+}
@@ -0,0 +1,246 @@
+/*
+ * QTests for the ARMv7M NVIC: interrupt storm microbenchmark and
+ * priority order
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A tiny guest on netduinoplus2 (STM32F405, 96 external IRQs) enables all
+ * external interrupts and keeps pending all of them through ISPR, while a
+ * common handler counts the interrupts taken in SRAM.  With every vector
+ * pending, each exception entry and return recomputes the NVIC state,
+ * which is what this measures.
+ *
+ * In normal runs the test only checks that the storm makes progress; run
+ * it with -m perf to get the interrupt throughput over a few seconds:
+ *   QTEST_QEMU_BINARY=./qemu-system-arm \
+ *       ./tests/qtest/armv7m-nvic-storm-test -m perf --verbose
+ *
+ * The priority test runs in Secure state on mps3-an547 (Cortex-M55).  With
+ * PRIMASK set, it pends five IRQs of mixed priorities, two of which target
+ * Non-secure state through ITNS.  It then logs VECTPENDING and clears that
+ * IRQ until none is left, with and without AIRCR.PRIS squashing the
+ * Non-secure priorities.  Last, it takes the three Secure IRQs and logs
+ * the order of the handlers.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "armv7m-image.h"
+
+#define NUM_VECTORS (16 + 96)
+#define HANDLER_OFFSET 32
+#define COUNTER_ADDR NETDUINO_SRAM_BASE
+
+/* SSE-300 DTCM, and SRAM outside of any MPC which qtest can read */
+#define AN547_DTCM_BASE 0x20000000
+#define PRIO_LOG 0x21000000
+#define PRIO_TAKEN_LOG (PRIO_LOG + 0x40)
+#define PRIO_TAKEN_COUNT (PRIO_LOG + 0x7c)
+#define PRIO_DONE (PRIO_LOG + 0x80)
+#define PRIO_HANDLER_OFFSET 0x78
+#define PRIO_NUM_IRQS 5
+#define AIRCR_VECTKEY 0x05fa0000
+#define AIRCR_PRIS (1 << 14)
+
+static const uint8_t storm_code[] = {
+    /* reset: */
+    0x4e, 0xf2, 0x00, 0x10,     /* movw  r0, #0xe100 */
+    0xce, 0xf2, 0x00, 0x00,     /* movt  r0, #0xe000 */
+    0x4f, 0xf0, 0xff, 0x31,     /* mov.w r1, #-1 */
+    0x01, 0x60,                 /* str   r1, [r0] (ISER0) */
+    0x41, 0x60,                 /* str   r1, [r0, #4] (ISER1) */
+    0x81, 0x60,                 /* str   r1, [r0, #8] (ISER2) */
+    /* loop: */
+    0xc0, 0xf8, 0x00, 0x11,     /* str.w r1, [r0, #0x100] (ISPR0) */
+    0xc0, 0xf8, 0x04, 0x11,     /* str.w r1, [r0, #0x104] (ISPR1) */
+    0xc0, 0xf8, 0x08, 0x11,     /* str.w r1, [r0, #0x108] (ISPR2) */
+    0xf8, 0xe7,                 /* b     loop */
+    /* handler: */
+    0x40, 0xf2, 0x00, 0x02,     /* movw  r2, #0 */
+    0xc2, 0xf2, 0x00, 0x02,     /* movt  r2, #0x2000 */
+    0x13, 0x68,                 /* ldr   r3, [r2] */
+    0x01, 0x33,                 /* adds  r3, #1 */
+    0x13, 0x60,                 /* str   r3, [r2] */
+    0x70, 0x47,                 /* bx    lr */
+};
+
+/*
+ * IRQ 0..4 priorities 0x80, 0x00, 0x40, 0x20, 0x80; IRQ 1 and 3 target
+ * Non-secure state.  The AIRCR value is the last word.
+ */
+static const uint8_t prio_code[] = {
+    /* reset: */
+    0x72, 0xb6,                 /* cpsid i */
+    0x4e, 0xf2, 0x00, 0x10,     /* movw  r0, #0xe100 */
+    0xce, 0xf2, 0x00, 0x00,     /* movt  r0, #0xe000 (NVIC) */
+    0x4e, 0xf6, 0x0c, 0x52,     /* movw  r2, #0xed0c */
+    0xce, 0xf2, 0x00, 0x02,     /* movt  r2, #0xe000 */
+    0x1f, 0x49,                 /* ldr   r1, aircr */
+    0x11, 0x60,                 /* str   r1, [r2] (AIRCR) */
+    0x40, 0xf2, 0x80, 0x01,     /* movw  r1, #0x0080 */
+    0xc2, 0xf2, 0x40, 0x01,     /* movt  r1, #0x2040 */
+    0xc0, 0xf8, 0x00, 0x13,     /* str.w r1, [r0, #0x300] (IPR0) */
+    0x80, 0x21,                 /* movs  r1, #0x80 */
+    0xc0, 0xf8, 0x04, 0x13,     /* str.w r1, [r0, #0x304] (IPR1: 0x80) */
+    0x0a, 0x21,                 /* movs  r1, #0x0a */
+    0xc0, 0xf8, 0x80, 0x12,     /* str.w r1, [r0, #0x280] (ITNS0) */
+    0x1f, 0x21,                 /* movs  r1, #0x1f */
+    0x01, 0x60,                 /* str   r1, [r0] (ISER0) */
+    0xc0, 0xf8, 0x00, 0x11,     /* str.w r1, [r0, #0x100] (ISPR0) */
+    0x40, 0xf2, 0x00, 0x03,     /* movw  r3, #0 */
+    0xc2, 0xf2, 0x00, 0x13,     /* movt  r3, #0x2100 (pending order log) */
+    0x4e, 0xf6, 0x04, 0x52,     /* movw  r2, #0xed04 */
+    0xce, 0xf2, 0x00, 0x02,     /* movt  r2, #0xe000 */
+    0x01, 0x25,                 /* movs  r5, #1 */
+    /* next: */
+    0x11, 0x68,                 /* ldr   r1, [r2] (ICSR) */
+    0xc1, 0xf3, 0x08, 0x31,     /* ubfx  r1, r1, #12, #9 (VECTPENDING) */
+    0x39, 0xb1,                 /* cbz   r1, taken */
+    0x43, 0xf8, 0x04, 0x1b,     /* str   r1, [r3], #4 */
+    0x10, 0x39,                 /* subs  r1, #16 */
+    0x05, 0xfa, 0x01, 0xf4,     /* lsl.w r4, r5, r1 */
+    0xc0, 0xf8, 0x80, 0x41,     /* str.w r4, [r0, #0x180] (ICPR0) */
+    0xf3, 0xe7,                 /* b     next */
+    /* taken: */
+    0x15, 0x21,                 /* movs  r1, #0x15 */
+    0xc0, 0xf8, 0x00, 0x11,     /* str.w r1, [r0, #0x100] (ISPR0) */
+    0x62, 0xb6,                 /* cpsie i */
+    0x40, 0xf2, 0x80, 0x03,     /* movw  r3, #0x80 */
+    0xc2, 0xf2, 0x00, 0x13,     /* movt  r3, #0x2100 */
+    0x01, 0x21,                 /* movs  r1, #1 */
+    0x19, 0x60,                 /* str   r1, [r3] (done) */
+    /* loop: */
+    0x30, 0xbf,                 /* wfi */
+    0xfd, 0xe7,                 /* b     loop */
+    /* handler: */
+    0xef, 0xf3, 0x05, 0x80,     /* mrs   r0, ipsr */
+    0x40, 0xf2, 0x40, 0x01,     /* movw  r1, #0x40 */
+    0xc2, 0xf2, 0x00, 0x11,     /* movt  r1, #0x2100 (taken order log) */
+    0xca, 0x6b,                 /* ldr   r2, [r1, #0x3c] */
+    0x41, 0xf8, 0x22, 0x00,     /* str.w r0, [r1, r2, lsl #2] */
+    0x01, 0x32,                 /* adds  r2, #1 */
+    0xca, 0x63,                 /* str   r2, [r1, #0x3c] */
+    0x70, 0x47,                 /* bx    lr */
+    /* aircr: */
+    0x00, 0x40, 0xfa, 0x05,     /* .word 0x05fa4000 (PRIS) */
+};
+
+static QTestState *boot_storm(void)
+{
+    ARMv7MImage img;
+    QTestState *qts;
+    int i;
+
+    QEMU_BUILD_BUG_ON(NUM_VECTORS > ARMV7M_IMAGE_VECTORS);
+
+    armv7m_image_init_netduino(&img, storm_code, sizeof(storm_code));
+    for (i = 2; i < NUM_VECTORS; i++) {
+        armv7m_image_set_vector(&img, i, HANDLER_OFFSET);
+    }
+    qts = armv7m_image_boot(&img, "-M netduinoplus2 -accel tcg");
+    armv7m_image_free(&img);
+    return qts;
+}
+
+static void test_irq_storm(void)
+{
+    unsigned long seconds = g_test_perf() ? 5 : 1;
+    uint32_t start_count, count;
+    int64_t start, elapsed;
+    QTestState *qts;
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+
+    qts = boot_storm();
+
+    start_count = qtest_readl(qts, COUNTER_ADDR);
+    start = g_get_monotonic_time();
+    g_usleep(seconds * G_USEC_PER_SEC);
+    count = qtest_readl(qts, COUNTER_ADDR) - start_count;
+    elapsed = g_get_monotonic_time() - start;
+
+    g_test_message("%" PRIu32 " interrupts in %.2f s: %.0f interrupts/s",
+                   count, elapsed / 1e6, count * 1e6 / elapsed);
+    g_assert_cmpuint(count, >, 0);
+
+    qtest_quit(qts);
+}
+
+static void run_prio_order(uint32_t aircr, const uint32_t *pending)
+{
+    static const uint32_t taken[] = { 18, 16, 20 };
+    uint8_t code[sizeof(prio_code)];
+    int64_t start;
+    ARMv7MImage img;
+    QTestState *qts;
+    int i;
+
+    memcpy(code, prio_code, sizeof(code));
+    stl_le_p(&code[sizeof(code) - 4], aircr);
+    armv7m_image_init(&img, 0, AN547_DTCM_BASE + 0x1000, code, sizeof(code));
+    img.kernel = true;
+    for (i = 0; i < PRIO_NUM_IRQS; i++) {
+        armv7m_image_set_vector(&img, 16 + i, PRIO_HANDLER_OFFSET);
+    }
+    qts = armv7m_image_boot(&img, "-M mps3-an547 -accel tcg");
+    armv7m_image_free(&img);
+
+    start = g_get_monotonic_time();
+    while (!qtest_readl(qts, PRIO_DONE)) {
+        g_assert_cmpint(g_get_monotonic_time() - start, <,
+                        10 * G_USEC_PER_SEC);
+        g_usleep(10 * 1000);
+    }
+
+    for (i = 0; i < PRIO_NUM_IRQS; i++) {
+        g_assert_cmpuint(qtest_readl(qts, PRIO_LOG + i * 4), ==, pending[i]);
+    }
+    g_assert_cmpuint(qtest_readl(qts, PRIO_LOG + i * 4), ==, 0);
+
+    g_assert_cmpuint(qtest_readl(qts, PRIO_TAKEN_COUNT), ==,
+                     ARRAY_SIZE(taken));
+    for (i = 0; i < ARRAY_SIZE(taken); i++) {
+        g_assert_cmpuint(qtest_readl(qts, PRIO_TAKEN_LOG + i * 4), ==,
+                         taken[i]);
+    }
+
+    qtest_quit(qts);
+}
+
+static void test_prio_order(void)
+{
+    /*
+     * Exception numbers.  With PRIS, Non-secure priority p counts as
+     * 0x80 + p / 2: IRQ 1 ties with IRQ 0 and 4 at 0x80, and the lowest
+     * exception number goes first.
+     */
+    static const uint32_t pending_pris[] = { 18, 16, 17, 20, 19 };
+    static const uint32_t pending[] = { 17, 19, 18, 16, 20 };
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+    if (!qtest_has_machine("mps3-an547")) {
+        g_test_skip("mps3-an547 not available");
+        return;
+    }
+
+    run_prio_order(AIRCR_VECTKEY | AIRCR_PRIS, pending_pris);
+    run_prio_order(AIRCR_VECTKEY, pending);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/armv7m-nvic/irq-storm", test_irq_storm);
+    qtest_add_func("/armv7m-nvic/prio-order", test_prio_order);
+    return g_test_run();
+}
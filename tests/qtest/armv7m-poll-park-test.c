@@ -0,0 +1,105 @@
+/*
+ * QTest for parking vCPUs polling a device register
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A guest on mps2-an385 runs CMSDK APB timer 0 with a 20 ms period and
+ * spins on INTSTATUS, which the timer callback sets.  With poll-park=on
+ * the vCPU is parked in that loop, and must be woken at the timer
+ * deadline: right after seeing the flag, the guest records how far the
+ * timer has counted since its reload, which must be well below the
+ * 10 ms a parked vCPU sleeps at most.
+ */
+
+#include "qemu/osdep.h"
+#include "armv7m-image.h"
+
+#define AN385_SRAM_BASE 0x20000000
+#define RESULT_ADDR AN385_SRAM_BASE
+#define LAG_LOG (AN385_SRAM_BASE + 16)
+#define PERIODS 10
+/* 1 ms at 25 MHz */
+#define MAX_LAG_TICKS 25000
+#define REAL_TIME_LIMIT_US (20 * G_USEC_PER_SEC)
+
+static const uint8_t poll_code[] = {
+    /* reset: */
+    0x40, 0xf2, 0x00, 0x02,     /* movw  r2, #0 */
+    0xc2, 0xf2, 0x00, 0x02,     /* movt  r2, #0x2000 */
+    0x40, 0xf2, 0x00, 0x01,     /* movw  r1, #0 (TIMER0) */
+    0xc4, 0xf2, 0x00, 0x01,     /* movt  r1, #0x4000 */
+    0x4a, 0xf2, 0x20, 0x10,     /* movw  r0, #0xa120 (20 ms at 25 MHz) */
+    0xc0, 0xf2, 0x07, 0x00,     /* movt  r0, #0x7 */
+    0x88, 0x60,                 /* str   r0, [r1, #8] (RELOAD) */
+    0x48, 0x60,                 /* str   r0, [r1, #4] (VALUE) */
+    0x09, 0x23,                 /* movs  r3, #9 */
+    0x0b, 0x60,                 /* str   r3, [r1] (CTRL: EN, IRQEN) */
+    0x00, 0x24,                 /* movs  r4, #0 */
+    0x02, 0xf1, 0x10, 0x05,     /* add   r5, r2, #16 */
+    /* poll: */
+    0xcb, 0x68,                 /* ldr   r3, [r1, #12] (INTSTATUS) */
+    0x00, 0x2b,                 /* cmp   r3, #0 */
+    0xfc, 0xd0,                 /* beq   poll */
+    0x4b, 0x68,                 /* ldr   r3, [r1, #4] */
+    0xc3, 0x1a,                 /* subs  r3, r0, r3 (ticks since the reload) */
+    0x45, 0xf8, 0x04, 0x3b,     /* str   r3, [r5], #4 */
+    0x01, 0x23,                 /* movs  r3, #1 */
+    0xcb, 0x60,                 /* str   r3, [r1, #12] (INTCLEAR) */
+    0x01, 0x34,                 /* adds  r4, #1 */
+    0x0a, 0x2c,                 /* cmp   r4, #10 */
+    0xf3, 0xd1,                 /* bne   poll */
+    0x13, 0x60,                 /* str   r3, [r2] */
+    /* halt: */
+    0xfe, 0xe7,                 /* b     halt */
+};
+
+static void test_timer_deadline(void)
+{
+    QTestState *qts;
+    int64_t start;
+    uint32_t done, lag;
+    ARMv7MImage img;
+    int i;
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+    if (!qtest_has_machine("mps2-an385")) {
+        g_test_skip("mps2-an385 not available");
+        return;
+    }
+
+    armv7m_image_init(&img, 0, AN385_SRAM_BASE + 0x1000,
+                      poll_code, sizeof(poll_code));
+    img.kernel = true;
+    qts = armv7m_image_boot(&img, "-M mps2-an385 -accel tcg,poll-park=on");
+    armv7m_image_free(&img);
+
+    start = g_get_monotonic_time();
+    do {
+        g_usleep(10 * 1000);
+        done = qtest_readl(qts, RESULT_ADDR);
+    } while (!done && g_get_monotonic_time() - start < REAL_TIME_LIMIT_US);
+    g_assert_cmpuint(done, ==, 1);
+
+    for (i = 0; i < PERIODS; i++) {
+        lag = qtest_readl(qts, LAG_LOG + i * 4);
+        g_test_message("period %d: flag seen %u ticks after the reload",
+                       i, lag);
+        g_assert_cmpuint(lag, <, MAX_LAG_TICKS);
+    }
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/armv7m/poll-park/timer-deadline", test_timer_deadline);
+    return g_test_run();
+}
@@ -0,0 +1,148 @@
+/*
+ * QTest for the TCG shadow return stack on ARMv7M
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A tiny guest on netduinoplus2 (STM32F405) keeps calling a leaf function
+ * returning with BX LR, and a function calling it in turn and returning
+ * with POP {PC}, counting the loops in SRAM.  The code runs from the
+ * flash, with CF_PCREL TBs as on any Arm board.  With the "return-stack"
+ * TCG property, "info jit" must show almost all of the returns jumping to
+ * the TB their call predicted; without it, none.
+ *
+ * In the mispredict test, the function calling the leaf rewrites its
+ * stacked return address before POP {PC}.  The return must go there and
+ * not where the call predicted, which counts in another SRAM word.
+ */
+
+#include "qemu/osdep.h"
+#include "armv7m-image.h"
+
+#define COUNTER_ADDR NETDUINO_SRAM_BASE
+#define WRONG_COUNTER_ADDR (NETDUINO_SRAM_BASE + 4)
+
+static const uint8_t calls_code[] = {
+    /* reset: */
+    0x40, 0xf2, 0x00, 0x02,     /* movw  r2, #0 */
+    0xc2, 0xf2, 0x00, 0x02,     /* movt  r2, #0x2000 */
+    /* loop: */
+    0x00, 0xf0, 0x06, 0xf8,     /* bl    leaf */
+    0x00, 0xf0, 0x05, 0xf8,     /* bl    nested */
+    0x13, 0x68,                 /* ldr   r3, [r2] */
+    0x01, 0x33,                 /* adds  r3, #1 */
+    0x13, 0x60,                 /* str   r3, [r2] */
+    0xf7, 0xe7,                 /* b     loop */
+    /* leaf: */
+    0x70, 0x47,                 /* bx    lr */
+    /* nested: */
+    0x00, 0xb5,                 /* push  {lr} */
+    0xff, 0xf7, 0xfc, 0xff,     /* bl    leaf */
+    0x00, 0xbd,                 /* pop   {pc} */
+};
+
+static const uint8_t redirect_code[] = {
+    /* reset: */
+    0x40, 0xf2, 0x00, 0x02,     /* movw  r2, #0 */
+    0xc2, 0xf2, 0x00, 0x02,     /* movt  r2, #0x2000 */
+    /* loop: */
+    0x00, 0xf0, 0x04, 0xf8,     /* bl    redirect */
+    0x53, 0x68,                 /* ldr   r3, [r2, #4] (wrong return) */
+    0x01, 0x33,                 /* adds  r3, #1 */
+    0x53, 0x60,                 /* str   r3, [r2, #4] */
+    0xf9, 0xe7,                 /* b     loop */
+    /* redirect: */
+    0x00, 0xb5,                 /* push  {lr} */
+    0x00, 0xf0, 0x05, 0xf8,     /* bl    leaf */
+    0x0f, 0xf2, 0x0a, 0x00,     /* adr.w r0, fixed */
+    0x01, 0x30,                 /* adds  r0, #1 */
+    0x00, 0x90,                 /* str   r0, [sp] (return to fixed instead) */
+    0x00, 0xbd,                 /* pop   {pc} */
+    /* leaf: */
+    0x70, 0x47,                 /* bx    lr */
+    /* fixed: */
+    0x13, 0x68,                 /* ldr   r3, [r2] */
+    0x01, 0x33,                 /* adds  r3, #1 */
+    0x13, 0x60,                 /* str   r3, [r2] */
+    0xec, 0xe7,                 /* b     loop */
+};
+
+/* Run the guest for @count loops, return the share of predicted returns */
+static size_t run_calls(const uint8_t *code, size_t size, const char *accel,
+                        uint32_t count, size_t *hits, uint32_t *wrong)
+{
+    ARMv7MImage img;
+    QTestState *qts;
+    const char *line;
+    size_t percent;
+    char *info;
+
+    armv7m_image_init_netduino(&img, code, size);
+    qts = armv7m_image_boot(&img, "-M netduinoplus2 -accel %s", accel);
+    armv7m_image_free(&img);
+
+    while (qtest_readl(qts, COUNTER_ADDR) < count) {
+        g_usleep(10 * 1000);
+    }
+    *wrong = qtest_readl(qts, WRONG_COUNTER_ADDR);
+
+    info = qtest_hmp(qts, "info jit");
+    line = strstr(info, "return stack hits");
+    g_assert_nonnull(line);
+    g_assert_cmpint(sscanf(line, "return stack hits %zu (%zu%%",
+                           hits, &percent), ==, 2);
+    g_test_message("%s: %s", accel, line);
+
+    g_free(info);
+    qtest_quit(qts);
+    return percent;
+}
+
+static void test_return_stack(void)
+{
+    size_t hits, percent;
+    uint32_t wrong;
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+
+    percent = run_calls(calls_code, sizeof(calls_code),
+                        "tcg,return-stack=on", 100000, &hits, &wrong);
+    /* Only the first returns, before their TB is in tb_jmp_cache, miss */
+    g_assert_cmpuint(hits, >=, 3 * 100000);
+    g_assert_cmpuint(percent, >=, 99);
+
+    run_calls(calls_code, sizeof(calls_code), "tcg", 100000, &hits, &wrong);
+    g_assert_cmpuint(hits, ==, 0);
+}
+
+static void test_return_mispredict(void)
+{
+    size_t hits, percent;
+    uint32_t wrong;
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+
+    /* The leaf returns are predicted, the rewritten ones are not */
+    percent = run_calls(redirect_code, sizeof(redirect_code),
+                        "tcg,return-stack=on", 100000, &hits, &wrong);
+    g_assert_cmpuint(wrong, ==, 0);
+    g_assert_cmpuint(hits, >=, 100000);
+    g_assert_cmpuint(percent, <=, 51);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/armv7m/return-stack", test_return_stack);
+    qtest_add_func("/armv7m/return-stack/mispredict", test_return_mispredict);
+    return g_test_run();
+}
@@ -0,0 +1,113 @@
+/*
+ * QTest for superblock translation of hot loops
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A tiny guest on netduinoplus2 runs a hot loop with a conditional branch
+ * forward, an unconditional branch forward and a conditional back edge,
+ * then stores its result in SRAM.  With a superblock threshold the loop
+ * is translated again as a superblock that follows all three branches;
+ * the result must not change, and "info jit" must report the superblock
+ * with its loop unrolled.
+ */
+
+#include "qemu/osdep.h"
+#include "armv7m-image.h"
+
+#define RESULT_ADDR NETDUINO_SRAM_BASE
+#define ITERATIONS 100000
+#define REAL_TIME_LIMIT_US (20 * G_USEC_PER_SEC)
+
+static const uint8_t loop_code[] = {
+    /* reset: */
+    0x40, 0xf2, 0x00, 0x02,     /* movw  r2, #0 */
+    0xc2, 0xf2, 0x00, 0x02,     /* movt  r2, #0x2000 */
+    0x00, 0x20,                 /* movs  r0, #0 (i) */
+    0x00, 0x21,                 /* movs  r1, #0 (sum) */
+    0x48, 0xf2, 0xa0, 0x63,     /* movw  r3, #0x86a0 (100000) */
+    0xc0, 0xf2, 0x01, 0x03,     /* movt  r3, #1 */
+    /* loop: */
+    0x10, 0xf0, 0x01, 0x0f,     /* tst   r0, #1 */
+    0x01, 0xd0,                 /* beq   even */
+    0x09, 0x18,                 /* adds  r1, r1, r0 */
+    0x00, 0xe0,                 /* b     next */
+    /* even: */
+    0x41, 0x40,                 /* eors  r1, r1, r0 */
+    /* next: */
+    0x01, 0x30,                 /* adds  r0, #1 */
+    0x98, 0x42,                 /* cmp   r0, r3 */
+    0xf6, 0xd1,                 /* bne   loop */
+    0x51, 0x60,                 /* str   r1, [r2, #4] */
+    0x01, 0x20,                 /* movs  r0, #1 */
+    0x10, 0x60,                 /* str   r0, [r2] */
+    /* halt: */
+    0xfe, 0xe7,                 /* b     halt */
+};
+
+static uint32_t expected_sum(void)
+{
+    uint32_t i, sum = 0;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        if (i & 1) {
+            sum += i;
+        } else {
+            sum ^= i;
+        }
+    }
+    return sum;
+}
+
+static void test_hot_loop(void)
+{
+    QTestState *qts;
+    int64_t start;
+    uint32_t done;
+    unsigned superblocks, loops, hot;
+    g_autofree char *jit = NULL;
+    const char *line;
+    ARMv7MImage img;
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+
+    armv7m_image_init_netduino(&img, loop_code, sizeof(loop_code));
+    qts = armv7m_image_boot(&img, "-M netduinoplus2 "
+                            "-accel tcg,superblock-threshold=16");
+    armv7m_image_free(&img);
+
+    start = g_get_monotonic_time();
+    do {
+        g_usleep(10 * 1000);
+        done = qtest_readl(qts, RESULT_ADDR);
+    } while (!done && g_get_monotonic_time() - start < REAL_TIME_LIMIT_US);
+    g_assert_cmpuint(done, ==, 1);
+    g_assert_cmphex(qtest_readl(qts, RESULT_ADDR + 4), ==, expected_sum());
+
+    jit = qtest_hmp(qts, "info jit");
+    line = strstr(jit, "superblock count");
+    g_assert_nonnull(line);
+    g_assert_cmpint(sscanf(line, "superblock count %u (%u with loops "
+                           "unrolled, %u hot TBs)", &superblocks, &loops,
+                           &hot), ==, 3);
+    g_test_message("%u superblocks, %u with loops unrolled, %u hot TBs",
+                   superblocks, loops, hot);
+    g_assert_cmpuint(hot, >=, 1);
+    g_assert_cmpuint(superblocks, >=, 1);
+    g_assert_cmpuint(loops, >=, 1);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/armv7m/superblock/hot-loop", test_hot_loop);
+    return g_test_run();
+}
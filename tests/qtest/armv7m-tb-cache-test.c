@@ -0,0 +1,180 @@
+/*
+ * QTest for the persistent TCG translation cache
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A tiny guest on netduinoplus2 runs a loop calling a helper (udiv) and
+ * going through the memory access slow path, then stores its result in
+ * SRAM.  It is run several times with the same tb-cache file, each run
+ * being a new QEMU process, so with a PIE build the QEMU binary and the
+ * code buffer are at other addresses: the host addresses in the saved
+ * code must be moved for the translations to be reused, as "info jit"
+ * reports.  Running a guest whose code page differs from the saved one
+ * must not reuse them, but they remain in the file for the next run of
+ * the original guest.
+ */
+
+#include "qemu/osdep.h"
+#include "armv7m-image.h"
+
+#define RESULT_ADDR NETDUINO_SRAM_BASE
+#define ITERATIONS 10000
+#define DIVISOR_OFFSET 12
+#define REAL_TIME_LIMIT_US (20 * G_USEC_PER_SEC)
+
+/*
+ * The host addresses are only moved by the x86-64 backend; elsewhere the
+ * translations are reused only if QEMU is loaded at the same address.
+ */
+#ifdef __x86_64__
+#define HOST_RELOCS true
+#else
+#define HOST_RELOCS false
+#endif
+
+static const uint8_t div_code[] = {
+    /* reset: */
+    0x40, 0xf2, 0x00, 0x02,     /* movw  r2, #0 */
+    0xc2, 0xf2, 0x00, 0x02,     /* movt  r2, #0x2000 */
+    0x00, 0x20,                 /* movs  r0, #0 (i) */
+    0x00, 0x21,                 /* movs  r1, #0 (sum) */
+    0x03, 0x24,                 /* movs  r4, #3 (divisor, patched) */
+    0x42, 0xf2, 0x10, 0x73,     /* movw  r3, #10000 */
+    /* loop: */
+    0xb0, 0xfb, 0xf4, 0xf5,     /* udiv  r5, r0, r4 */
+    0x49, 0x19,                 /* adds  r1, r1, r5 */
+    0x91, 0x60,                 /* str   r1, [r2, #8] */
+    0x91, 0x68,                 /* ldr   r1, [r2, #8] */
+    0x01, 0x30,                 /* adds  r0, #1 */
+    0x98, 0x42,                 /* cmp   r0, r3 */
+    0xf7, 0xd1,                 /* bne   loop */
+    0x51, 0x60,                 /* str   r1, [r2, #4] */
+    0x01, 0x20,                 /* movs  r0, #1 */
+    0x10, 0x60,                 /* str   r0, [r2] */
+    /* halt: */
+    0xfe, 0xe7,                 /* b     halt */
+};
+
+static uint32_t expected_sum(uint8_t divisor)
+{
+    uint32_t i, sum = 0;
+
+    for (i = 0; i < ITERATIONS; i++) {
+        sum += i / divisor;
+    }
+    return sum;
+}
+
+/*
+ * Run the guest dividing by @divisor with the translation cache @path,
+ * check its result, and return the TBs adopted from the cache.
+ */
+static unsigned run_guest(const char *path, uint8_t divisor)
+{
+    uint8_t code[sizeof(div_code)];
+    QTestState *qts;
+    int64_t start;
+    uint32_t done;
+    unsigned adopted, loaded;
+    g_autofree char *jit = NULL;
+    const char *line;
+    ARMv7MImage img;
+
+    memcpy(code, div_code, sizeof(code));
+    code[DIVISOR_OFFSET] = divisor;
+    armv7m_image_init_netduino(&img, code, sizeof(code));
+    qts = armv7m_image_boot(&img, "-M netduinoplus2 -accel tcg,tb-cache=%s",
+                            path);
+    armv7m_image_free(&img);
+
+    start = g_get_monotonic_time();
+    do {
+        g_usleep(10 * 1000);
+        done = qtest_readl(qts, RESULT_ADDR);
+    } while (!done && g_get_monotonic_time() - start < REAL_TIME_LIMIT_US);
+    g_assert_cmpuint(done, ==, 1);
+    g_assert_cmpuint(qtest_readl(qts, RESULT_ADDR + 4), ==,
+                     expected_sum(divisor));
+
+    jit = qtest_hmp(qts, "info jit");
+    line = strstr(jit, "TB cache adopted");
+    g_assert_nonnull(line);
+    g_assert_cmpint(sscanf(line, "TB cache adopted %u (of %u loaded)",
+                           &adopted, &loaded), ==, 2);
+    g_test_message("divisor %u: %u TBs adopted of %u loaded",
+                   divisor, adopted, loaded);
+    g_assert_cmpuint(adopted, <=, loaded);
+
+    /* Saves the translations */
+    qtest_quit(qts);
+    g_assert_true(g_file_test(path, G_FILE_TEST_IS_REGULAR));
+    return adopted;
+}
+
+static char *tb_cache_path(char **dir)
+{
+    *dir = g_dir_make_tmp("qemu-tb-cache-XXXXXX", NULL);
+    g_assert_nonnull(*dir);
+    return g_build_filename(*dir, "tbs", NULL);
+}
+
+static void tb_cache_cleanup(char *dir, char *path)
+{
+    unlink(path);
+    rmdir(dir);
+    g_free(path);
+    g_free(dir);
+}
+
+static void test_reuse(void)
+{
+    char *dir, *path;
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+
+    path = tb_cache_path(&dir);
+    g_assert_cmpuint(run_guest(path, 3), ==, 0);
+    if (HOST_RELOCS) {
+        g_assert_cmpuint(run_guest(path, 3), >, 0);
+    } else {
+        run_guest(path, 3);
+    }
+    tb_cache_cleanup(dir, path);
+}
+
+static void test_modified_page(void)
+{
+    char *dir, *path;
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+
+    path = tb_cache_path(&dir);
+    run_guest(path, 3);
+    /* All the code is in one page, which differs */
+    g_assert_cmpuint(run_guest(path, 5), ==, 0);
+    /* The translations of the first guest were kept */
+    if (HOST_RELOCS) {
+        g_assert_cmpuint(run_guest(path, 3), >, 0);
+    } else {
+        run_guest(path, 3);
+    }
+    tb_cache_cleanup(dir, path);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/armv7m/tb-cache/reuse", test_reuse);
+    qtest_add_func("/armv7m/tb-cache/modified-page", test_modified_page);
+    return g_test_run();
+}
@@ -0,0 +1,166 @@
+/*
+ * QTest for TB eviction
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A guest on netduinoplus2 runs a chain of BLOCKS small blocks several
+ * times, each its own TB: "adds r1, #imm" and a call to a common
+ * subroutine, which returns to the next block.  The chain needs a few
+ * MiB of host code, so with a 1 MiB code buffer and tb-eviction=on the
+ * oldest code regions are evicted over and over.  The calls are chained
+ * into the subroutine TB from blocks in newer regions, so those jumps
+ * must be unlinked when its region goes; a stale one would run whatever
+ * was translated there since and break the sum.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "armv7m-image.h"
+
+#define RESULT_ADDR NETDUINO_SRAM_BASE
+#define BLOCKS 8192
+#define BLOCK_SIZE 6
+#define PASSES 8
+/* in tail_code */
+#define SUB_OFFSET 14
+#define REAL_TIME_LIMIT_US (60 * G_USEC_PER_SEC)
+
+static const uint8_t head_code[] = {
+    /* reset: */
+    0x40, 0xf2, 0x00, 0x02,     /* movw  r2, #0 */
+    0xc2, 0xf2, 0x00, 0x02,     /* movt  r2, #0x2000 */
+    0x08, 0x20,                 /* movs  r0, #8 (passes) */
+    0x00, 0x21,                 /* movs  r1, #0 */
+    0x40, 0xf2, 0x15, 0x23,     /* movw  r3, #0x0215 (first block, Thumb) */
+    0xc0, 0xf6, 0x00, 0x03,     /* movt  r3, #0x0800 */
+};
+
+static const uint8_t tail_code[] = {
+    /* tail: */
+    0x01, 0x38,                 /* subs  r0, #1 */
+    0x00, 0xd0,                 /* beq   done */
+    0x18, 0x47,                 /* bx    r3 */
+    /* done: */
+    0x51, 0x60,                 /* str   r1, [r2, #4] */
+    0x01, 0x20,                 /* movs  r0, #1 */
+    0x10, 0x60,                 /* str   r0, [r2] */
+    /* halt: */
+    0xfe, 0xe7,                 /* b     halt */
+    /* sub: */
+    0x01, 0x31,                 /* adds  r1, #1 */
+    0x70, 0x47,                 /* bx    lr */
+};
+
+static uint8_t block_imm(unsigned i)
+{
+    return i * 7 + 1;
+}
+
+/* Thumb BL from @from to @to */
+static void put_bl(uint8_t *p, uint32_t from, uint32_t to)
+{
+    int32_t off = to - (from + 4);
+    uint32_t s = (off >> 24) & 1;
+    uint32_t j1 = !((off >> 23) & 1) ^ s;
+    uint32_t j2 = !((off >> 22) & 1) ^ s;
+
+    stw_le_p(p, 0xf000 | (s << 10) | ((off >> 12) & 0x3ff));
+    stw_le_p(p + 2, 0xd000 | (j1 << 13) | (j2 << 11) | ((off >> 1) & 0x7ff));
+}
+
+static uint8_t *build_code(size_t *size)
+{
+    size_t blocks = sizeof(head_code);
+    size_t tail = blocks + BLOCKS * BLOCK_SIZE;
+    uint32_t base = NETDUINO_FLASH_BASE + ARMV7M_IMAGE_CODE_OFFSET;
+    uint8_t *code;
+    unsigned i;
+
+    /* head_code starts the chain at 0x08000215 */
+    QEMU_BUILD_BUG_ON(NETDUINO_FLASH_BASE + ARMV7M_IMAGE_CODE_OFFSET +
+                      sizeof(head_code) != 0x08000214);
+
+    *size = tail + sizeof(tail_code);
+    code = g_malloc(*size);
+    memcpy(code, head_code, sizeof(head_code));
+    for (i = 0; i < BLOCKS; i++) {
+        uint8_t *p = &code[blocks + i * BLOCK_SIZE];
+
+        /* adds r1, #imm */
+        stw_le_p(p, 0x3100 | block_imm(i));
+        put_bl(p + 2, base + (p + 2 - code), base + tail + SUB_OFFSET);
+    }
+    memcpy(&code[tail], tail_code, sizeof(tail_code));
+    return code;
+}
+
+static uint32_t expected_sum(void)
+{
+    uint32_t sum = 0;
+    unsigned i;
+
+    for (i = 0; i < BLOCKS; i++) {
+        sum += block_imm(i) + 1;
+    }
+    return sum * PASSES;
+}
+
+static void test_eviction(void)
+{
+    QTestState *qts;
+    int64_t start;
+    uint32_t done;
+    unsigned flushes, evictions, tbs, unlinked;
+    g_autofree char *jit = NULL;
+    g_autofree uint8_t *code = NULL;
+    const char *line;
+    ARMv7MImage img;
+    size_t size;
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+
+    code = build_code(&size);
+    armv7m_image_init_netduino(&img, code, size);
+    qts = armv7m_image_boot(&img, "-M netduinoplus2 "
+                            "-accel tcg,tb-size=1,tb-eviction=on");
+    armv7m_image_free(&img);
+
+    start = g_get_monotonic_time();
+    do {
+        g_usleep(10 * 1000);
+        done = qtest_readl(qts, RESULT_ADDR);
+    } while (!done && g_get_monotonic_time() - start < REAL_TIME_LIMIT_US);
+    g_assert_cmpuint(done, ==, 1);
+    g_assert_cmphex(qtest_readl(qts, RESULT_ADDR + 4), ==, expected_sum());
+
+    jit = qtest_hmp(qts, "info jit");
+    line = strstr(jit, "TB flush count");
+    g_assert_nonnull(line);
+    g_assert_cmpint(sscanf(line, "TB flush count %u", &flushes), ==, 1);
+    line = strstr(jit, "TB eviction count");
+    g_assert_nonnull(line);
+    g_assert_cmpint(sscanf(line, "TB eviction count %u (%u TBs, %u jumps "
+                           "unlinked)", &evictions, &tbs, &unlinked), ==, 3);
+    g_test_message("%u evictions of %u TBs, %u jumps unlinked",
+                   evictions, tbs, unlinked);
+    g_assert_cmpuint(flushes, ==, 0);
+    g_assert_cmpuint(evictions, >, 0);
+    g_assert_cmpuint(tbs, >, 0);
+    g_assert_cmpuint(unlinked, >, 0);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/armv7m/tb-eviction", test_eviction);
+    return g_test_run();
+}
@@ -0,0 +1,97 @@
+/*
+ * QTest for translate-ahead with self-modifying code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A guest on netduinoplus2 writes to SRAM a function f which branches to
+ * a function g on the same page, so that translating f queues g for the
+ * translate-ahead threads.  It then rewrites g as "movs r0, #i; bx lr"
+ * for i = 0 .. ITERATIONS - 1, calls f each time and counts the calls
+ * not returning i, i.e. running a stale translation of g.
+ */
+
+#include "qemu/osdep.h"
+#include "armv7m-image.h"
+
+#define RESULT_ADDR NETDUINO_SRAM_BASE
+#define ITERATIONS 0x4000
+#define REAL_TIME_LIMIT_US (60 * G_USEC_PER_SEC)
+
+static const uint8_t smc_code[] = {
+    /* reset: */
+    0x40, 0xf2, 0x00, 0x02,     /* movw  r2, #0 */
+    0xc2, 0xf2, 0x00, 0x02,     /* movt  r2, #0x2000 */
+    0x40, 0xf2, 0x00, 0x14,     /* movw  r4, #0x0100 (f, in SRAM) */
+    0xc2, 0xf2, 0x00, 0x04,     /* movt  r4, #0x2000 */
+    0x4e, 0xf2, 0x1e, 0x00,     /* movw  r0, #0xe01e (f: b g; nop) */
+    0xcb, 0xf6, 0x00, 0x70,     /* movt  r0, #0xbf00 */
+    0x20, 0x60,                 /* str   r0, [r4] */
+    0x00, 0x25,                 /* movs  r5, #0 (iteration) */
+    0x00, 0x26,                 /* movs  r6, #0 (stale results) */
+    0x42, 0xf2, 0x00, 0x07,     /* movw  r7, #0x2000 (g: movs r0, #0; bx lr) */
+    0xc4, 0xf2, 0x70, 0x77,     /* movt  r7, #0x4770 */
+    /* loop: */
+    0xe9, 0xb2,                 /* uxtb  r1, r5 */
+    0x47, 0xea, 0x01, 0x00,     /* orr   r0, r7, r1 */
+    0x20, 0x64,                 /* str   r0, [r4, #0x40] (g: movs r0, #i) */
+    0xbf, 0xf3, 0x4f, 0x8f,     /* dsb */
+    0xbf, 0xf3, 0x6f, 0x8f,     /* isb */
+    0x63, 0x1c,                 /* adds  r3, r4, #1 */
+    0x98, 0x47,                 /* blx   r3 */
+    0x88, 0x42,                 /* cmp   r0, r1 */
+    0x18, 0xbf,                 /* it    ne */
+    0x01, 0x36,                 /* addne r6, #1 */
+    0x01, 0x35,                 /* adds  r5, #1 */
+    0xb5, 0xf5, 0x80, 0x4f,     /* cmp.w r5, #0x4000 */
+    0xee, 0xd1,                 /* bne   loop */
+    0x56, 0x60,                 /* str   r6, [r2, #4] */
+    0x01, 0x20,                 /* movs  r0, #1 */
+    0x10, 0x60,                 /* str   r0, [r2] */
+    /* halt: */
+    0xfe, 0xe7,                 /* b     halt */
+};
+
+static void run_smc(unsigned threads)
+{
+    QTestState *qts;
+    int64_t start;
+    uint32_t done;
+    ARMv7MImage img;
+
+    armv7m_image_init_netduino(&img, smc_code, sizeof(smc_code));
+    qts = armv7m_image_boot(&img, "-M netduinoplus2 "
+                            "-accel tcg,translate-ahead=%u", threads);
+    armv7m_image_free(&img);
+
+    start = g_get_monotonic_time();
+    do {
+        g_usleep(10 * 1000);
+        done = qtest_readl(qts, RESULT_ADDR);
+    } while (!done && g_get_monotonic_time() - start < REAL_TIME_LIMIT_US);
+    g_assert_cmpuint(done, ==, 1);
+    g_assert_cmpuint(qtest_readl(qts, RESULT_ADDR + 4), ==, 0);
+
+    qtest_quit(qts);
+}
+
+static void test_smc(void)
+{
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+
+    run_smc(1);
+    run_smc(4);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/armv7m/translate-ahead/self-modifying", test_smc);
+    return g_test_run();
+}
@@ -0,0 +1,80 @@
+/*
+ * QTest for the profile of the accesses to unimplemented devices on ARMv7M
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A tiny guest on netduinoplus2 (STM32F405) keeps reading the DAC, which
+ * is an unimplemented device, counting the loops in SRAM.  The code runs
+ * from the flash, with CF_PCREL TBs as on any Arm board, which only
+ * record the offset of each instruction in its page: "info unimp" must
+ * still show the full address of the load.
+ */
+
+#include "qemu/osdep.h"
+#include "armv7m-image.h"
+
+#define COUNTER_ADDR NETDUINO_SRAM_BASE
+#define LOAD_OFFSET 16
+
+static const uint8_t poll_code[] = {
+    /* reset: */
+    0x40, 0xf2, 0x00, 0x02,     /* movw  r2, #0 */
+    0xc2, 0xf2, 0x00, 0x02,     /* movt  r2, #0x2000 */
+    0x47, 0xf2, 0x00, 0x41,     /* movw  r1, #0x7400 */
+    0xc4, 0xf2, 0x00, 0x01,     /* movt  r1, #0x4000 */
+    /* loop: */
+    0x08, 0x68,                 /* ldr   r0, [r1] (DAC) */
+    0x13, 0x68,                 /* ldr   r3, [r2] */
+    0x01, 0x33,                 /* adds  r3, #1 */
+    0x13, 0x60,                 /* str   r3, [r2] */
+    0xfa, 0xe7,                 /* b     loop */
+};
+
+static void test_unimp_pc(void)
+{
+    QTestState *qts;
+    const char *line;
+    unsigned long reads, first_pc, last_pc;
+    uint32_t load_pc;
+    ARMv7MImage img;
+    char *info;
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+
+    armv7m_image_init_netduino(&img, poll_code, sizeof(poll_code));
+    load_pc = armv7m_image_addr(&img, LOAD_OFFSET);
+    qts = armv7m_image_boot(&img, "-M netduinoplus2 -accel tcg");
+    armv7m_image_free(&img);
+
+    while (qtest_readl(qts, COUNTER_ADDR) < 1000) {
+        g_usleep(10 * 1000);
+    }
+
+    info = qtest_hmp(qts, "info unimp");
+    line = strstr(info, "DAC @0x40007400:");
+    g_assert_nonnull(line);
+    g_test_message("%s", line);
+    g_assert_cmpint(sscanf(line, "DAC @0x40007400: %lu reads, 0 writes, "
+                           "first pc 0x%lx, last pc 0x%lx",
+                           &reads, &first_pc, &last_pc), ==, 3);
+    g_assert_cmpuint(reads, >=, 1000);
+    g_assert_cmphex(first_pc, ==, load_pc);
+    g_assert_cmphex(last_pc, ==, load_pc);
+
+    g_free(info);
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/armv7m/unimp/pc", test_unimp_pc);
+    return g_test_run();
+}
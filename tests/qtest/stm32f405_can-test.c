@@ -0,0 +1,287 @@
+/*
+ * QTest testcase for the STM32F4xx bxCAN controller
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define CAN1 0x40006400
+#define CAN2 0x40006800
+
+#define MCR   0x00
+#define MSR   0x04
+#define TSR   0x08
+#define RF0R  0x0C
+#define RF1R  0x10
+#define IER   0x14
+#define BTR   0x1C
+#define TIR(n)  (0x180 + 0x10 * (n))
+#define TDTR(n) (0x184 + 0x10 * (n))
+#define TDLR(n) (0x188 + 0x10 * (n))
+#define TDHR(n) (0x18C + 0x10 * (n))
+#define RIR(f)  (0x1B0 + 0x10 * (f))
+#define RDTR(f) (0x1B4 + 0x10 * (f))
+#define RDLR(f) (0x1B8 + 0x10 * (f))
+#define RDHR(f) (0x1BC + 0x10 * (f))
+#define FMR   0x200
+#define FM1R  0x204
+#define FS1R  0x20C
+#define FFA1R 0x214
+#define FA1R  0x21C
+#define FR1(b) (0x240 + 8 * (b))
+#define FR2(b) (0x244 + 8 * (b))
+
+#define MCR_INRQ (1 << 0)
+#define MCR_RFLM (1 << 3)
+#define MSR_INAK (1 << 0)
+#define MSR_SLAK (1 << 1)
+#define TSR_RQCP0 (1 << 0)
+#define TSR_TXOK0 (1 << 1)
+#define TSR_TME0 (1 << 26)
+#define RFR_FMP(v) ((v) & 3)
+#define RFR_FULL (1 << 3)
+#define RFR_FOVR (1 << 4)
+#define RFR_RFOM (1 << 5)
+#define IER_FMPIE0 (1 << 1)
+#define BTR_LBKM (1u << 30)
+#define BTR_SILM (1u << 31)
+#define TIR_TXRQ (1 << 0)
+#define TIR_RTR (1 << 1)
+#define TIR_IDE (1 << 2)
+#define FMR_FINIT (1 << 0)
+#define FMR_CAN2SB(n) ((n) << 8)
+
+/* 16 MHz APB1 out of reset: BRP 15 gives 1 us quanta, 1 + 7 + 2 per bit */
+#define BTR_100KBPS ((1 << 20) | (6 << 16) | 15)
+
+#define STD(id) ((uint32_t)(id) << 21)
+#define EXT(id) ((uint32_t)(id) << 3 | TIR_IDE)
+#define STD16(id) ((uint32_t)(id) << 5)
+
+#define NVIC_ISPR0 0xE000E200
+#define CAN1_RX0_IRQ 20
+
+#define MS 1000000
+
+static QTestState *can_init(void)
+{
+    QTestState *qts = qtest_init("-machine netduinoplus2 "
+                                 "-object can-bus,id=canbus0 "
+                                 "-global stm32f405-soc.canbus0=canbus0 "
+                                 "-global stm32f405-soc.canbus1=canbus0");
+
+    g_assert_cmphex(qtest_readl(qts, CAN1 + MSR) & MSR_SLAK, ==, MSR_SLAK);
+    return qts;
+}
+
+static void can_start(QTestState *qts, uint32_t can, uint32_t btr)
+{
+    qtest_writel(qts, can + MCR, MCR_INRQ);
+    g_assert_cmphex(qtest_readl(qts, can + MSR) & (MSR_INAK | MSR_SLAK), ==,
+                    MSR_INAK);
+    qtest_writel(qts, can + BTR, btr);
+    qtest_writel(qts, can + MCR, 0);
+    g_assert_cmphex(qtest_readl(qts, can + MSR) & (MSR_INAK | MSR_SLAK), ==,
+                    0);
+}
+
+/* A 32-bit mask filter accepting everything, in bank @bank */
+static void can_accept_all(QTestState *qts, unsigned bank, unsigned fifo)
+{
+    qtest_writel(qts, CAN1 + FMR, FMR_FINIT | FMR_CAN2SB(14));
+    qtest_writel(qts, CAN1 + FS1R, qtest_readl(qts, CAN1 + FS1R) | 1 << bank);
+    qtest_writel(qts, CAN1 + FFA1R,
+                 (qtest_readl(qts, CAN1 + FFA1R) & ~(1 << bank)) |
+                 fifo << bank);
+    qtest_writel(qts, CAN1 + FR1(bank), 0);
+    qtest_writel(qts, CAN1 + FR2(bank), 0);
+    qtest_writel(qts, CAN1 + FA1R, qtest_readl(qts, CAN1 + FA1R) | 1 << bank);
+    qtest_writel(qts, CAN1 + FMR, FMR_CAN2SB(14));
+}
+
+static void can_send(QTestState *qts, uint32_t can, uint32_t id,
+                     uint8_t dlc, uint32_t lo, uint32_t hi)
+{
+    qtest_writel(qts, can + TDTR(0), dlc);
+    qtest_writel(qts, can + TDLR(0), lo);
+    qtest_writel(qts, can + TDHR(0), hi);
+    qtest_writel(qts, can + TIR(0), id | TIR_TXRQ);
+    g_assert_cmphex(qtest_readl(qts, can + TSR) &
+                    (TSR_RQCP0 | TSR_TXOK0 | TSR_TME0), ==,
+                    TSR_RQCP0 | TSR_TXOK0 | TSR_TME0);
+    qtest_writel(qts, can + TSR, TSR_RQCP0);
+}
+
+/* Check the message at the output of FIFO @f, then release it */
+static void can_expect(QTestState *qts, uint32_t can, unsigned f,
+                       uint32_t id, uint8_t fmi, uint8_t dlc,
+                       uint32_t lo, uint32_t hi)
+{
+    g_assert_cmpuint(RFR_FMP(qtest_readl(qts, can + RF0R + 4 * f)), >, 0);
+    g_assert_cmphex(qtest_readl(qts, can + RIR(f)), ==, id);
+    g_assert_cmphex(qtest_readl(qts, can + RDTR(f)) & 0xFFFF, ==,
+                    fmi << 8 | dlc);
+    g_assert_cmphex(qtest_readl(qts, can + RDLR(f)), ==, lo);
+    g_assert_cmphex(qtest_readl(qts, can + RDHR(f)), ==, hi);
+    qtest_writel(qts, can + RF0R + 4 * f, RFR_RFOM);
+}
+
+static void test_bus(void)
+{
+    QTestState *qts = can_init();
+
+    can_start(qts, CAN1, BTR_100KBPS);
+    can_start(qts, CAN2, BTR_100KBPS);
+    can_accept_all(qts, 0, 0);
+    can_accept_all(qts, 14, 1);
+
+    can_send(qts, CAN1, STD(0x123), 8, 0x44332211, 0x88776655);
+    can_expect(qts, CAN2, 1, STD(0x123), 0, 8, 0x44332211, 0x88776655);
+    g_assert_cmpuint(qtest_readl(qts, CAN2 + RF1R), ==, 0);
+    /* A controller does not receive its own frames */
+    g_assert_cmpuint(qtest_readl(qts, CAN1 + RF0R), ==, 0);
+
+    can_send(qts, CAN2, EXT(0x1ABCDEF) | TIR_RTR, 0, 0, 0);
+    can_expect(qts, CAN1, 0, EXT(0x1ABCDEF) | TIR_RTR, 0, 0, 0, 0);
+
+    /* Nothing is received in initialization mode */
+    qtest_writel(qts, CAN2 + MCR, MCR_INRQ);
+    can_send(qts, CAN1, STD(0x123), 0, 0, 0);
+    g_assert_cmpuint(qtest_readl(qts, CAN2 + RF1R), ==, 0);
+
+    qtest_quit(qts);
+}
+
+static void test_filters(void)
+{
+    QTestState *qts = can_init();
+
+    can_start(qts, CAN1, BTR_100KBPS);
+    can_start(qts, CAN2, BTR_100KBPS);
+
+    qtest_writel(qts, CAN1 + FMR, FMR_FINIT | FMR_CAN2SB(14));
+    /* Bank 0: 16-bit list of 0x100 to 0x103, FIFO 0, FMI 0 to 3 */
+    qtest_writel(qts, CAN1 + FR1(0), STD16(0x101) << 16 | STD16(0x100));
+    qtest_writel(qts, CAN1 + FR2(0), STD16(0x103) << 16 | STD16(0x102));
+    /* Bank 1: 32-bit list, FIFO 1, FMI 0 and 1 */
+    qtest_writel(qts, CAN1 + FR1(1), EXT(0x12345678));
+    qtest_writel(qts, CAN1 + FR2(1), STD(0x200));
+    /* Bank 2: 32-bit mask of 0x300 to 0x30F data frames, FIFO 0, FMI 4 */
+    qtest_writel(qts, CAN1 + FR1(2), STD(0x300));
+    qtest_writel(qts, CAN1 + FR2(2), STD(0x7F0) | TIR_IDE | TIR_RTR);
+    /* Bank 3: inactive 32-bit mask accepting everything, FIFO 0, FMI 5 */
+    qtest_writel(qts, CAN1 + FR1(3), 0);
+    qtest_writel(qts, CAN1 + FR2(3), 0);
+    /* Bank 4: 16-bit mask for 0x102, FIFO 0, FMI 6 */
+    qtest_writel(qts, CAN1 + FR1(4), 0xFFFF0000 | STD16(0x102));
+    qtest_writel(qts, CAN1 + FR2(4), 0xFFFF0000 | STD16(0x102));
+    qtest_writel(qts, CAN1 + FM1R, 0x3);
+    qtest_writel(qts, CAN1 + FS1R, 0xE);
+    qtest_writel(qts, CAN1 + FFA1R, 0x2);
+    qtest_writel(qts, CAN1 + FA1R, 0x17);
+    qtest_writel(qts, CAN1 + FMR, FMR_CAN2SB(14));
+
+    /* The 16-bit list has priority over the 16-bit mask */
+    can_send(qts, CAN2, STD(0x102), 1, 0xAA, 0);
+    can_expect(qts, CAN1, 0, STD(0x102), 2, 1, 0xAA, 0);
+    can_send(qts, CAN2, EXT(0x12345678), 2, 0xBBCC, 0);
+    can_expect(qts, CAN1, 1, EXT(0x12345678), 0, 2, 0xBBCC, 0);
+    can_send(qts, CAN2, STD(0x200), 0, 0, 0);
+    can_expect(qts, CAN1, 1, STD(0x200), 1, 0, 0, 0);
+    can_send(qts, CAN2, STD(0x30A), 0, 0, 0);
+    can_expect(qts, CAN1, 0, STD(0x30A), 4, 0, 0, 0);
+
+    /* Remote frames, other identifiers and inactive banks do not match */
+    can_send(qts, CAN2, STD(0x30A) | TIR_RTR, 0, 0, 0);
+    can_send(qts, CAN2, STD(0x400), 0, 0, 0);
+    can_send(qts, CAN2, EXT(0x100), 0, 0, 0);
+    g_assert_cmpuint(qtest_readl(qts, CAN1 + RF0R), ==, 0);
+    g_assert_cmpuint(qtest_readl(qts, CAN1 + RF1R), ==, 0);
+
+    /* Activating a bank takes effect without filter initialization */
+    qtest_writel(qts, CAN1 + FA1R, 0x1F);
+    can_send(qts, CAN2, STD(0x400), 0, 0, 0);
+    can_expect(qts, CAN1, 0, STD(0x400), 5, 0, 0, 0);
+
+    qtest_quit(qts);
+}
+
+static void test_fifo(void)
+{
+    QTestState *qts = can_init();
+    uint32_t t0, t1;
+    int i;
+
+    can_start(qts, CAN1, BTR_100KBPS);
+    can_start(qts, CAN2, BTR_100KBPS);
+    can_accept_all(qts, 0, 0);
+    qtest_writel(qts, CAN1 + IER, IER_FMPIE0);
+
+    for (i = 0; i < 3; i++) {
+        can_send(qts, CAN2, STD(0x10 + i), 0, 0, 0);
+        if (i == 0) {
+            g_assert_true(qtest_readl(qts, NVIC_ISPR0) &
+                          (1 << CAN1_RX0_IRQ));
+        }
+        qtest_clock_step(qts, MS);
+    }
+    g_assert_cmphex(qtest_readl(qts, CAN1 + RF0R), ==, RFR_FULL | 3);
+
+    /* The last message is overwritten, unless the FIFO is locked */
+    can_send(qts, CAN2, STD(0x20), 0, 0, 0);
+    g_assert_cmphex(qtest_readl(qts, CAN1 + RF0R), ==,
+                    RFR_FOVR | RFR_FULL | 3);
+    qtest_writel(qts, CAN1 + RF0R, RFR_FOVR | RFR_FULL);
+    qtest_writel(qts, CAN1 + MCR, MCR_RFLM);
+    can_send(qts, CAN2, STD(0x30), 0, 0, 0);
+    g_assert_cmphex(qtest_readl(qts, CAN1 + RF0R), ==, RFR_FOVR | 3);
+
+    /* 1 ms is 100 bit times */
+    t0 = qtest_readl(qts, CAN1 + RDTR(0)) >> 16;
+    can_expect(qts, CAN1, 0, STD(0x10), 0, 0, 0, 0);
+    t1 = qtest_readl(qts, CAN1 + RDTR(0)) >> 16;
+    can_expect(qts, CAN1, 0, STD(0x11), 0, 0, 0, 0);
+    g_assert_cmpuint((t1 - t0) & 0xFFFF, >=, 99);
+    g_assert_cmpuint((t1 - t0) & 0xFFFF, <=, 101);
+    can_expect(qts, CAN1, 0, STD(0x20), 0, 0, 0, 0);
+    g_assert_cmphex(qtest_readl(qts, CAN1 + RF0R), ==, RFR_FOVR);
+
+    qtest_quit(qts);
+}
+
+static void test_loopback(void)
+{
+    QTestState *qts = can_init();
+
+    can_start(qts, CAN1, BTR_100KBPS | BTR_LBKM | BTR_SILM);
+    can_start(qts, CAN2, BTR_100KBPS);
+    can_accept_all(qts, 0, 0);
+    can_accept_all(qts, 14, 0);
+
+    /* Silent loop back: the frame only comes back to CAN1 */
+    can_send(qts, CAN1, STD(0x7FF), 4, 0xDEADBEEF, 0);
+    can_expect(qts, CAN1, 0, STD(0x7FF), 0, 4, 0xDEADBEEF, 0);
+    g_assert_cmpuint(qtest_readl(qts, CAN2 + RF0R), ==, 0);
+
+    /* ... and in loop back mode, the RX pin is not sampled */
+    can_send(qts, CAN2, STD(0x7FE), 0, 0, 0);
+    g_assert_cmpuint(qtest_readl(qts, CAN1 + RF0R), ==, 0);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_set_nonfatal_assertions();
+
+    qtest_add_func("stm32f405/can/bus", test_bus);
+    qtest_add_func("stm32f405/can/filters", test_filters);
+    qtest_add_func("stm32f405/can/fifo", test_fifo);
+    qtest_add_func("stm32f405/can/loopback", test_loopback);
+
+    return g_test_run();
+}
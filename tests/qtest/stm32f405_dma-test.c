@@ -0,0 +1,199 @@
+/*
+ * QTest testcase for the DMA controllers of the STM32F405
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/socket.h>
+#include "libqtest.h"
+
+#define DMA1_BASE 0x40026000
+#define DMA2_BASE 0x40026400
+#define LISR 0x00
+#define HISR 0x04
+#define LIFCR 0x08
+#define SxCR(n) (0x10 + 0x18 * (n))
+#define SxNDTR(n) (0x14 + 0x18 * (n))
+#define SxPAR(n) (0x18 + 0x18 * (n))
+#define SxM0AR(n) (0x1C + 0x18 * (n))
+
+#define CR_EN (1 << 0)
+#define CR_HTIE (1 << 3)
+#define CR_TCIE (1 << 4)
+#define CR_P2M (0 << 6)
+#define CR_M2P (1 << 6)
+#define CR_M2M (2 << 6)
+#define CR_CIRC (1 << 8)
+#define CR_PINC (1 << 9)
+#define CR_MINC (1 << 10)
+#define CR_WORDS ((2 << 11) | (2 << 13))
+#define CR_CHSEL(n) ((n) << 25)
+
+/* Flags of streams 0 and 4, 1 and 5... in LISR or HISR */
+static const unsigned flag_shift[] = { 0, 6, 16, 22 };
+#define HTIF(n) (1 << (flag_shift[(n) % 4] + 4))
+#define TCIF(n) (1 << (flag_shift[(n) % 4] + 5))
+
+#define USART1_BASE 0x40011000
+#define USART_DR 0x04
+#define USART_CR1 0x0C
+#define USART_CR3 0x14
+#define USART_CR1_UE (1 << 13)
+#define USART_CR1_TE (1 << 3)
+#define USART_CR1_RE (1 << 2)
+#define USART_CR3_DMAT (1 << 7)
+#define USART_CR3_DMAR (1 << 6)
+
+#define SPI2_BASE 0x40003800
+#define SPI_CR1 0x00
+#define SPI_CR2 0x04
+#define SPI_DR 0x0C
+#define SPI_CR1_SPE (1 << 6)
+#define SPI_CR1_MSTR (1 << 2)
+#define SPI_CR2_TXDMAEN (1 << 1)
+#define SPI_CR2_RXDMAEN (1 << 0)
+
+#define NVIC_ISPR0 0xE000E200
+#define NVIC_ISPR1 0xE000E204
+
+#define SRC 0x20000000
+#define DST 0x20001000
+
+static void dma_start(QTestState *qts, uint32_t dma, int n, uint32_t par,
+                      uint32_t m0ar, uint32_t ndtr, uint32_t cr)
+{
+    qtest_writel(qts, dma + SxPAR(n), par);
+    qtest_writel(qts, dma + SxM0AR(n), m0ar);
+    qtest_writel(qts, dma + SxNDTR(n), ndtr);
+    qtest_writel(qts, dma + SxCR(n), cr | CR_EN);
+}
+
+static void test_m2m(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+    uint32_t cr = CR_M2M | CR_PINC | CR_MINC | CR_WORDS | CR_TCIE;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        qtest_writel(qts, SRC + i * 4, 0x11111111 * i);
+    }
+
+    /* DMA1 has no memory to memory transfers */
+    dma_start(qts, DMA1_BASE, 0, SRC, DST, 8, cr);
+    g_assert_cmphex(qtest_readl(qts, DMA1_BASE + SxCR(0)) & CR_EN, ==, 0);
+    g_assert_cmpuint(qtest_readl(qts, DMA1_BASE + SxNDTR(0)), ==, 8);
+    g_assert_cmphex(qtest_readl(qts, DST), ==, 0);
+
+    dma_start(qts, DMA2_BASE, 0, SRC, DST, 8, cr);
+    g_assert_cmphex(qtest_readl(qts, DMA2_BASE + SxCR(0)) & CR_EN, ==, 0);
+    g_assert_cmpuint(qtest_readl(qts, DMA2_BASE + SxNDTR(0)), ==, 0);
+    for (i = 0; i < 8; i++) {
+        g_assert_cmphex(qtest_readl(qts, DST + i * 4), ==, 0x11111111 * i);
+    }
+
+    /* Stream 0 of DMA2 interrupts on IRQ 56 */
+    g_assert_cmphex(qtest_readl(qts, DMA2_BASE + LISR), ==,
+                    TCIF(0) | HTIF(0));
+    g_assert_true(qtest_readl(qts, NVIC_ISPR1) & (1 << (56 - 32)));
+    qtest_writel(qts, DMA2_BASE + LIFCR, TCIF(0) | HTIF(0));
+    g_assert_cmphex(qtest_readl(qts, DMA2_BASE + LISR), ==, 0);
+
+    qtest_quit(qts);
+}
+
+static void test_usart(void)
+{
+    const char tx[] = "USART1 over DMA";
+    char buf[sizeof(tx)];
+    QTestState *qts;
+    int sock[2];
+    int i;
+
+    g_assert_cmpint(socketpair(PF_UNIX, SOCK_STREAM, 0, sock), ==, 0);
+    qts = qtest_initf("-M netduinoplus2 -chardev socket,id=usart1,fd=%d "
+                      "-serial chardev:usart1", sock[1]);
+
+    qtest_writel(qts, USART1_BASE + USART_CR1,
+                 USART_CR1_UE | USART_CR1_TE | USART_CR1_RE);
+    qtest_writel(qts, USART1_BASE + USART_CR3,
+                 USART_CR3_DMAT | USART_CR3_DMAR);
+
+    /* TX on stream 7, channel 4 of DMA2 */
+    qtest_memwrite(qts, SRC, tx, sizeof(tx));
+    dma_start(qts, DMA2_BASE, 7, USART1_BASE + USART_DR, SRC, sizeof(tx),
+              CR_CHSEL(4) | CR_M2P | CR_MINC);
+    g_assert_cmpuint(qtest_readl(qts, DMA2_BASE + SxNDTR(7)), ==, 0);
+    g_assert_cmphex(qtest_readl(qts, DMA2_BASE + HISR) & TCIF(7), ==,
+                    TCIF(7));
+    g_assert_cmpint(recv(sock[0], buf, sizeof(buf), MSG_WAITALL), ==,
+                    sizeof(buf));
+    g_assert_cmpstr(buf, ==, tx);
+
+    /* RX on stream 5, channel 4, as the bytes come in */
+    dma_start(qts, DMA2_BASE, 5, USART1_BASE + USART_DR, DST, sizeof(tx),
+              CR_CHSEL(4) | CR_P2M | CR_MINC);
+    g_assert_cmpint(send(sock[0], tx, sizeof(tx), 0), ==, sizeof(tx));
+    for (i = 0; i < 1000 && qtest_readl(qts, DMA2_BASE + SxNDTR(5)); i++) {
+        g_usleep(1000);
+    }
+    g_assert_cmpuint(qtest_readl(qts, DMA2_BASE + SxNDTR(5)), ==, 0);
+    qtest_memread(qts, DST, buf, sizeof(buf));
+    g_assert_cmpstr(buf, ==, tx);
+
+    qtest_quit(qts);
+    close(sock[0]);
+}
+
+static void test_spi(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+    int i;
+
+    /* Nothing on the bus: every byte clocked out brings a zero in */
+    for (i = 0; i < 8; i++) {
+        qtest_writeb(qts, SRC + i, i + 1);
+        qtest_writeb(qts, DST + i, 0xff);
+    }
+
+    /* RX on stream 3 in circular mode, TX on stream 4, both channel 0 */
+    dma_start(qts, DMA1_BASE, 3, SPI2_BASE + SPI_DR, DST, 4,
+              CR_P2M | CR_MINC | CR_CIRC | CR_HTIE | CR_TCIE);
+    dma_start(qts, DMA1_BASE, 4, SPI2_BASE + SPI_DR, SRC, 8,
+              CR_M2P | CR_MINC);
+    qtest_writel(qts, SPI2_BASE + SPI_CR1, SPI_CR1_SPE | SPI_CR1_MSTR);
+    qtest_writel(qts, SPI2_BASE + SPI_CR2,
+                 SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+
+    g_assert_cmpuint(qtest_readl(qts, DMA1_BASE + SxNDTR(4)), ==, 0);
+    g_assert_cmphex(qtest_readl(qts, DMA1_BASE + SxCR(4)) & CR_EN, ==, 0);
+
+    /* The frames come back once they are out, 1 us each at 16 MHz */
+    g_assert_cmpuint(qtest_readl(qts, DMA1_BASE + SxNDTR(3)), ==, 4);
+    g_assert_cmphex(qtest_readl(qts, DMA1_BASE + LISR), ==, 0);
+    qtest_clock_step(qts, 8000);
+
+    /* Two passes over the RX buffer, which is still enabled */
+    g_assert_cmpuint(qtest_readl(qts, DMA1_BASE + SxNDTR(3)), ==, 4);
+    g_assert_cmphex(qtest_readl(qts, DMA1_BASE + SxCR(3)) & CR_EN, ==, CR_EN);
+    g_assert_cmphex(qtest_readl(qts, DMA1_BASE + LISR) &
+                    (HTIF(3) | TCIF(3)), ==, HTIF(3) | TCIF(3));
+    g_assert_cmphex(qtest_readl(qts, DST), ==, 0);
+    g_assert_cmphex(qtest_readl(qts, DST + 4), ==, 0xffffffff);
+
+    /* Stream 3 of DMA1 interrupts on IRQ 14 */
+    g_assert_true(qtest_readl(qts, NVIC_ISPR0) & (1 << 14));
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/stm32f405/dma/m2m", test_m2m);
+    qtest_add_func("/stm32f405/dma/usart", test_usart);
+    qtest_add_func("/stm32f405/dma/spi", test_spi);
+    return g_test_run();
+}
@@ -0,0 +1,108 @@
+/*
+ * QTest for the icount fetch timing model of the STM32F405 SoC
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A tiny guest on netduinoplus2 sets FLASH_ACR.LATENCY, with the prefetch
+ * buffer and the ART off, and times a two instruction loop in flash with
+ * SysTick on the CPU clock.  The loop fits in one 128-bit fetch line, so
+ * each iteration costs 2 icount units with no wait states and 7 with
+ * LATENCY=5.
+ */
+
+#include "qemu/osdep.h"
+#include "armv7m-image.h"
+
+#define LATENCY_OFFSET 16
+#define RESULT_ADDR NETDUINO_SRAM_BASE
+#define SYSTICK_MASK 0xffffff
+#define REAL_TIME_LIMIT_US (20 * G_USEC_PER_SEC)
+
+static const uint8_t loop_code[] = {
+    /* reset: */
+    0x40, 0xf2, 0x00, 0x02,     /* movw  r2, #0 */
+    0xc2, 0xf2, 0x00, 0x02,     /* movt  r2, #0x2000 */
+    0x43, 0xf6, 0x00, 0x41,     /* movw  r1, #0x3c00 (FLASH_ACR) */
+    0xc4, 0xf2, 0x02, 0x01,     /* movt  r1, #0x4002 */
+    0x00, 0x20,                 /* movs  r0, #0 (LATENCY, patched) */
+    0x08, 0x60,                 /* str   r0, [r1] */
+    0x4e, 0xf2, 0x10, 0x01,     /* movw  r1, #0xe010 (SysTick) */
+    0xce, 0xf2, 0x00, 0x01,     /* movt  r1, #0xe000 */
+    0x4f, 0xf6, 0xff, 0x70,     /* movw  r0, #0xffff */
+    0xc0, 0xf2, 0xff, 0x00,     /* movt  r0, #0x00ff */
+    0x48, 0x60,                 /* str   r0, [r1, #4] (RVR) */
+    0x88, 0x60,                 /* str   r0, [r1, #8] (CVR) */
+    0x05, 0x20,                 /* movs  r0, #5 */
+    0x08, 0x60,                 /* str   r0, [r1] (CSR: ENABLE, CLKSOURCE) */
+    0x8b, 0x68,                 /* ldr   r3, [r1, #8] */
+    0x53, 0x60,                 /* str   r3, [r2, #4] */
+    0x42, 0xf2, 0x10, 0x70,     /* movw  r0, #10000 */
+    /* loop: */
+    0x01, 0x38,                 /* subs  r0, #1 */
+    0xfd, 0xd1,                 /* bne   loop */
+    0x8b, 0x68,                 /* ldr   r3, [r1, #8] */
+    0x93, 0x60,                 /* str   r3, [r2, #8] */
+    0x01, 0x20,                 /* movs  r0, #1 */
+    0x10, 0x60,                 /* str   r0, [r2] */
+    /* halt: */
+    0xfe, 0xe7,                 /* b     halt */
+};
+
+/* SysTick ticks taken by the timed loop */
+static uint32_t run_loop(unsigned latency)
+{
+    QTestState *qts;
+    int64_t start;
+    uint32_t done, ticks;
+    ARMv7MImage img;
+
+    armv7m_image_init_netduino(&img, loop_code, sizeof(loop_code));
+    img.data[ARMV7M_IMAGE_CODE_OFFSET + LATENCY_OFFSET] = latency;
+    qts = armv7m_image_boot(&img, "-M netduinoplus2 -accel tcg "
+                            "-icount shift=4 "
+                            "-global stm32f405-soc.cycle-timing=on");
+    armv7m_image_free(&img);
+
+    start = g_get_monotonic_time();
+    do {
+        g_usleep(10 * 1000);
+        done = qtest_readl(qts, RESULT_ADDR);
+    } while (!done && g_get_monotonic_time() - start < REAL_TIME_LIMIT_US);
+    g_assert_cmpuint(done, ==, 1);
+
+    /* SysTick counts down */
+    ticks = (qtest_readl(qts, RESULT_ADDR + 4) -
+             qtest_readl(qts, RESULT_ADDR + 8)) & SYSTICK_MASK;
+    g_test_message("LATENCY=%u: %u SysTick ticks", latency, ticks);
+
+    qtest_quit(qts);
+    return ticks;
+}
+
+static void test_latency(void)
+{
+    uint32_t fast, slow;
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+
+    fast = run_loop(0);
+    slow = run_loop(5);
+
+    g_assert_cmpuint(fast, >, 0);
+    g_assert_cmpuint(slow, >, fast * 3);
+    g_assert_cmpuint(slow, <, fast * 4);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/stm32f405/fetch-timing/latency", test_latency);
+    return g_test_run();
+}
@@ -0,0 +1,256 @@
+/*
+ * QTest testcase for the STM32F4xx flash interface
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qapi/qmp/qdict.h"
+#include "libqtest.h"
+
+#define FLASH_BASE 0x08000000
+#define FLASH_SIZE (1024 * 1024)
+#define SECTOR1 (FLASH_BASE + 0x4000)
+#define FLASH_IF_BASE 0x40023C00
+
+#define KEYR    (FLASH_IF_BASE + 0x04)
+#define OPTKEYR (FLASH_IF_BASE + 0x08)
+#define SR      (FLASH_IF_BASE + 0x0C)
+#define CR      (FLASH_IF_BASE + 0x10)
+#define OPTCR   (FLASH_IF_BASE + 0x14)
+
+#define SR_EOP (1 << 0)
+#define SR_WRPERR (1 << 4)
+#define SR_PGPERR (1 << 6)
+#define SR_BSY (1 << 16)
+#define CR_PG (1 << 0)
+#define CR_SER (1 << 1)
+#define CR_SNB(n) ((n) << 3)
+#define CR_PSIZE_X32 (2 << 8)
+#define CR_STRT (1 << 16)
+#define CR_EOPIE (1 << 24)
+#define CR_LOCK (1u << 31)
+#define OPTCR_OPTLOCK (1 << 0)
+#define OPTCR_OPTSTRT (1 << 1)
+#define OPTCR_NWRP(n) (1 << (16 + (n)))
+
+#define US 1000
+#define MS (1000 * US)
+
+static void flash_unlock(QTestState *qts)
+{
+    qtest_writel(qts, KEYR, 0x45670123);
+    qtest_writel(qts, KEYR, 0xCDEF89AB);
+    g_assert_cmpuint(qtest_readl(qts, CR) & CR_LOCK, ==, 0);
+}
+
+static void test_unlock(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+
+    g_assert_cmpuint(qtest_readl(qts, CR), ==, CR_LOCK);
+    g_assert_cmpuint(qtest_readl(qts, OPTCR), ==, 0x0FFFAAED);
+
+    /* CR is ignored while locked */
+    qtest_writel(qts, CR, CR_PG);
+    g_assert_cmpuint(qtest_readl(qts, CR), ==, CR_LOCK);
+
+    flash_unlock(qts);
+    qtest_writel(qts, CR, CR_LOCK);
+    g_assert_cmpuint(qtest_readl(qts, CR), ==, CR_LOCK);
+
+    /* A wrong key locks CR until reset */
+    qtest_writel(qts, KEYR, 0x12345678);
+    qtest_writel(qts, KEYR, 0x45670123);
+    qtest_writel(qts, KEYR, 0xCDEF89AB);
+    g_assert_cmpuint(qtest_readl(qts, CR), ==, CR_LOCK);
+
+    qtest_system_reset(qts);
+    flash_unlock(qts);
+
+    qtest_quit(qts);
+}
+
+static void test_program(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+
+    g_assert_cmpuint(qtest_readl(qts, SECTOR1), ==, 0xFFFFFFFF);
+
+    /* Flash is read only without PG */
+    qtest_writel(qts, SECTOR1, 0);
+    g_assert_cmpuint(qtest_readl(qts, SECTOR1), ==, 0xFFFFFFFF);
+
+    flash_unlock(qts);
+    qtest_writel(qts, CR, CR_PG | CR_PSIZE_X32 | CR_EOPIE);
+    qtest_writel(qts, SECTOR1, 0x12345678);
+    g_assert_cmpuint(qtest_readl(qts, SR), ==, SR_BSY);
+    qtest_clock_step(qts, 20 * US);
+    g_assert_cmpuint(qtest_readl(qts, SR), ==, SR_EOP);
+    qtest_writel(qts, SR, SR_EOP);
+
+    /* Programming only clears bits */
+    qtest_writel(qts, SECTOR1, 0xFFFF0000);
+    g_assert_cmpuint(qtest_readl(qts, SECTOR1), ==, 0x12340000);
+    g_assert_cmpuint(qtest_readl(qts, 0x4000), ==, 0x12340000);
+
+    /* The access size must match PSIZE */
+    qtest_writew(qts, SECTOR1 + 4, 0);
+    g_assert_cmpuint(qtest_readl(qts, SR) & SR_PGPERR, ==, SR_PGPERR);
+    g_assert_cmpuint(qtest_readl(qts, SECTOR1 + 4), ==, 0xFFFFFFFF);
+
+    qtest_quit(qts);
+}
+
+static void test_erase(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+
+    flash_unlock(qts);
+    qtest_writel(qts, CR, CR_PG | CR_PSIZE_X32);
+    qtest_writel(qts, SECTOR1, 0);
+    qtest_writel(qts, SECTOR1 + 0x3FFC, 0);
+    qtest_writel(qts, SECTOR1 + 0x4000, 0);
+
+    qtest_writel(qts, CR, CR_SER | CR_SNB(1) | CR_STRT);
+    g_assert_cmpuint(qtest_readl(qts, SR) & SR_BSY, ==, SR_BSY);
+    g_assert_cmpuint(qtest_readl(qts, SECTOR1), ==, 0xFFFFFFFF);
+    g_assert_cmpuint(qtest_readl(qts, SECTOR1 + 0x3FFC), ==, 0xFFFFFFFF);
+    /* Sector 2 is left alone */
+    g_assert_cmpuint(qtest_readl(qts, SECTOR1 + 0x4000), ==, 0);
+
+    qtest_clock_step(qts, 240 * MS);
+    g_assert_cmpuint(qtest_readl(qts, SR) & SR_BSY, ==, SR_BSY);
+    qtest_clock_step(qts, 20 * MS);
+    g_assert_cmpuint(qtest_readl(qts, SR) & SR_BSY, ==, 0);
+
+    qtest_quit(qts);
+}
+
+static void test_write_protection(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+    uint32_t optcr;
+
+    flash_unlock(qts);
+    qtest_writel(qts, OPTKEYR, 0x08192A3B);
+    qtest_writel(qts, OPTKEYR, 0x4C5D6E7F);
+    optcr = qtest_readl(qts, OPTCR);
+    g_assert_cmpuint(optcr & OPTCR_OPTLOCK, ==, 0);
+    qtest_writel(qts, OPTCR, (optcr & ~OPTCR_NWRP(1)) | OPTCR_OPTSTRT);
+    qtest_clock_step(qts, 300 * MS);
+
+    qtest_writel(qts, CR, CR_SER | CR_SNB(1) | CR_STRT);
+    g_assert_cmpuint(qtest_readl(qts, SR), ==, SR_WRPERR);
+    qtest_writel(qts, SR, SR_WRPERR);
+    qtest_writel(qts, CR, CR_PG | CR_PSIZE_X32);
+    qtest_writel(qts, SECTOR1, 0);
+    g_assert_cmpuint(qtest_readl(qts, SR), ==, SR_WRPERR);
+    g_assert_cmpuint(qtest_readl(qts, SECTOR1), ==, 0xFFFFFFFF);
+
+    /* The option bytes survive a reset */
+    qtest_system_reset(qts);
+    g_assert_cmpuint(qtest_readl(qts, OPTCR) & OPTCR_NWRP(1), ==, 0);
+
+    qtest_quit(qts);
+}
+
+static void test_memdev(void)
+{
+    char *path = g_strdup_printf("%s/stm32f405-flash-XXXXXX", g_get_tmp_dir());
+    uint32_t word = 0xFFFFFFFF;
+    QTestState *qts;
+    int fd, i;
+
+    /* A blank image, then the contents must reach the host file */
+    fd = g_mkstemp(path);
+    g_assert(fd >= 0);
+    for (i = 0; i < FLASH_SIZE / 4; i++) {
+        g_assert_cmpint(write(fd, &word, 4), ==, 4);
+    }
+
+    qts = qtest_initf("-M netduinoplus2 "
+                      "-object memory-backend-file,id=flash,size=1M,"
+                      "mem-path=%s,share=on "
+                      "-global stm32f4xx-flash.memdev=/objects/flash", path);
+    flash_unlock(qts);
+    qtest_writel(qts, CR, CR_PG | CR_PSIZE_X32);
+    qtest_writel(qts, SECTOR1, 0x12345678);
+    qtest_quit(qts);
+
+    g_assert_cmpint(pread(fd, &word, 4, SECTOR1 - FLASH_BASE), ==, 4);
+    g_assert_cmphex(le32_to_cpu(word), ==, 0x12345678);
+
+    /* ... and back into the flash on the next start */
+    qts = qtest_initf("-M netduinoplus2 "
+                      "-object memory-backend-file,id=flash,size=1M,"
+                      "mem-path=%s,share=on "
+                      "-global stm32f4xx-flash.memdev=/objects/flash", path);
+    g_assert_cmpuint(qtest_readl(qts, SECTOR1), ==, 0x12345678);
+    qtest_quit(qts);
+
+    close(fd);
+    unlink(path);
+    g_free(path);
+}
+
+/* The word at @addr as seen by the CPU of board @board */
+static uint32_t board_readl(QTestState *qts, int board, uint32_t addr)
+{
+    g_autofree char *cmd = g_strdup_printf("x /1wx 0x%" PRIx32, addr);
+    QDict *resp;
+    const char *out;
+    uint32_t val;
+
+    resp = qtest_qmp(qts, "{ 'execute': 'human-monitor-command',"
+                     " 'arguments': { 'command-line': %s, 'cpu-index': %d } }",
+                     cmd, board);
+    out = strchr(qdict_get_str(resp, "return"), ':');
+    g_assert_nonnull(out);
+    g_assert_cmpint(sscanf(out, ": 0x%" SCNx32, &val), ==, 1);
+    qobject_unref(resp);
+    return val;
+}
+
+static void test_farm(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2 -smp 3");
+    QDict *resp;
+
+    /* The boards after the first one use its flash */
+    resp = qtest_qmp(qts, "{ 'execute': 'qom-get', 'arguments': {"
+                     " 'path': '/machine/soc2/flash-if',"
+                     " 'property': 'shared' } }");
+    g_assert_cmpstr(qdict_get_str(resp, "return"), ==, "/machine/soc/flash-if");
+    qobject_unref(resp);
+
+    /* ... and the first board is programmed as on its own */
+    flash_unlock(qts);
+    qtest_writel(qts, CR, CR_PG | CR_PSIZE_X32);
+    qtest_writel(qts, SECTOR1, 0x12345678);
+    g_assert_cmpuint(qtest_readl(qts, SECTOR1), ==, 0x12345678);
+    g_assert_cmphex(board_readl(qts, 0, SECTOR1), ==, 0x12345678);
+
+    /* on a copy of the flash, the other boards still see it blank */
+    g_assert_cmphex(board_readl(qts, 1, SECTOR1), ==, 0xFFFFFFFF);
+    g_assert_cmphex(board_readl(qts, 2, SECTOR1), ==, 0xFFFFFFFF);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_set_nonfatal_assertions();
+
+    qtest_add_func("stm32f405/flash/unlock", test_unlock);
+    qtest_add_func("stm32f405/flash/program", test_program);
+    qtest_add_func("stm32f405/flash/erase", test_erase);
+    qtest_add_func("stm32f405/flash/write_protection", test_write_protection);
+    qtest_add_func("stm32f405/flash/memdev", test_memdev);
+    qtest_add_func("stm32f405/flash/farm", test_farm);
+
+    return g_test_run();
+}
@@ -0,0 +1,82 @@
+/*
+ * QTest testcase for the FSMC of the STM32F405
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/mman.h>
+#include "libqtest.h"
+
+#define FSMC_BCR(n) (0xA0000000 + 8 * (n))
+#define FSMC_BTR(n) (0xA0000004 + 8 * (n))
+#define FSMC_BWTR(n) (0xA0000104 + 8 * (n))
+
+#define BCR_MBKEN (1 << 0)
+#define BCR_WREN (1 << 12)
+
+/* Subbank 2, NE2 */
+#define SUBBANK2 0x64000000
+#define MEM_SIZE (1024 * 1024)
+
+static void test_reset(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+
+    g_assert_cmphex(qtest_readl(qts, FSMC_BCR(0)), ==, 0x000030DB);
+    g_assert_cmphex(qtest_readl(qts, FSMC_BCR(1)), ==, 0x000030D2);
+    g_assert_cmphex(qtest_readl(qts, FSMC_BTR(3)), ==, 0x0FFFFFFF);
+    g_assert_cmphex(qtest_readl(qts, FSMC_BWTR(3)), ==, 0x0FFFFFFF);
+
+    qtest_quit(qts);
+}
+
+static void test_memory(void)
+{
+    char *path = g_strdup_printf("%s/stm32f405-fsmc-XXXXXX", g_get_tmp_dir());
+    int fd = g_mkstemp(path);
+    QTestState *qts;
+    uint32_t *mem;
+
+    g_assert(fd >= 0);
+    g_assert_cmpint(ftruncate(fd, MEM_SIZE), ==, 0);
+    mem = mmap(NULL, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    g_assert(mem != MAP_FAILED);
+
+    qts = qtest_initf("-M netduinoplus2 -object memory-backend-file,id=sram,"
+                      "size=1M,mem-path=%s,share=on "
+                      "-global stm32f4xx-fsmc.subbank2-memdev=/objects/sram",
+                      path);
+
+    /* Nothing there until the subbank is enabled */
+    qtest_writel(qts, SUBBANK2 + 0x10, 0x12345678);
+    g_assert_cmphex(mem[4], ==, 0);
+
+    /* Then the guest and the host see the same memory */
+    qtest_writel(qts, FSMC_BCR(1), 0x000030D2 | BCR_MBKEN);
+    qtest_writel(qts, SUBBANK2 + 0x10, 0x12345678);
+    g_assert_cmphex(mem[4], ==, 0x12345678);
+    mem[5] = 0xCAFEF00D;
+    g_assert_cmphex(qtest_readl(qts, SUBBANK2 + 0x14), ==, 0xCAFEF00D);
+
+    /* Read-only without WREN */
+    qtest_writel(qts, FSMC_BCR(1), (0x000030D2 & ~BCR_WREN) | BCR_MBKEN);
+    qtest_writel(qts, SUBBANK2 + 0x10, 0);
+    g_assert_cmphex(qtest_readl(qts, SUBBANK2 + 0x10), ==, 0x12345678);
+
+    qtest_quit(qts);
+    munmap(mem, MEM_SIZE);
+    close(fd);
+    unlink(path);
+    g_free(path);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/stm32f405/fsmc/reset", test_reset);
+    qtest_add_func("/stm32f405/fsmc/memory", test_memory);
+    return g_test_run();
+}
@@ -0,0 +1,183 @@
+/*
+ * QTest testcase for the GPIO ports of the STM32F405
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/mman.h>
+#include "libqtest.h"
+#include "hw/gpio/stm32f4xx_pinbus.h"
+
+#define GPIO_BASE(port) (0x40020000 + (port) * 0x400)
+#define GPIO_MODER(port) (GPIO_BASE(port) + 0x00)
+#define GPIO_OTYPER(port) (GPIO_BASE(port) + 0x04)
+#define GPIO_PUPDR(port) (GPIO_BASE(port) + 0x0C)
+#define GPIO_IDR(port) (GPIO_BASE(port) + 0x10)
+#define GPIO_ODR(port) (GPIO_BASE(port) + 0x14)
+#define GPIO_BSRR(port) (GPIO_BASE(port) + 0x18)
+#define GPIO_LCKR(port) (GPIO_BASE(port) + 0x1C)
+
+#define GPIOA 0
+#define GPIOB 1
+#define GPIOC 2
+
+#define LCKR_LCKK (1 << 16)
+
+#define EXTI_IMR 0x40013C00
+#define EXTI_RTSR 0x40013C08
+#define EXTI_PR 0x40013C14
+#define SYSCFG_EXTICR1 0x40013808
+#define NVIC_ISPR0 0xE000E200
+#define EXTI1_IRQ 7
+
+static void test_reset(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+
+    /* The debug port pins of GPIOA and GPIOB, with their pulls */
+    g_assert_cmphex(qtest_readl(qts, GPIO_MODER(GPIOA)), ==, 0xA8000000);
+    g_assert_cmphex(qtest_readl(qts, GPIO_IDR(GPIOA)), ==, 0xA000);
+    g_assert_cmphex(qtest_readl(qts, GPIO_MODER(GPIOB)), ==, 0x00000280);
+    g_assert_cmphex(qtest_readl(qts, GPIO_IDR(GPIOB)), ==, 0x0010);
+    g_assert_cmphex(qtest_readl(qts, GPIO_MODER(GPIOC)), ==, 0);
+    g_assert_cmphex(qtest_readl(qts, GPIO_IDR(GPIOC)), ==, 0);
+
+    qtest_quit(qts);
+}
+
+static void test_output(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+
+    /* PC0 and PC1 are outputs, PC1 open-drain */
+    qtest_writel(qts, GPIO_MODER(GPIOC), 0x5);
+    qtest_writel(qts, GPIO_OTYPER(GPIOC), 0x2);
+    qtest_writel(qts, GPIO_BSRR(GPIOC), 0x3);
+    g_assert_cmphex(qtest_readl(qts, GPIO_ODR(GPIOC)), ==, 0x3);
+    g_assert_cmphex(qtest_readl(qts, GPIO_IDR(GPIOC)), ==, 0x1);
+
+    /* Set wins over reset, and half-word writes to the reset bits */
+    qtest_writel(qts, GPIO_BSRR(GPIOC), 0x00010001);
+    g_assert_cmphex(qtest_readl(qts, GPIO_ODR(GPIOC)), ==, 0x3);
+    qtest_writew(qts, GPIO_BSRR(GPIOC) + 2, 0x3);
+    g_assert_cmphex(qtest_readl(qts, GPIO_ODR(GPIOC)), ==, 0);
+
+    /* Pulled-up PC2, driven low from outside */
+    qtest_writel(qts, GPIO_PUPDR(GPIOC), 0x10);
+    g_assert_cmphex(qtest_readl(qts, GPIO_IDR(GPIOC)), ==, 0x4);
+    qtest_set_irq_in(qts, "/machine/soc/gpio[2]", NULL, 2, 0);
+    g_assert_cmphex(qtest_readl(qts, GPIO_IDR(GPIOC)), ==, 0);
+    qtest_set_irq_in(qts, "/machine/soc/gpio[2]", NULL, 2, -1);
+    g_assert_cmphex(qtest_readl(qts, GPIO_IDR(GPIOC)), ==, 0x4);
+
+    qtest_quit(qts);
+}
+
+static void test_lock(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+
+    qtest_writel(qts, GPIO_LCKR(GPIOC), LCKR_LCKK | 0x1);
+    qtest_writel(qts, GPIO_LCKR(GPIOC), 0x1);
+    qtest_writel(qts, GPIO_LCKR(GPIOC), LCKR_LCKK | 0x1);
+    g_assert_cmphex(qtest_readl(qts, GPIO_LCKR(GPIOC)), ==, LCKR_LCKK | 0x1);
+
+    /* PC0 keeps its mode, PC1 does not */
+    qtest_writel(qts, GPIO_MODER(GPIOC), 0x5);
+    g_assert_cmphex(qtest_readl(qts, GPIO_MODER(GPIOC)), ==, 0x4);
+    qtest_writel(qts, GPIO_LCKR(GPIOC), 0);
+    g_assert_cmphex(qtest_readl(qts, GPIO_LCKR(GPIOC)), ==, LCKR_LCKK | 0x1);
+
+    qtest_quit(qts);
+}
+
+static void test_exti(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+
+    /* EXTI1 on PB1, rising edge */
+    qtest_writel(qts, SYSCFG_EXTICR1, 0x10);
+    qtest_writel(qts, EXTI_RTSR, 0x2);
+    qtest_writel(qts, EXTI_IMR, 0x2);
+
+    qtest_set_irq_in(qts, "/machine/soc/gpio[1]", NULL, 1, 1);
+    g_assert_cmphex(qtest_readl(qts, EXTI_PR), ==, 0x2);
+    g_assert_true(qtest_readl(qts, NVIC_ISPR0) & (1 << EXTI1_IRQ));
+
+    qtest_quit(qts);
+}
+
+static void test_pinbus(void)
+{
+    char *path = g_strdup_printf("%s/stm32f405-pinbus-XXXXXX",
+                                 g_get_tmp_dir());
+    int fd = g_mkstemp(path);
+    STM32F4xxPinbus *bus;
+    STM32F4xxPinbusEvent *ev;
+    QTestState *qts;
+    uint32_t head;
+
+    g_assert(fd >= 0);
+    g_assert_cmpint(ftruncate(fd, 128 * 1024), ==, 0);
+    bus = mmap(NULL, sizeof(*bus), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    g_assert(bus != MAP_FAILED);
+
+    qts = qtest_initf("-M netduinoplus2 -object memory-backend-file,id=pins,"
+                      "size=128K,mem-path=%s,share=on "
+                      "-global stm32f405-soc.pinbus=/objects/pins", path);
+    g_assert_cmphex(qatomic_load_acquire(&bus->magic), ==,
+                    STM32F4XX_PINBUS_MAGIC);
+    g_assert_cmpuint(bus->nports, ==, 9);
+    g_assert_cmpuint(bus->ring_size, ==, STM32F4XX_PINBUS_RING);
+
+    /* Published on reset */
+    g_assert_cmphex(bus->port[GPIOA].moder, ==, 0xA8000000);
+    g_assert_cmphex(bus->port[GPIOA].idr, ==, 0xA000);
+    g_assert_cmphex(bus->port[GPIOB].idr, ==, 0x0010);
+
+    /* A change of PC3 goes to the live page and the ring */
+    head = qatomic_load_acquire(&bus->head);
+    qtest_writel(qts, GPIO_MODER(GPIOC), 0x40);
+    qtest_writel(qts, GPIO_BSRR(GPIOC), 0x8);
+    g_assert_cmphex(bus->port[GPIOC].moder, ==, 0x40);
+    g_assert_cmphex(bus->port[GPIOC].odr, ==, 0x8);
+    g_assert_cmpuint(qatomic_load_acquire(&bus->head), ==, head + 1);
+    ev = &bus->ring[head % STM32F4XX_PINBUS_RING];
+    g_assert_cmpuint(ev->port, ==, GPIOC);
+    g_assert_cmphex(ev->changed, ==, 0x8);
+    g_assert_cmphex(ev->level, ==, 0x8);
+
+    /* The co-simulation drives PC4 */
+    bus->port[GPIOC].in_level = 0x10;
+    qatomic_store_release(&bus->port[GPIOC].in_mask, 0x10);
+    g_assert_cmphex(qtest_readl(qts, GPIO_IDR(GPIOC)), ==, 0x18);
+    g_assert_cmphex(bus->port[GPIOC].idr, ==, 0x18);
+    qatomic_store_release(&bus->port[GPIOC].in_mask, 0);
+
+    /* The reset state is published again */
+    qtest_qmp_assert_success(qts, "{ 'execute': 'system_reset' }");
+    qtest_qmp_eventwait(qts, "RESET");
+    g_assert_cmphex(bus->port[GPIOC].moder, ==, 0);
+    g_assert_cmphex(bus->port[GPIOC].odr, ==, 0);
+    g_assert_cmphex(bus->port[GPIOC].idr, ==, 0);
+
+    qtest_quit(qts);
+    munmap(bus, sizeof(*bus));
+    close(fd);
+    unlink(path);
+    g_free(path);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/stm32f405/gpio/reset", test_reset);
+    qtest_add_func("/stm32f405/gpio/output", test_output);
+    qtest_add_func("/stm32f405/gpio/lock", test_lock);
+    qtest_add_func("/stm32f405/gpio/exti", test_exti);
+    qtest_add_func("/stm32f405/gpio/pinbus", test_pinbus);
+    return g_test_run();
+}
@@ -0,0 +1,199 @@
+/*
+ * QTest testcase for the STM32F4xx I2C controller
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define I2C1_BASE 0x40005400
+#define CR1   (I2C1_BASE + 0x00)
+#define CR2   (I2C1_BASE + 0x04)
+#define DR    (I2C1_BASE + 0x10)
+#define SR1   (I2C1_BASE + 0x14)
+#define SR2   (I2C1_BASE + 0x18)
+#define CCR   (I2C1_BASE + 0x1C)
+#define TRISE (I2C1_BASE + 0x20)
+
+#define CR1_PE (1 << 0)
+#define CR1_START (1 << 8)
+#define CR1_STOP (1 << 9)
+#define CR1_ACK (1 << 10)
+#define CR1_POS (1 << 11)
+#define CR2_FREQ_42MHZ 42
+#define SR1_SB (1 << 0)
+#define SR1_ADDR (1 << 1)
+#define SR1_BTF (1 << 2)
+#define SR1_RXNE (1 << 6)
+#define SR1_TXE (1 << 7)
+#define SR1_AF (1 << 10)
+#define SR2_MSL (1 << 0)
+#define SR2_BUSY (1 << 1)
+#define SR2_TRA (1 << 2)
+
+/* Standard mode, 2 * 210 periods of 42 MHz: a 10 us SCL period */
+#define CCR_100KHZ 210
+#define TMP105_ADDR 0x48
+#define TMP105_CONFIG 1
+#define TMP105_T_LOW 2
+#define TMP105_T_HIGH 3
+
+#define US 1000
+
+static QTestState *i2c_init(void)
+{
+    QTestState *qts = qtest_init("-machine netduinoplus2 "
+                                 "-device tmp105,bus=i2c1,address=0x48");
+
+    qtest_writel(qts, CR2, CR2_FREQ_42MHZ);
+    qtest_writel(qts, CCR, CCR_100KHZ);
+    qtest_writel(qts, TRISE, CR2_FREQ_42MHZ + 1);
+    qtest_writel(qts, CR1, CR1_PE | CR1_ACK);
+    return qts;
+}
+
+static void i2c_start(QTestState *qts, uint8_t addr, bool read)
+{
+    qtest_writel(qts, CR1, qtest_readl(qts, CR1) | CR1_START);
+    g_assert_cmphex(qtest_readl(qts, SR1), ==, SR1_SB);
+    qtest_writel(qts, DR, addr << 1 | read);
+    g_assert_cmphex(qtest_readl(qts, SR1), ==, SR1_ADDR);
+}
+
+static void i2c_stop(QTestState *qts)
+{
+    qtest_writel(qts, CR1, qtest_readl(qts, CR1) | CR1_STOP);
+    g_assert_cmphex(qtest_readl(qts, SR2) & SR2_MSL, ==, 0);
+}
+
+/* Address the sensor and write the pointer register, then @len bytes */
+static void tmp105_write(QTestState *qts, uint8_t reg, const uint8_t *buf,
+                         int len)
+{
+    int i;
+
+    i2c_start(qts, TMP105_ADDR, false);
+    g_assert_cmphex(qtest_readl(qts, SR2), ==, SR2_MSL | SR2_BUSY | SR2_TRA);
+    g_assert_cmphex(qtest_readl(qts, SR1), ==, SR1_TXE);
+    qtest_writel(qts, DR, reg);
+    for (i = 0; i < len; i++) {
+        g_assert_cmphex(qtest_readl(qts, SR1) & SR1_TXE, ==, SR1_TXE);
+        qtest_writel(qts, DR, buf[i]);
+    }
+    g_assert_cmphex(qtest_readl(qts, SR1), ==, SR1_TXE | SR1_BTF);
+}
+
+/* Read @len bytes after a restart, with the sequences of RM0090 27.3.3 */
+static void tmp105_read(QTestState *qts, uint8_t reg, uint8_t *buf, int len)
+{
+    int i = 0;
+
+    tmp105_write(qts, reg, NULL, 0);
+    i2c_start(qts, TMP105_ADDR, true);
+
+    if (len == 1) {
+        qtest_writel(qts, CR1, CR1_PE);
+        qtest_readl(qts, SR2);
+        i2c_stop(qts);
+        g_assert_cmphex(qtest_readl(qts, SR1) & SR1_RXNE, ==, SR1_RXNE);
+        buf[0] = qtest_readl(qts, DR);
+    } else if (len == 2) {
+        qtest_writel(qts, CR1, CR1_PE | CR1_ACK | CR1_POS);
+        qtest_readl(qts, SR2);
+        qtest_writel(qts, CR1, CR1_PE | CR1_POS);
+        g_assert_cmphex(qtest_readl(qts, SR1) & SR1_BTF, ==, SR1_BTF);
+        i2c_stop(qts);
+        buf[0] = qtest_readl(qts, DR);
+        buf[1] = qtest_readl(qts, DR);
+    } else {
+        qtest_readl(qts, SR2);
+        for (; i < len - 3; i++) {
+            g_assert_cmphex(qtest_readl(qts, SR1) & SR1_RXNE, ==, SR1_RXNE);
+            buf[i] = qtest_readl(qts, DR);
+        }
+        g_assert_cmphex(qtest_readl(qts, SR1) & SR1_BTF, ==, SR1_BTF);
+        qtest_writel(qts, CR1, CR1_PE);
+        buf[i++] = qtest_readl(qts, DR);
+        g_assert_cmphex(qtest_readl(qts, SR1) & SR1_BTF, ==, SR1_BTF);
+        i2c_stop(qts);
+        buf[i++] = qtest_readl(qts, DR);
+        g_assert_cmphex(qtest_readl(qts, SR1) & SR1_RXNE, ==, SR1_RXNE);
+        buf[i++] = qtest_readl(qts, DR);
+    }
+    qtest_writel(qts, CR1, CR1_PE | CR1_ACK);
+    g_assert_cmphex(qtest_readl(qts, SR1) & (SR1_RXNE | SR1_BTF), ==, 0);
+}
+
+static void test_read_write(void)
+{
+    QTestState *qts = i2c_init();
+    const uint8_t limit[2] = { 0x12, 0x30 };
+    uint8_t buf[4];
+
+    /* T_high resets to 80 degrees */
+    tmp105_read(qts, TMP105_T_HIGH, buf, 2);
+    g_assert_cmphex(buf[0], ==, 0x50);
+    g_assert_cmphex(buf[1], ==, 0x00);
+
+    tmp105_write(qts, TMP105_T_LOW, limit, 2);
+    i2c_stop(qts);
+    tmp105_read(qts, TMP105_T_LOW, buf, 2);
+    g_assert_cmphex(buf[0], ==, 0x12);
+    g_assert_cmphex(buf[1], ==, 0x30);
+
+    tmp105_read(qts, TMP105_CONFIG, buf, 1);
+    g_assert_cmphex(buf[0], ==, 0);
+
+    /* The sensor returns 0xff past the end of its registers */
+    tmp105_read(qts, TMP105_T_HIGH, buf, 4);
+    g_assert_cmphex(buf[0], ==, 0x50);
+    g_assert_cmphex(buf[1], ==, 0x00);
+    g_assert_cmphex(buf[2], ==, 0xff);
+    g_assert_cmphex(buf[3], ==, 0xff);
+
+    qtest_quit(qts);
+}
+
+static void test_busy(void)
+{
+    QTestState *qts = i2c_init();
+    const uint8_t config = 0;
+
+    /* BUSY stays set until the bytes would be done on the wire */
+    tmp105_write(qts, TMP105_CONFIG, &config, 1);
+    i2c_stop(qts);
+    g_assert_cmphex(qtest_readl(qts, SR2), ==, SR2_BUSY);
+    qtest_clock_step(qts, 4 * 90 * US);
+    g_assert_cmphex(qtest_readl(qts, SR2), ==, 0);
+
+    qtest_quit(qts);
+}
+
+static void test_nack(void)
+{
+    QTestState *qts = i2c_init();
+
+    qtest_writel(qts, CR1, CR1_PE | CR1_ACK | CR1_START);
+    g_assert_cmphex(qtest_readl(qts, SR1), ==, SR1_SB);
+    qtest_writel(qts, DR, 0x50 << 1);
+    g_assert_cmphex(qtest_readl(qts, SR1), ==, SR1_AF);
+    i2c_stop(qts);
+    qtest_writel(qts, SR1, ~SR1_AF);
+    g_assert_cmphex(qtest_readl(qts, SR1), ==, 0);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_set_nonfatal_assertions();
+
+    qtest_add_func("stm32f405/i2c/read_write", test_read_write);
+    qtest_add_func("stm32f405/i2c/busy", test_busy);
+    qtest_add_func("stm32f405/i2c/nack", test_nack);
+
+    return g_test_run();
+}
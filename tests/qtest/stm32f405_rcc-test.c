@@ -0,0 +1,142 @@
+/*
+ * QTest testcase for the RCC of the STM32F405
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * The frequency of the clocks is checked through TIM2, on the APB1 timer
+ * clock: with no prescaler it counts the clock ticks.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define RCC_BASE 0x40023800
+#define CR       (RCC_BASE + 0x00)
+#define PLLCFGR  (RCC_BASE + 0x04)
+#define CFGR     (RCC_BASE + 0x08)
+#define CIR      (RCC_BASE + 0x0C)
+#define CSR      (RCC_BASE + 0x74)
+
+#define CR_HSEON (1 << 16)
+#define CR_HSERDY (1 << 17)
+#define CR_PLLON (1 << 24)
+#define CR_PLLRDY (1 << 25)
+#define CFGR_SW_HSE 1
+#define CFGR_SW_PLL 2
+#define CFGR_SWS(cfgr) (((cfgr) >> 2) & 3)
+#define CFGR_PPRE1_DIV4 (5 << 10)
+#define CFGR_PPRE2_DIV2 (4 << 13)
+#define CIR_HSERDYF (1 << 3)
+#define CIR_HSERDYIE (1 << 11)
+#define CIR_HSERDYC (1 << 19)
+
+/* 25 MHz HSE / 25 * 336 / 2 = 168 MHz, 48 MHz for USB with Q = 7 */
+#define PLLCFGR_168MHZ ((7 << 24) | (1 << 22) | (336 << 6) | 25)
+
+#define TIM2_BASE 0x40000000
+#define TIM_CR1  (TIM2_BASE + 0x00)
+#define TIM_CNT  (TIM2_BASE + 0x24)
+
+#define NVIC_ISPR0 0xE000E200
+#define RCC_IRQ 5
+
+#define MS 1000000
+
+/* TIM2 ticks in 1 ms of virtual time */
+static uint32_t tim2_khz(QTestState *qts)
+{
+    uint32_t cnt = qtest_readl(qts, TIM_CNT);
+
+    qtest_clock_step(qts, MS);
+    return qtest_readl(qts, TIM_CNT) - cnt;
+}
+
+static QTestState *rcc_init(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+
+    qtest_writel(qts, TIM_CR1, 1);
+    return qts;
+}
+
+static void test_reset(void)
+{
+    QTestState *qts = rcc_init();
+
+    g_assert_cmphex(qtest_readl(qts, CR), ==, 0x00000083);
+    g_assert_cmphex(qtest_readl(qts, PLLCFGR), ==, 0x24003010);
+    g_assert_cmphex(qtest_readl(qts, CFGR), ==, 0);
+    g_assert_cmphex(qtest_readl(qts, CSR), ==, 0x0E000000);
+
+    /* The HSI runs the whole tree */
+    g_assert_cmpuint(tim2_khz(qts), ==, 16000);
+
+    qtest_quit(qts);
+}
+
+static void test_pll(void)
+{
+    QTestState *qts = rcc_init();
+
+    qtest_writel(qts, CR, qtest_readl(qts, CR) | CR_HSEON);
+    g_assert_cmphex(qtest_readl(qts, CR) & CR_HSERDY, ==, CR_HSERDY);
+    qtest_writel(qts, PLLCFGR, PLLCFGR_168MHZ);
+    qtest_writel(qts, CR, qtest_readl(qts, CR) | CR_PLLON);
+    g_assert_cmphex(qtest_readl(qts, CR) & CR_PLLRDY, ==, CR_PLLRDY);
+
+    /* One write moves SYSCLK and both APB prescalers */
+    qtest_writel(qts, CFGR, CFGR_PPRE1_DIV4 | CFGR_PPRE2_DIV2 | CFGR_SW_PLL);
+    g_assert_cmpuint(CFGR_SWS(qtest_readl(qts, CFGR)), ==, CFGR_SW_PLL);
+
+    /* 42 MHz APB1, its timers run at twice that */
+    g_assert_cmpuint(tim2_khz(qts), ==, 84000);
+
+    /* The PLL runs SYSCLK: it cannot be stopped, nor reconfigured */
+    qtest_writel(qts, CR, qtest_readl(qts, CR) & ~CR_PLLON);
+    g_assert_cmphex(qtest_readl(qts, CR) & CR_PLLRDY, ==, CR_PLLRDY);
+    qtest_writel(qts, PLLCFGR, 0x24003010);
+    g_assert_cmphex(qtest_readl(qts, PLLCFGR), ==, PLLCFGR_168MHZ);
+
+    /* Back to the HSI, undivided */
+    qtest_writel(qts, CFGR, 0);
+    g_assert_cmpuint(CFGR_SWS(qtest_readl(qts, CFGR)), ==, 0);
+    g_assert_cmpuint(tim2_khz(qts), ==, 16000);
+
+    qtest_quit(qts);
+}
+
+static void test_switch(void)
+{
+    QTestState *qts = rcc_init();
+
+    /* The switch waits for the HSE to be ready */
+    qtest_writel(qts, CFGR, CFGR_SW_HSE);
+    g_assert_cmpuint(CFGR_SWS(qtest_readl(qts, CFGR)), ==, 0);
+    g_assert_cmpuint(tim2_khz(qts), ==, 16000);
+
+    qtest_writel(qts, CIR, CIR_HSERDYIE);
+    qtest_writel(qts, CR, qtest_readl(qts, CR) | CR_HSEON);
+    g_assert_cmpuint(CFGR_SWS(qtest_readl(qts, CFGR)), ==, CFGR_SW_HSE);
+    g_assert_cmpuint(tim2_khz(qts), ==, 25000);
+
+    /* HSE ready interrupt */
+    g_assert_cmphex(qtest_readl(qts, CIR) & CIR_HSERDYF, ==, CIR_HSERDYF);
+    g_assert_true(qtest_readl(qts, NVIC_ISPR0) & (1 << RCC_IRQ));
+    qtest_writel(qts, CIR, CIR_HSERDYIE | CIR_HSERDYC);
+    g_assert_cmphex(qtest_readl(qts, CIR), ==, CIR_HSERDYIE);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/stm32f405/rcc/reset", test_reset);
+    qtest_add_func("/stm32f405/rcc/pll", test_pll);
+    qtest_add_func("/stm32f405/rcc/switch", test_switch);
+    return g_test_run();
+}
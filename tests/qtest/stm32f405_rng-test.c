@@ -0,0 +1,79 @@
+/*
+ * QTest testcase for the STM32F405 random number generator
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define RNG_BASE 0x50060800
+#define RNG_CR (RNG_BASE + 0x00)
+#define RNG_SR (RNG_BASE + 0x04)
+#define RNG_DR (RNG_BASE + 0x08)
+
+#define CR_RNGEN (1 << 2)
+#define CR_IE (1 << 3)
+#define SR_DRDY (1 << 0)
+
+#define RNG_IRQ 80
+#define NVIC_ISPR2 0xE000E208
+#define NVIC_ICPR2 0xE000E288
+
+#define US 1000
+
+static void test_ready(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+    uint32_t val[4];
+
+    /* Nothing without RNGEN */
+    qtest_clock_step(qts, 10 * US);
+    g_assert_cmphex(qtest_readl(qts, RNG_SR), ==, 0);
+    g_assert_cmphex(qtest_readl(qts, RNG_DR), ==, 0);
+
+    qtest_writel(qts, RNG_CR, CR_RNGEN);
+    for (int i = 0; i < ARRAY_SIZE(val); i++) {
+        qtest_clock_step(qts, US);
+        g_assert_cmphex(qtest_readl(qts, RNG_SR), ==, SR_DRDY);
+        val[i] = qtest_readl(qts, RNG_DR);
+        /* Reading DR starts the next number */
+        g_assert_cmphex(qtest_readl(qts, RNG_SR), ==, 0);
+    }
+    /* Four zero or equal numbers in a row are not going to happen */
+    g_assert_false(val[0] == val[1] && val[1] == val[2] && val[2] == val[3]);
+
+    qtest_writel(qts, RNG_CR, 0);
+    qtest_clock_step(qts, 10 * US);
+    g_assert_cmphex(qtest_readl(qts, RNG_SR), ==, 0);
+    qtest_quit(qts);
+}
+
+static void test_irq(void)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+    uint32_t bit = 1 << (RNG_IRQ - 64);
+
+    qtest_writel(qts, RNG_CR, CR_RNGEN | CR_IE);
+    qtest_clock_step(qts, US);
+    g_assert_true(qtest_readl(qts, NVIC_ISPR2) & bit);
+
+    qtest_readl(qts, RNG_DR);
+    qtest_writel(qts, NVIC_ICPR2, bit);
+    g_assert_false(qtest_readl(qts, NVIC_ISPR2) & bit);
+    qtest_clock_step(qts, US);
+    g_assert_true(qtest_readl(qts, NVIC_ISPR2) & bit);
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_set_nonfatal_assertions();
+
+    qtest_add_func("stm32f405/rng/ready", test_ready);
+    qtest_add_func("stm32f405/rng/irq", test_irq);
+
+    return g_test_run();
+}
@@ -0,0 +1,88 @@
+/*
+ * QTest for the sleep-skip property of the STM32F405 SoC
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A tiny guest on netduinoplus2 arms SysTick on the reference clock with
+ * the longest reload, 8.4 s of virtual time at HCLK / 8 with the 16 MHz
+ * HSI the RCC starts with, sets SCR.SLEEPDEEP and waits in WFI, counting
+ * the SysTick interrupts in SRAM.  With sleep skip the virtual clock jumps
+ * to each SysTick deadline, so that 7 minutes of virtual time go by in
+ * much less real time.
+ */
+
+#include "qemu/osdep.h"
+#include "armv7m-image.h"
+
+#define HANDLER_OFFSET 40
+#define COUNTER_ADDR NETDUINO_SRAM_BASE
+#define SYSTICK_VECTOR 15
+
+/* 50 SysTick periods of 8.4 s, 7 minutes of virtual time */
+#define TICKS 50
+#define REAL_TIME_LIMIT_US (20 * G_USEC_PER_SEC)
+
+static const uint8_t stop_code[] = {
+    /* reset: */
+    0x40, 0xf2, 0x00, 0x02,     /* movw  r2, #0 */
+    0xc2, 0xf2, 0x00, 0x02,     /* movt  r2, #0x2000 */
+    0x4e, 0xf2, 0x10, 0x01,     /* movw  r1, #0xe010 (SysTick) */
+    0xce, 0xf2, 0x00, 0x01,     /* movt  r1, #0xe000 */
+    0x4f, 0xf6, 0xff, 0x70,     /* movw  r0, #0xffff */
+    0xc0, 0xf2, 0xff, 0x00,     /* movt  r0, #0x00ff */
+    0x48, 0x60,                 /* str   r0, [r1, #4] (RVR) */
+    0x03, 0x20,                 /* movs  r0, #3 */
+    0x08, 0x60,                 /* str   r0, [r1] (CSR: ENABLE, TICKINT) */
+    0x04, 0x20,                 /* movs  r0, #4 */
+    0xc1, 0xf8, 0x00, 0x0d,     /* str.w r0, [r1, #0xd00] (SCR.SLEEPDEEP) */
+    /* loop: */
+    0x30, 0xbf,                 /* wfi */
+    0xfd, 0xe7,                 /* b     loop */
+    /* systick: */
+    0x13, 0x68,                 /* ldr   r3, [r2] */
+    0x01, 0x33,                 /* adds  r3, #1 */
+    0x13, 0x60,                 /* str   r3, [r2] */
+    0x70, 0x47,                 /* bx    lr */
+};
+
+static void test_sleep_skip(void)
+{
+    QTestState *qts;
+    int64_t start;
+    uint32_t ticks;
+    ARMv7MImage img;
+
+    if (!qtest_has_accel("tcg")) {
+        g_test_skip("TCG not available");
+        return;
+    }
+
+    armv7m_image_init_netduino(&img, stop_code, sizeof(stop_code));
+    armv7m_image_set_vector(&img, SYSTICK_VECTOR, HANDLER_OFFSET);
+    qts = armv7m_image_boot(&img, "-M netduinoplus2 -accel tcg "
+                            "-global stm32f405-soc.sleep-skip=on");
+    armv7m_image_free(&img);
+
+    start = g_get_monotonic_time();
+    do {
+        g_usleep(10 * 1000);
+        ticks = qtest_readl(qts, COUNTER_ADDR);
+    } while (ticks < TICKS &&
+             g_get_monotonic_time() - start < REAL_TIME_LIMIT_US);
+    g_test_message("%u SysTick periods in %" PRId64 " ms", ticks,
+                   (g_get_monotonic_time() - start) / 1000);
+    g_assert_cmpuint(ticks, >=, TICKS);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/stm32f405/sleep-skip", test_sleep_skip);
+    return g_test_run();
+}
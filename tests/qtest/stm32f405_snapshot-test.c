@@ -0,0 +1,149 @@
+/*
+ * QTest testcase for booting the STM32F405 from a RAM image
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qapi/qmp/qdict.h"
+#include "libqtest.h"
+
+#define SRAM_BASE 0x20000000
+#define SRAM_SIZE (128 * 1024)
+#define TIM2_ARR 0x4000002C
+
+static void set_ignore_shared(QTestState *qts)
+{
+    qtest_qmp_assert_success(qts, "{ 'execute': 'migrate-set-capabilities',"
+                             " 'arguments': { 'capabilities': [ {"
+                             " 'capability': 'x-ignore-shared',"
+                             " 'state': true } ] } }");
+}
+
+static void wait_migration(QTestState *qts)
+{
+    for (;;) {
+        QDict *resp = qtest_qmp(qts, "{ 'execute': 'query-migrate' }");
+        const char *status = qdict_get_try_str(qdict_get_qdict(resp, "return"),
+                                               "status");
+        bool done = !g_strcmp0(status, "completed");
+
+        g_assert_cmpstr(status, !=, "failed");
+        qobject_unref(resp);
+        if (done) {
+            return;
+        }
+        g_usleep(1000);
+    }
+}
+
+/* The memories of the SoC, all backed by files for the image */
+static const struct {
+    const char *id;
+    const char *size;
+    const char *global;
+} mem[] = {
+    { "flash", "1M", "stm32f4xx-flash.memdev" },
+    { "sram", "128K", "stm32f405-soc.sram-memdev" },
+    { "ccm", "64K", "stm32f405-soc.ccm-memdev" },
+};
+
+static GString *mem_args(char **paths, bool share)
+{
+    GString *args = g_string_new("-M netduinoplus2");
+
+    for (int i = 0; i < ARRAY_SIZE(mem); i++) {
+        g_string_append_printf(args, " -object memory-backend-file,id=%s,"
+                               "size=%s,mem-path=%s,share=%s"
+                               " -global %s=/objects/%s",
+                               mem[i].id, mem[i].size, paths[i],
+                               share ? "on" : "off", mem[i].global, mem[i].id);
+    }
+    return args;
+}
+
+static void test_restore(void)
+{
+    char *paths[ARRAY_SIZE(mem)];
+    char *state_path = g_strdup_printf("%s/stm32f405-state-XXXXXX",
+                                       g_get_tmp_dir());
+    int state_fd = g_mkstemp(state_path);
+    g_autofree char *save_uri = g_strdup_printf("exec:cat > %s", state_path);
+    g_autofree char *load_uri = g_strdup_printf("exec:cat %s", state_path);
+    int sram_fd = -1;
+    QTestState *qts;
+    GString *args;
+    uint32_t word;
+
+    g_assert(state_fd >= 0);
+    for (int i = 0; i < ARRAY_SIZE(mem); i++) {
+        int fd;
+
+        paths[i] = g_strdup_printf("%s/stm32f405-%s-XXXXXX", g_get_tmp_dir(),
+                                   mem[i].id);
+        fd = g_mkstemp(paths[i]);
+        g_assert(fd >= 0);
+        if (!strcmp(mem[i].id, "sram")) {
+            sram_fd = fd;
+        } else {
+            close(fd);
+        }
+    }
+
+    /* Boot: the memories are the host files, only the devices are saved */
+    args = mem_args(paths, true);
+    qts = qtest_init(args->str);
+    g_string_free(args, true);
+    qtest_writel(qts, SRAM_BASE, 0xCAFEF00D);
+    qtest_writel(qts, SRAM_BASE + SRAM_SIZE - 4, 0x12345678);
+    qtest_writel(qts, TIM2_ARR, 0x1234);
+    set_ignore_shared(qts);
+    qtest_qmp_assert_success(qts, "{ 'execute': 'migrate',"
+                             " 'arguments': { 'uri': %s } }", save_uri);
+    wait_migration(qts);
+    qtest_quit(qts);
+    g_assert_cmpint(lseek(state_fd, 0, SEEK_END), <, SRAM_SIZE);
+
+    /* Test run: the files are mapped copy-on-write */
+    args = mem_args(paths, false);
+    g_string_append(args, " -incoming defer");
+    qts = qtest_init(args->str);
+    g_string_free(args, true);
+    set_ignore_shared(qts);
+    qtest_qmp_assert_success(qts, "{ 'execute': 'migrate-incoming',"
+                             " 'arguments': { 'uri': %s } }", load_uri);
+    qtest_qmp_eventwait(qts, "RESUME");
+    g_assert_cmphex(qtest_readl(qts, SRAM_BASE), ==, 0xCAFEF00D);
+    g_assert_cmphex(qtest_readl(qts, SRAM_BASE + SRAM_SIZE - 4), ==,
+                    0x12345678);
+    g_assert_cmphex(qtest_readl(qts, TIM2_ARR), ==, 0x1234);
+
+    qtest_writel(qts, SRAM_BASE, 0);
+    g_assert_cmphex(qtest_readl(qts, SRAM_BASE), ==, 0);
+    qtest_quit(qts);
+
+    /* ... and leaves the image alone for the next one */
+    g_assert_cmpint(pread(sram_fd, &word, 4, 0), ==, 4);
+    g_assert_cmphex(le32_to_cpu(word), ==, 0xCAFEF00D);
+
+    close(sram_fd);
+    close(state_fd);
+    unlink(state_path);
+    g_free(state_path);
+    for (int i = 0; i < ARRAY_SIZE(mem); i++) {
+        unlink(paths[i]);
+        g_free(paths[i]);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_set_nonfatal_assertions();
+
+    qtest_add_func("stm32f405/snapshot/restore", test_restore);
+
+    return g_test_run();
+}
@@ -0,0 +1,172 @@
+/*
+ * QTest testcase for the SPI controllers of the STM32F405
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * SPI2 is on APB1, at 16 MHz out of reset.  Nothing is on its bus: each
+ * frame clocked out brings a zero in.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+#include "qapi/qmp/qdict.h"
+
+#define SPI2_BASE 0x40003800
+#define SPI_CR1 (SPI2_BASE + 0x00)
+#define SPI_CR2 (SPI2_BASE + 0x04)
+#define SPI_SR  (SPI2_BASE + 0x08)
+#define SPI_DR  (SPI2_BASE + 0x0C)
+
+#define CR1_DFF (1 << 11)
+#define CR1_SPE (1 << 6)
+#define CR1_BR_DIV256 (7 << 3)
+#define CR1_MSTR (1 << 2)
+#define CR2_RXNEIE (1 << 6)
+#define CR2_ERRIE (1 << 5)
+#define SR_BSY (1 << 7)
+#define SR_OVR (1 << 6)
+#define SR_TXE (1 << 1)
+#define SR_RXNE (1 << 0)
+
+#define FIFO_DEPTH 32
+
+#define NVIC_ISPR1 0xE000E204
+#define NVIC_ICPR1 0xE000E284
+#define SPI2_IRQ 36
+
+/* 8 bits at 16 MHz / 256 */
+#define FRAME_NS 128000
+
+static QTestState *spi_init(uint32_t cr1)
+{
+    QTestState *qts = qtest_init("-M netduinoplus2");
+
+    qtest_writel(qts, SPI_CR1, CR1_SPE | CR1_MSTR | CR1_BR_DIV256 | cr1);
+    return qts;
+}
+
+static void test_timing(void)
+{
+    QTestState *qts = spi_init(0);
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        qtest_writel(qts, SPI_DR, 0xa5);
+    }
+    g_assert_cmphex(qtest_readl(qts, SPI_SR) & (SR_BSY | SR_TXE | SR_RXNE),
+                    ==, SR_BSY | SR_TXE);
+
+    /* The burst completes with its last frame */
+    qtest_clock_step(qts, 4 * FRAME_NS - 1);
+    g_assert_cmphex(qtest_readl(qts, SPI_SR) & (SR_BSY | SR_RXNE), ==,
+                    SR_BSY);
+    qtest_clock_step(qts, 1);
+    g_assert_cmphex(qtest_readl(qts, SPI_SR) & (SR_BSY | SR_RXNE), ==,
+                    SR_RXNE);
+
+    for (i = 0; i < 4; i++) {
+        g_assert_cmphex(qtest_readl(qts, SPI_SR) & SR_RXNE, ==, SR_RXNE);
+        g_assert_cmphex(qtest_readl(qts, SPI_DR), ==, 0);
+    }
+    g_assert_cmphex(qtest_readl(qts, SPI_SR) & SR_RXNE, ==, 0);
+
+    qtest_quit(qts);
+}
+
+static void test_16bit(void)
+{
+    QTestState *qts = spi_init(CR1_DFF);
+
+    /* 16-bit frames take twice as long */
+    qtest_writel(qts, SPI_DR, 0x1234);
+    qtest_clock_step(qts, 2 * FRAME_NS - 1);
+    g_assert_cmphex(qtest_readl(qts, SPI_SR) & SR_RXNE, ==, 0);
+    qtest_clock_step(qts, 1);
+    g_assert_cmphex(qtest_readl(qts, SPI_SR) & SR_RXNE, ==, SR_RXNE);
+
+    qtest_quit(qts);
+}
+
+static void test_fifo(void)
+{
+    QTestState *qts = spi_init(0);
+    int i;
+
+    qtest_writel(qts, SPI_CR2, CR2_RXNEIE | CR2_ERRIE);
+    for (i = 0; i < FIFO_DEPTH; i++) {
+        g_assert_cmphex(qtest_readl(qts, SPI_SR) & SR_TXE, ==, SR_TXE);
+        qtest_writel(qts, SPI_DR, i);
+    }
+    g_assert_cmphex(qtest_readl(qts, SPI_SR) & SR_TXE, ==, 0);
+    g_assert_false(qtest_readl(qts, NVIC_ISPR1) & (1 << (SPI2_IRQ - 32)));
+
+    /* RXNE interrupt once the burst is in */
+    qtest_clock_step(qts, FIFO_DEPTH * FRAME_NS);
+    g_assert_cmphex(qtest_readl(qts, SPI_SR) & (SR_TXE | SR_RXNE), ==,
+                    SR_TXE | SR_RXNE);
+    g_assert_true(qtest_readl(qts, NVIC_ISPR1) & (1 << (SPI2_IRQ - 32)));
+
+    /* One more frame does not fit in the RX FIFO */
+    qtest_writel(qts, SPI_CR2, CR2_ERRIE);
+    qtest_writel(qts, NVIC_ICPR1, 1 << (SPI2_IRQ - 32));
+    qtest_writel(qts, SPI_DR, 0);
+    qtest_clock_step(qts, FRAME_NS);
+    g_assert_cmphex(qtest_readl(qts, SPI_SR) & SR_OVR, ==, SR_OVR);
+    g_assert_true(qtest_readl(qts, NVIC_ISPR1) & (1 << (SPI2_IRQ - 32)));
+
+    for (i = 0; i < FIFO_DEPTH; i++) {
+        qtest_readl(qts, SPI_DR);
+    }
+    g_assert_cmphex(qtest_readl(qts, SPI_SR) & SR_RXNE, ==, 0);
+    qtest_writel(qts, SPI_SR, 0);
+    g_assert_cmphex(qtest_readl(qts, SPI_SR) & SR_OVR, ==, 0);
+
+    qtest_quit(qts);
+}
+
+static uint64_t spi_counter(QTestState *qts, const char *name)
+{
+    QDict *response;
+    uint64_t ret;
+
+    response = qtest_qmp(qts, "{ 'execute': 'qom-get', 'arguments': "
+                         "{ 'path': '/machine/soc/spi[1]', 'property': %s } }",
+                         name);
+    g_assert(qdict_haskey(response, "return"));
+    ret = qdict_get_int(response, "return");
+    qobject_unref(response);
+    return ret;
+}
+
+static void test_counters(void)
+{
+    QTestState *qts = spi_init(0);
+    int i;
+
+    /* spi_init() wrote CR1 */
+    g_assert_cmpuint(spi_counter(qts, "mmio-reads"), ==, 0);
+    g_assert_cmpuint(spi_counter(qts, "mmio-writes"), ==, 1);
+
+    for (i = 0; i < 3; i++) {
+        qtest_writel(qts, SPI_DR, i);
+        qtest_readl(qts, SPI_SR);
+    }
+    g_assert_cmpuint(spi_counter(qts, "mmio-reads"), ==, 3);
+    g_assert_cmpuint(spi_counter(qts, "mmio-writes"), ==, 4);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/stm32f405/spi/timing", test_timing);
+    qtest_add_func("/stm32f405/spi/16bit", test_16bit);
+    qtest_add_func("/stm32f405/spi/fifo", test_fifo);
+    qtest_add_func("/stm32f405/spi/counters", test_counters);
+    return g_test_run();
+}
@@ -0,0 +1,162 @@
+/*
+ * QTest testcase for the USARTs of the STM32F405
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+/*
+ * USART1 runs from APB2, at 16 MHz out of reset: BRR = 1600 gives 10000
+ * baud, and 1 ms for a frame of 8 data bits and a stop bit.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/socket.h>
+#include "libqtest.h"
+
+#define USART1_BASE 0x40011000
+#define USART_SR  (USART1_BASE + 0x00)
+#define USART_DR  (USART1_BASE + 0x04)
+#define USART_BRR (USART1_BASE + 0x08)
+#define USART_CR1 (USART1_BASE + 0x0C)
+
+#define SR_TXE  (1 << 7)
+#define SR_TC   (1 << 6)
+#define SR_RXNE (1 << 5)
+#define SR_ORE  (1 << 3)
+#define CR1_UE  (1 << 13)
+#define CR1_TE  (1 << 3)
+#define CR1_RE  (1 << 2)
+
+#define BRR_10KBAUD 1600
+#define FRAME_NS 1000000
+
+static QTestState *usart_init(int *sock, bool fast_forward)
+{
+    QTestState *qts;
+
+    g_assert_cmpint(socketpair(PF_UNIX, SOCK_STREAM, 0, sock), ==, 0);
+    qts = qtest_initf("-M netduinoplus2 -chardev socket,id=usart1,fd=%d "
+                      "-serial chardev:usart1 "
+                      "-global stm32f2xx-usart.fast-forward=%s",
+                      sock[1], fast_forward ? "on" : "off");
+    qtest_writel(qts, USART_BRR, BRR_10KBAUD);
+    qtest_writel(qts, USART_CR1, CR1_UE | CR1_TE | CR1_RE);
+    return qts;
+}
+
+static void usart_quit(QTestState *qts, int *sock)
+{
+    qtest_quit(qts);
+    close(sock[0]);
+}
+
+/* Wait until the host data got to the USART */
+static void wait_rxne(QTestState *qts, bool paced)
+{
+    int i;
+
+    for (i = 0; i < 1000; i++) {
+        if (paced) {
+            qtest_clock_step(qts, FRAME_NS);
+        }
+        if (qtest_readl(qts, USART_SR) & SR_RXNE) {
+            return;
+        }
+        g_usleep(1000);
+    }
+    g_assert_not_reached();
+}
+
+static void test_paced_tx(void)
+{
+    int sock[2];
+    QTestState *qts = usart_init(sock, false);
+    char buf[2];
+
+    /* DR and the shift register take two bytes */
+    qtest_writel(qts, USART_DR, 'a');
+    g_assert_cmphex(qtest_readl(qts, USART_SR) & (SR_TXE | SR_TC), ==,
+                    SR_TXE);
+    qtest_writel(qts, USART_DR, 'b');
+    g_assert_cmphex(qtest_readl(qts, USART_SR) & (SR_TXE | SR_TC), ==, 0);
+
+    qtest_clock_step(qts, FRAME_NS - 1);
+    g_assert_cmphex(qtest_readl(qts, USART_SR) & SR_TXE, ==, 0);
+    qtest_clock_step(qts, 1);
+    g_assert_cmphex(qtest_readl(qts, USART_SR) & (SR_TXE | SR_TC), ==,
+                    SR_TXE);
+    g_assert_cmpint(recv(sock[0], buf, 1, MSG_WAITALL), ==, 1);
+    g_assert_cmpint(buf[0], ==, 'a');
+
+    qtest_clock_step(qts, FRAME_NS);
+    g_assert_cmphex(qtest_readl(qts, USART_SR) & (SR_TXE | SR_TC), ==,
+                    SR_TXE | SR_TC);
+    g_assert_cmpint(recv(sock[0], buf, 1, MSG_WAITALL), ==, 1);
+    g_assert_cmpint(buf[0], ==, 'b');
+
+    usart_quit(qts, sock);
+}
+
+static void test_paced_rx(void)
+{
+    int sock[2];
+    QTestState *qts = usart_init(sock, false);
+
+    g_assert_cmpint(send(sock[0], "xyz", 3, 0), ==, 3);
+    wait_rxne(qts, true);
+    g_usleep(10000);
+
+    /* One byte a frame, DR is not read: the next two are lost */
+    qtest_clock_step(qts, 2 * FRAME_NS);
+    g_assert_cmphex(qtest_readl(qts, USART_SR) & (SR_RXNE | SR_ORE), ==,
+                    SR_RXNE | SR_ORE);
+    g_assert_cmphex(qtest_readl(qts, USART_DR), ==, 'x');
+    g_assert_cmphex(qtest_readl(qts, USART_SR) & (SR_RXNE | SR_ORE), ==, 0);
+
+    qtest_clock_step(qts, FRAME_NS);
+    g_assert_cmphex(qtest_readl(qts, USART_SR) & SR_RXNE, ==, 0);
+
+    usart_quit(qts, sock);
+}
+
+static void test_fast_forward(void)
+{
+    int sock[2];
+    QTestState *qts = usart_init(sock, true);
+    char tx[64], rx[64];
+    int i;
+
+    for (i = 0; i < sizeof(tx); i++) {
+        tx[i] = 'A' + i % 26;
+    }
+
+    /* No waiting on the baud rate, in either direction */
+    for (i = 0; i < sizeof(tx); i++) {
+        g_assert_cmphex(qtest_readl(qts, USART_SR) & SR_TXE, ==, SR_TXE);
+        qtest_writel(qts, USART_DR, tx[i]);
+    }
+    g_assert_cmpint(recv(sock[0], rx, sizeof(rx), MSG_WAITALL), ==,
+                    sizeof(rx));
+    g_assert_cmpmem(rx, sizeof(rx), tx, sizeof(tx));
+
+    g_assert_cmpint(send(sock[0], tx, sizeof(tx), 0), ==, sizeof(tx));
+    for (i = 0; i < sizeof(rx); i++) {
+        wait_rxne(qts, false);
+        rx[i] = qtest_readl(qts, USART_DR);
+    }
+    g_assert_cmpmem(rx, sizeof(rx), tx, sizeof(tx));
+    g_assert_cmphex(qtest_readl(qts, USART_SR) & SR_ORE, ==, 0);
+
+    usart_quit(qts, sock);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/stm32f405/usart/paced-tx", test_paced_tx);
+    qtest_add_func("/stm32f405/usart/paced-rx", test_paced_rx);
+    qtest_add_func("/stm32f405/usart/fast-forward", test_fast_forward);
+    return g_test_run();
+}
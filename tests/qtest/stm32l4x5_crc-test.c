@@ -0,0 +1,120 @@
+/*
+ * QTest testcase for the STM32L4x5 CRC calculation unit
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest-single.h"
+
+#define CRC_BASE 0x40023000
+#define CRC_DR (CRC_BASE + 0x00)
+#define CRC_IDR (CRC_BASE + 0x04)
+#define CRC_CR (CRC_BASE + 0x08)
+#define CRC_INIT (CRC_BASE + 0x10)
+#define CRC_POL (CRC_BASE + 0x14)
+
+#define CR_RESET (1 << 0)
+#define CR_POLYSIZE(n) ((n) << 3)
+#define CR_REV_IN_WORD (3 << 5)
+#define CR_REV_OUT (1 << 7)
+
+static const char check[] = "123456789";
+
+static void setup(uint32_t cr, uint32_t pol, uint32_t init)
+{
+    writel(CRC_CR, cr);
+    writel(CRC_POL, pol);
+    writel(CRC_INIT, init);
+}
+
+static void write_check_bytes(void)
+{
+    for (int i = 0; i < 9; i++) {
+        writeb(CRC_DR, check[i]);
+    }
+}
+
+static void test_reset(void)
+{
+    g_assert_cmphex(readl(CRC_DR), ==, 0xFFFFFFFF);
+    g_assert_cmphex(readl(CRC_CR), ==, 0);
+    g_assert_cmphex(readl(CRC_INIT), ==, 0xFFFFFFFF);
+    g_assert_cmphex(readl(CRC_POL), ==, 0x04C11DB7);
+
+    writeb(CRC_IDR, 0x5A);
+    g_assert_cmphex(readl(CRC_IDR), ==, 0x5A);
+}
+
+static void test_word(void)
+{
+    /* The default configuration, as on the STM32F4 */
+    setup(0, 0x04C11DB7, 0xFFFFFFFF);
+    writel(CRC_DR, 0x12345678);
+    g_assert_cmphex(readl(CRC_DR), ==, 0xDF8A8A2B);
+
+    writel(CRC_CR, CR_RESET);
+    g_assert_cmphex(readl(CRC_DR), ==, 0xFFFFFFFF);
+    g_assert_cmphex(readl(CRC_CR), ==, 0);
+}
+
+static void test_crc32(void)
+{
+    /* Reflected in and out: the CRC-32 of zlib, before the final xor */
+    setup(CR_REV_IN_WORD | CR_REV_OUT, 0x04C11DB7, 0xFFFFFFFF);
+    write_check_bytes();
+    g_assert_cmphex(readl(CRC_DR), ==, ~0xCBF43926u);
+
+    /* Same with words, little endian in memory */
+    writel(CRC_CR, CR_REV_IN_WORD | CR_REV_OUT | CR_RESET);
+    writel(CRC_DR, 0x34333231);
+    writel(CRC_DR, 0x38373635);
+    writeb(CRC_DR, '9');
+    g_assert_cmphex(readl(CRC_DR), ==, ~0xCBF43926u);
+}
+
+static void test_polysize(void)
+{
+    /* CRC-16/CCITT-FALSE */
+    setup(CR_POLYSIZE(1), 0x1021, 0xFFFF);
+    g_assert_cmphex(readl(CRC_DR), ==, 0xFFFF);
+    write_check_bytes();
+    g_assert_cmphex(readl(CRC_DR), ==, 0x29B1);
+
+    writel(CRC_CR, CR_POLYSIZE(1) | CR_RESET);
+    for (int i = 0; i < 8; i += 2) {
+        writew(CRC_DR, check[i] << 8 | check[i + 1]);
+    }
+    writeb(CRC_DR, check[8]);
+    g_assert_cmphex(readl(CRC_DR), ==, 0x29B1);
+
+    /* CRC-8 */
+    setup(CR_POLYSIZE(2), 0x07, 0);
+    write_check_bytes();
+    g_assert_cmphex(readl(CRC_DR), ==, 0xF4);
+
+    /* CRC-7 */
+    setup(CR_POLYSIZE(3), 0x09, 0);
+    write_check_bytes();
+    g_assert_cmphex(readl(CRC_DR), ==, 0x75);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_set_nonfatal_assertions();
+
+    qtest_add_func("stm32l4x5/crc/test_reset", test_reset);
+    qtest_add_func("stm32l4x5/crc/test_word", test_word);
+    qtest_add_func("stm32l4x5/crc/test_crc32", test_crc32);
+    qtest_add_func("stm32l4x5/crc/test_polysize", test_polysize);
+
+    qtest_start("-machine b-l475e-iot01a");
+    ret = g_test_run();
+    qtest_end();
+
+    return ret;
+}
@@ -0,0 +1,68 @@
+/*
+ * QTest testcase for the STM32L4x5 FLASH_ACR register
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest-single.h"
+
+#define FLASH_ACR_ADDR 0x40022000
+
+#define ACR_PRFTEN (1 << 8)
+#define ACR_ICEN (1 << 9)
+#define ACR_DCEN (1 << 10)
+#define ACR_ICRST (1 << 11)
+#define ACR_DCRST (1 << 12)
+
+static void system_reset(void)
+{
+    QDict *response;
+    response = qtest_qmp(global_qtest, "{'execute': 'system_reset'}");
+    g_assert(qdict_haskey(response, "return"));
+    qobject_unref(response);
+}
+
+static void test_reset(void)
+{
+    /* Instruction and data caches are enabled at reset */
+    g_assert_cmpuint(readl(FLASH_ACR_ADDR), ==, ACR_ICEN | ACR_DCEN);
+
+    writel(FLASH_ACR_ADDR, 4 | ACR_PRFTEN);
+    system_reset();
+    g_assert_cmpuint(readl(FLASH_ACR_ADDR), ==, ACR_ICEN | ACR_DCEN);
+}
+
+static void test_latency(void)
+{
+    writel(FLASH_ACR_ADDR, 4 | ACR_PRFTEN | ACR_ICEN | ACR_DCEN);
+    g_assert_cmpuint(readl(FLASH_ACR_ADDR), ==,
+                     4 | ACR_PRFTEN | ACR_ICEN | ACR_DCEN);
+
+    /* The cache reset bits read back as zero */
+    writel(FLASH_ACR_ADDR, 2 | ACR_ICRST | ACR_DCRST);
+    g_assert_cmpuint(readl(FLASH_ACR_ADDR), ==, 2);
+
+    /* Reserved bits are ignored */
+    writel(FLASH_ACR_ADDR, 0xFFFF80F0);
+    g_assert_cmpuint(readl(FLASH_ACR_ADDR), ==, 0);
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_set_nonfatal_assertions();
+
+    qtest_add_func("stm32l4x5/flash_acr/test_reset", test_reset);
+    qtest_add_func("stm32l4x5/flash_acr/test_latency", test_latency);
+
+    qtest_start("-machine b-l475e-iot01a "
+                "-global stm32l4x5xg-soc.cycle-timing=on");
+    ret = g_test_run();
+    qtest_end();
+
+    return ret;
+}
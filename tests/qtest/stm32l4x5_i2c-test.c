@@ -0,0 +1,197 @@
+/*
+ * QTest testcase for the STM32L4x5 I2C controller
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define I2C1_BASE 0x40005400
+#define CR1     (I2C1_BASE + 0x00)
+#define CR2     (I2C1_BASE + 0x04)
+#define TIMINGR (I2C1_BASE + 0x10)
+#define ISR     (I2C1_BASE + 0x18)
+#define ICR     (I2C1_BASE + 0x1C)
+#define RXDR    (I2C1_BASE + 0x24)
+#define TXDR    (I2C1_BASE + 0x28)
+
+#define CR1_PE (1 << 0)
+#define CR1_TCIE (1 << 6)
+#define CR2_SADD(a) ((a) << 1)
+#define CR2_RD_WRN (1 << 10)
+#define CR2_START (1 << 13)
+#define CR2_NBYTES(n) ((n) << 16)
+#define CR2_RELOAD (1 << 24)
+#define CR2_AUTOEND (1 << 25)
+#define ISR_TXIS (1 << 1)
+#define ISR_RXNE (1 << 2)
+#define ISR_NACKF (1 << 4)
+#define ISR_STOPF (1 << 5)
+#define ISR_TC (1 << 6)
+#define ISR_TCR (1 << 7)
+#define ISR_BUSY (1 << 15)
+
+#define NVIC_ISPR0 0xE000E200
+#define I2C1_EV_IRQ 31
+
+/* SYSCLK is 80 MHz: PRESC 7 gives 100 ns ticks, and a 10 us SCL period */
+#define TIMINGR_100KHZ ((7 << 28) | (49 << 8) | 49)
+#define TMP105_ADDR 0x48
+#define TMP105_T_LOW 2
+#define TMP105_T_HIGH 3
+
+#define US 1000
+/* Address and data bytes, 9 SCL periods each */
+#define BYTES_NS(n) ((n) * 90 * US)
+
+static QTestState *i2c_init(void)
+{
+    QTestState *qts = qtest_init("-machine b-l475e-iot01a "
+                                 "-device tmp105,bus=i2c1,address=0x48");
+
+    qtest_writel(qts, TIMINGR, TIMINGR_100KHZ);
+    qtest_writel(qts, CR1, CR1_PE);
+    return qts;
+}
+
+/* Write the pointer register then @len bytes, up to STOPF */
+static void tmp105_write(QTestState *qts, uint8_t reg, const uint8_t *buf,
+                         int len)
+{
+    int i;
+
+    qtest_writel(qts, CR2, CR2_SADD(TMP105_ADDR) | CR2_NBYTES(len + 1) |
+                 CR2_AUTOEND | CR2_START);
+    g_assert_cmphex(qtest_readl(qts, ISR) & ISR_TXIS, ==, ISR_TXIS);
+    qtest_writel(qts, TXDR, reg);
+    for (i = 0; i < len; i++) {
+        g_assert_cmphex(qtest_readl(qts, ISR) & ISR_TXIS, ==, ISR_TXIS);
+        qtest_writel(qts, TXDR, buf[i]);
+    }
+    qtest_clock_step(qts, BYTES_NS(len + 2));
+    g_assert_cmphex(qtest_readl(qts, ISR) & (ISR_STOPF | ISR_BUSY), ==,
+                    ISR_STOPF);
+    qtest_writel(qts, ICR, ISR_STOPF);
+}
+
+/* Write the pointer register, then read @len bytes after a restart */
+static void tmp105_read(QTestState *qts, uint8_t reg, uint8_t *buf, int len)
+{
+    int i;
+
+    qtest_writel(qts, CR2, CR2_SADD(TMP105_ADDR) | CR2_NBYTES(1) |
+                 CR2_START);
+    qtest_writel(qts, TXDR, reg);
+    qtest_clock_step(qts, BYTES_NS(2));
+    g_assert_cmphex(qtest_readl(qts, ISR) & ISR_TC, ==, ISR_TC);
+
+    qtest_writel(qts, CR2, CR2_SADD(TMP105_ADDR) | CR2_RD_WRN |
+                 CR2_NBYTES(len) | CR2_AUTOEND | CR2_START);
+    qtest_clock_step(qts, BYTES_NS(len + 1));
+    for (i = 0; i < len; i++) {
+        g_assert_cmphex(qtest_readl(qts, ISR) & ISR_RXNE, ==, ISR_RXNE);
+        buf[i] = qtest_readl(qts, RXDR);
+    }
+    g_assert_cmphex(qtest_readl(qts, ISR) & (ISR_RXNE | ISR_STOPF), ==,
+                    ISR_STOPF);
+    qtest_writel(qts, ICR, ISR_STOPF);
+}
+
+static void test_read_write(void)
+{
+    QTestState *qts = i2c_init();
+    const uint8_t limit[2] = { 0x12, 0x30 };
+    uint8_t buf[2];
+
+    /* T_high resets to 80 degrees */
+    tmp105_read(qts, TMP105_T_HIGH, buf, 2);
+    g_assert_cmphex(buf[0], ==, 0x50);
+    g_assert_cmphex(buf[1], ==, 0x00);
+
+    tmp105_write(qts, TMP105_T_LOW, limit, 2);
+    tmp105_read(qts, TMP105_T_LOW, buf, 2);
+    g_assert_cmphex(buf[0], ==, 0x12);
+    g_assert_cmphex(buf[1], ==, 0x30);
+
+    qtest_quit(qts);
+}
+
+static void test_timing(void)
+{
+    QTestState *qts = i2c_init();
+
+    qtest_writel(qts, CR1, CR1_PE | CR1_TCIE);
+    qtest_writel(qts, CR2, CR2_SADD(TMP105_ADDR) | CR2_NBYTES(3) |
+                 CR2_START);
+    qtest_writel(qts, TXDR, TMP105_T_LOW);
+    qtest_writel(qts, TXDR, 0x12);
+    qtest_writel(qts, TXDR, 0x30);
+
+    /* The flags only change once the four bytes are done on the wire */
+    qtest_clock_step(qts, BYTES_NS(4) - US);
+    g_assert_cmphex(qtest_readl(qts, ISR) & (ISR_TC | ISR_BUSY), ==,
+                    ISR_BUSY);
+    g_assert_false(qtest_readl(qts, NVIC_ISPR0) & (1 << I2C1_EV_IRQ));
+    qtest_clock_step(qts, US);
+    g_assert_cmphex(qtest_readl(qts, ISR) & (ISR_TC | ISR_BUSY), ==,
+                    ISR_TC | ISR_BUSY);
+    g_assert_true(qtest_readl(qts, NVIC_ISPR0) & (1 << I2C1_EV_IRQ));
+
+    qtest_quit(qts);
+}
+
+static void test_reload(void)
+{
+    QTestState *qts = i2c_init();
+    uint8_t buf[2];
+
+    /* Read T_high in two chunks of one byte */
+    tmp105_read(qts, TMP105_T_HIGH, buf, 1);
+    qtest_writel(qts, CR2, CR2_SADD(TMP105_ADDR) | CR2_RD_WRN |
+                 CR2_NBYTES(1) | CR2_RELOAD | CR2_START);
+    qtest_clock_step(qts, BYTES_NS(2));
+    g_assert_cmphex(qtest_readl(qts, ISR) & (ISR_RXNE | ISR_TCR), ==,
+                    ISR_RXNE | ISR_TCR);
+    buf[0] = qtest_readl(qts, RXDR);
+    qtest_writel(qts, CR2, CR2_SADD(TMP105_ADDR) | CR2_RD_WRN |
+                 CR2_NBYTES(1) | CR2_AUTOEND);
+    qtest_clock_step(qts, BYTES_NS(1));
+    g_assert_cmphex(qtest_readl(qts, ISR) & (ISR_RXNE | ISR_STOPF), ==,
+                    ISR_RXNE | ISR_STOPF);
+    buf[1] = qtest_readl(qts, RXDR);
+    g_assert_cmphex(buf[0], ==, 0x50);
+    g_assert_cmphex(buf[1], ==, 0x00);
+
+    qtest_quit(qts);
+}
+
+static void test_nack(void)
+{
+    QTestState *qts = i2c_init();
+
+    qtest_writel(qts, CR2, CR2_SADD(0x50) | CR2_NBYTES(1) | CR2_AUTOEND |
+                 CR2_START);
+    qtest_clock_step(qts, BYTES_NS(1));
+    g_assert_cmphex(qtest_readl(qts, ISR) &
+                    (ISR_TXIS | ISR_NACKF | ISR_STOPF | ISR_BUSY), ==,
+                    ISR_NACKF | ISR_STOPF);
+    qtest_writel(qts, ICR, ISR_NACKF | ISR_STOPF);
+    g_assert_cmphex(qtest_readl(qts, ISR) & (ISR_NACKF | ISR_STOPF), ==, 0);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_set_nonfatal_assertions();
+
+    qtest_add_func("stm32l4x5/i2c/read_write", test_read_write);
+    qtest_add_func("stm32l4x5/i2c/timing", test_timing);
+    qtest_add_func("stm32l4x5/i2c/reload", test_reload);
+    qtest_add_func("stm32l4x5/i2c/nack", test_nack);
+
+    return g_test_run();
+}
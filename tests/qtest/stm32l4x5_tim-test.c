@@ -0,0 +1,213 @@
+/*
+ * QTest testcase for the STM32L4x5 general purpose timers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+#define TIM2_BASE 0x40000000
+#define TIM3_BASE 0x40000400
+#define TIM2_IRQ 28
+
+#define CR1   0x00
+#define CR2   0x04
+#define SMCR  0x08
+#define DIER  0x0C
+#define SR    0x10
+#define EGR   0x14
+#define CCMR1 0x18
+#define CCER  0x20
+#define CNT   0x24
+#define PSC   0x28
+#define ARR   0x2C
+#define CCR1  0x34
+
+#define CR1_CEN (1 << 0)
+#define CR1_OPM (1 << 3)
+#define CR2_MMS_UPDATE (2 << 4)
+#define SMCR_SMS_EXT_CLOCK 7
+#define SMCR_TS_ITR1 (1 << 4)
+#define DIER_UIE (1 << 0)
+#define SR_UIF (1 << 0)
+#define SR_CC1IF (1 << 1)
+#define EGR_UG (1 << 0)
+#define CCMR1_CC1S_TI1 1
+#define CCMR1_OC1PE (1 << 3)
+#define CCMR1_OC1M_PWM1 (6 << 4)
+#define CCER_CC1E (1 << 0)
+
+#define NVIC_ISER0 0xE000E100
+#define NVIC_ISPR0 0xE000E200
+#define NVIC_ICPR0 0xE000E280
+
+/* SYSCLK is 80 MHz, a prescaler of 80 gives one tick per microsecond */
+#define PSC_1MHZ 79
+#define US 1000
+
+static QTestState *tim_init(const char *extra_args)
+{
+    return qtest_initf("-machine b-l475e-iot01a %s", extra_args);
+}
+
+static void tim_start(QTestState *qts, uint32_t base, uint32_t arr)
+{
+    qtest_writel(qts, base + PSC, PSC_1MHZ);
+    qtest_writel(qts, base + ARR, arr);
+    /* Load the prescaler, then forget the update flag that sets */
+    qtest_writel(qts, base + EGR, EGR_UG);
+    qtest_writel(qts, base + SR, 0);
+    qtest_writel(qts, base + CR1, qtest_readl(qts, base + CR1) | CR1_CEN);
+}
+
+static void test_count(void)
+{
+    QTestState *qts = tim_init("");
+
+    /* 32-bit counter, ARR reset value */
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + ARR), ==, 0xFFFFFFFF);
+
+    tim_start(qts, TIM2_BASE, 999);
+    qtest_clock_step(qts, 500 * US);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + CNT), ==, 500);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + SR) & SR_UIF, ==, 0);
+
+    qtest_clock_step(qts, 600 * US);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + CNT), ==, 100);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + SR) & SR_UIF, ==, SR_UIF);
+
+    /* Stopped, the counter holds its value */
+    qtest_writel(qts, TIM2_BASE + CR1, 0);
+    qtest_clock_step(qts, 300 * US);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + CNT), ==, 100);
+
+    qtest_quit(qts);
+}
+
+static void test_update_irq(void)
+{
+    QTestState *qts = tim_init("");
+
+    qtest_writel(qts, NVIC_ISER0, 1 << TIM2_IRQ);
+    qtest_writel(qts, NVIC_ICPR0, 1 << TIM2_IRQ);
+    qtest_writel(qts, TIM2_BASE + DIER, DIER_UIE);
+    tim_start(qts, TIM2_BASE, 999);
+
+    qtest_clock_step(qts, 999 * US);
+    g_assert_false(qtest_readl(qts, NVIC_ISPR0) & (1 << TIM2_IRQ));
+    qtest_clock_step(qts, 1 * US);
+    g_assert_true(qtest_readl(qts, NVIC_ISPR0) & (1 << TIM2_IRQ));
+
+    qtest_quit(qts);
+}
+
+static void test_one_pulse(void)
+{
+    QTestState *qts = tim_init("");
+
+    qtest_writel(qts, TIM2_BASE + CR1, CR1_OPM);
+    tim_start(qts, TIM2_BASE, 99);
+
+    qtest_clock_step(qts, 250 * US);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + CR1) & CR1_CEN, ==, 0);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + CNT), ==, 0);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + SR) & SR_UIF, ==, SR_UIF);
+
+    qtest_quit(qts);
+}
+
+static void test_compare(void)
+{
+    QTestState *qts = tim_init("");
+
+    qtest_writel(qts, TIM2_BASE + CCR1, 300);
+    tim_start(qts, TIM2_BASE, 999);
+
+    qtest_clock_step(qts, 299 * US);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + SR), ==, 0);
+    qtest_clock_step(qts, 2 * US);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + SR), ==, SR_CC1IF);
+
+    qtest_quit(qts);
+}
+
+static void test_input_capture(void)
+{
+    QTestState *qts = tim_init("");
+
+    qtest_writel(qts, TIM2_BASE + CCMR1, CCMR1_CC1S_TI1);
+    qtest_writel(qts, TIM2_BASE + CCER, CCER_CC1E);
+    tim_start(qts, TIM2_BASE, 999);
+
+    qtest_clock_step(qts, 250 * US);
+    qtest_set_irq_in(qts, "/machine/soc/tim2", "ic", 0, 1);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + SR), ==, SR_CC1IF);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + CCR1), ==, 250);
+    /* Reading the captured value clears the flag */
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + SR), ==, 0);
+
+    /* Only rising edges are captured */
+    qtest_clock_step(qts, 100 * US);
+    qtest_set_irq_in(qts, "/machine/soc/tim2", "ic", 0, 0);
+    g_assert_cmpuint(qtest_readl(qts, TIM2_BASE + SR), ==, 0);
+
+    qtest_quit(qts);
+}
+
+static void test_pwm_edges(void)
+{
+    QTestState *qts = tim_init("-global stm32f2xx-timer.pwm-edges=on");
+
+    qtest_irq_intercept_out_named(qts, "/machine/soc/tim3", "oc");
+    qtest_writel(qts, TIM3_BASE + CCMR1, CCMR1_OC1M_PWM1 | CCMR1_OC1PE);
+    qtest_writel(qts, TIM3_BASE + CCR1, 250);
+    qtest_writel(qts, TIM3_BASE + CCER, CCER_CC1E);
+    tim_start(qts, TIM3_BASE, 999);
+    g_assert_true(qtest_get_irq(qts, 0));
+
+    qtest_clock_step(qts, 249 * US);
+    g_assert_true(qtest_get_irq(qts, 0));
+    qtest_clock_step(qts, 1 * US);
+    g_assert_false(qtest_get_irq(qts, 0));
+    qtest_clock_step(qts, 750 * US);
+    g_assert_true(qtest_get_irq(qts, 0));
+
+    qtest_quit(qts);
+}
+
+static void test_master_slave(void)
+{
+    QTestState *qts = tim_init("");
+
+    /* TIM3 counts the update events of TIM2, its master on ITR1 */
+    qtest_writel(qts, TIM3_BASE + SMCR, SMCR_SMS_EXT_CLOCK | SMCR_TS_ITR1);
+    qtest_writel(qts, TIM3_BASE + ARR, 999);
+    qtest_writel(qts, TIM3_BASE + CR1, CR1_CEN);
+
+    qtest_writel(qts, TIM2_BASE + CR2, CR2_MMS_UPDATE);
+    tim_start(qts, TIM2_BASE, 99);
+
+    /* The UG in tim_start() sends one TRGO pulse, then one per overflow */
+    qtest_clock_step(qts, 1050 * US);
+    g_assert_cmpuint(qtest_readl(qts, TIM3_BASE + CNT), ==, 11);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_set_nonfatal_assertions();
+
+    qtest_add_func("stm32l4x5/tim/count", test_count);
+    qtest_add_func("stm32l4x5/tim/update_irq", test_update_irq);
+    qtest_add_func("stm32l4x5/tim/one_pulse", test_one_pulse);
+    qtest_add_func("stm32l4x5/tim/compare", test_compare);
+    qtest_add_func("stm32l4x5/tim/input_capture", test_input_capture);
+    qtest_add_func("stm32l4x5/tim/pwm_edges", test_pwm_edges);
+    qtest_add_func("stm32l4x5/tim/master_slave", test_master_slave);
+
+    return g_test_run();
+}
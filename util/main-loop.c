@@ -28,6 +28,7 @@
 #include "qemu/timer.h"
 #include "sysemu/cpu-timers.h"
 #include "sysemu/replay.h"
+#include "sysemu/tcg.h"
 #include "qemu/main-loop.h"
 #include "block/aio.h"
 #include "block/thread-pool.h"
@@ -596,8 +597,12 @@ void main_loop_wait(int nonblocking)
          * missing the warp
          */
         icount_start_warp_timer();
+    } else if (cpu_clock_sleep_skip_enabled()) {
+        cpu_clock_sleep_skip();
     }
     qemu_clock_run_all_timers();
+    /* Devices may have changed, let the vCPUs poll them again */
+    tcg_poll_unpark_all();
 }
 
 /* Functions to operate on the main QEMU AioContext.  */